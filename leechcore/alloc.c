@@ -0,0 +1,474 @@
+// alloc.c : implementation : huge page and NUMA aware read buffer allocation.
+//
+// Large read buffers (the contigious read worker buffers and device transfer
+// buffers) are allocated according to the allocation policy of the context
+// (LC_OPT_CORE_ALLOC_POLICY or device parameter 'alloc=<policy>'):
+// - LC_ALLOC_POLICY_HUGEPAGE: back buffers with 2MB huge pages - explicit huge
+//   pages if available (MAP_HUGETLB / MEM_LARGE_PAGES) otherwise advised as
+//   transparent huge pages (Linux only).
+// - LC_ALLOC_POLICY_NUMA: place contigious read worker buffers on the NUMA
+//   node assigned to the worker (workers are assigned nodes round-robin).
+// - LC_ALLOC_POLICY_PIN: pin contigious read worker threads to the processors
+//   of their assigned NUMA node.
+// Without a policy buffers are allocated by LocalAlloc as before.
+// MEMs allocated by LcAllocScatter1 are not tied to a context - their buffers
+// are advised as transparent huge pages only while at least one open context
+// has the LC_ALLOC_POLICY_HUGEPAGE policy set.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_ALLOC_HUGEPAGE_SIZE          0x00200000      // 2MB
+#define LC_ALLOC_NODES_MAX              64
+#define LC_ALLOC_POLICY_MASK            (LC_ALLOC_POLICY_HUGEPAGE | LC_ALLOC_POLICY_NUMA | LC_ALLOC_POLICY_PIN)
+
+#define LC_ALLOC_FLAG_LOCALALLOC        0x01            // allocated by LocalAlloc.
+#define LC_ALLOC_FLAG_MAP               0x02            // allocated by mmap / VirtualAlloc.
+#define LC_ALLOC_FLAG_HUGEPAGE          0x04            // huge page backed or advised.
+#define LC_ALLOC_FLAG_NUMA              0x08            // placed on a specific NUMA node.
+
+typedef struct tdLC_ALLOC_CONTEXT {
+    CRITICAL_SECTION LockPolicy;    // serializes policy changes.
+    DWORD dwPolicy;                 // LC_OPT_CORE_ALLOC_POLICY
+    DWORD cNodes;                   // LC_OPT_CORE_ALLOC_NUMA_NODES
+    QWORD cbHugePage;               // LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES
+    QWORD cbNuma;                   // LC_OPT_CORE_ALLOC_NUMA_BYTES
+    DWORD cThreadPinned;            // LC_OPT_CORE_ALLOC_PINNED
+} LC_ALLOC_CONTEXT;
+
+DWORD g_cAllocPolicyHugePage = 0;   // open contexts with LC_ALLOC_POLICY_HUGEPAGE.
+BOOL g_fLcAllocHugePageFail = FALSE;
+
+
+
+//-----------------------------------------------------------------------------
+// OPERATING SYSTEM SPECIFIC FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+/*
+* Retrieve the number of NUMA nodes of the system.
+* -- return
+*/
+DWORD LcAlloc_OsNodeCount()
+{
+    ULONG ulHighestNode = 0;
+    if(!GetNumaHighestNodeNumber(&ulHighestNode)) { return 1; }
+    return min(LC_ALLOC_NODES_MAX, ulHighestNode + 1);
+}
+
+/*
+* Allocate memory (zero initialized) by the operating system.
+* -- cb = size in bytes - a multiple of LC_ALLOC_HUGEPAGE_SIZE if fHugePage.
+* -- fHugePage
+* -- iNode = NUMA node, or LC_ALLOC_NODE_ANY.
+* -- pdwFlags = LC_ALLOC_FLAG_* of the resulting allocation.
+* -- return
+*/
+PBYTE LcAlloc_OsAlloc(_In_ SIZE_T cb, _In_ BOOL fHugePage, _In_ DWORD iNode, _Out_ PDWORD pdwFlags)
+{
+    PBYTE pb = NULL;
+    DWORD flAllocationType = MEM_RESERVE | MEM_COMMIT;
+    *pdwFlags = LC_ALLOC_FLAG_MAP;
+    // large pages require SeLockMemoryPrivilege - fall back to normal pages.
+    if(fHugePage && !g_fLcAllocHugePageFail && GetLargePageMinimum() && !(cb % GetLargePageMinimum())) {
+        if(iNode == LC_ALLOC_NODE_ANY) {
+            pb = VirtualAlloc(NULL, cb, flAllocationType | MEM_LARGE_PAGES, PAGE_READWRITE);
+        } else {
+            pb = VirtualAllocExNuma(GetCurrentProcess(), NULL, cb, flAllocationType | MEM_LARGE_PAGES, PAGE_READWRITE, iNode);
+        }
+        if(pb) { *pdwFlags |= LC_ALLOC_FLAG_HUGEPAGE; }
+    }
+    if(!pb) {
+        if(iNode == LC_ALLOC_NODE_ANY) {
+            pb = VirtualAlloc(NULL, cb, flAllocationType, PAGE_READWRITE);
+        } else {
+            pb = VirtualAllocExNuma(GetCurrentProcess(), NULL, cb, flAllocationType, PAGE_READWRITE, iNode);
+        }
+    }
+    if(pb && (iNode != LC_ALLOC_NODE_ANY)) { *pdwFlags |= LC_ALLOC_FLAG_NUMA; }
+    return pb;
+}
+
+/*
+* Free memory allocated by LcAlloc_OsAlloc.
+* -- pb
+* -- cb
+*/
+VOID LcAlloc_OsFree(_In_ PBYTE pb, _In_ SIZE_T cb)
+{
+    VirtualFree(pb, 0, MEM_RELEASE);
+}
+
+/*
+* Pin the calling thread to the processors of a NUMA node - or unpin it from
+* any NUMA node if iNode is LC_ALLOC_NODE_ANY.
+* -- iNode
+* -- return
+*/
+_Success_(return)
+BOOL LcAlloc_OsThreadPin(_In_ DWORD iNode)
+{
+    GROUP_AFFINITY Affinity = { 0 };
+    DWORD_PTR dwProcessAffinityMask, dwSystemAffinityMask;
+    if(iNode == LC_ALLOC_NODE_ANY) {
+        if(!GetProcessAffinityMask(GetCurrentProcess(), &dwProcessAffinityMask, &dwSystemAffinityMask)) { return FALSE; }
+        return SetThreadAffinityMask(GetCurrentThread(), dwProcessAffinityMask) ? TRUE : FALSE;
+    }
+    if(!GetNumaNodeProcessorMaskEx((USHORT)iNode, &Affinity) || !Affinity.Mask) { return FALSE; }
+    return SetThreadGroupAffinity(GetCurrentThread(), &Affinity, NULL);
+}
+
+#endif /* _WIN32 */
+#ifdef LINUX
+
+#define LC_ALLOC_MPOL_PREFERRED         1
+
+/*
+* Parse a sysfs cpu/node list such as "0-3,8-11".
+* -- szList
+* -- pMask = optional cpu set to receive the list entries.
+* -- return = highest entry + 1, 0 on fail.
+*/
+DWORD LcAlloc_OsParseList(_In_ LPSTR szList, _Out_opt_ cpu_set_t *pMask)
+{
+    DWORD iFirst, iLast, cMax = 0;
+    LPSTR sz = szList;
+    if(pMask) { CPU_ZERO(pMask); }
+    while(*sz >= '0' && *sz <= '9') {
+        iFirst = iLast = (DWORD)strtoul(sz, &sz, 10);
+        if(*sz == '-') {
+            iLast = (DWORD)strtoul(sz + 1, &sz, 10);
+        }
+        for(; pMask && (iFirst <= iLast) && (iFirst < CPU_SETSIZE); iFirst++) {
+            CPU_SET(iFirst, pMask);
+        }
+        cMax = max(cMax, iLast + 1);
+        if(*sz != ',') { break; }
+        sz++;
+    }
+    return cMax;
+}
+
+/*
+* Read a sysfs cpu/node list file.
+* -- szFile
+* -- pMask = optional cpu set to receive the list entries.
+* -- return = highest entry + 1, 0 on fail.
+*/
+DWORD LcAlloc_OsReadList(_In_ LPSTR szFile, _Out_opt_ cpu_set_t *pMask)
+{
+    FILE *hFile;
+    CHAR szList[0x400] = { 0 };
+    if(!(hFile = fopen(szFile, "r"))) { return 0; }
+    if(!fgets(szList, sizeof(szList) - 1, hFile)) { szList[0] = 0; }
+    fclose(hFile);
+    return LcAlloc_OsParseList(szList, pMask);
+}
+
+DWORD LcAlloc_OsNodeCount()
+{
+    DWORD cNodes = LcAlloc_OsReadList("/sys/devices/system/node/online", NULL);
+    return max(1, min(LC_ALLOC_NODES_MAX, cNodes));
+}
+
+PBYTE LcAlloc_OsAlloc(_In_ SIZE_T cb, _In_ BOOL fHugePage, _In_ DWORD iNode, _Out_ PDWORD pdwFlags)
+{
+    PBYTE pb = MAP_FAILED;
+    QWORD qwNodeMask;
+    *pdwFlags = LC_ALLOC_FLAG_MAP;
+    if(fHugePage && !g_fLcAllocHugePageFail) {
+        // explicit huge pages are only available if reserved by the system
+        // (vm.nr_hugepages) - fall back to transparent huge pages.
+        pb = mmap(NULL, cb, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(pb == MAP_FAILED) {
+            pb = mmap(NULL, cb, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if((pb != MAP_FAILED) && madvise(pb, cb, MADV_HUGEPAGE)) {
+                fHugePage = FALSE;
+            }
+        }
+        if((pb != MAP_FAILED) && fHugePage) { *pdwFlags |= LC_ALLOC_FLAG_HUGEPAGE; }
+    } else {
+        pb = mmap(NULL, cb, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if(pb == MAP_FAILED) { return NULL; }
+#ifdef SYS_mbind
+    // prefer (rather than bind to) the node so that allocations never fail
+    // due to memory pressure on the node - memory is placed at first touch.
+    if(iNode != LC_ALLOC_NODE_ANY) {
+        qwNodeMask = 1ULL << iNode;
+        if(!syscall(SYS_mbind, pb, cb, LC_ALLOC_MPOL_PREFERRED, &qwNodeMask, LC_ALLOC_NODES_MAX + 1, 0)) {
+            *pdwFlags |= LC_ALLOC_FLAG_NUMA;
+        }
+    }
+#endif /* SYS_mbind */
+    return pb;
+}
+
+VOID LcAlloc_OsFree(_In_ PBYTE pb, _In_ SIZE_T cb)
+{
+    munmap(pb, cb);
+}
+
+_Success_(return)
+BOOL LcAlloc_OsThreadPin(_In_ DWORD iNode)
+{
+    cpu_set_t Mask;
+    CHAR szFile[MAX_PATH];
+    if(iNode == LC_ALLOC_NODE_ANY) {
+        if(!LcAlloc_OsReadList("/sys/devices/system/cpu/online", &Mask)) { return FALSE; }
+    } else {
+        _snprintf_s(szFile, _countof(szFile), _TRUNCATE, "/sys/devices/system/node/node%u/cpulist", iNode);
+        if(!LcAlloc_OsReadList(szFile, &Mask) || !CPU_COUNT(&Mask)) { return FALSE; }
+    }
+    return 0 == sched_setaffinity(0, sizeof(cpu_set_t), &Mask);
+}
+
+#endif /* LINUX */
+
+
+
+//-----------------------------------------------------------------------------
+// ALLOCATION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Retrieve the NUMA node assigned to a contigious read worker.
+* -- ctxLC
+* -- iWorker
+* -- return = NUMA node, or LC_ALLOC_NODE_ANY if NUMA placement is disabled.
+*/
+DWORD LcAlloc_WorkerNode(_In_ PLC_CONTEXT ctxLC, _In_ DWORD iWorker)
+{
+    PLC_ALLOC_CONTEXT ctx = ctxLC->pAlloc;
+    if(!ctx || !(ctx->dwPolicy & (LC_ALLOC_POLICY_NUMA | LC_ALLOC_POLICY_PIN)) || (ctx->cNodes < 2)) { return LC_ALLOC_NODE_ANY; }
+    return iWorker % ctx->cNodes;
+}
+
+/*
+* Allocate a large read buffer according to the allocation policy. The buffer
+* contents are uninitialized.
+* -- ctxLC
+* -- cb
+* -- iNode = NUMA node (LC_ALLOC_POLICY_NUMA only), or LC_ALLOC_NODE_ANY.
+* -- pAlloc = receives the allocation - to be free'd by LcAlloc_LargeFree.
+* -- return = the buffer, NULL on fail.
+*/
+PBYTE LcAlloc_Large(_In_ PLC_CONTEXT ctxLC, _In_ SIZE_T cb, _In_ DWORD iNode, _Out_ PLC_ALLOC_LARGE pAlloc)
+{
+    PLC_ALLOC_CONTEXT ctx = ctxLC->pAlloc;
+    DWORD dwPolicy = ctx ? ctx->dwPolicy : 0;
+    BOOL fHugePage = (dwPolicy & LC_ALLOC_POLICY_HUGEPAGE) && (cb >= LC_ALLOC_HUGEPAGE_SIZE);
+    ZeroMemory(pAlloc, sizeof(LC_ALLOC_LARGE));
+    pAlloc->dwPolicy = dwPolicy;
+    if(!(dwPolicy & LC_ALLOC_POLICY_NUMA)) { iNode = LC_ALLOC_NODE_ANY; }
+    if(!fHugePage && (iNode == LC_ALLOC_NODE_ANY)) {
+        pAlloc->cb = cb;
+        pAlloc->dwFlags = LC_ALLOC_FLAG_LOCALALLOC;
+        return pAlloc->pb = LocalAlloc(0, cb);
+    }
+    pAlloc->cb = fHugePage ? ((cb + LC_ALLOC_HUGEPAGE_SIZE - 1) & ~(SIZE_T)(LC_ALLOC_HUGEPAGE_SIZE - 1)) : ((cb + 0xfff) & ~(SIZE_T)0xfff);
+    if(!(pAlloc->pb = LcAlloc_OsAlloc(pAlloc->cb, fHugePage, iNode, &pAlloc->dwFlags))) {
+        pAlloc->cb = 0;
+        pAlloc->dwFlags = 0;
+        return NULL;
+    }
+    if(pAlloc->dwFlags & LC_ALLOC_FLAG_HUGEPAGE) { InterlockedAdd64(&ctx->cbHugePage, pAlloc->cb); }
+    if(pAlloc->dwFlags & LC_ALLOC_FLAG_NUMA) { InterlockedAdd64(&ctx->cbNuma, pAlloc->cb); }
+    return pAlloc->pb;
+}
+
+/*
+* Free a large read buffer allocated by LcAlloc_Large.
+* -- ctxLC
+* -- pAlloc
+*/
+VOID LcAlloc_LargeFree(_In_ PLC_CONTEXT ctxLC, _Inout_ PLC_ALLOC_LARGE pAlloc)
+{
+    PLC_ALLOC_CONTEXT ctx = ctxLC->pAlloc;
+    if(!pAlloc->pb) { return; }
+    if(pAlloc->dwFlags & LC_ALLOC_FLAG_LOCALALLOC) {
+        LocalFree(pAlloc->pb);
+    } else {
+        if(ctx && (pAlloc->dwFlags & LC_ALLOC_FLAG_HUGEPAGE)) { InterlockedAdd64(&ctx->cbHugePage, (QWORD)0 - pAlloc->cb); }
+        if(ctx && (pAlloc->dwFlags & LC_ALLOC_FLAG_NUMA)) { InterlockedAdd64(&ctx->cbNuma, (QWORD)0 - pAlloc->cb); }
+        LcAlloc_OsFree(pAlloc->pb, pAlloc->cb);
+    }
+    ZeroMemory(pAlloc, sizeof(LC_ALLOC_LARGE));
+}
+
+/*
+* Check whether a large read buffer was allocated under the current allocation
+* policy - if not it should be re-allocated when convenient.
+* -- ctxLC
+* -- pAlloc
+* -- return
+*/
+BOOL LcAlloc_LargeIsCurrent(_In_ PLC_CONTEXT ctxLC, _In_ PLC_ALLOC_LARGE pAlloc)
+{
+    return !ctxLC->pAlloc || (pAlloc->dwPolicy == ctxLC->pAlloc->dwPolicy);
+}
+
+/*
+* Pin (or unpin) the calling contigious read worker thread to the processors
+* of its NUMA node according to the current allocation policy.
+* -- ctxLC
+* -- iWorker
+* -- pfPinned = pinned state of the worker thread - updated on change.
+*/
+VOID LcAlloc_WorkerPin(_In_ PLC_CONTEXT ctxLC, _In_ DWORD iWorker, _Inout_ PBOOL pfPinned)
+{
+    PLC_ALLOC_CONTEXT ctx = ctxLC->pAlloc;
+    DWORD iNode = LcAlloc_WorkerNode(ctxLC, iWorker);
+    BOOL fPin = ctx && (ctx->dwPolicy & LC_ALLOC_POLICY_PIN) && (iNode != LC_ALLOC_NODE_ANY);
+    if(fPin == *pfPinned) { return; }
+    if(fPin && LcAlloc_OsThreadPin(iNode)) {
+        *pfPinned = TRUE;
+        InterlockedIncrement(&ctx->cThreadPinned);
+    }
+    if(!fPin) {
+        LcAlloc_OsThreadPin(LC_ALLOC_NODE_ANY);
+        *pfPinned = FALSE;
+        InterlockedDecrement(&ctx->cThreadPinned);
+    }
+}
+
+/*
+* Advise that a large buffer allocated by LocalAlloc should be backed by
+* transparent huge pages (Linux only) - used by LcAllocScatter1. No advice is
+* given unless an open context has the LC_ALLOC_POLICY_HUGEPAGE policy set.
+* -- pb
+* -- cb
+*/
+VOID LcAlloc_HintHugePage(_In_ PBYTE pb, _In_ SIZE_T cb)
+{
+#ifdef LINUX
+    QWORD vaStart = ((QWORD)pb + LC_ALLOC_HUGEPAGE_SIZE - 1) & ~(QWORD)(LC_ALLOC_HUGEPAGE_SIZE - 1);
+    QWORD vaEnd = ((QWORD)pb + cb) & ~(QWORD)(LC_ALLOC_HUGEPAGE_SIZE - 1);
+    if(g_cAllocPolicyHugePage && (vaStart < vaEnd)) {
+        madvise((PVOID)vaStart, vaEnd - vaStart, MADV_HUGEPAGE);
+    }
+#endif /* LINUX */
+}
+
+
+
+//-----------------------------------------------------------------------------
+// GET / SET OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Set the allocation policy of a context and keep track of the number of open
+* contexts with the LC_ALLOC_POLICY_HUGEPAGE policy set.
+* -- ctx
+* -- dwPolicy
+*/
+VOID LcAlloc_PolicySet(_In_ PLC_ALLOC_CONTEXT ctx, _In_ DWORD dwPolicy)
+{
+    EnterCriticalSection(&ctx->LockPolicy);
+    if((dwPolicy & LC_ALLOC_POLICY_HUGEPAGE) && !(ctx->dwPolicy & LC_ALLOC_POLICY_HUGEPAGE)) {
+        InterlockedIncrement(&g_cAllocPolicyHugePage);
+    }
+    if(!(dwPolicy & LC_ALLOC_POLICY_HUGEPAGE) && (ctx->dwPolicy & LC_ALLOC_POLICY_HUGEPAGE)) {
+        InterlockedDecrement(&g_cAllocPolicyHugePage);
+    }
+    ctx->dwPolicy = dwPolicy;
+    LeaveCriticalSection(&ctx->LockPolicy);
+}
+
+/*
+* Retrieve an allocation option (LC_OPT_CORE_ALLOC_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcAlloc_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_ALLOC_CONTEXT ctx = ctxLC->pAlloc;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_ALLOC_POLICY:
+            *pqwValue = ctx->dwPolicy;
+            return TRUE;
+        case LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES:
+            *pqwValue = ctx->cbHugePage;
+            return TRUE;
+        case LC_OPT_CORE_ALLOC_NUMA_BYTES:
+            *pqwValue = ctx->cbNuma;
+            return TRUE;
+        case LC_OPT_CORE_ALLOC_NUMA_NODES:
+            *pqwValue = ctx->cNodes;
+            return TRUE;
+        case LC_OPT_CORE_ALLOC_PINNED:
+            *pqwValue = ctx->cThreadPinned;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Set an allocation option (LC_OPT_CORE_ALLOC_*). A new allocation policy is
+* applied to contigious read worker buffers and threads at their next read.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcAlloc_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    switch(fOption) {
+        case LC_OPT_CORE_ALLOC_POLICY:
+            if(qwValue & ~(QWORD)LC_ALLOC_POLICY_MASK) { return FALSE; }
+            LcAlloc_PolicySet(ctxLC->pAlloc, (DWORD)qwValue);
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the allocation policy of a LeechCore context - the initial policy
+* is taken from the device parameter 'alloc' (if any).
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcAlloc_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_ALLOC_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_ALLOC_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->LockPolicy);
+    LcAlloc_PolicySet(ctx, (DWORD)LcDeviceParameterGetNumeric(ctxLC, LC_DEVICE_PARAMETER_ALLOC) & LC_ALLOC_POLICY_MASK);
+    ctx->cNodes = LcAlloc_OsNodeCount();
+    ctxLC->pAlloc = ctx;
+    return TRUE;
+}
+
+/*
+* Close the allocation policy of a LeechCore context. All large read buffers
+* must have been free'd before this call.
+* -- ctxLC
+*/
+VOID LcAlloc_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_ALLOC_CONTEXT ctx = ctxLC->pAlloc;
+    if(!ctx) { return; }
+    ctxLC->pAlloc = NULL;
+    LcAlloc_PolicySet(ctx, 0);
+    DeleteCriticalSection(&ctx->LockPolicy);
+    LocalFree(ctx);
+}
@@ -0,0 +1,354 @@
+// arena.c : implementation : per-thread scratch arena and pooled MEM allocation.
+//
+// Temporary buffers on the read/write hot path (such as MEM arrays in LcRead
+// and LcWrite) are taken from a per-thread scratch arena rather than from the
+// heap. Arena allocations must be freed in reverse allocation order (LIFO).
+// Allocations which do not fit in the arena fall back to the heap.
+//
+// Pooled MEM allocations (LcAllocScatterPooled) are kept in per-thread free
+// lists by size class when freed so that steady-state callers are able to
+// re-use their MEM blocks without heap allocations. Blocks handed out to the
+// caller are tracked in a process-wide table so that LcFreeScatterPooled is
+// able to reject pointers not allocated by LcAllocScatterPooled without ever
+// touching memory it does not own.
+//
+// The per-thread context also holds the event a thread waits on while its
+// read is queued in the read submission queue of a single-threaded device.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_ARENA_SIZE                   0x00100000      // 1MB scratch arena per thread.
+#define LC_ARENA_ALIGN(cb)              (((cb) + 0xf) & ~(SIZE_T)0xf)
+#define LC_POOL_MAGIC                   0x4c63b10c
+#define LC_POOL_CLASS_MEMS(iClass)      (0x10 << (iClass))
+#define LC_POOL_CLASS_MAX               9               // classes: 0x10 .. 0x1000 MEMs.
+#define LC_POOL_CLASS_NONE              0xffffffff
+#define LC_POOL_CACHE_MAX               0x02000000      // max 32MB cached pool blocks per thread.
+#define LC_POOL_LIVE_BUCKETS            0x400
+#define LC_POOL_LIVE_HASH(p)            ((((SIZE_T)(p)) >> 6) & (LC_POOL_LIVE_BUCKETS - 1))
+
+typedef struct tdLC_POOL_BLOCK {
+    DWORD magic;                    // LC_POOL_MAGIC
+    DWORD iClass;                   // LC_POOL_CLASS_* / LC_POOL_CLASS_NONE
+    struct tdLC_POOL_BLOCK *FLink;  // per-thread free list (when cached) / live table bucket (when allocated).
+    // PMEM_SCATTER[cMEMs] / MEM_SCATTER[cMEMs] / BYTE[cMEMs][0x1000] follows.
+} LC_POOL_BLOCK, *PLC_POOL_BLOCK;
+
+typedef struct tdLC_ARENA_THREAD {
+    SIZE_T cbUsed;
+    SIZE_T cbPoolCache;
+    PLC_POOL_BLOCK pPoolFree[LC_POOL_CLASS_MAX];
+    PBYTE pbArena;                  // LC_ARENA_SIZE bytes (allocated on first use).
+    HANDLE hEventSubmit;            // read submission completion event (created on first use).
+} LC_ARENA_THREAD, *PLC_ARENA_THREAD;
+
+#define LC_POOL_BLOCK_SIZE(cMEMs)       (sizeof(LC_POOL_BLOCK) + (SIZE_T)(cMEMs) * (sizeof(PMEM_SCATTER) + sizeof(MEM_SCATTER) + 0x1000))
+
+typedef struct tdLC_POOL_LIVE {
+    BOOL fValid;
+    CRITICAL_SECTION Lock;
+    PLC_POOL_BLOCK pBucket[LC_POOL_LIVE_BUCKETS];
+} LC_POOL_LIVE;
+
+LC_POOL_LIVE g_PoolLive = { 0 };
+
+#ifdef _WIN32
+DWORD g_dwArenaTls = TLS_OUT_OF_INDEXES;
+#define LcArena_TlsGet()                ((g_dwArenaTls != TLS_OUT_OF_INDEXES) ? (PLC_ARENA_THREAD)TlsGetValue(g_dwArenaTls) : NULL)
+#define LcArena_TlsSet(p)               ((g_dwArenaTls != TLS_OUT_OF_INDEXES) && TlsSetValue(g_dwArenaTls, p))
+#endif /* _WIN32 */
+#ifdef LINUX
+BOOL g_fArenaTls = FALSE;
+pthread_key_t g_ArenaTls;
+#define LcArena_TlsGet()                (g_fArenaTls ? (PLC_ARENA_THREAD)pthread_getspecific(g_ArenaTls) : NULL)
+#define LcArena_TlsSet(p)               (g_fArenaTls && !pthread_setspecific(g_ArenaTls, p))
+#endif /* LINUX */
+
+
+
+//-----------------------------------------------------------------------------
+// PER-THREAD CONTEXT FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Free a per-thread arena context and all its cached pool blocks.
+* -- pv
+*/
+VOID LcArena_ThreadFree(_In_opt_ PVOID pv)
+{
+    DWORD i;
+    PLC_POOL_BLOCK pBlock;
+    PLC_ARENA_THREAD ctx = (PLC_ARENA_THREAD)pv;
+    if(!ctx) { return; }
+    for(i = 0; i < LC_POOL_CLASS_MAX; i++) {
+        while((pBlock = ctx->pPoolFree[i])) {
+            ctx->pPoolFree[i] = pBlock->FLink;
+            LocalFree(pBlock);
+        }
+    }
+    if(ctx->hEventSubmit) { CloseHandle(ctx->hEventSubmit); }
+    LocalFree(ctx->pbArena);
+    LocalFree(ctx);
+}
+
+/*
+* Retrieve the arena context of the current thread - create it if required.
+* -- return = the context, NULL on fail.
+*/
+PLC_ARENA_THREAD LcArena_ThreadGet()
+{
+    PLC_ARENA_THREAD ctx;
+    if((ctx = LcArena_TlsGet())) { return ctx; }
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_ARENA_THREAD)))) { return NULL; }
+    if(!LcArena_TlsSet(ctx)) {
+        LocalFree(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/*
+* Initialize the per-thread arena functionality. Called on process attach.
+*/
+VOID LcArena_ProcessAttach()
+{
+#ifdef _WIN32
+    g_dwArenaTls = TlsAlloc();
+#endif /* _WIN32 */
+#ifdef LINUX
+    g_fArenaTls = (0 == pthread_key_create(&g_ArenaTls, LcArena_ThreadFree));
+#endif /* LINUX */
+    InitializeCriticalSection(&g_PoolLive.Lock);
+    g_PoolLive.fValid = TRUE;
+}
+
+/*
+* Free the arena context of the current thread. Called on thread detach.
+*/
+VOID LcArena_ThreadDetach()
+{
+    LcArena_ThreadFree(LcArena_TlsGet());
+    LcArena_TlsSet(NULL);
+}
+
+/*
+* Close the per-thread arena functionality. Called on process detach.
+*/
+VOID LcArena_ProcessDetach()
+{
+    LcArena_ThreadDetach();
+#ifdef _WIN32
+    if(g_dwArenaTls != TLS_OUT_OF_INDEXES) {
+        TlsFree(g_dwArenaTls);
+        g_dwArenaTls = TLS_OUT_OF_INDEXES;
+    }
+#endif /* _WIN32 */
+#ifdef LINUX
+    if(g_fArenaTls) {
+        g_fArenaTls = FALSE;
+        pthread_key_delete(g_ArenaTls);
+    }
+#endif /* LINUX */
+    if(g_PoolLive.fValid) {
+        g_PoolLive.fValid = FALSE;
+        DeleteCriticalSection(&g_PoolLive.Lock);
+    }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// SCRATCH ARENA FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Allocate a temporary buffer from the per-thread scratch arena. The buffer is
+* not zero initialized. If the arena is exhausted the buffer is allocated from
+* the heap instead. The buffer must be freed by LcArena_Free in reverse order
+* of allocation on the same thread.
+* -- cb
+* -- return
+*/
+PVOID LcArena_Alloc(_In_ SIZE_T cb)
+{
+    PBYTE pb;
+    PLC_ARENA_THREAD ctx = LcArena_ThreadGet();
+    cb = LC_ARENA_ALIGN(cb);
+    if(ctx && (cb <= LC_ARENA_SIZE - ctx->cbUsed)) {
+        if(!ctx->pbArena && !(ctx->pbArena = LocalAlloc(0, LC_ARENA_SIZE))) {
+            return LocalAlloc(0, cb);
+        }
+        pb = ctx->pbArena + ctx->cbUsed;
+        ctx->cbUsed += cb;
+        return pb;
+    }
+    return LocalAlloc(0, cb);
+}
+
+/*
+* Free a buffer allocated by LcArena_Alloc.
+* -- pv
+*/
+VOID LcArena_Free(_In_opt_ PVOID pv)
+{
+    PLC_ARENA_THREAD ctx;
+    if(!pv) { return; }
+    ctx = LcArena_TlsGet();
+    if(ctx && ctx->pbArena && ((PBYTE)pv >= ctx->pbArena) && ((PBYTE)pv < ctx->pbArena + LC_ARENA_SIZE)) {
+        ctx->cbUsed = (PBYTE)pv - ctx->pbArena;
+        return;
+    }
+    LocalFree(pv);
+}
+
+
+
+/*
+* Retrieve the read submission completion event of the current thread. The
+* event is auto-reset and lives until the thread exits.
+* -- return = the event, or NULL on fail.
+*/
+HANDLE LcArena_SubmitEvent()
+{
+    PLC_ARENA_THREAD ctx = LcArena_ThreadGet();
+    if(!ctx) { return NULL; }
+    if(!ctx->hEventSubmit) {
+        ctx->hEventSubmit = CreateEvent(NULL, FALSE, FALSE, NULL);
+    }
+    return ctx->hEventSubmit;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// POOLED MEM ALLOCATION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Insert a pool block handed out to a caller into the live block table.
+* -- pBlock
+* -- return
+*/
+_Success_(return)
+BOOL LcPool_LiveInsert(_In_ PLC_POOL_BLOCK pBlock)
+{
+    DWORD iBucket = LC_POOL_LIVE_HASH(pBlock);
+    if(!g_PoolLive.fValid) { return FALSE; }
+    EnterCriticalSection(&g_PoolLive.Lock);
+    pBlock->FLink = g_PoolLive.pBucket[iBucket];
+    g_PoolLive.pBucket[iBucket] = pBlock;
+    LeaveCriticalSection(&g_PoolLive.Lock);
+    return TRUE;
+}
+
+/*
+* Remove a block from the live block table. Only addresses of blocks in the
+* table are dereferenced - arbitrary (non-pool) pointers are safe to look up.
+* -- pBlock = candidate block address (may not be a valid block).
+* -- return = TRUE if the block was live and is now removed from the table.
+*/
+_Success_(return)
+BOOL LcPool_LiveRemove(_In_ PLC_POOL_BLOCK pBlock)
+{
+    BOOL fResult = FALSE;
+    PLC_POOL_BLOCK *ppNext;
+    DWORD iBucket = LC_POOL_LIVE_HASH(pBlock);
+    if(!g_PoolLive.fValid) { return FALSE; }
+    EnterCriticalSection(&g_PoolLive.Lock);
+    ppNext = &g_PoolLive.pBucket[iBucket];
+    while(*ppNext && (*ppNext != pBlock)) {
+        ppNext = &(*ppNext)->FLink;
+    }
+    if(*ppNext) {
+        *ppNext = pBlock->FLink;
+        pBlock->FLink = NULL;
+        fResult = TRUE;
+    }
+    LeaveCriticalSection(&g_PoolLive.Lock);
+    return fResult;
+}
+
+/*
+* Allocate and pre-initialize empty MEMs including a 0x1000 buffer for each
+* pMEM - in the same way as LcAllocScatter1. The MEM blocks are re-used from
+* a per-thread pool. NB! the 0x1000 buffers are not zero initialized.
+* The result must be freed by LcFreeScatterPooled (not LcMemFree).
+* -- cMEMs
+* -- pppMEMs = pointer to receive ppMEMs
+* -- return
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcAllocScatterPooled(_In_ DWORD cMEMs, _Out_ PPMEM_SCATTER *pppMEMs)
+{
+    DWORD i, iClass = 0;
+    PBYTE pbData;
+    PMEM_SCATTER pMEMs;
+    PPMEM_SCATTER ppMEMs;
+    PLC_POOL_BLOCK pBlock = NULL;
+    PLC_ARENA_THREAD ctx;
+    while((iClass < LC_POOL_CLASS_MAX) && (LC_POOL_CLASS_MEMS(iClass) < cMEMs)) {
+        iClass++;
+    }
+    if(iClass == LC_POOL_CLASS_MAX) {
+        iClass = LC_POOL_CLASS_NONE;
+        if(!(pBlock = LocalAlloc(0, LC_POOL_BLOCK_SIZE(cMEMs)))) { return FALSE; }
+    } else {
+        if((ctx = LcArena_ThreadGet()) && (pBlock = ctx->pPoolFree[iClass])) {
+            ctx->pPoolFree[iClass] = pBlock->FLink;
+            ctx->cbPoolCache -= LC_POOL_BLOCK_SIZE(LC_POOL_CLASS_MEMS(iClass));
+        }
+        if(!pBlock && !(pBlock = LocalAlloc(0, LC_POOL_BLOCK_SIZE(LC_POOL_CLASS_MEMS(iClass))))) { return FALSE; }
+    }
+    pBlock->magic = LC_POOL_MAGIC;
+    pBlock->iClass = iClass;
+    if(!LcPool_LiveInsert(pBlock)) {
+        LocalFree(pBlock);
+        return FALSE;
+    }
+    ppMEMs = (PPMEM_SCATTER)(pBlock + 1);
+    pMEMs = (PMEM_SCATTER)(ppMEMs + cMEMs);
+    pbData = (PBYTE)(pMEMs + cMEMs);
+    ZeroMemory(pMEMs, cMEMs * sizeof(MEM_SCATTER));
+    for(i = 0; i < cMEMs; i++) {
+        ppMEMs[i] = pMEMs + i;
+        pMEMs[i].version = MEM_SCATTER_VERSION;
+        pMEMs[i].cb = 0x1000;
+        pMEMs[i].pb = pbData + ((SIZE_T)i << 12);
+    }
+    *pppMEMs = ppMEMs;
+    return TRUE;
+}
+
+/*
+* Free MEMs allocated by LcAllocScatterPooled. The MEM block is returned to the
+* pool of the calling thread for re-use (or freed if the pool is full).
+* Pointers not allocated by LcAllocScatterPooled are ignored.
+* -- ppMEMs
+*/
+EXPORTED_FUNCTION VOID LcFreeScatterPooled(_Frees_ptr_opt_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_POOL_BLOCK pBlock;
+    PLC_ARENA_THREAD ctx;
+    SIZE_T cbBlock;
+    if(!ppMEMs) { return; }
+    pBlock = (PLC_POOL_BLOCK)((SIZE_T)ppMEMs - sizeof(LC_POOL_BLOCK));
+    if(!LcPool_LiveRemove(pBlock)) { return; }
+    pBlock->magic = 0;
+    if(pBlock->iClass < LC_POOL_CLASS_MAX) {
+        cbBlock = LC_POOL_BLOCK_SIZE(LC_POOL_CLASS_MEMS(pBlock->iClass));
+        if((ctx = LcArena_ThreadGet()) && (ctx->cbPoolCache + cbBlock <= LC_POOL_CACHE_MAX)) {
+            pBlock->FLink = ctx->pPoolFree[pBlock->iClass];
+            ctx->pPoolFree[pBlock->iClass] = pBlock;
+            ctx->cbPoolCache += cbBlock;
+            return;
+        }
+    }
+    LocalFree(pBlock);
+}
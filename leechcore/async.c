@@ -0,0 +1,466 @@
+// async.c : implementation : asynchronous scatter reads.
+//
+// Asynchronous reads are queued per LeechCore context and serviced by a small
+// pool of worker threads which are started on first use. Each request has its
+// own completion event and an optional completion callback. Requests which are
+// still queued may be cancelled. Towards asynchronous (pfnSubmit) devices one
+// worker thread per allowed in-flight batch is started - each worker keeping
+// one device batch in flight.
+// Async read handles are looked up in a process-wide table of live requests -
+// handles not returned by LcReadScatterAsync (or already closed) are rejected
+// without ever being dereferenced.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_ASYNC_THREADS_SINGLE         2               // worker threads: single-threaded devices.
+#define LC_ASYNC_THREADS_MULTI          4               // worker threads: multi-threaded devices.
+#define LC_ASYNC_THREADS_MAX            16              // worker threads: asynchronous (pfnSubmit) devices max.
+#define LC_ASYNC_LIVE_BUCKETS           0x100
+#define LC_ASYNC_LIVE_HASH(p)           ((((SIZE_T)(p)) >> 6) & (LC_ASYNC_LIVE_BUCKETS - 1))
+
+typedef struct tdLC_ASYNC_REQUEST {
+    DWORD dwStatus;                 // LC_ASYNC_STATUS_*
+    DWORD cRef;                     // caller reference + worker reference
+    DWORD cMEMs;
+    DWORD dwCallbackThreadId;       // thread currently completing the request
+    DWORD dwQosPriority;            // LC_QOS_PRIORITY_* of the submitting thread
+    struct tdLC_ASYNC_REQUEST *FLink;
+    struct tdLC_ASYNC_REQUEST *FLinkLive;   // live request table bucket link.
+    PLC_CONTEXT ctxLC;
+    PPMEM_SCATTER ppMEMs;
+    PLC_READSCATTER_ASYNC_CALLBACK pfnCallback;
+    PVOID ctxCallback;
+    HANDLE hEventComplete;          // manual reset - set on complete/cancel
+} LC_ASYNC_REQUEST, *PLC_ASYNC_REQUEST;
+
+typedef struct tdLC_ASYNC_CONTEXT {
+    CRITICAL_SECTION Lock;
+    BOOL fActive;
+    DWORD cThread;
+    DWORD cThreadActive;
+    HANDLE hEventWork;              // auto reset - set on submit
+    HANDLE hThread[LC_ASYNC_THREADS_MAX];
+    PLC_ASYNC_REQUEST pQueueHead;
+    PLC_ASYNC_REQUEST pQueueTail;
+} LC_ASYNC_CONTEXT;
+
+typedef struct tdLC_ASYNC_LIVE {
+    BOOL fValid;
+    CRITICAL_SECTION Lock;
+    PLC_ASYNC_REQUEST pBucket[LC_ASYNC_LIVE_BUCKETS];
+} LC_ASYNC_LIVE;
+
+LC_ASYNC_LIVE g_AsyncLive = { 0 };
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Release a reference to a request and free it on last reference.
+* -- pReq
+*/
+VOID LcAsync_RequestRelease(_In_ PLC_ASYNC_REQUEST pReq)
+{
+    if(InterlockedDecrement(&pReq->cRef)) { return; }
+    CloseHandle(pReq->hEventComplete);
+    LocalFree(pReq);
+}
+
+/*
+* Insert a request handed out to the caller into the live request table.
+* -- pReq
+* -- return
+*/
+_Success_(return)
+BOOL LcAsync_LiveInsert(_In_ PLC_ASYNC_REQUEST pReq)
+{
+    DWORD iBucket = LC_ASYNC_LIVE_HASH(pReq);
+    if(!g_AsyncLive.fValid) { return FALSE; }
+    EnterCriticalSection(&g_AsyncLive.Lock);
+    pReq->FLinkLive = g_AsyncLive.pBucket[iBucket];
+    g_AsyncLive.pBucket[iBucket] = pReq;
+    LeaveCriticalSection(&g_AsyncLive.Lock);
+    return TRUE;
+}
+
+/*
+* Look up a handle in the live request table. Only addresses of requests in
+* the table are dereferenced - arbitrary handles are safe to look up.
+* -- hLcAsync = candidate handle (may not be a valid handle).
+* -- fRemove = remove the request from the table (the handle is closed).
+* -- return = the request with a reference taken (fRemove: the caller reference
+*             handed over), or NULL if the handle is not live.
+*/
+PLC_ASYNC_REQUEST LcAsync_LiveLookup(_In_opt_ HANDLE hLcAsync, _In_ BOOL fRemove)
+{
+    PLC_ASYNC_REQUEST pReq, *ppNext;
+    if(!hLcAsync || !g_AsyncLive.fValid) { return NULL; }
+    EnterCriticalSection(&g_AsyncLive.Lock);
+    ppNext = &g_AsyncLive.pBucket[LC_ASYNC_LIVE_HASH(hLcAsync)];
+    while(*ppNext && (*ppNext != (PLC_ASYNC_REQUEST)hLcAsync)) {
+        ppNext = &(*ppNext)->FLinkLive;
+    }
+    if((pReq = *ppNext)) {
+        if(fRemove) {
+            *ppNext = pReq->FLinkLive;
+            pReq->FLinkLive = NULL;
+        } else {
+            InterlockedIncrement(&pReq->cRef);
+        }
+    }
+    LeaveCriticalSection(&g_AsyncLive.Lock);
+    return pReq;
+}
+
+/*
+* Complete a request: invoke the optional callback, set its final status and
+* signal its event. The worker reference is released afterwards.
+* -- pReq
+* -- dwStatus = LC_ASYNC_STATUS_COMPLETE or LC_ASYNC_STATUS_CANCELLED.
+*/
+VOID LcAsync_RequestComplete(_In_ PLC_ASYNC_REQUEST pReq, _In_ DWORD dwStatus)
+{
+    pReq->dwCallbackThreadId = GetCurrentThreadId();
+    if(pReq->pfnCallback) {
+        pReq->pfnCallback(pReq->ctxCallback, (HANDLE)pReq, pReq->cMEMs, pReq->ppMEMs);
+    }
+    pReq->dwStatus = dwStatus;
+    SetEvent(pReq->hEventComplete);
+    LcAsync_RequestRelease(pReq);
+}
+
+/*
+* Dequeue the first pending request (if any) and mark it as active.
+* -- ctx
+* -- return
+*/
+PLC_ASYNC_REQUEST LcAsync_Dequeue(_In_ PLC_ASYNC_CONTEXT ctx)
+{
+    PLC_ASYNC_REQUEST pReq;
+    EnterCriticalSection(&ctx->Lock);
+    if((pReq = ctx->pQueueHead)) {
+        ctx->pQueueHead = pReq->FLink;
+        if(!ctx->pQueueHead) { ctx->pQueueTail = NULL; }
+        pReq->FLink = NULL;
+        pReq->dwStatus = LC_ASYNC_STATUS_ACTIVE;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return pReq;
+}
+
+/*
+* Worker thread loop servicing the async request queue.
+* -- ctxLC
+* -- return
+*/
+DWORD LcAsync_ThreadProc(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_ASYNC_CONTEXT ctx = ctxLC->pAsync;
+    PLC_ASYNC_REQUEST pReq;
+    while(ctx->fActive) {
+        while(ctx->fActive && (pReq = LcAsync_Dequeue(ctx))) {
+            if(ctx->pQueueHead) { SetEvent(ctx->hEventWork); }     // wake up another worker (if any idle).
+            // the worker takes the priority of the submitting thread. A worker
+            // only ever has a priority in its own context - setting it may fail
+            // on out-of-memory only (the request is then read as interactive).
+            if(pReq->dwQosPriority) {
+                LcQos_SetThreadPriority(ctxLC, pReq->dwQosPriority);
+            }
+            LcReadScatter(ctxLC, pReq->cMEMs, pReq->ppMEMs);
+            if(pReq->dwQosPriority) {
+                LcQos_SetThreadPriority(ctxLC, LC_QOS_PRIORITY_INTERACTIVE);
+            }
+            LcAsync_RequestComplete(pReq, LC_ASYNC_STATUS_COMPLETE);
+        }
+        if(!ctx->fActive) { break; }
+        WaitForSingleObject(ctx->hEventWork, INFINITE);
+    }
+    InterlockedDecrement(&ctx->cThreadActive);
+    return 0;
+}
+
+/*
+* Start the worker threads (if not already started).
+* NB! Must be called with the async lock held.
+* -- ctxLC
+* -- ctx
+* -- return
+*/
+_Success_(return)
+BOOL LcAsync_StartThreads(_In_ PLC_CONTEXT ctxLC, _In_ PLC_ASYNC_CONTEXT ctx)
+{
+    DWORD i, cThread;
+    if(ctx->cThread) { return TRUE; }
+    if(!ctx->hEventWork && !(ctx->hEventWork = CreateEvent(NULL, FALSE, FALSE, NULL))) { return FALSE; }
+    cThread = ctxLC->fMultiThread ? LC_ASYNC_THREADS_MULTI : LC_ASYNC_THREADS_SINGLE;
+    if(ctxLC->pDeviceAsync) {
+        cThread = min(LC_ASYNC_THREADS_MAX, max(cThread, ctxLC->Caps.cInFlightMax));
+    }
+    for(i = 0; i < cThread; i++) {
+        InterlockedIncrement(&ctx->cThreadActive);
+        if(!(ctx->hThread[i] = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)LcAsync_ThreadProc, ctxLC, 0, NULL))) {
+            InterlockedDecrement(&ctx->cThreadActive);
+            break;
+        }
+        ctx->cThread++;
+    }
+    lcprintfvv_fn(ctxLC, "started %i async worker threads.\n", ctx->cThread);
+    return ctx->cThread > 0;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// EXPORTED ASYNC READ FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Retrieve a live async request from a handle. The request is referenced and
+* must be released by the caller with LcAsync_RequestRelease.
+* -- hLcAsync
+* -- return
+*/
+PLC_ASYNC_REQUEST LcAsync_GetRequest(_In_opt_ HANDLE hLcAsync)
+{
+    return LcAsync_LiveLookup(hLcAsync, FALSE);
+}
+
+/*
+* Cancel a request if it is not yet started.
+* -- pReq
+* -- return = TRUE if the request was cancelled.
+*/
+_Success_(return)
+BOOL LcAsync_RequestCancel(_In_ PLC_ASYNC_REQUEST pReq)
+{
+    PLC_ASYNC_CONTEXT ctx;
+    PLC_ASYNC_REQUEST pPrev = NULL, pCur;
+    BOOL fCancel = FALSE;
+    if(pReq->dwStatus != LC_ASYNC_STATUS_PENDING) { return FALSE; }
+    ctx = pReq->ctxLC->pAsync;
+    EnterCriticalSection(&ctx->Lock);
+    for(pCur = ctx->pQueueHead; pCur && (pCur != pReq); pCur = pCur->FLink) {
+        pPrev = pCur;
+    }
+    if(pCur) {
+        if(pPrev) { pPrev->FLink = pReq->FLink; } else { ctx->pQueueHead = pReq->FLink; }
+        if(ctx->pQueueTail == pReq) { ctx->pQueueTail = pPrev; }
+        pReq->FLink = NULL;
+        fCancel = TRUE;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    if(fCancel) {
+        LcAsync_RequestComplete(pReq, LC_ASYNC_STATUS_CANCELLED);
+    }
+    return fCancel;
+}
+
+/*
+* Submit an asynchronous scatter read. The function returns immediately and
+* the read is performed by a LeechCore worker thread. Multiple reads may be in
+* flight at the same time on a LeechCore handle.
+* The ppMEMs array and its MEMs must remain valid until the read is completed.
+* CALLER LcReadScatterAsyncClose: return
+* -- hLC
+* -- cMEMs
+* -- ppMEMs
+* -- pfnCallback = optional callback invoked on completion/cancellation.
+* -- ctxCallback = optional context passed to pfnCallback.
+* -- return = async read handle, NULL on fail.
+*/
+_Success_(return != NULL)
+EXPORTED_FUNCTION HANDLE LcReadScatterAsync(_In_ HANDLE hLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _In_opt_ PLC_READSCATTER_ASYNC_CALLBACK pfnCallback, _In_opt_ PVOID ctxCallback)
+{
+    PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
+    PLC_ASYNC_CONTEXT ctx;
+    PLC_ASYNC_REQUEST pReq;
+    if(!ctxLC || (ctxLC->version != LC_CONTEXT_VERSION) || !(ctx = ctxLC->pAsync)) { return NULL; }
+    if(!(pReq = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_ASYNC_REQUEST)))) { return NULL; }
+    if(!(pReq->hEventComplete = CreateEvent(NULL, TRUE, FALSE, NULL))) {
+        LocalFree(pReq);
+        return NULL;
+    }
+    pReq->dwStatus = LC_ASYNC_STATUS_PENDING;
+    pReq->cRef = 2;
+    pReq->ctxLC = ctxLC;
+    pReq->cMEMs = cMEMs;
+    pReq->ppMEMs = ppMEMs;
+    pReq->pfnCallback = pfnCallback;
+    pReq->ctxCallback = ctxCallback;
+    pReq->dwQosPriority = LcQos_GetThreadPriority(ctxLC);
+    if(!LcAsync_LiveInsert(pReq)) {
+        CloseHandle(pReq->hEventComplete);
+        LocalFree(pReq);
+        return NULL;
+    }
+    EnterCriticalSection(&ctx->Lock);
+    if(!ctx->fActive || !LcAsync_StartThreads(ctxLC, ctx)) {
+        LeaveCriticalSection(&ctx->Lock);
+        LcAsync_LiveLookup((HANDLE)pReq, TRUE);
+        CloseHandle(pReq->hEventComplete);
+        LocalFree(pReq);
+        return NULL;
+    }
+    if(ctx->pQueueTail) {
+        ctx->pQueueTail->FLink = pReq;
+    } else {
+        ctx->pQueueHead = pReq;
+    }
+    ctx->pQueueTail = pReq;
+    LeaveCriticalSection(&ctx->Lock);
+    SetEvent(ctx->hEventWork);
+    return (HANDLE)pReq;
+}
+
+/*
+* Wait for an asynchronous scatter read to complete.
+* -- hLcAsync
+* -- dwMilliseconds = timeout in ms, INFINITE (0xffffffff) to wait forever.
+* -- return = TRUE if the read is completed (or cancelled), FALSE on timeout.
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcReadScatterAsyncWait(_In_ HANDLE hLcAsync, _In_ DWORD dwMilliseconds)
+{
+    BOOL fResult;
+    PLC_ASYNC_REQUEST pReq = LcAsync_GetRequest(hLcAsync);
+    if(!pReq) { return FALSE; }
+    fResult = (pReq->dwStatus >= LC_ASYNC_STATUS_COMPLETE) || (WAIT_OBJECT_0 == WaitForSingleObject(pReq->hEventComplete, dwMilliseconds));
+    LcAsync_RequestRelease(pReq);
+    return fResult;
+}
+
+/*
+* Retrieve the status of an asynchronous scatter read without waiting.
+* -- hLcAsync
+* -- return = LC_ASYNC_STATUS_*, LC_ASYNC_STATUS_INVALID on bad handle.
+*/
+EXPORTED_FUNCTION DWORD LcReadScatterAsyncPoll(_In_ HANDLE hLcAsync)
+{
+    DWORD dwStatus;
+    PLC_ASYNC_REQUEST pReq = LcAsync_GetRequest(hLcAsync);
+    if(!pReq) { return LC_ASYNC_STATUS_INVALID; }
+    dwStatus = pReq->dwStatus;
+    LcAsync_RequestRelease(pReq);
+    return dwStatus;
+}
+
+/*
+* Cancel an asynchronous scatter read. Only reads which are not yet started
+* may be cancelled. A cancelled read is completed with status
+* LC_ASYNC_STATUS_CANCELLED and its callback (if any) is invoked on the
+* calling thread before this function returns.
+* -- hLcAsync
+* -- return = TRUE if the read was cancelled.
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcReadScatterAsyncCancel(_In_ HANDLE hLcAsync)
+{
+    BOOL fCancel;
+    PLC_ASYNC_REQUEST pReq = LcAsync_GetRequest(hLcAsync);
+    if(!pReq) { return FALSE; }
+    fCancel = LcAsync_RequestCancel(pReq);
+    LcAsync_RequestRelease(pReq);
+    return fCancel;
+}
+
+/*
+* Close an asynchronous scatter read handle. If the read is still pending it
+* is cancelled, if it is active the function waits for it to complete.
+* The handle may be closed from within its completion callback.
+* -- hLcAsync
+*/
+EXPORTED_FUNCTION VOID LcReadScatterAsyncClose(_In_opt_ _Post_ptr_invalid_ HANDLE hLcAsync)
+{
+    PLC_ASYNC_REQUEST pReq = LcAsync_LiveLookup(hLcAsync, TRUE);
+    if(!pReq) { return; }
+    LcAsync_RequestCancel(pReq);
+    if((pReq->dwStatus < LC_ASYNC_STATUS_COMPLETE) && (pReq->dwCallbackThreadId != GetCurrentThreadId())) {
+        WaitForSingleObject(pReq->hEventComplete, INFINITE);
+    }
+    LcAsync_RequestRelease(pReq);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the live async request table. Called on process attach.
+*/
+VOID LcAsync_ProcessAttach()
+{
+    InitializeCriticalSection(&g_AsyncLive.Lock);
+    g_AsyncLive.fValid = TRUE;
+}
+
+/*
+* Close the live async request table. Called on process detach.
+*/
+VOID LcAsync_ProcessDetach()
+{
+    if(g_AsyncLive.fValid) {
+        g_AsyncLive.fValid = FALSE;
+        DeleteCriticalSection(&g_AsyncLive.Lock);
+    }
+}
+
+/*
+* Initialize the async read functionality of a LeechCore context. Worker
+* threads are not started until the first async read is submitted.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcAsync_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_ASYNC_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_ASYNC_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    ctx->fActive = TRUE;
+    ctxLC->pAsync = ctx;
+    return TRUE;
+}
+
+/*
+* Close the async read functionality of a LeechCore context. Pending reads are
+* cancelled and active reads are waited upon. Async read handles must still be
+* closed by the caller with LcReadScatterAsyncClose.
+* NB! Must be called before the device is closed.
+* -- ctxLC
+*/
+VOID LcAsync_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    DWORD i;
+    PLC_ASYNC_CONTEXT ctx = ctxLC->pAsync;
+    PLC_ASYNC_REQUEST pReq;
+    if(!ctx) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    ctx->fActive = FALSE;
+    LeaveCriticalSection(&ctx->Lock);
+    while(ctx->cThreadActive) {
+        SetEvent(ctx->hEventWork);
+        SwitchToThread();
+    }
+    while((pReq = LcAsync_Dequeue(ctx))) {
+        LcAsync_RequestComplete(pReq, LC_ASYNC_STATUS_CANCELLED);
+    }
+    for(i = 0; i < ctx->cThread; i++) {
+        if(ctx->hThread[i]) { CloseHandle(ctx->hThread[i]); }
+    }
+    if(ctx->hEventWork) { CloseHandle(ctx->hEventWork); }
+    ctxLC->pAsync = NULL;
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx);
+}
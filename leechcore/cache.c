@@ -0,0 +1,433 @@
+// cache.c : implementation : core read-through page cache.
+//
+// The page cache sits between the memory map translation and the device read
+// in LcReadScatter. Pages are keyed on their translated (device) address and
+// evicted in least recently used order. Volatile devices additionally expire
+// cached pages after a configurable time-to-live.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_CACHE_ENTRIES_MAX            0x00400000      // max 16GB cache.
+#define LC_CACHE_TTL_DEFAULT            500             // default time-to-live in ms for volatile devices.
+#define LC_CACHE_HASH(pa, cMask)        ((DWORD)(((pa) >> 12) * 0x9E3779B97F4A7C15) & (cMask))
+
+typedef struct tdLC_CACHE_ENTRY {
+    QWORD pa;                       // translated page address
+    QWORD tcInsert;                 // tick count (ms) when inserted
+    DWORD iHashNext;                // next entry in hash bucket chain (0 = none)
+    DWORD iLruPrev;                 // previous (more recently used) entry (0 = none)
+    DWORD iLruNext;                 // next (less recently used) entry (0 = none)
+    DWORD _Filler;
+} LC_CACHE_ENTRY, *PLC_CACHE_ENTRY;
+
+typedef struct tdLC_CACHE_CONTEXT {
+    CRITICAL_SECTION Lock;
+    DWORD cEntries;                 // max number of cached pages (0 = disabled)
+    DWORD cEntriesUsed;
+    DWORD dwPolicy;                 // LC_CACHE_POLICY_*
+    DWORD dwTTL;                    // time-to-live in ms (TTL policy only)
+    QWORD cHit;
+    QWORD cMiss;
+    DWORD iLruHead;                 // most recently used entry
+    DWORD iLruTail;                 // least recently used entry
+    DWORD iFree;                    // free list (chained by iHashNext)
+    DWORD cHashMask;
+    PDWORD piHashMap;
+    PLC_CACHE_ENTRY pe;             // entries [1..cEntries] - entry 0 is unused
+    PBYTE pbData;                   // page data [0..cEntries-1]
+} LC_CACHE_CONTEXT;
+
+#define LC_CACHE_PAGE(ctx, i)           ((ctx)->pbData + (((SIZE_T)(i) - 1) << 12))
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+// All functions assume the cache lock is held by the caller.
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether the TTL policy is in effect for the cache.
+*/
+BOOL LcCache_IsPolicyTTL(_In_ PLC_CONTEXT ctxLC, _In_ PLC_CACHE_CONTEXT ctx)
+{
+    if(ctx->dwPolicy == LC_CACHE_POLICY_AUTO) {
+        return ctxLC->Config.fVolatile;
+    }
+    return ctx->dwPolicy == LC_CACHE_POLICY_TTL;
+}
+
+VOID LcCache_LruUnlink(_In_ PLC_CACHE_CONTEXT ctx, _In_ DWORD i)
+{
+    PLC_CACHE_ENTRY pe = ctx->pe + i;
+    if(pe->iLruPrev) { ctx->pe[pe->iLruPrev].iLruNext = pe->iLruNext; } else { ctx->iLruHead = pe->iLruNext; }
+    if(pe->iLruNext) { ctx->pe[pe->iLruNext].iLruPrev = pe->iLruPrev; } else { ctx->iLruTail = pe->iLruPrev; }
+    pe->iLruPrev = 0;
+    pe->iLruNext = 0;
+}
+
+VOID LcCache_LruPushHead(_In_ PLC_CACHE_CONTEXT ctx, _In_ DWORD i)
+{
+    PLC_CACHE_ENTRY pe = ctx->pe + i;
+    pe->iLruPrev = 0;
+    pe->iLruNext = ctx->iLruHead;
+    if(ctx->iLruHead) { ctx->pe[ctx->iLruHead].iLruPrev = i; }
+    ctx->iLruHead = i;
+    if(!ctx->iLruTail) { ctx->iLruTail = i; }
+}
+
+/*
+* Find the entry index of a page address in the cache.
+* -- return = entry index, 0 if not found.
+*/
+DWORD LcCache_Find(_In_ PLC_CACHE_CONTEXT ctx, _In_ QWORD pa)
+{
+    DWORD i = ctx->piHashMap[LC_CACHE_HASH(pa, ctx->cHashMask)];
+    while(i && (ctx->pe[i].pa != pa)) {
+        i = ctx->pe[i].iHashNext;
+    }
+    return i;
+}
+
+/*
+* Remove an entry from the hash map and the LRU list and put it on the free list.
+*/
+VOID LcCache_Remove(_In_ PLC_CACHE_CONTEXT ctx, _In_ DWORD i)
+{
+    PDWORD pi = ctx->piHashMap + LC_CACHE_HASH(ctx->pe[i].pa, ctx->cHashMask);
+    while(*pi && (*pi != i)) {
+        pi = &ctx->pe[*pi].iHashNext;
+    }
+    if(*pi) { *pi = ctx->pe[i].iHashNext; }
+    LcCache_LruUnlink(ctx, i);
+    ctx->pe[i].iHashNext = ctx->iFree;
+    ctx->iFree = i;
+    ctx->cEntriesUsed--;
+}
+
+/*
+* Free the cache buffers and reset the cache to its disabled state.
+*/
+VOID LcCache_FreeBuffers(_In_ PLC_CACHE_CONTEXT ctx)
+{
+    LocalFree(ctx->piHashMap);
+    LocalFree(ctx->pe);
+    LocalFree(ctx->pbData);
+    ctx->piHashMap = NULL;
+    ctx->pe = NULL;
+    ctx->pbData = NULL;
+    ctx->cEntries = 0;
+    ctx->cEntriesUsed = 0;
+    ctx->cHashMask = 0;
+    ctx->iLruHead = 0;
+    ctx->iLruTail = 0;
+    ctx->iFree = 0;
+}
+
+/*
+* Allocate the cache buffers for the given number of pages. Any previously
+* cached pages are discarded.
+* -- ctx
+* -- cEntries
+* -- return
+*/
+_Success_(return)
+BOOL LcCache_AllocBuffers(_In_ PLC_CACHE_CONTEXT ctx, _In_ DWORD cEntries)
+{
+    DWORD i, cHashMap = 1;
+    LcCache_FreeBuffers(ctx);
+    if(!cEntries) { return TRUE; }
+    while(cHashMap < cEntries) { cHashMap <<= 1; }
+    ctx->piHashMap = LocalAlloc(LMEM_ZEROINIT, cHashMap * sizeof(DWORD));
+    ctx->pe = LocalAlloc(LMEM_ZEROINIT, (cEntries + 1ULL) * sizeof(LC_CACHE_ENTRY));
+    ctx->pbData = LocalAlloc(0, (SIZE_T)cEntries << 12);
+    if(!ctx->piHashMap || !ctx->pe || !ctx->pbData) {
+        LcCache_FreeBuffers(ctx);
+        return FALSE;
+    }
+    for(i = cEntries; i; i--) {
+        ctx->pe[i].iHashNext = ctx->iFree;
+        ctx->iFree = i;
+    }
+    ctx->cEntries = cEntries;
+    ctx->cHashMask = cHashMap - 1;
+    return TRUE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// CACHE READ / WRITE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether the page cache is enabled.
+* -- ctxLC
+* -- return
+*/
+BOOL LcCache_IsEnabled(_In_ PLC_CONTEXT ctxLC)
+{
+    return ctxLC->pCache && ctxLC->pCache->cEntries;
+}
+
+/*
+* Retrieve the time-to-live which applies to buffered pages of the device -
+* also when the page cache itself is disabled. A time-to-live applies to
+* volatile devices and if the TTL policy is explicitly selected.
+* -- ctxLC
+* -- pdwTTL = time-to-live in ms.
+* -- return = TRUE if buffered pages expire.
+*/
+_Success_(return)
+BOOL LcCache_GetTTL(_In_ PLC_CONTEXT ctxLC, _Out_ PDWORD pdwTTL)
+{
+    PLC_CACHE_CONTEXT ctx = ctxLC->pCache;
+    *pdwTTL = ctx ? ctx->dwTTL : 0;
+    return ctxLC->Config.fVolatile || (ctx && (ctx->dwPolicy == LC_CACHE_POLICY_TTL));
+}
+
+/*
+* Serve MEMs from the page cache. MEMs which are served from the cache are
+* marked as successfully read. MEMs which still require a device read are put
+* into the ppMEMsMiss array (which must have room for cMEMs entries).
+* MEMs are assumed to have their memory map translation completed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcCache_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss)
+{
+    PLC_CACHE_CONTEXT ctx = ctxLC->pCache;
+    DWORD iMEM, iEntry, cMiss = 0;
+    QWORD tcNow = 0;
+    BOOL fTTL;
+    PMEM_SCATTER pMEM;
+    EnterCriticalSection(&ctx->Lock);
+    if(!ctx->cEntries) {
+        LeaveCriticalSection(&ctx->Lock);
+        for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+            pMEM = ppMEMs[iMEM];
+            if(!pMEM->f && MEM_SCATTER_ADDR_ISVALID(pMEM)) {
+                ppMEMsMiss[cMiss++] = pMEM;
+            }
+        }
+        return cMiss;
+    }
+    if((fTTL = LcCache_IsPolicyTTL(ctxLC, ctx))) {
+        tcNow = GetTickCount64();
+    }
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        iEntry = LcCache_Find(ctx, pMEM->qwA & ~0xfff);
+        if(iEntry && fTTL && (tcNow - ctx->pe[iEntry].tcInsert > ctx->dwTTL)) {
+            LcCache_Remove(ctx, iEntry);
+            iEntry = 0;
+        }
+        if(!iEntry || ((pMEM->qwA & 0xfff) + pMEM->cb > 0x1000)) {
+            ppMEMsMiss[cMiss++] = pMEM;
+            ctx->cMiss++;
+            continue;
+        }
+        memcpy(pMEM->pb, LC_CACHE_PAGE(ctx, iEntry) + (pMEM->qwA & 0xfff), pMEM->cb);
+        pMEM->f = TRUE;
+        LcCache_LruUnlink(ctx, iEntry);
+        LcCache_LruPushHead(ctx, iEntry);
+        ctx->cHit++;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return cMiss;
+}
+
+/*
+* Insert successfully read full pages into the page cache.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcCache_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_CACHE_CONTEXT ctx = ctxLC->pCache;
+    DWORD iMEM, iEntry, iBucket;
+    QWORD tcNow;
+    PMEM_SCATTER pMEM;
+    if(!ctx->cEntries) { return; }
+    tcNow = GetTickCount64();
+    EnterCriticalSection(&ctx->Lock);
+    if(qwWriteGeneration != ctxLC->qwWriteGeneration) { cMEMs = 0; }
+    for(iMEM = 0; ctx->cEntries && (iMEM < cMEMs); iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(!pMEM->f || (pMEM->cb != 0x1000) || (pMEM->qwA & 0xfff) || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        if((iEntry = LcCache_Find(ctx, pMEM->qwA))) {
+            LcCache_LruUnlink(ctx, iEntry);
+        } else {
+            if(!ctx->iFree) {
+                LcCache_Remove(ctx, ctx->iLruTail);
+            }
+            iEntry = ctx->iFree;
+            ctx->iFree = ctx->pe[iEntry].iHashNext;
+            iBucket = LC_CACHE_HASH(pMEM->qwA, ctx->cHashMask);
+            ctx->pe[iEntry].pa = pMEM->qwA;
+            ctx->pe[iEntry].iHashNext = ctx->piHashMap[iBucket];
+            ctx->piHashMap[iBucket] = iEntry;
+            ctx->cEntriesUsed++;
+        }
+        ctx->pe[iEntry].tcInsert = tcNow;
+        memcpy(LC_CACHE_PAGE(ctx, iEntry), pMEM->pb, 0x1000);
+        LcCache_LruPushHead(ctx, iEntry);
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Invalidate any cached pages touched by the MEMs. This is called on writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcCache_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_CACHE_CONTEXT ctx = ctxLC->pCache;
+    DWORD iMEM, iEntry;
+    PMEM_SCATTER pMEM;
+    if(!ctx->cEntries) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; ctx->cEntries && (iMEM < cMEMs); iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        if((iEntry = LcCache_Find(ctx, pMEM->qwA & ~0xfff))) {
+            LcCache_Remove(ctx, iEntry);
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Remove all pages from the cache.
+* -- ctxLC
+*/
+VOID LcCache_Flush(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_CACHE_CONTEXT ctx = ctxLC->pCache;
+    EnterCriticalSection(&ctx->Lock);
+    LcCache_AllocBuffers(ctx, ctx->cEntries);
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// GET / SET OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Retrieve a page cache option (LC_OPT_CORE_CACHE_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcCache_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_CACHE_CONTEXT ctx = ctxLC->pCache;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_CACHE_SIZE:
+            *pqwValue = ctx->cEntries;
+            return TRUE;
+        case LC_OPT_CORE_CACHE_POLICY:
+            *pqwValue = ctx->dwPolicy;
+            return TRUE;
+        case LC_OPT_CORE_CACHE_TTL:
+            *pqwValue = ctx->dwTTL;
+            return TRUE;
+        case LC_OPT_CORE_CACHE_HIT:
+            *pqwValue = ctx->cHit;
+            return TRUE;
+        case LC_OPT_CORE_CACHE_MISS:
+            *pqwValue = ctx->cMiss;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Set a page cache option (LC_OPT_CORE_CACHE_*). Changing the cache size will
+* discard all currently cached pages.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcCache_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    PLC_CACHE_CONTEXT ctx = ctxLC->pCache;
+    BOOL fResult = FALSE;
+    EnterCriticalSection(&ctx->Lock);
+    switch(fOption) {
+        case LC_OPT_CORE_CACHE_SIZE:
+            if(qwValue > LC_CACHE_ENTRIES_MAX) { break; }
+            fResult = LcCache_AllocBuffers(ctx, (DWORD)qwValue);
+            lcprintfv_fn(ctxLC, "cache size: %i pages (%s).\n", ctx->cEntries, fResult ? "ok" : "fail");
+            break;
+        case LC_OPT_CORE_CACHE_POLICY:
+            if(qwValue > LC_CACHE_POLICY_TTL) { break; }
+            ctx->dwPolicy = (DWORD)qwValue;
+            fResult = TRUE;
+            break;
+        case LC_OPT_CORE_CACHE_TTL:
+            ctx->dwTTL = (DWORD)min(qwValue, 0xffffffff);
+            fResult = TRUE;
+            break;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the (initially disabled) page cache of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcCache_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_CACHE_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_CACHE_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    ctx->dwPolicy = LC_CACHE_POLICY_AUTO;
+    ctx->dwTTL = LC_CACHE_TTL_DEFAULT;
+    ctxLC->pCache = ctx;
+    return TRUE;
+}
+
+/*
+* Close the page cache of a LeechCore context and free its resources.
+* -- ctxLC
+*/
+VOID LcCache_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_CACHE_CONTEXT ctx = ctxLC->pCache;
+    if(!ctx) { return; }
+    ctxLC->pCache = NULL;
+    LcCache_FreeBuffers(ctx);
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx);
+}
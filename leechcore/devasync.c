@@ -0,0 +1,244 @@
+// devasync.c : implementation : asynchronous (submit / complete) device interface.
+//
+// Devices backed by an asynchronous transport may implement pfnSubmit (and
+// optionally pfnPoll) instead of pfnReadScatter. Submitted batches are later
+// completed by the device - either by its own threads (completion callback)
+// or from within pfnPoll - by calling pBatch->pfnComplete.
+// The core bridges the interface to the synchronous pfnReadScatter: each read
+// submits one batch and blocks until it is completed. The device is treated as
+// thread safe - so concurrent readers, the fan-out threads and the async read
+// worker threads keep multiple batches in flight. Max batches in flight is
+// Caps.cInFlightMax - enforced by the core read dispatch (devcaps.c). Each
+// batch in flight thus occupies one blocked core thread.
+// A batch rejected by pfnSubmit (e.g. a full device queue) is re-submitted as
+// soon as another batch in flight completes. If no other batch is in flight
+// the rejection is final and the batch is failed - its MEMs are left unread.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_DEVASYNC_POLL_MS             10
+#define LC_DEVASYNC_INFLIGHT_DEFAULT    8
+
+typedef struct tdLC_DEVASYNC_CONTEXT {
+    CRITICAL_SECTION LockPoll;      // serializes pfnPoll calls.
+    CRITICAL_SECTION LockInFlight;
+    CONDITION_VARIABLE CondInFlight;    // woken when a batch leaves flight.
+    DWORD cInFlight;
+    DWORD cInFlightPeak;            // LC_OPT_CORE_DEVICE_BATCH_INFLIGHT_PEAK
+    QWORD cSubmit;                  // LC_OPT_CORE_DEVICE_BATCH_SUBMIT
+    QWORD cComplete;                // batches left flight (completed or failed).
+    QWORD cReject;                  // LC_OPT_CORE_DEVICE_BATCH_REJECT
+} LC_DEVASYNC_CONTEXT, *PLC_DEVASYNC_CONTEXT;
+
+typedef struct tdLC_DEVASYNC_BATCH {
+    LC_DEVICE_BATCH Batch;          // must be first - handed to the device.
+    volatile BOOL fComplete;        // poll mode only.
+    HANDLE hEventComplete;          // manual reset - event mode only (no pfnPoll).
+} LC_DEVASYNC_BATCH, *PLC_DEVASYNC_BATCH;
+
+
+
+//-----------------------------------------------------------------------------
+// SYNCHRONOUS BRIDGE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Completion function called by the device exactly once per submitted batch.
+* The device may not touch the batch after this call. The batch may be freed
+* by the waiting thread as soon as it is signalled - so signalling it (setting
+* the event or the poll mode completion flag) must be the last access.
+* -- pBatch
+*/
+VOID LcDeviceAsync_BatchComplete(_In_ PLC_DEVICE_BATCH pBatch)
+{
+    PLC_DEVASYNC_BATCH pb = (PLC_DEVASYNC_BATCH)pBatch;
+    if(pb->hEventComplete) {
+        SetEvent(pb->hEventComplete);
+    } else {
+        pb->fComplete = TRUE;
+    }
+}
+
+/*
+* Wait for a submitted batch to complete. If the device has a poll function
+* completions are driven by (serialized) calls to pfnPoll - otherwise the wait
+* is solely on the completion event.
+* -- ctxLC
+* -- pb
+*/
+VOID LcDeviceAsync_BatchWait(_In_ PLC_CONTEXT ctxLC, _In_ PLC_DEVASYNC_BATCH pb)
+{
+    PLC_DEVASYNC_CONTEXT ctx = ctxLC->pDeviceAsync;
+    if(pb->hEventComplete) {
+        WaitForSingleObject(pb->hEventComplete, INFINITE);
+        return;
+    }
+    while(!pb->fComplete) {
+        EnterCriticalSection(&ctx->LockPoll);
+        if(!pb->fComplete) {
+            ctxLC->pfnPoll(ctxLC, LC_DEVASYNC_POLL_MS);
+        }
+        LeaveCriticalSection(&ctx->LockPoll);
+    }
+}
+
+/*
+* Account for a batch entering (fSubmit) or leaving flight. The number of
+* batches in flight is limited by the core read dispatch - not here.
+* -- ctxLC
+* -- fSubmit
+*/
+VOID LcDeviceAsync_InFlight(_In_ PLC_CONTEXT ctxLC, _In_ BOOL fSubmit)
+{
+    PLC_DEVASYNC_CONTEXT ctx = ctxLC->pDeviceAsync;
+    EnterCriticalSection(&ctx->LockInFlight);
+    if(fSubmit) {
+        ctx->cInFlight++;
+        ctx->cInFlightPeak = max(ctx->cInFlightPeak, ctx->cInFlight);
+        ctx->cSubmit++;
+    } else {
+        ctx->cInFlight--;
+        ctx->cComplete++;
+        WakeAllConditionVariable(&ctx->CondInFlight);
+    }
+    LeaveCriticalSection(&ctx->LockInFlight);
+}
+
+/*
+* Submit a batch to the device. A batch rejected by the device while other
+* batches are in flight is re-submitted once another batch has left flight. A
+* batch rejected while no other batch is in flight is failed.
+* -- ctxLC
+* -- pb
+* -- return = TRUE if the batch was accepted by the device.
+*/
+_Success_(return)
+BOOL LcDeviceAsync_Submit(_In_ PLC_CONTEXT ctxLC, _In_ PLC_DEVASYNC_BATCH pb)
+{
+    PLC_DEVASYNC_CONTEXT ctx = ctxLC->pDeviceAsync;
+    QWORD cComplete;
+    while(TRUE) {
+        EnterCriticalSection(&ctx->LockInFlight);
+        cComplete = ctx->cComplete;
+        LeaveCriticalSection(&ctx->LockInFlight);
+        if(ctxLC->pfnSubmit(ctxLC, &pb->Batch)) { return TRUE; }
+        EnterCriticalSection(&ctx->LockInFlight);
+        if((ctx->cInFlight <= 1) && (ctx->cComplete == cComplete)) {
+            ctx->cReject++;
+            LeaveCriticalSection(&ctx->LockInFlight);
+            lcprintfvv_fn(ctxLC, "batch of %i MEMs rejected by device - batch failed.\n", pb->Batch.cMEMs);
+            return FALSE;
+        }
+        while((ctx->cInFlight > 1) && (ctx->cComplete == cComplete)) {
+            SleepConditionVariableCS(&ctx->CondInFlight, &ctx->LockInFlight, INFINITE);
+        }
+        LeaveCriticalSection(&ctx->LockInFlight);
+    }
+}
+
+/*
+* Synchronous read function (pfnReadScatter) of asynchronous devices - submit
+* the MEMs as one batch and wait for it to complete. MEMs of a batch finally
+* rejected by the device are failed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcDeviceAsync_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    LC_DEVASYNC_BATCH b = { 0 };
+    if(!cMEMs) { return; }
+    b.Batch.dwVersion = LC_DEVICE_BATCH_VERSION;
+    b.Batch.cMEMs = cMEMs;
+    b.Batch.ppMEMs = ppMEMs;
+    b.Batch.pfnComplete = LcDeviceAsync_BatchComplete;
+    if(!ctxLC->pfnPoll && !(b.hEventComplete = CreateEvent(NULL, TRUE, FALSE, NULL))) { return; }
+    LcDeviceAsync_InFlight(ctxLC, TRUE);
+    if(LcDeviceAsync_Submit(ctxLC, &b)) {
+        LcDeviceAsync_BatchWait(ctxLC, &b);
+    }
+    LcDeviceAsync_InFlight(ctxLC, FALSE);
+    if(b.hEventComplete) { CloseHandle(b.hEventComplete); }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE / GET OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Bridge the asynchronous device interface (if set by the device in pfnCreate)
+* to the synchronous pfnReadScatter. Must be called after pfnCreate and before
+* the device capabilities are resolved.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcDeviceAsync_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_DEVASYNC_CONTEXT ctx;
+    if(!ctxLC->pfnSubmit || ctxLC->pfnReadScatter || ctxLC->Config.fRemote) { return TRUE; }
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_DEVASYNC_CONTEXT)))) { return FALSE; }
+    if(ctxLC->Caps.dwVersion != LC_DEVICE_CAPS_VERSION) {
+        ZeroMemory(&ctxLC->Caps, sizeof(LC_DEVICE_CAPS));
+        ctxLC->Caps.dwVersion = LC_DEVICE_CAPS_VERSION;
+    }
+    if(!ctxLC->Caps.cInFlightMax) {
+        ctxLC->Caps.cInFlightMax = LC_DEVASYNC_INFLIGHT_DEFAULT;
+    }
+    InitializeCriticalSection(&ctx->LockPoll);
+    InitializeCriticalSection(&ctx->LockInFlight);
+    InitializeConditionVariable(&ctx->CondInFlight);
+    ctxLC->Caps.fFlags |= LC_DEVICE_CAPS_FLAG_THREADSAFE;
+    ctxLC->pfnReadScatter = LcDeviceAsync_ReadScatter;
+    ctxLC->pDeviceAsync = ctx;
+    return TRUE;
+}
+
+/*
+* Close the asynchronous device interface bridge. All batches are completed
+* since no reads may be in progress when the device is closed.
+* -- ctxLC
+*/
+VOID LcDeviceAsync_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_DEVASYNC_CONTEXT ctx = ctxLC->pDeviceAsync;
+    if(!ctx) { return; }
+    ctxLC->pDeviceAsync = NULL;
+    DeleteCriticalSection(&ctx->LockPoll);
+    DeleteCriticalSection(&ctx->LockInFlight);
+    LocalFree(ctx);
+}
+
+/*
+* Retrieve an asynchronous device interface option (LC_OPT_CORE_DEVICE_BATCH_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcDeviceAsync_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_DEVASYNC_CONTEXT ctx = ctxLC->pDeviceAsync;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_DEVICE_BATCH_SUBMIT:
+            *pqwValue = ctx ? ctx->cSubmit : 0;
+            return TRUE;
+        case LC_OPT_CORE_DEVICE_BATCH_INFLIGHT_PEAK:
+            *pqwValue = ctx ? ctx->cInFlightPeak : 0;
+            return TRUE;
+        case LC_OPT_CORE_DEVICE_BATCH_REJECT:
+            *pqwValue = ctx ? ctx->cReject : 0;
+            return TRUE;
+    }
+    return FALSE;
+}
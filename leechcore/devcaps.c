@@ -0,0 +1,391 @@
+// devcaps.c : implementation : device capability driven read dispatching.
+//
+// Devices (including external device plugins) may describe their read
+// capabilities in LC_CONTEXT.Caps at open. Devices not filling in the caps
+// have them derived from the legacy fields (fMultiThread). The max MEM size of
+// scatter devices is always taken from cbReadScatterMax.
+// Reads towards scatter devices are then dispatched according to the caps:
+// - LC_DEVICE_CAPS_FLAG_SORTED: MEMs are sorted on address before the read.
+// - LC_DEVICE_CAPS_FLAG_CONTIGUOUS: address contiguous page runs are read as
+//   one large MEM (max cbReadScatterMax) - through a bounce buffer if the MEM buffers
+//   are not contiguous. Failed runs are re-read page by page.
+// - LC_DEVICE_CAPS_FLAG_PARTIAL: the pages of a partially read run are kept
+//   and only the remainder of the run is re-read page by page.
+// - cbAlign: MEMs not aligned on cbAlign are read through an aligned bounce.
+// - cMEMsBatchMax: MEMs are split into batches of at most cMEMsBatchMax.
+// - cInFlightMax: limits the number of concurrent reads towards thread safe
+//   devices. The limit is enforced per device context in the read dispatch so
+//   it applies to concurrent callers, fan-out and async worker threads alike.
+// Bounce reads share one bounce buffer sized to the bounce reads in total but
+// at most LC_DEVCAPS_BOUNCE_MAX (or one run if larger) - they are read in
+// groups filling the buffer which is then re-used.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+#include "util.h"
+
+#define LC_DEVCAPS_BOUNCE_MAX           0x00100000      // max shared bounce buffer size (unless a single run is larger).
+
+typedef struct tdLC_DEVCAPS_CONTEXT {
+    CRITICAL_SECTION LockInFlight;
+    CONDITION_VARIABLE CondInFlight;    // woken when a read slot is released.
+    DWORD cInFlight;
+    DWORD cInFlightPeak;            // LC_OPT_CORE_DEVICE_CAPS_INFLIGHT_PEAK
+} LC_DEVCAPS_CONTEXT, *PLC_DEVCAPS_CONTEXT;
+
+typedef struct tdLC_DEVICE_CAPS_FIXUP {
+    MEM_SCATTER MEM;                // device MEM replacing the original MEM(s)
+    DWORD iMEM;                     // first original MEM (index into sorted MEMs)
+    DWORD cMEMs;                    // number of original MEMs (1 = aligned bounce read)
+    DWORD cbRequest;                // requested device MEM size (cb may be lowered by partial reads)
+    BOOL fBounce;
+} LC_DEVICE_CAPS_FIXUP, *PLC_DEVICE_CAPS_FIXUP;
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether a MEM is a not yet read page aligned full page.
+*/
+BOOL LcDeviceCaps_IsPage(_In_ PMEM_SCATTER pMEM)
+{
+    return !pMEM->f && (pMEM->cb == 0x1000) && !(pMEM->qwA & 0xfff) && MEM_SCATTER_ADDR_ISVALID(pMEM);
+}
+
+/*
+* Retrieve the number of original MEMs completed by a device MEM. Partially
+* read page runs (LC_DEVICE_CAPS_FLAG_PARTIAL) complete their leading pages.
+* -- ctxLC
+* -- pFix
+* -- return
+*/
+DWORD LcDeviceCaps_FixupReadCount(_In_ PLC_CONTEXT ctxLC, _In_ PLC_DEVICE_CAPS_FIXUP pFix)
+{
+    if(!pFix->MEM.f) { return 0; }
+    if(pFix->MEM.cb == pFix->cbRequest) { return pFix->cMEMs; }
+    if((ctxLC->Caps.fFlags & LC_DEVICE_CAPS_FLAG_PARTIAL) && (pFix->cMEMs > 1) && (pFix->MEM.cb < pFix->cbRequest)) {
+        return pFix->MEM.cb >> 12;
+    }
+    return 0;
+}
+
+/*
+* Read MEMs from the device in batches of at most cMEMsBatchMax MEMs.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcDeviceCaps_ReadBatch(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    DWORD i, cBatch = ctxLC->Caps.cMEMsBatchMax ? ctxLC->Caps.cMEMsBatchMax : cMEMs;
+    for(i = 0; i < cMEMs; i += cBatch) {
+        ctxLC->pfnReadScatter(ctxLC, min(cBatch, cMEMs - i), ppMEMs + i);
+    }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// IN-FLIGHT LIMIT FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Acquire a device read slot - wait if Caps.cInFlightMax reads are in flight.
+* Devices without an in-flight limit always have a slot available.
+* -- ctxLC
+*/
+VOID LcDeviceCaps_SlotAcquire(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_DEVCAPS_CONTEXT ctx = ctxLC->pDeviceCaps;
+    if(!ctx) { return; }
+    EnterCriticalSection(&ctx->LockInFlight);
+    while(ctx->cInFlight >= ctxLC->Caps.cInFlightMax) {
+        SleepConditionVariableCS(&ctx->CondInFlight, &ctx->LockInFlight, INFINITE);
+    }
+    ctx->cInFlight++;
+    ctx->cInFlightPeak = max(ctx->cInFlightPeak, ctx->cInFlight);
+    LeaveCriticalSection(&ctx->LockInFlight);
+}
+
+/*
+* Release a device read slot acquired by LcDeviceCaps_SlotAcquire.
+* -- ctxLC
+*/
+VOID LcDeviceCaps_SlotRelease(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_DEVCAPS_CONTEXT ctx = ctxLC->pDeviceCaps;
+    if(!ctx) { return; }
+    EnterCriticalSection(&ctx->LockInFlight);
+    ctx->cInFlight--;
+    WakeConditionVariable(&ctx->CondInFlight);
+    LeaveCriticalSection(&ctx->LockInFlight);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// READ DISPATCH FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether any not yet read MEM is misaligned on the device alignment.
+* -- cbAlignMask
+* -- cMEMs
+* -- ppMEMs
+* -- return
+*/
+BOOL LcDeviceCaps_IsMisaligned(_In_ DWORD cbAlignMask, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    DWORD i;
+    for(i = 0; i < cMEMs; i++) {
+        if(!ppMEMs[i]->f && MEM_SCATTER_ADDR_ISVALID(ppMEMs[i]) && ((ppMEMs[i]->qwA | ppMEMs[i]->cb) & cbAlignMask)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+* Complete the original MEMs of a device MEM after the device read. Failed
+* page runs, or the unread remainder of partially read page runs, are re-read
+* page by page.
+* -- ctxLC
+* -- pFix
+* -- ppSrc = sorted original MEMs.
+* -- return = number of device reads saved by coalescing.
+*/
+DWORD LcDeviceCaps_FixupComplete(_In_ PLC_CONTEXT ctxLC, _In_ PLC_DEVICE_CAPS_FIXUP pFix, _Inout_ PPMEM_SCATTER ppSrc)
+{
+    DWORD k, cRead = LcDeviceCaps_FixupReadCount(ctxLC, pFix);
+    PMEM_SCATTER pMEM;
+    if(pFix->cMEMs == 1) {
+        if(cRead) {
+            pMEM = ppSrc[pFix->iMEM];
+            memcpy(pMEM->pb, pFix->MEM.pb + (pMEM->qwA - pFix->MEM.qwA), pMEM->cb);
+            pMEM->f = TRUE;
+        }
+        return 0;
+    }
+    for(k = 0; k < cRead; k++) {
+        pMEM = ppSrc[pFix->iMEM + k];
+        if(pFix->fBounce) {
+            memcpy(pMEM->pb, pFix->MEM.pb + ((QWORD)k << 12), 0x1000);
+        }
+        pMEM->f = TRUE;
+    }
+    if(cRead < pFix->cMEMs) {
+        LcDeviceCaps_ReadBatch(ctxLC, pFix->cMEMs - cRead, ppSrc + pFix->iMEM + cRead);
+    }
+    return cRead ? cRead - 1 : 0;
+}
+
+/*
+* Read MEMs from a scatter device according to its capabilities.
+* MEMs are assumed to have their memory map translation completed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- return = TRUE if read, FALSE if no capability applies - caller should read.
+*/
+_Success_(return)
+BOOL LcDeviceCaps_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_DEVICE_CAPS pCaps = &ctxLC->Caps;
+    BOOL fSort = (pCaps->fFlags & LC_DEVICE_CAPS_FLAG_SORTED) ? TRUE : FALSE;
+    BOOL fCoalesce = (pCaps->fFlags & LC_DEVICE_CAPS_FLAG_CONTIGUOUS) && (ctxLC->cbReadScatterMax > 0x1000);
+    DWORD i, j, k, cDev = 0, cFix = 0, cBounce = 0, oBounce = 0, cbBounce = 0, cbBounceRunMax = 0, cbAlignMask = pCaps->cbAlign ? pCaps->cbAlign - 1 : 0;
+    PPMEM_SCATTER ppSrc, ppDev, ppBounce;
+    PLC_DEVICE_CAPS_FIXUP pFix, pFixAll;
+    PMEM_SCATTER pMEM;
+    PBYTE pbBuffer, pbBounce = NULL;
+    QWORD cSaved = 0, cbBounceTotal = 0;
+    if(cbAlignMask && !LcDeviceCaps_IsMisaligned(cbAlignMask, cMEMs, ppMEMs)) {
+        cbAlignMask = 0;
+    }
+    if(!fSort && !fCoalesce && !cbAlignMask && (!pCaps->cMEMsBatchMax || (cMEMs <= pCaps->cMEMsBatchMax))) { return FALSE; }
+    if(!(pbBuffer = LcArena_Alloc(cMEMs * (2 * sizeof(PMEM_SCATTER) + sizeof(LC_DEVICE_CAPS_FIXUP))))) { return FALSE; }
+    pFixAll = (PLC_DEVICE_CAPS_FIXUP)pbBuffer;
+    ppSrc = (PPMEM_SCATTER)(pFixAll + cMEMs);
+    ppDev = ppSrc + cMEMs;
+    memcpy(ppSrc, ppMEMs, cMEMs * sizeof(PMEM_SCATTER));
+    if((fSort || fCoalesce) && !Util_SortMEMs(cMEMs, ppSrc)) {
+        fCoalesce = FALSE;
+    }
+    // 1: build device MEMs - coalesce page runs and align unaligned MEMs:
+    for(i = 0; i < cMEMs; i = j) {
+        pMEM = ppSrc[i];
+        j = i + 1;
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        if(fCoalesce && LcDeviceCaps_IsPage(pMEM)) {
+            while((j < cMEMs) && ((j - i + 1) * 0x1000ULL <= ctxLC->cbReadScatterMax) && LcDeviceCaps_IsPage(ppSrc[j]) && (ppSrc[j]->qwA == ppSrc[j - 1]->qwA + 0x1000)) {
+                j++;
+            }
+        }
+        if(j - i > 1) {
+            pFix = pFixAll + cFix++;
+            ZeroMemory(pFix, sizeof(LC_DEVICE_CAPS_FIXUP));
+            pFix->MEM.qwA = pMEM->qwA;
+            pFix->MEM.cb = (j - i) << 12;
+            pFix->MEM.pb = pMEM->pb;
+            for(k = i + 1; !pFix->fBounce && (k < j); k++) {
+                pFix->fBounce = (ppSrc[k]->pb != pMEM->pb + ((k - i) << 12));
+            }
+        } else if(cbAlignMask && ((pMEM->qwA | pMEM->cb) & cbAlignMask)) {
+            pFix = pFixAll + cFix++;
+            ZeroMemory(pFix, sizeof(LC_DEVICE_CAPS_FIXUP));
+            pFix->MEM.qwA = pMEM->qwA & ~(QWORD)cbAlignMask;
+            pFix->MEM.cb = (DWORD)(((pMEM->qwA + pMEM->cb + cbAlignMask) & ~(QWORD)cbAlignMask) - pFix->MEM.qwA);
+            pFix->fBounce = TRUE;
+        } else {
+            ppDev[cDev++] = pMEM;
+            continue;
+        }
+        pFix->MEM.version = MEM_SCATTER_VERSION;
+        pFix->iMEM = i;
+        pFix->cMEMs = j - i;
+        pFix->cbRequest = pFix->MEM.cb;
+        if(pFix->fBounce) {
+            cBounce++;
+            cbBounceTotal += pFix->MEM.cb;
+            cbBounceRunMax = max(cbBounceRunMax, pFix->MEM.cb);
+        } else {
+            ppDev[cDev++] = &pFix->MEM;
+        }
+    }
+    cbBounce = (DWORD)max(cbBounceRunMax, min(cbBounceTotal, LC_DEVCAPS_BOUNCE_MAX));
+    if(cBounce && !(pbBounce = LcArena_Alloc(cbBounce))) {
+        LcArena_Free(pbBuffer);
+        return FALSE;
+    }
+    // 2: read non-bounce MEMs from device and complete the original MEMs:
+    LcDeviceCaps_ReadBatch(ctxLC, cDev, ppDev);
+    for(i = 0; i < cFix; i++) {
+        if(!pFixAll[i].fBounce) {
+            cSaved += LcDeviceCaps_FixupComplete(ctxLC, pFixAll + i, ppSrc);
+        }
+    }
+    // 3: read bounce MEMs in groups filling the bounce buffer - the original
+    //    MEMs of a group are completed before the bounce buffer is re-used:
+    ppBounce = ppDev + cDev;
+    for(i = 0, j = 0, cDev = 0; i <= cFix; i++) {
+        pFix = pFixAll + i;
+        if((i < cFix) && (!pFix->fBounce || (oBounce + pFix->MEM.cb <= cbBounce))) {
+            if(pFix->fBounce) {
+                pFix->MEM.pb = pbBounce + oBounce;
+                oBounce += pFix->MEM.cb;
+                ppBounce[cDev++] = &pFix->MEM;
+            }
+            continue;
+        }
+        LcDeviceCaps_ReadBatch(ctxLC, cDev, ppBounce);
+        for(; j < i; j++) {
+            if(pFixAll[j].fBounce) {
+                cSaved += LcDeviceCaps_FixupComplete(ctxLC, pFixAll + j, ppSrc);
+            }
+        }
+        if(i < cFix) {
+            pFix->MEM.pb = pbBounce;
+            oBounce = pFix->MEM.cb;
+            ppBounce[0] = &pFix->MEM;
+            cDev = 1;
+        }
+    }
+    if(cSaved) {
+        InterlockedAdd64(&ctxLC->cCoalesceSaved, cSaved);
+    }
+    if(pbBounce) { LcArena_Free(pbBounce); }
+    LcArena_Free(pbBuffer);
+    return TRUE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE / GET OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Resolve the device capabilities after the device has been opened. Caps not
+* filled in by the device are derived from the legacy device fields and the
+* thread safe flag is reflected in fMultiThread.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcDeviceCaps_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_DEVCAPS_CONTEXT ctx;
+    PLC_DEVICE_CAPS pCaps = &ctxLC->Caps;
+    if(pCaps->dwVersion != LC_DEVICE_CAPS_VERSION) {
+        ZeroMemory(pCaps, sizeof(LC_DEVICE_CAPS));
+        pCaps->dwVersion = LC_DEVICE_CAPS_VERSION;
+        if(ctxLC->pfnReadContigious) {
+            pCaps->fFlags |= LC_DEVICE_CAPS_FLAG_SORTED | LC_DEVICE_CAPS_FLAG_CONTIGUOUS;
+        }
+    }
+    if(ctxLC->fMultiThread) {
+        pCaps->fFlags |= LC_DEVICE_CAPS_FLAG_THREADSAFE;
+    }
+    if(pCaps->fFlags & LC_DEVICE_CAPS_FLAG_THREADSAFE) {
+        ctxLC->fMultiThread = TRUE;
+    }
+    if((pCaps->cbAlign > 0x1000) || (pCaps->cbAlign & (pCaps->cbAlign - 1))) {
+        pCaps->cbAlign = 0;
+    }
+    if(pCaps->cbAlign == 1) {
+        pCaps->cbAlign = 0;
+    }
+    // in-flight limit (thread safe scatter devices only):
+    if(!ctxLC->fMultiThread || !pCaps->cInFlightMax || !ctxLC->pfnReadScatter || ctxLC->Config.fRemote) { return TRUE; }
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_DEVCAPS_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->LockInFlight);
+    InitializeConditionVariable(&ctx->CondInFlight);
+    ctxLC->pDeviceCaps = ctx;
+    return TRUE;
+}
+
+/*
+* Close the device capability functionality. No reads may be in progress.
+* -- ctxLC
+*/
+VOID LcDeviceCaps_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_DEVCAPS_CONTEXT ctx = ctxLC->pDeviceCaps;
+    if(!ctx) { return; }
+    ctxLC->pDeviceCaps = NULL;
+    DeleteCriticalSection(&ctx->LockInFlight);
+    LocalFree(ctx);
+}
+
+/*
+* Retrieve a device capability option (LC_OPT_CORE_DEVICE_CAPS_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcDeviceCaps_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_DEVICE_CAPS_FLAGS:
+            *pqwValue = ctxLC->Caps.fFlags;
+            return TRUE;
+        case LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED:
+            *pqwValue = ctxLC->cCoalesceSaved;
+            return TRUE;
+        case LC_OPT_CORE_DEVICE_CAPS_INFLIGHT_PEAK:
+            *pqwValue = ctxLC->pDeviceCaps ? ((PLC_DEVCAPS_CONTEXT)ctxLC->pDeviceCaps)->cInFlightPeak : 0;
+            return TRUE;
+    }
+    return FALSE;
+}
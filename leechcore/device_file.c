@@ -134,6 +134,10 @@ typedef struct tdElf64_Ehdr {
 // DEFINES: GENERAL
 //-----------------------------------------------------------------------------
 
+#define FILE_PARAMETER_FILE             "file"
+#define FILE_PARAMETER_THREADS          "threads"
+#define FILE_RC_THREADS_MAX             8
+
 typedef struct tdDEVICE_CONTEXT_FILE {
     FILE *pFile;
     QWORD cbFile;
@@ -158,7 +162,7 @@ typedef struct tdDEVICE_CONTEXT_FILE {
 VOID DeviceFile_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cpMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
 {
     PDEVICE_CONTEXT_FILE ctx = (PDEVICE_CONTEXT_FILE)ctxLC->hDevice;
-    DWORD i;
+    DWORD i, cbRead;
     PMEM_SCATTER pMEM;
     for(i = 0; i < cpMEMs; i++) {
         pMEM = ppMEMs[i];
@@ -166,7 +170,13 @@ VOID DeviceFile_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cpMEMs, _Inout_ P
         if(pMEM->qwA != (QWORD)_ftelli64(ctx->pFile)) {
             if(_fseeki64(ctx->pFile, pMEM->qwA, SEEK_SET)) { continue; }
         }
-        pMEM->f = pMEM->cb == (DWORD)fread(pMEM->pb, 1, pMEM->cb, ctx->pFile);
+        cbRead = (DWORD)fread(pMEM->pb, 1, pMEM->cb, ctx->pFile);
+        if((cbRead < pMEM->cb) && (pMEM->cb > 0x1000) && (cbRead >= 0x1000)) {
+            // short read of a large MEM (e.g. crossing end-of-file) - complete
+            // the whole pages read; the core re-reads the remainder page by page.
+            pMEM->cb = cbRead & ~0xfff;
+        }
+        pMEM->f = pMEM->cb <= cbRead;
         if(pMEM->f) {
             if(ctxLC->fPrintf[LC_PRINTF_VVV]) {
                 lcprintf_fn(
@@ -183,11 +193,40 @@ VOID DeviceFile_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cpMEMs, _Inout_ P
     }
 }
 
-VOID DeviceFile_ReadContigious(_Inout_ PLC_READ_CONTIGIOUS_CONTEXT ctxRC)
+/*
+* Read from the backing file at an offset without using the shared file
+* position - contigious reads may thus be made from multiple threads.
+* -- ctx
+* -- qwOffset
+* -- cb
+* -- pb
+* -- return = the number of bytes read.
+*/
+DWORD DeviceFile_ReadAt(_In_ PDEVICE_CONTEXT_FILE ctx, _In_ QWORD qwOffset, _In_ DWORD cb, _Out_writes_(cb) PBYTE pb)
+{
+#ifdef _WIN32
+    DWORD cbRead = 0;
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD)qwOffset;
+    ov.OffsetHigh = (DWORD)(qwOffset >> 32);
+    if(!ReadFile((HANDLE)_get_osfhandle(_fileno(ctx->pFile)), pb, cb, &cbRead, &ov)) { return 0; }
+    return cbRead;
+#endif /* _WIN32 */
+#ifdef LINUX
+    ssize_t cbRead = pread(fileno(ctx->pFile), pb, cb, (off_t)qwOffset);
+    return (cbRead > 0) ? (DWORD)cbRead : 0;
+#endif /* LINUX */
+}
+
+VOID DeviceFile_ReadContigiousZeroCopy(_Inout_ PLC_READ_CONTIGIOUS_CONTEXT ctxRC, _Out_writes_(ctxRC->cb) PBYTE pb)
 {
     PDEVICE_CONTEXT_FILE ctx = (PDEVICE_CONTEXT_FILE)ctxRC->ctxLC->hDevice;
-    if(_fseeki64(ctx->pFile, ctxRC->paBase, SEEK_SET)) { return; }
-    ctxRC->cbRead = (DWORD)fread(ctxRC->pb, 1, ctxRC->cb, ctx->pFile);
+    ctxRC->cbRead = DeviceFile_ReadAt(ctx, ctxRC->paBase, ctxRC->cb, pb);
+}
+
+VOID DeviceFile_ReadContigious(_Inout_ PLC_READ_CONTIGIOUS_CONTEXT ctxRC)
+{
+    DeviceFile_ReadContigiousZeroCopy(ctxRC, ctxRC->pb);
 }
 
 //-----------------------------------------------------------------------------
@@ -592,10 +631,15 @@ _Success_(return)
 BOOL DeviceFile_Open(_Inout_ PLC_CONTEXT ctxLC, _Out_opt_ PPLC_CONFIG_ERRORINFO ppLcCreateErrorInfo)
 {
     PDEVICE_CONTEXT_FILE ctx;
+    PLC_DEVICE_PARAMETER_ENTRY pParam;
+    struct _stat64 st;
+    QWORD qwModifyTime, cThread;
     if(ppLcCreateErrorInfo) { *ppLcCreateErrorInfo = NULL; }
     if(!(ctx = (PDEVICE_CONTEXT_FILE)LocalAlloc(LMEM_ZEROINIT, sizeof(DEVICE_CONTEXT_FILE)))) { return FALSE; }
     lcprintfv(ctxLC, "DEVICE OPEN: %s\n", ctxLC->Config.szDeviceName);
-    if(0 == _strnicmp("file://", ctxLC->Config.szDevice, 7)) {
+    if((pParam = LcDeviceParameterGet(ctxLC, FILE_PARAMETER_FILE)) && pParam->szValue[0]) {
+        strncpy_s(ctx->szFileName, _countof(ctx->szFileName), pParam->szValue, _TRUNCATE);
+    } else if(0 == _strnicmp("file://", ctxLC->Config.szDevice, 7)) {
         strncpy_s(ctx->szFileName, _countof(ctx->szFileName), ctxLC->Config.szDevice + 7, _countof(ctxLC->Config.szDevice) - 7);
     } else if(0 == _stricmp(ctxLC->Config.szDevice, "livekd")) {
         strcpy_s(ctx->szFileName, _countof(ctx->szFileName), "C:\\WINDOWS\\livekd.dmp");
@@ -610,10 +654,20 @@ BOOL DeviceFile_Open(_Inout_ PLC_CONTEXT ctxLC, _Out_opt_ PPLC_CONFIG_ERRORINFO
     ctx->cbFile = _ftelli64(ctx->pFile);                    // get current file pointer
     if(ctx->cbFile < 0x01000000) { goto fail; }             // minimum allowed dump file size = 16MB
     if(ctx->cbFile > 0xffff000000000000) { goto fail; }     // file too large
+    // identity of file contents (path, size and modification time) - used as disk cache key:
+    ZeroMemory(&st, sizeof(st));
+    _stat64(ctx->szFileName, &st);
+    qwModifyTime = (QWORD)st.st_mtime;
+    ctxLC->qwDeviceIdentity = Util_HashFNV1a64(0, (PBYTE)ctx->szFileName, (DWORD)strlen(ctx->szFileName));
+    ctxLC->qwDeviceIdentity = Util_HashFNV1a64(ctxLC->qwDeviceIdentity, (PBYTE)&ctx->cbFile, sizeof(QWORD));
+    ctxLC->qwDeviceIdentity = Util_HashFNV1a64(ctxLC->qwDeviceIdentity, (PBYTE)&qwModifyTime, sizeof(QWORD));
     ctxLC->hDevice = (HANDLE)ctx;
     // set callback functions and fix up config
     ctxLC->pfnClose = DeviceFile_Close;
     ctxLC->pfnReadScatter = DeviceFile_ReadScatter;
+    ctxLC->cbReadScatterMax = 0x01000000;             // Files may be read in large chunks (max 16MB).
+    ctxLC->Caps.dwVersion = LC_DEVICE_CAPS_VERSION;
+    ctxLC->Caps.fFlags = LC_DEVICE_CAPS_FLAG_SORTED | LC_DEVICE_CAPS_FLAG_CONTIGUOUS | LC_DEVICE_CAPS_FLAG_PARTIAL;
     ctxLC->pfnGetOption = DeviceFile_GetOption;
     ctxLC->pfnCommand = DeviceFile_Command;
     ctxLC->Config.fVolatile = FALSE;                  // Files are assumed to be static non-volatile.
@@ -626,7 +680,18 @@ BOOL DeviceFile_Open(_Inout_ PLC_CONTEXT ctxLC, _Out_opt_ PPLC_CONFIG_ERRORINFO
         // very marginally (10-15%); doing multi-threaded reads does not help :(
         ctxLC->Config.fVolatile = TRUE;
         ctxLC->pfnReadScatter = NULL;
+    }
+    if((cThread = LcDeviceParameterGetNumeric(ctxLC, FILE_PARAMETER_THREADS))) {
+        // contigious reads with the requested number of threads.
+        ctxLC->pfnReadScatter = NULL;
+        ctxLC->ReadContigious.cThread = (DWORD)min(cThread, FILE_RC_THREADS_MAX);
+    }
+    if(!ctxLC->pfnReadScatter) {
+        // contigious reads are positional - multiple threads may be used
+        // (LC_OPT_CORE_RC_THREADS) - the default is a single thread.
         ctxLC->pfnReadContigious = DeviceFile_ReadContigious;
+        ctxLC->pfnReadContigiousZeroCopy = DeviceFile_ReadContigiousZeroCopy;
+        ctxLC->Caps.cThreadContigiousMax = FILE_RC_THREADS_MAX;
     }
     if((strlen(ctx->szFileName) >= 6) && (0 == _stricmp(".vmem", ctx->szFileName + strlen(ctx->szFileName) - 5))) {
         DeviceFile_VMwareDumpInitialize(ctxLC);
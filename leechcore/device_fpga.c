@@ -137,11 +137,13 @@ typedef struct tdDEVICE_CONTEXT_FPGA {
         PBYTE pb;
         DWORD cb;
         DWORD cbMax;
+        LC_ALLOC_LARGE Alloc;
     } rxbuf;
     struct {
         PBYTE pb;
         DWORD cb;
         DWORD cbMax;
+        LC_ALLOC_LARGE Alloc;
     } txbuf;
     struct {
         HMODULE hModule;
@@ -1055,8 +1057,8 @@ VOID DeviceFPGA_Close(_Inout_ PLC_CONTEXT ctxLC)
 #ifdef WIN32
     } __except(EXCEPTION_EXECUTE_HANDLER) { ; }
 #endif /* WIN32 */
-    LocalFree(ctx->rxbuf.pb);
-    LocalFree(ctx->txbuf.pb);
+    LcAlloc_LargeFree(ctxLC, &ctx->rxbuf.Alloc);
+    LcAlloc_LargeFree(ctxLC, &ctx->txbuf.Alloc);
     LocalFree(ctx);
     ctxLC->hDevice = 0;
 }
@@ -2619,10 +2621,10 @@ BOOL DeviceFPGA_Open(_Inout_ PLC_CONTEXT ctxLC, _Out_opt_ PPLC_CONFIG_ERRORINFO
     }
     DeviceFPGA_SetPerformanceProfile(ctx);
     ctx->rxbuf.cbMax = ctx->dev.f2232h ? 0x01000000 : (DWORD)(1.30 * ctx->perf.MAX_SIZE_RX + 0x2000);  // buffer size tuned to lowest possible (+margin) for performance (FT601).
-    ctx->rxbuf.pb = LocalAlloc(0, 0x01000000);
+    ctx->rxbuf.pb = LcAlloc_Large(ctxLC, 0x01000000, LC_ALLOC_NODE_ANY, &ctx->rxbuf.Alloc);
     if(!ctx->rxbuf.pb) { goto fail; }
     ctx->txbuf.cbMax = ctx->perf.MAX_SIZE_TX + 0x10000;
-    ctx->txbuf.pb = LocalAlloc(0, ctx->txbuf.cbMax);
+    ctx->txbuf.pb = LcAlloc_Large(ctxLC, ctx->txbuf.cbMax, LC_ALLOC_NODE_ANY, &ctx->txbuf.Alloc);
     if(!ctx->txbuf.pb) { goto fail; }
     // set callback functions and fix up config
     ctxLC->Config.fVolatile = TRUE;
@@ -87,7 +87,7 @@ VOID DevicePMEM_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cpMEMs, _Inout_ P
         if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
         qwA_LI.QuadPart = pMEM->qwA;
         SetFilePointerEx(ctx->hFile, qwA_LI, NULL, FILE_BEGIN);
-        pMEM->f = ReadFile(ctx->hFile, pMEM->pb, pMEM->cb, &cbRead, NULL);
+        pMEM->f = ReadFile(ctx->hFile, pMEM->pb, pMEM->cb, &cbRead, NULL) && (cbRead == pMEM->cb);
         if(pMEM->f) {
             if(ctxLC->fPrintf[LC_PRINTF_VVV]) {
                 lcprintf_fn(
@@ -361,6 +361,9 @@ BOOL DevicePMEM_Open2(_Inout_ PLC_CONTEXT ctxLC, _Out_opt_ PPLC_CONFIG_ERRORINFO
     ctxLC->Config.fVolatile = TRUE;
     ctxLC->pfnClose = DevicePMEM_Close;
     ctxLC->pfnReadScatter = DevicePMEM_ReadScatter;
+    ctxLC->cbReadScatterMax = 0x00200000;             // large page sized reads (max 2MB).
+    ctxLC->Caps.dwVersion = LC_DEVICE_CAPS_VERSION;
+    ctxLC->Caps.fFlags = LC_DEVICE_CAPS_FLAG_SORTED | LC_DEVICE_CAPS_FLAG_CONTIGUOUS;
     ctxLC->pfnGetOption = DevicePMEM_GetOption;
     // 2: load winpmem kernel driver.
     g_cDevicePMEM++;
@@ -182,6 +182,8 @@ BOOL DeviceVMWare_Open(_Inout_ PLC_CONTEXT ctxLC, _Out_opt_ PPLC_CONFIG_ERRORINF
     ctxLC->hDevice = (HANDLE)ctx;
     // 4: set callback functions and fix up config
     ctxLC->fMultiThread = TRUE;
+    ctxLC->Caps.dwVersion = LC_DEVICE_CAPS_VERSION;
+    ctxLC->Caps.fFlags = LC_DEVICE_CAPS_FLAG_THREADSAFE | LC_DEVICE_CAPS_FLAG_SORTED;
     ctxLC->Config.fVolatile = TRUE;
     ctxLC->pfnClose = DeviceVMWare_Close;
     ctxLC->pfnReadScatter = DeviceVMWare_ReadScatter;
@@ -0,0 +1,402 @@
+// diskcache.c : implementation : persistent on-disk page cache.
+//
+// Pages read from non-volatile devices (such as memory dump files - locally or
+// over a remote connection) are stored in a local sparse file at their device
+// address. An index bitmap of stored pages is kept in memory and persisted
+// in a separate index file on close. Cache files are keyed on the identity of
+// the device (device string, device supplied content identity and max address)
+// so that re-opening the same device warm-starts from the cache. Devices which
+// do not supply a content identity (LC_CONTEXT.qwDeviceIdentity - fetched from
+// the remote device on remote connections) are not cached - the device string
+// alone does not tell a replaced memory dump from the previous one.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+#include "util.h"
+
+#define LC_DISKCACHE_INDEX_MAGIC        0x6b736964
+#define LC_DISKCACHE_INDEX_VERSION      1
+#define LC_DISKCACHE_PA_MAX             0x10000000000   // max cached address (1TB - 32MB index bitmap).
+
+typedef struct tdLC_DISKCACHE_INDEX_HEADER {
+    DWORD dwMagic;                  // LC_DISKCACHE_INDEX_MAGIC
+    DWORD dwVersion;                // LC_DISKCACHE_INDEX_VERSION
+    QWORD qwIdentity;
+    QWORD cPagesMax;
+    QWORD cPages;
+    // BYTE pbBitmap[(cPagesMax + 7) / 8];
+} LC_DISKCACHE_INDEX_HEADER, *PLC_DISKCACHE_INDEX_HEADER;
+
+typedef struct tdLC_DISKCACHE_CONTEXT {
+    CRITICAL_SECTION Lock;
+    BOOL fActive;
+    QWORD qwIdentity;
+    QWORD qwMemMapHash;             // remote memory map (remote addresses are untranslated)
+    QWORD cPagesMax;
+    QWORD cPages;
+    QWORD cHit;
+    PBYTE pbBitmap;                 // stored pages
+    FILE *pFile;                    // sparse page file
+    CHAR szDirectory[MAX_PATH - 0x40];
+    CHAR szFileIndex[MAX_PATH];
+} LC_DISKCACHE_CONTEXT;
+
+#define LC_DISKCACHE_BIT_GET(ctx, pa)   ((ctx)->pbBitmap[(pa) >> 15] & (1 << (((pa) >> 12) & 7)))
+#define LC_DISKCACHE_BIT_SET(ctx, pa)   ((ctx)->pbBitmap[(pa) >> 15] |= (1 << (((pa) >> 12) & 7)))
+#define LC_DISKCACHE_BIT_CLR(ctx, pa)   ((ctx)->pbBitmap[(pa) >> 15] &= ~(1 << (((pa) >> 12) & 7)))
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+// All functions assume the disk cache lock is held by the caller.
+//-----------------------------------------------------------------------------
+
+/*
+* Close the cache files - persisting the index.
+* -- ctx
+*/
+VOID LcDiskCache_CloseFiles(_In_ PLC_DISKCACHE_CONTEXT ctx)
+{
+    FILE *pFileIndex = NULL;
+    LC_DISKCACHE_INDEX_HEADER hdr;
+    if(!ctx->fActive) { return; }
+    ctx->fActive = FALSE;
+    if(!fflush(ctx->pFile) && !fopen_s(&pFileIndex, ctx->szFileIndex, "wb") && pFileIndex) {
+        hdr.dwMagic = LC_DISKCACHE_INDEX_MAGIC;
+        hdr.dwVersion = LC_DISKCACHE_INDEX_VERSION;
+        hdr.qwIdentity = ctx->qwIdentity;
+        hdr.cPagesMax = ctx->cPagesMax;
+        hdr.cPages = ctx->cPages;
+        fwrite(&hdr, 1, sizeof(hdr), pFileIndex);
+        fwrite(ctx->pbBitmap, 1, (SIZE_T)((ctx->cPagesMax + 7) / 8), pFileIndex);
+        fclose(pFileIndex);
+    }
+    fclose(ctx->pFile);
+    ctx->pFile = NULL;
+    LocalFree(ctx->pbBitmap);
+    ctx->pbBitmap = NULL;
+    ctx->cPages = 0;
+}
+
+/*
+* Open (or create) the cache files of the device in ctx->szDirectory. The index
+* file is removed while the cache is open - pages written in a session which
+* does not close cleanly are not trusted on the next open.
+* -- ctxLC
+* -- ctx
+* -- return
+*/
+_Success_(return)
+BOOL LcDiskCache_OpenFiles(_In_ PLC_CONTEXT ctxLC, _In_ PLC_DISKCACHE_CONTEXT ctx)
+{
+    FILE *pFileIndex = NULL;
+    CHAR szFilePages[MAX_PATH];
+    LC_DISKCACHE_INDEX_HEADER hdr = { 0 };
+    QWORD paMax, qwIdentity;
+    SIZE_T cbBitmap;
+#ifdef _WIN32
+    DWORD cbReturn;
+#endif /* _WIN32 */
+    if(ctxLC->Config.fVolatile || !ctxLC->qwDeviceIdentity || !ctx->szDirectory[0]) { return FALSE; }
+    paMax = (ctxLC->Config.paMax && (ctxLC->Config.paMax < LC_DISKCACHE_PA_MAX)) ? ctxLC->Config.paMax : LC_DISKCACHE_PA_MAX;
+    qwIdentity = Util_HashFNV1a64(0, (PBYTE)ctxLC->Config.szDevice, (DWORD)strnlen_s(ctxLC->Config.szDevice, _countof(ctxLC->Config.szDevice)));
+    qwIdentity = Util_HashFNV1a64(qwIdentity, (PBYTE)ctxLC->Config.szRemote, (DWORD)strnlen_s(ctxLC->Config.szRemote, _countof(ctxLC->Config.szRemote)));
+    qwIdentity = Util_HashFNV1a64(qwIdentity, (PBYTE)&ctxLC->qwDeviceIdentity, sizeof(QWORD));
+    qwIdentity = Util_HashFNV1a64(qwIdentity, (PBYTE)&ctx->qwMemMapHash, sizeof(QWORD));
+    qwIdentity = Util_HashFNV1a64(qwIdentity, (PBYTE)&paMax, sizeof(QWORD));
+    ctx->qwIdentity = qwIdentity;
+    ctx->cPagesMax = (paMax + 0xfff) >> 12;
+    cbBitmap = (SIZE_T)((ctx->cPagesMax + 7) / 8);
+    _snprintf_s(szFilePages, _countof(szFilePages), _TRUNCATE, "%s/leechcore_%016llx.pages", ctx->szDirectory, qwIdentity);
+    _snprintf_s(ctx->szFileIndex, _countof(ctx->szFileIndex), _TRUNCATE, "%s/leechcore_%016llx.index", ctx->szDirectory, qwIdentity);
+    if(!(ctx->pbBitmap = LocalAlloc(LMEM_ZEROINIT, cbBitmap))) { goto fail; }
+    if(fopen_s(&ctx->pFile, szFilePages, "r+b") || !ctx->pFile) {
+        ctx->pFile = NULL;
+        if(fopen_s(&ctx->pFile, szFilePages, "w+b") || !ctx->pFile) {
+            ctx->pFile = NULL;
+            goto fail;
+        }
+#ifdef _WIN32
+        DeviceIoControl((HANDLE)_get_osfhandle(_fileno(ctx->pFile)), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &cbReturn, NULL);
+#endif /* _WIN32 */
+    } else if(!fopen_s(&pFileIndex, ctx->szFileIndex, "rb") && pFileIndex) {
+        if((sizeof(hdr) == fread(&hdr, 1, sizeof(hdr), pFileIndex)) && (hdr.dwMagic == LC_DISKCACHE_INDEX_MAGIC) && (hdr.dwVersion == LC_DISKCACHE_INDEX_VERSION) && (hdr.qwIdentity == qwIdentity) && (hdr.cPagesMax == ctx->cPagesMax)) {
+            if(cbBitmap == fread(ctx->pbBitmap, 1, cbBitmap, pFileIndex)) {
+                ctx->cPages = hdr.cPages;
+            } else {
+                ZeroMemory(ctx->pbBitmap, cbBitmap);
+            }
+        }
+        fclose(pFileIndex);
+    }
+    remove(ctx->szFileIndex);
+    ctx->fActive = TRUE;
+    lcprintfv(ctxLC, "DISKCACHE: Opened '%s' (%lli cached pages).\n", szFilePages, ctx->cPages);
+    return TRUE;
+fail:
+    if(ctx->pFile) { fclose(ctx->pFile); }
+    ctx->pFile = NULL;
+    LocalFree(ctx->pbBitmap);
+    ctx->pbBitmap = NULL;
+    return FALSE;
+}
+
+/*
+* Check whether all pages touched by an address range are stored.
+* -- ctx
+* -- qwA
+* -- cb
+* -- return
+*/
+BOOL LcDiskCache_IsStored(_In_ PLC_DISKCACHE_CONTEXT ctx, _In_ QWORD qwA, _In_ DWORD cb)
+{
+    QWORD pa;
+    if(!cb || (qwA + cb > (ctx->cPagesMax << 12))) { return FALSE; }
+    for(pa = qwA & ~0xfff; pa < qwA + cb; pa += 0x1000) {
+        if(!LC_DISKCACHE_BIT_GET(ctx, pa)) { return FALSE; }
+    }
+    return TRUE;
+}
+
+/*
+* Store a run of full pages.
+* -- ctx
+* -- pa
+* -- cb
+* -- pb
+*/
+VOID LcDiskCache_StorePages(_In_ PLC_DISKCACHE_CONTEXT ctx, _In_ QWORD pa, _In_ QWORD cb, _In_reads_(cb) PBYTE pb)
+{
+    QWORD o;
+    if(!cb || _fseeki64(ctx->pFile, pa, SEEK_SET) || (cb != fwrite(pb, 1, (SIZE_T)cb, ctx->pFile))) { return; }
+    for(o = 0; o < cb; o += 0x1000) {
+        LC_DISKCACHE_BIT_SET(ctx, pa + o);
+        ctx->cPages++;
+    }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// READ / WRITE PATH FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether the disk cache is open.
+* -- ctxLC
+* -- return
+*/
+BOOL LcDiskCache_IsEnabled(_In_ PLC_CONTEXT ctxLC)
+{
+    return ctxLC->pDiskCache && ctxLC->pDiskCache->fActive;
+}
+
+/*
+* Read MEMs from the disk cache. MEMs which are not stored are put into the
+* ppMEMsMiss array (which must have room for cMEMs entries, and which may be
+* the same array as ppMEMs).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcDiskCache_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss)
+{
+    PLC_DISKCACHE_CONTEXT ctx = ctxLC->pDiskCache;
+    PMEM_SCATTER pMEM;
+    DWORD iMEM, cMiss = 0;
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        if(ctx->fActive && LcDiskCache_IsStored(ctx, pMEM->qwA, pMEM->cb) && !_fseeki64(ctx->pFile, pMEM->qwA, SEEK_SET)) {
+            if(pMEM->cb == (DWORD)fread(pMEM->pb, 1, pMEM->cb, ctx->pFile)) {
+                pMEM->f = TRUE;
+                ctx->cHit++;
+                continue;
+            }
+        }
+        ppMEMsMiss[cMiss++] = pMEM;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return cMiss;
+}
+
+/*
+* Store full pages successfully read from the device in the disk cache.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcDiskCache_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_DISKCACHE_CONTEXT ctx = ctxLC->pDiskCache;
+    PMEM_SCATTER pMEM;
+    DWORD iMEM;
+    QWORD pa, paRun, paEnd;
+    if(!LcDiskCache_IsEnabled(ctxLC)) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    if(qwWriteGeneration != ctxLC->qwWriteGeneration) { cMEMs = 0; }
+    for(iMEM = 0; ctx->fActive && (iMEM < cMEMs); iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(!pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        paRun = pa = (pMEM->qwA + 0xfff) & ~0xfff;
+        paEnd = min((pMEM->qwA + pMEM->cb) & ~0xfff, ctx->cPagesMax << 12);
+        for(; pa < paEnd; pa += 0x1000) {
+            if(LC_DISKCACHE_BIT_GET(ctx, pa)) {
+                LcDiskCache_StorePages(ctx, paRun, pa - paRun, pMEM->pb + (paRun - pMEM->qwA));
+                paRun = pa + 0x1000;
+            }
+        }
+        if(paRun < paEnd) {
+            LcDiskCache_StorePages(ctx, paRun, paEnd - paRun, pMEM->pb + (paRun - pMEM->qwA));
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Remove pages touched by the MEMs from the disk cache. This is called on writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcDiskCache_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_DISKCACHE_CONTEXT ctx = ctxLC->pDiskCache;
+    DWORD iMEM;
+    QWORD pa, paEnd;
+    if(!LcDiskCache_IsEnabled(ctxLC)) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; ctx->fActive && (iMEM < cMEMs); iMEM++) {
+        if(MEM_SCATTER_ADDR_ISINVALID(ppMEMs[iMEM])) { continue; }
+        paEnd = min(ppMEMs[iMEM]->qwA + ppMEMs[iMEM]->cb, ctx->cPagesMax << 12);
+        for(pa = ppMEMs[iMEM]->qwA & ~0xfff; pa < paEnd; pa += 0x1000) {
+            if(LC_DISKCACHE_BIT_GET(ctx, pa)) {
+                LC_DISKCACHE_BIT_CLR(ctx, pa);
+                ctx->cPages--;
+            }
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Re-key the disk cache on a remote memory map change. Remote pages are keyed
+* on untranslated addresses - the memory map is part of the cache identity.
+* -- ctxLC
+* -- cbMemMap
+* -- pbMemMap = the memory map as set by LC_CMD_MEMMAP_SET / LC_CMD_MEMMAP_SET_STRUCT.
+*/
+VOID LcDiskCache_SetMemMap(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cbMemMap, _In_reads_(cbMemMap) PBYTE pbMemMap)
+{
+    PLC_DISKCACHE_CONTEXT ctx = ctxLC->pDiskCache;
+    if(!ctx) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    ctx->qwMemMapHash = Util_HashFNV1a64(0, pbMemMap, cbMemMap);
+    if(ctx->fActive) {
+        LcDiskCache_CloseFiles(ctx);
+        LcDiskCache_OpenFiles(ctxLC, ctx);
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// COMMAND / OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Open the disk cache in a directory - replacing any currently open disk cache.
+* The disk cache is only supported on non-volatile devices which supply a
+* content identity.
+* -- ctxLC
+* -- cbDirectory
+* -- szDirectory
+* -- return
+*/
+_Success_(return)
+BOOL LcDiskCache_Open(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cbDirectory, _In_reads_(cbDirectory) LPSTR szDirectory)
+{
+    PLC_DISKCACHE_CONTEXT ctx = ctxLC->pDiskCache;
+    BOOL fResult;
+    if(!cbDirectory || !szDirectory) { return FALSE; }
+    EnterCriticalSection(&ctx->Lock);
+    LcDiskCache_CloseFiles(ctx);
+    ZeroMemory(ctx->szDirectory, sizeof(ctx->szDirectory));
+    strncpy_s(ctx->szDirectory, _countof(ctx->szDirectory), szDirectory, cbDirectory);
+    fResult = LcDiskCache_OpenFiles(ctxLC, ctx);
+    if(!fResult && !ctxLC->Config.fVolatile && !ctxLC->qwDeviceIdentity) {
+        lcprintfv(ctxLC, "DISKCACHE: Device does not supply a content identity - not cached.\n");
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+/*
+* Retrieve a disk cache option (LC_OPT_CORE_DISKCACHE_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcDiskCache_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_DISKCACHE_CONTEXT ctx = ctxLC->pDiskCache;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_DISKCACHE_PAGES:
+            *pqwValue = ctx->cPages;
+            return TRUE;
+        case LC_OPT_CORE_DISKCACHE_HIT:
+            *pqwValue = ctx->cHit;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the (initially closed) disk cache of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcDiskCache_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_DISKCACHE_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_DISKCACHE_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    ctxLC->pDiskCache = ctx;
+    return TRUE;
+}
+
+/*
+* Close the disk cache of a LeechCore context - persisting its index - and free
+* its resources.
+* -- ctxLC
+*/
+VOID LcDiskCache_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_DISKCACHE_CONTEXT ctx = ctxLC->pDiskCache;
+    if(!ctx) { return; }
+    ctxLC->pDiskCache = NULL;
+    LcDiskCache_CloseFiles(ctx);
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx);
+}
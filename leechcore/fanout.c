@@ -0,0 +1,319 @@
+// fanout.c : implementation : parallel fan-out of large scatter reads.
+//
+// Large scatter reads towards thread-safe devices (fMultiThread) are sorted on
+// address and split into slices which are read in parallel by a pool of worker
+// threads. The calling thread reads slices as well. Worker threads are started
+// on first use.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+#include "util.h"
+
+#define LC_FANOUT_THREADS_DEFAULT       4               // parallel slices (including calling thread).
+#define LC_FANOUT_THREADS_MAX           32
+#define LC_FANOUT_SLICE_DEFAULT         0x400           // MEMs per slice.
+#define LC_FANOUT_SLICE_MIN             0x10
+
+typedef struct tdLC_FANOUT_JOB {
+    struct tdLC_FANOUT_JOB *FLink;
+    PPMEM_SCATTER ppMEMs;           // address sorted MEMs
+    DWORD cMEMs;
+    DWORD cMEMsSlice;
+    DWORD cSlice;
+    DWORD iSliceNext;               // next slice to take (protected by ctx lock)
+    DWORD cSliceRemaining;          // slices not yet completed
+    HANDLE hEventDone;              // manual reset - set when all slices are completed
+} LC_FANOUT_JOB, *PLC_FANOUT_JOB;
+
+typedef struct tdLC_FANOUT_CONTEXT {
+    CRITICAL_SECTION Lock;
+    BOOL fActive;
+    DWORD cThread;                  // LC_OPT_CORE_FANOUT_THREADS (1 = disabled)
+    DWORD cMEMsSlice;               // LC_OPT_CORE_FANOUT_SLICE
+    DWORD cThreadStarted;
+    DWORD cThreadActive;
+    DWORD cThreadIndex;
+    HANDLE hEventWork[LC_FANOUT_THREADS_MAX - 1];  // auto reset - per worker - set on job submit
+    HANDLE hThread[LC_FANOUT_THREADS_MAX - 1];
+    PLC_FANOUT_JOB pJobHead;
+    PLC_FANOUT_JOB pJobTail;
+} LC_FANOUT_CONTEXT;
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Take the next slice of a job. The job is removed from the job queue once its
+* last slice is taken.
+* -- ctx
+* -- pJob = job to take slice from, NULL for the first queued job.
+* -- piSlice
+* -- return = the job the slice belongs to, NULL if no slice remains.
+*/
+PLC_FANOUT_JOB LcFanout_SliceTake(_In_ PLC_FANOUT_CONTEXT ctx, _In_opt_ PLC_FANOUT_JOB pJob, _Out_ PDWORD piSlice)
+{
+    PLC_FANOUT_JOB *ppJob, pJobPrev = NULL;
+    EnterCriticalSection(&ctx->Lock);
+    if(!pJob) { pJob = ctx->pJobHead; }
+    if(!pJob || (pJob->iSliceNext >= pJob->cSlice)) {
+        LeaveCriticalSection(&ctx->Lock);
+        return NULL;
+    }
+    *piSlice = pJob->iSliceNext++;
+    if(pJob->iSliceNext == pJob->cSlice) {
+        for(ppJob = &ctx->pJobHead; *ppJob; ppJob = &(*ppJob)->FLink) {
+            if(*ppJob == pJob) {
+                *ppJob = pJob->FLink;
+                if(ctx->pJobTail == pJob) { ctx->pJobTail = pJobPrev; }
+                break;
+            }
+            pJobPrev = *ppJob;
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return pJob;
+}
+
+/*
+* Read a slice of a job from the device and signal the job if completed.
+* -- ctxLC
+* -- pJob
+* -- iSlice
+*/
+VOID LcFanout_SliceRead(_In_ PLC_CONTEXT ctxLC, _In_ PLC_FANOUT_JOB pJob, _In_ DWORD iSlice)
+{
+    DWORD iMEM = iSlice * pJob->cMEMsSlice;
+    LcReadScatter_DeviceDispatch(ctxLC, min(pJob->cMEMsSlice, pJob->cMEMs - iMEM), pJob->ppMEMs + iMEM);
+    if(0 == InterlockedDecrement(&pJob->cSliceRemaining)) {
+        SetEvent(pJob->hEventDone);
+    }
+}
+
+/*
+* Worker thread loop reading slices of queued jobs. Each worker has its own
+* wake-up event - workers in excess of the configured thread count are not
+* woken up and stay idle.
+* -- ctxLC
+* -- return
+*/
+DWORD LcFanout_ThreadProc(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_FANOUT_CONTEXT ctx = ctxLC->pFanout;
+    PLC_FANOUT_JOB pJob;
+    DWORD iSlice, iThread = InterlockedIncrement(&ctx->cThreadIndex) - 1;
+    while(ctx->fActive) {
+        WaitForSingleObject(ctx->hEventWork[iThread], INFINITE);
+        while(ctx->fActive && (pJob = LcFanout_SliceTake(ctx, NULL, &iSlice))) {
+            LcFanout_SliceRead(ctxLC, pJob, iSlice);
+        }
+    }
+    InterlockedDecrement(&ctx->cThreadActive);
+    return 0;
+}
+
+/*
+* Start worker threads up to the configured thread count (if not started).
+* NB! Must be called with the fan-out lock held.
+* -- ctxLC
+* -- ctx
+* -- return
+*/
+_Success_(return)
+BOOL LcFanout_StartThreads(_In_ PLC_CONTEXT ctxLC, _In_ PLC_FANOUT_CONTEXT ctx)
+{
+    while(ctx->cThreadStarted + 1 < ctx->cThread) {
+        if(!ctx->hEventWork[ctx->cThreadStarted] && !(ctx->hEventWork[ctx->cThreadStarted] = CreateEvent(NULL, FALSE, FALSE, NULL))) { break; }
+        InterlockedIncrement(&ctx->cThreadActive);
+        if(!(ctx->hThread[ctx->cThreadStarted] = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)LcFanout_ThreadProc, ctxLC, 0, NULL))) {
+            InterlockedDecrement(&ctx->cThreadActive);
+            break;
+        }
+        ctx->cThreadStarted++;
+    }
+    return ctx->cThreadStarted > 0;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// FAN-OUT READ FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Read MEMs from a thread-safe (fMultiThread) device in parallel if the read is
+* large enough to be split into multiple slices. MEMs are sorted on address
+* and each slice is dispatched to the device as an address-contiguous range.
+* Contigious read devices are not fanned out - they are read in parallel by
+* the contigious read thread pool instead.
+* MEMs are assumed to have their memory map translation completed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- return = TRUE if read, FALSE if not applicable - caller should read.
+*/
+_Success_(return)
+BOOL LcFanout_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_FANOUT_CONTEXT ctx = ctxLC->pFanout;
+    LC_FANOUT_JOB Job = { 0 };
+    DWORD i, iSlice, cWorker, cMEMsSlice;
+    BOOL fResult = FALSE;
+    if(!ctx || !ctx->fActive || (ctx->cThread < 2) || !ctxLC->pfnReadScatter || (ctxLC->Caps.cInFlightMax == 1)) { return FALSE; }
+    cMEMsSlice = ctx->cMEMsSlice;
+    if(ctxLC->Caps.cMEMsBatchMax) {
+        cMEMsSlice = min(cMEMsSlice, ctxLC->Caps.cMEMsBatchMax);
+    }
+    if(cMEMs <= cMEMsSlice) { return FALSE; }
+    // 1: set up job with address sorted MEMs:
+    if(!(Job.ppMEMs = LcArena_Alloc(cMEMs * sizeof(PMEM_SCATTER)))) { return FALSE; }
+    if(!(Job.hEventDone = CreateEvent(NULL, TRUE, FALSE, NULL))) { goto fail; }
+    memcpy(Job.ppMEMs, ppMEMs, cMEMs * sizeof(PMEM_SCATTER));
+    if(!Util_SortMEMs(cMEMs, Job.ppMEMs)) { goto fail; }
+    Job.cMEMs = cMEMs;
+    Job.cMEMsSlice = cMEMsSlice;
+    Job.cSlice = Job.cSliceRemaining = (cMEMs + cMEMsSlice - 1) / cMEMsSlice;
+    // 2: queue job and wake up workers:
+    EnterCriticalSection(&ctx->Lock);
+    if(!ctx->fActive || !LcFanout_StartThreads(ctxLC, ctx)) {
+        LeaveCriticalSection(&ctx->Lock);
+        goto fail;
+    }
+    if(ctx->pJobTail) {
+        ctx->pJobTail->FLink = &Job;
+    } else {
+        ctx->pJobHead = &Job;
+    }
+    ctx->pJobTail = &Job;
+    cWorker = min(min(ctx->cThread - 1, ctx->cThreadStarted), Job.cSlice - 1);
+    if(ctxLC->Caps.cInFlightMax) {
+        cWorker = min(cWorker, ctxLC->Caps.cInFlightMax - 1);
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    for(i = 0; i < cWorker; i++) {
+        SetEvent(ctx->hEventWork[i]);
+    }
+    // 3: read slices on the calling thread as well and wait for completion:
+    while(LcFanout_SliceTake(ctx, &Job, &iSlice)) {
+        LcFanout_SliceRead(ctxLC, &Job, iSlice);
+    }
+    WaitForSingleObject(Job.hEventDone, INFINITE);
+    fResult = TRUE;
+fail:
+    if(Job.hEventDone) { CloseHandle(Job.hEventDone); }
+    LcArena_Free(Job.ppMEMs);
+    return fResult;
+}
+
+/*
+* Retrieve a fan-out option (LC_OPT_CORE_FANOUT_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcFanout_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_FANOUT_CONTEXT ctx = ctxLC->pFanout;
+    *pqwValue = 0;
+    if(!ctx) { return FALSE; }
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_FANOUT_THREADS:
+            *pqwValue = ctx->cThread;
+            return TRUE;
+        case LC_OPT_CORE_FANOUT_SLICE:
+            *pqwValue = ctx->cMEMsSlice;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Set a fan-out option (LC_OPT_CORE_FANOUT_*). Lowering the thread count takes
+* effect on the next read - already started excess workers stay idle.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcFanout_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    PLC_FANOUT_CONTEXT ctx = ctxLC->pFanout;
+    if(!ctx) { return FALSE; }
+    switch(fOption) {
+        case LC_OPT_CORE_FANOUT_THREADS:
+            if(!qwValue || (qwValue > LC_FANOUT_THREADS_MAX)) { return FALSE; }
+            EnterCriticalSection(&ctx->Lock);
+            ctx->cThread = (DWORD)qwValue;
+            LeaveCriticalSection(&ctx->Lock);
+            return TRUE;
+        case LC_OPT_CORE_FANOUT_SLICE:
+            if((qwValue < LC_FANOUT_SLICE_MIN) || (qwValue > 0x01000000)) { return FALSE; }
+            ctx->cMEMsSlice = (DWORD)qwValue;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the fan-out read functionality of a LeechCore context. Worker
+* threads are not started until the first fan-out read.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcFanout_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_FANOUT_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_FANOUT_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    ctx->fActive = TRUE;
+    ctx->cThread = LC_FANOUT_THREADS_DEFAULT;
+    ctx->cMEMsSlice = LC_FANOUT_SLICE_DEFAULT;
+    ctxLC->pFanout = ctx;
+    return TRUE;
+}
+
+/*
+* Close the fan-out read functionality of a LeechCore context.
+* NB! Must be called before the device is closed.
+* -- ctxLC
+*/
+VOID LcFanout_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    DWORD i;
+    PLC_FANOUT_CONTEXT ctx = ctxLC->pFanout;
+    if(!ctx) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    ctx->fActive = FALSE;
+    LeaveCriticalSection(&ctx->Lock);
+    while(ctx->cThreadActive) {
+        for(i = 0; i < ctx->cThreadStarted; i++) {
+            SetEvent(ctx->hEventWork[i]);
+        }
+        SwitchToThread();
+    }
+    for(i = 0; i < LC_FANOUT_THREADS_MAX - 1; i++) {
+        if(ctx->hThread[i]) { CloseHandle(ctx->hThread[i]); }
+        if(ctx->hEventWork[i]) { CloseHandle(ctx->hEventWork[i]); }
+    }
+    DeleteCriticalSection(&ctx->Lock);
+    ctxLC->pFanout = NULL;
+    LocalFree(ctx);
+}
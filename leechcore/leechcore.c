@@ -40,9 +40,19 @@ BOOL WINAPI DllMain(_In_ HINSTANCE hinstDLL, _In_ DWORD fdwReason, _In_ PVOID lp
     if(fdwReason == DLL_PROCESS_ATTACH) {
         ZeroMemory(&g_ctx, sizeof(LC_MAIN_CONTEXT));
         InitializeCriticalSection(&g_ctx.Lock);
+        LcArena_ProcessAttach();
+        LcAsync_ProcessAttach();
+        LcQos_ProcessAttach();
+    }
+    if(fdwReason == DLL_THREAD_DETACH) {
+        LcQos_ThreadDetach();
+        LcArena_ThreadDetach();
     }
     if(fdwReason == DLL_PROCESS_DETACH) {
         LcCloseAll();
+        LcQos_ProcessDetach();
+        LcAsync_ProcessDetach();
+        LcArena_ProcessDetach();
         DeleteCriticalSection(&g_ctx.Lock);
         ZeroMemory(&g_ctx, sizeof(LC_MAIN_CONTEXT));
     }
@@ -54,11 +64,17 @@ __attribute__((constructor)) VOID LcAttach()
 {
     ZeroMemory(&g_ctx, sizeof(LC_MAIN_CONTEXT));
     InitializeCriticalSection(&g_ctx.Lock);
+    LcArena_ProcessAttach();
+    LcAsync_ProcessAttach();
+    LcQos_ProcessAttach();
 }
 
 __attribute__((destructor)) VOID LcDetach()
 {
     LcCloseAll();
+    LcQos_ProcessDetach();
+    LcAsync_ProcessDetach();
+    LcArena_ProcessDetach();
     DeleteCriticalSection(&g_ctx.Lock);
     ZeroMemory(&g_ctx, sizeof(LC_MAIN_CONTEXT));
 }
@@ -118,14 +134,26 @@ EXPORTED_FUNCTION VOID LcClose(_In_opt_ _Post_ptr_invalid_ HANDLE hLC)
                 ctxParent = (PLC_CONTEXT)ctxParent->FLink;
             }
         }
+        LcAsync_Close(ctxLC);
+        LcReadAhead_Close(ctxLC);
+        LcFanout_Close(ctxLC);
+        LcQos_Close(ctxLC);
         LcLockAcquire(ctxLC);
         LcReadContigious_Close(ctxLC);
         if(ctxLC->pfnClose) { ctxLC->pfnClose(ctxLC); }
         LcLockRelease(ctxLC);
+        LcCache_Close(ctxLC);
+        LcNegCache_Close(ctxLC);
+        LcSnapshot_Close(ctxLC);
+        LcDiskCache_Close(ctxLC);
+        LcZCache_Close(ctxLC);
+        LcAlloc_Close(ctxLC);
+        LcDeviceAsync_Close(ctxLC);
+        LcDeviceCaps_Close(ctxLC);
         ctxLC->version = 0;
         DeleteCriticalSection(&ctxLC->Lock);
         if(ctxLC->hDeviceModule) { FreeLibrary(ctxLC->hDeviceModule); }
-        LocalFree(ctxLC->pMemMap);
+        LcMemMap_Close(ctxLC);
         LocalFree(ctxLC);
     }
     LeaveCriticalSection(&g_ctx.Lock);
@@ -371,6 +399,7 @@ _Success_(return != NULL)
 EXPORTED_FUNCTION HANDLE LcCreateEx(_Inout_ PLC_CONFIG pLcCreateConfig, _Out_opt_ PPLC_CONFIG_ERRORINFO ppLcCreateErrorInfo)
 {
     PLC_CONTEXT ctxLC = NULL;
+    PLC_DEVICE_PARAMETER_ENTRY pDiskCacheParameter;
     QWORD qwExistingHandle = 0, tmStart = LcCallStart();
     if(ppLcCreateErrorInfo) { *ppLcCreateErrorInfo = NULL; }
     if(!pLcCreateConfig || (pLcCreateConfig->dwVersion != LC_CONFIG_VERSION)) { return NULL; }
@@ -401,15 +430,17 @@ EXPORTED_FUNCTION HANDLE LcCreateEx(_Inout_ PLC_CONFIG pLcCreateConfig, _Out_opt
     InitializeCriticalSection(&ctxLC->Lock);
     ctxLC->version = LC_CONTEXT_VERSION;
     ctxLC->dwHandleCount = 1;
-    ctxLC->cMemMapMax = 0x20;
-    ctxLC->pMemMap = LocalAlloc(LMEM_ZEROINIT, ctxLC->cMemMapMax * sizeof(LC_MEMMAP_ENTRY));
     ctxLC->fPrintf[0] = (ctxLC->Config.dwPrintfVerbosity & LC_CONFIG_PRINTF_ENABLED) ? TRUE : FALSE;
     ctxLC->fPrintf[1] = (ctxLC->Config.dwPrintfVerbosity & LC_CONFIG_PRINTF_V) ? TRUE : FALSE;
     ctxLC->fPrintf[2] = (ctxLC->Config.dwPrintfVerbosity & LC_CONFIG_PRINTF_VV) ? TRUE : FALSE;
     ctxLC->fPrintf[3] = (ctxLC->Config.dwPrintfVerbosity & LC_CONFIG_PRINTF_VVV) ? TRUE : FALSE;
     LcCreate_FetchDeviceParameter(ctxLC);
     LcCreate_FetchDevice(ctxLC);
-    if(!ctxLC->pfnCreate || !ctxLC->pfnCreate(ctxLC, ppLcCreateErrorInfo) || !LcReadContigious_Initialize(ctxLC)) {
+    if(!LcMemMap_Initialize(ctxLC) || !LcCache_Initialize(ctxLC) || !LcAsync_Initialize(ctxLC) || !LcFanout_Initialize(ctxLC) || !LcQos_Initialize(ctxLC) || !LcNegCache_Initialize(ctxLC) || !LcSnapshot_Initialize(ctxLC) || !LcDiskCache_Initialize(ctxLC) || !LcZCache_Initialize(ctxLC) || !LcAlloc_Initialize(ctxLC) || !LcReadAhead_Initialize(ctxLC) || !ctxLC->pfnCreate || !ctxLC->pfnCreate(ctxLC, ppLcCreateErrorInfo) || !LcDeviceAsync_Initialize(ctxLC) || !LcReadContigious_Initialize(ctxLC)) {
+        LcClose(ctxLC);
+        return NULL;
+    }
+    if(!LcDeviceCaps_Initialize(ctxLC)) {
         LcClose(ctxLC);
         return NULL;
     }
@@ -418,6 +449,9 @@ EXPORTED_FUNCTION HANDLE LcCreateEx(_Inout_ PLC_CONFIG pLcCreateConfig, _Out_opt
         ctxLC->Config.paMax = LcMemMap_GetMaxAddress(ctxLC);
         ctxLC->Config.fWritable = (ctxLC->pfnWriteScatter != NULL) || (ctxLC->pfnWriteContigious != NULL);
     }
+    if((pDiskCacheParameter = LcDeviceParameterGet(ctxLC, LC_DEVICE_PARAMETER_DISKCACHE)) && pDiskCacheParameter->szValue[0]) {
+        LcDiskCache_Open(ctxLC, _countof(pDiskCacheParameter->szValue), pDiskCacheParameter->szValue);
+    }
     ctxLC->CallStat.dwVersion = LC_STATISTICS_VERSION;
     QueryPerformanceFrequency((PLARGE_INTEGER)&ctxLC->CallStat.qwFreq);
     memcpy(pLcCreateConfig, &ctxLC->Config, sizeof(LC_CONFIG));
@@ -470,6 +504,7 @@ EXPORTED_FUNCTION BOOL LcAllocScatter1(_In_ DWORD cMEMs, _Out_ PPMEM_SCATTER *pp
     ppMEMs = (PPMEM_SCATTER)pb;
     pMEMs = (PMEM_SCATTER)(pb + cMEMs * (sizeof(PMEM_SCATTER)));
     pbData = pb + cMEMs * (sizeof(PMEM_SCATTER) + sizeof(MEM_SCATTER));
+    LcAlloc_HintHugePage(pbData, (SIZE_T)cMEMs << 12);
     for(i = 0; i < cMEMs; i++) {
         ppMEMs[i] = pMEMs + i;
         pMEMs[i].version = MEM_SCATTER_VERSION;
@@ -513,26 +548,31 @@ EXPORTED_FUNCTION BOOL LcAllocScatter2(_In_ DWORD cbData, _Inout_updates_opt_(cb
 }
 
 /*
-* Allocate and pre-initialize empty MEMs excluding the 0x1000 buffer which
-* will be accounted towards the pbData buffer in a contiguous way.
-* -- pbDataFirstPage = optional buffer of first page
-* -- pbDataLastPage = optional buffer of last page
-* -- cbData = size of pbData
-* -- pbData = buffer used for MEM.pb except first/last if exists
+* Allocate and pre-initialize MEMs in the same way as LcAllocScatter3. If
+* fArena is set the MEMs are allocated from the per-thread scratch arena and
+* must be freed by LcArena_Free (in LIFO order) rather than by LcMemFree.
+* -- fArena
+* -- pbDataFirstPage
+* -- pbDataLastPage
+* -- cbData
+* -- pbData
 * -- cMEMs
-* -- pppMEMs = pointer to receive ppMEMs
+* -- pppMEMs
 * -- return
 */
 _Success_(return)
-EXPORTED_FUNCTION BOOL LcAllocScatter3(_Inout_updates_opt_(0x1000) PBYTE pbDataFirstPage, _Inout_updates_opt_(0x1000) PBYTE pbDataLastPage, _In_ DWORD cbData, _Inout_updates_opt_(cbData) PBYTE pbData, _In_ DWORD cMEMs, _Out_ PPMEM_SCATTER *pppMEMs)
+BOOL LcAllocScatter3_DoWork(_In_ BOOL fArena, _Inout_updates_opt_(0x1000) PBYTE pbDataFirstPage, _Inout_updates_opt_(0x1000) PBYTE pbDataLastPage, _In_ DWORD cbData, _Inout_updates_opt_(cbData) PBYTE pbData, _In_ DWORD cMEMs, _Out_ PPMEM_SCATTER *pppMEMs)
 {
     DWORD i, o = 0;
     PBYTE pb;
+    SIZE_T cb;
     PMEM_SCATTER pMEMs, *ppMEMs;
     if(pbDataFirstPage) { cbData += 0x1000; }
     if(pbDataLastPage) { cbData += 0x1000; }
     if(cbData > (cMEMs << 12)) { return FALSE; }
-    if(!(pb = LocalAlloc(LMEM_ZEROINIT, cMEMs * (sizeof(PMEM_SCATTER) + sizeof(MEM_SCATTER))))) { return FALSE; }
+    cb = cMEMs * (sizeof(PMEM_SCATTER) + sizeof(MEM_SCATTER));
+    if(!(pb = fArena ? LcArena_Alloc(cb) : LocalAlloc(0, cb))) { return FALSE; }
+    ZeroMemory(pb, cb);
     ppMEMs = (PPMEM_SCATTER)pb;
     pMEMs = (PMEM_SCATTER)(pb + cMEMs * (sizeof(PMEM_SCATTER)));
     for(i = 0; i < cMEMs; i++) {
@@ -552,86 +592,263 @@ EXPORTED_FUNCTION BOOL LcAllocScatter3(_Inout_updates_opt_(0x1000) PBYTE pbDataF
     return TRUE;
 }
 
+/*
+* Allocate and pre-initialize empty MEMs excluding the 0x1000 buffer which
+* will be accounted towards the pbData buffer in a contiguous way.
+* -- pbDataFirstPage = optional buffer of first page
+* -- pbDataLastPage = optional buffer of last page
+* -- cbData = size of pbData
+* -- pbData = buffer used for MEM.pb except first/last if exists
+* -- cMEMs
+* -- pppMEMs = pointer to receive ppMEMs
+* -- return
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcAllocScatter3(_Inout_updates_opt_(0x1000) PBYTE pbDataFirstPage, _Inout_updates_opt_(0x1000) PBYTE pbDataLastPage, _In_ DWORD cbData, _Inout_updates_opt_(cbData) PBYTE pbData, _In_ DWORD cMEMs, _Out_ PPMEM_SCATTER *pppMEMs)
+{
+    return LcAllocScatter3_DoWork(FALSE, pbDataFirstPage, pbDataLastPage, cbData, pbData, cMEMs, pppMEMs);
+}
+
 
 
 // ----------------------------------------------------------------------------
 // READ CONTIGIOUS FUNCTIONALITY BELOW:
 // ----------------------------------------------------------------------------
 
+#define LC_RC_THREADS_MAX               64
+#define LC_RC_CHUNKSIZE_DEFAULT         0x01000000      // 16MB
+#define LC_RC_CHUNKSIZE_MAX             0x04000000      // 64MB
+#define LC_RC_SUBCHUNK_MIN              0x00010000      // 64kB
+#define LC_RC_SUBCHUNK_PER_THREAD       4               // sub-chunks per thread (load balance granularity).
+#define LC_RC_BUFFER_ALIGN              0x000fffff      // worker buffers are grown in 1MB steps.
+
+typedef struct tdLC_RC_WORK {
+    QWORD paBase;
+    DWORD cb;
+    DWORD cMEMs;
+    PPMEM_SCATTER ppMEMs;
+} LC_RC_WORK, *PLC_RC_WORK;
+
+typedef struct tdLC_RC_WORKER {
+    CRITICAL_SECTION Lock;          // protects iHead/iTail.
+    DWORD iHead;                    // next work item - taken by owning worker.
+    DWORD iTail;                    // end of work items - stolen by other workers.
+    DWORD iWorker;                  // worker index (also used as device iRL).
+    DWORD cbBuffer;                 // size of ctxRC buffer.
+    PLC_READ_CONTIGIOUS_CONTEXT ctxRC;  // allocated on first use.
+    LC_ALLOC_LARGE AllocRC;         // allocation of ctxRC.
+    BOOL fPinned;                   // worker thread pinned to its NUMA node.
+    HANDLE hEventWork;
+    HANDLE hThread;
+    PLC_RC_POOL pPool;
+} LC_RC_WORKER, *PLC_RC_WORKER;
+
+typedef struct tdLC_RC_POOL {
+    PLC_CONTEXT ctxLC;
+    BOOL fActive;
+    DWORD cThreadMax;               // max threads as supported by the device (Caps.cThreadContigiousMax).
+    DWORD cThreadStarted;
+    DWORD cThreadActive;
+    DWORD cWorker;                  // workers participating in current read.
+    DWORD cWorkRemaining;
+    HANDLE hEventDone;
+    PLC_RC_WORK pWork;              // work items of current read.
+    LC_RC_WORKER Worker[0];
+} LC_RC_POOL;
+
 /*
-* Perform a contigious read from an underlying device instance.
+* Perform a contigious read from an underlying device instance. If zero-copy
+* the device reads directly into the (contiguous) MEM buffers - no data is
+* copied and MEMs not fully read are cleared since they may hold partial data.
 * -- ctxRC
+* -- fZeroCopy
 */
-VOID LcReadContigious_DeviceRead(PLC_READ_CONTIGIOUS_CONTEXT ctxRC)
+VOID LcReadContigious_DeviceRead(_Inout_ PLC_READ_CONTIGIOUS_CONTEXT ctxRC, _In_ BOOL fZeroCopy)
 {
     DWORD i, o, cbRead;
     PMEM_SCATTER pMEM;
-    ctxRC->ctxLC->pfnReadContigious(ctxRC);
-    cbRead = ctxRC->cbRead;
+    if(fZeroCopy) {
+        ctxRC->ctxLC->pfnReadContigiousZeroCopy(ctxRC, ctxRC->ppMEMs[0]->pb);
+    } else {
+        ctxRC->ctxLC->pfnReadContigious(ctxRC);
+    }
+    cbRead = min(ctxRC->cbRead, ctxRC->cb);
     for(i = 0, o = 0; ((i < ctxRC->cMEMs) && (cbRead >= ctxRC->ppMEMs[i]->cb)); i++) {
         pMEM = ctxRC->ppMEMs[i];
-        memcpy(pMEM->pb, ctxRC->pb + o, pMEM->cb);
+        if(!fZeroCopy) {
+            memcpy(pMEM->pb, ctxRC->pb + o, pMEM->cb);
+        }
         pMEM->f = TRUE;
         o += pMEM->cb;
         cbRead -= pMEM->cb;
     }
+    for(; fZeroCopy && (i < ctxRC->cMEMs); i++) {
+        ZeroMemory(ctxRC->ppMEMs[i]->pb, ctxRC->ppMEMs[i]->cb);
+    }
 }
 
 /*
-* Main thread loop for multi-chunked/threaded linear reads.
-* -- ctxRC
+* Check whether the MEM buffers of a work item are laid out back-to-back in a
+* single contiguous buffer (as allocated by LcAllocScatter2/LcRead) - in which
+* case the device may read directly into the MEM buffers.
+* -- pWork
 * -- return
 */
-DWORD LcReadContigious_ThreadProc(PLC_READ_CONTIGIOUS_CONTEXT ctxRC)
+BOOL LcReadContigious_IsBufferContigious(_In_ PLC_RC_WORK pWork)
 {
-    while(ctxRC->ctxLC->RC.fActive) {
-        WaitForSingleObject(ctxRC->hEventWakeup, INFINITE);
-        if(!ctxRC->ctxLC->RC.fActive) { break; }
-        LcReadContigious_DeviceRead(ctxRC);
-        SetEvent(ctxRC->hEventFinish);
+    DWORD i;
+    for(i = 1; i < pWork->cMEMs; i++) {
+        if(pWork->ppMEMs[i - 1]->pb + pWork->ppMEMs[i - 1]->cb != pWork->ppMEMs[i]->pb) {
+            return FALSE;
+        }
     }
-    SetEvent(ctxRC->hEventFinish);
+    return TRUE;
+}
+
+/*
+* Read a work item. If the MEM buffers are contiguous and the device supports
+* zero-copy reads the device reads directly into them - otherwise the read
+* buffer of the worker is used. The read buffer is allocated on first use (as
+* per the allocation policy) and re-allocated if the work item does not fit or
+* if the allocation policy is changed.
+* -- pWorker
+* -- pWork
+*/
+VOID LcReadContigious_WorkerRead(_In_ PLC_RC_WORKER pWorker, _In_ PLC_RC_WORK pWork)
+{
+    PLC_CONTEXT ctxLC = pWorker->pPool->ctxLC;
+    PLC_READ_CONTIGIOUS_CONTEXT ctxRC = pWorker->ctxRC;
+    BOOL fZeroCopy = ctxLC->pfnReadContigiousZeroCopy && LcReadContigious_IsBufferContigious(pWork);
+    DWORD cbBuffer = fZeroCopy ? 0 : pWork->cb;
+    if(!ctxRC || (pWorker->cbBuffer < cbBuffer) || !LcAlloc_LargeIsCurrent(ctxLC, &pWorker->AllocRC)) {
+        LcAlloc_LargeFree(ctxLC, &pWorker->AllocRC);
+        pWorker->cbBuffer = (max(cbBuffer, pWorker->cbBuffer) + LC_RC_BUFFER_ALIGN) & ~LC_RC_BUFFER_ALIGN;
+        if(!(ctxRC = pWorker->ctxRC = (PLC_READ_CONTIGIOUS_CONTEXT)LcAlloc_Large(ctxLC, sizeof(LC_READ_CONTIGIOUS_CONTEXT) + pWorker->cbBuffer + 0x1000, LcAlloc_WorkerNode(ctxLC, pWorker->iWorker), &pWorker->AllocRC))) {
+            pWorker->cbBuffer = 0;
+            return;
+        }
+        ZeroMemory(ctxRC, sizeof(LC_READ_CONTIGIOUS_CONTEXT));
+        ctxRC->ctxLC = ctxLC;
+        ctxRC->hThread = pWorker->hThread;
+        ctxRC->iRL = pWorker->iWorker;
+    }
+    ctxRC->cbRead = 0;
+    ctxRC->cMEMs = pWork->cMEMs;
+    ctxRC->ppMEMs = pWork->ppMEMs;
+    ctxRC->paBase = pWork->paBase;
+    ctxRC->cb = pWork->cb;
+    LcReadContigious_DeviceRead(ctxRC, fZeroCopy);
+}
+
+/*
+* Retrieve the next work item for a worker. Work is primarily taken from the
+* head of the worker's own range - if exhausted work is stolen from the tail
+* of the other workers' ranges.
+* -- pPool
+* -- iWorker
+* -- return = the work item, NULL if no work remains.
+*/
+PLC_RC_WORK LcReadContigious_WorkerTake(_In_ PLC_RC_POOL pPool, _In_ DWORD iWorker)
+{
+    DWORD i, cWorker = pPool->cWorker;
+    PLC_RC_WORKER pWorker;
+    PLC_RC_WORK pWork = NULL;
+    for(i = 0; !pWork && (i < cWorker); i++) {
+        pWorker = pPool->Worker + ((iWorker + i) % cWorker);
+        EnterCriticalSection(&pWorker->Lock);
+        if(pWorker->iHead < pWorker->iTail) {
+            pWork = pPool->pWork + (i ? --pWorker->iTail : pWorker->iHead++);
+        }
+        LeaveCriticalSection(&pWorker->Lock);
+    }
+    return pWork;
+}
+
+/*
+* Main thread loop for multi-threaded linear reads.
+* -- pWorker
+* -- return
+*/
+DWORD LcReadContigious_ThreadProc(_In_ PLC_RC_WORKER pWorker)
+{
+    PLC_RC_POOL pPool = pWorker->pPool;
+    PLC_RC_WORK pWork;
+    while(pPool->fActive) {
+        WaitForSingleObject(pWorker->hEventWork, INFINITE);
+        LcAlloc_WorkerPin(pPool->ctxLC, pWorker->iWorker, &pWorker->fPinned);
+        while(pPool->fActive && (pWork = LcReadContigious_WorkerTake(pPool, pWorker->iWorker))) {
+            LcReadContigious_WorkerRead(pWorker, pWork);
+            if(0 == InterlockedDecrement(&pPool->cWorkRemaining)) {
+                SetEvent(pPool->hEventDone);
+            }
+        }
+    }
+    InterlockedDecrement(&pPool->cThreadActive);
     return 0;
 }
 
 /*
-* Perform a read of the linear memory specified onto the supplied MEMs.
-* -- ctxLC
-* -- cMEMs
-* -- ppMEMs
-* -- paBase
-* -- cb
-* -- fSingleThreaded
+* Ensure that at least cThread worker threads are started.
+* -- pPool
+* -- cThread
+* -- return
+*/
+_Success_(return)
+BOOL LcReadContigious_ThreadStart(_In_ PLC_RC_POOL pPool, _In_ DWORD cThread)
+{
+    PLC_RC_WORKER pWorker;
+    while(pPool->cThreadStarted < cThread) {
+        pWorker = pPool->Worker + pPool->cThreadStarted;
+        if(!pWorker->hEventWork && !(pWorker->hEventWork = CreateEvent(NULL, FALSE, FALSE, NULL))) { return FALSE; }
+        InterlockedIncrement(&pPool->cThreadActive);
+        if(!(pWorker->hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)LcReadContigious_ThreadProc, pWorker, 0, NULL))) {
+            InterlockedDecrement(&pPool->cThreadActive);
+            return FALSE;
+        }
+        pPool->cThreadStarted++;
+    }
+    return TRUE;
+}
+
+/*
+* Read work items in parallel. The work items are split into one contiguous
+* range per worker - idle workers steal remaining work from busy workers.
+* -- pPool
+* -- cWork
+* -- pWork
+* -- cWorker
+* -- return = TRUE if read in parallel, FALSE if threads could not be started.
 */
-VOID LcReadContigious_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _In_ QWORD paBase, _In_ DWORD cb, _In_ BOOL fSingleThreaded)
+_Success_(return)
+BOOL LcReadContigious_ReadParallel(_In_ PLC_RC_POOL pPool, _In_ DWORD cWork, _In_ PLC_RC_WORK pWork, _In_ DWORD cWorker)
 {
     DWORD i;
-    PLC_READ_CONTIGIOUS_CONTEXT ctxRC;
-    if(!ctxLC->RC.fActive) { return; }
-    if(fSingleThreaded) {
-        ctxRC = ctxLC->RC.ctx[0];
-    } else {
-        i = WaitForMultipleObjects(ctxLC->ReadContigious.cThread, ctxLC->RC.hEventFinish, FALSE, INFINITE) - WAIT_OBJECT_0;
-        if(!ctxLC->RC.fActive || (i >= ctxLC->ReadContigious.cThread)) { return; }
-        ctxRC = ctxLC->RC.ctx[i];
-        ResetEvent(ctxRC->hEventFinish);
+    PLC_RC_WORKER pWorker;
+    if(!LcReadContigious_ThreadStart(pPool, cWorker)) { return FALSE; }
+    pPool->pWork = pWork;
+    pPool->cWorker = cWorker;
+    pPool->cWorkRemaining = cWork;
+    for(i = 0; i < cWorker; i++) {
+        pWorker = pPool->Worker + i;
+        EnterCriticalSection(&pWorker->Lock);
+        pWorker->iHead = (DWORD)(((QWORD)i * cWork) / cWorker);
+        pWorker->iTail = (DWORD)(((QWORD)(i + 1) * cWork) / cWorker);
+        LeaveCriticalSection(&pWorker->Lock);
     }
-    ctxRC->cbRead = 0;
-    ctxRC->cMEMs = cMEMs;
-    ctxRC->ppMEMs = ppMEMs;
-    ctxRC->paBase = paBase;
-    ctxRC->cb = cb;
-    if(fSingleThreaded) {
-        LcReadContigious_DeviceRead(ctxRC);
-    } else {
-        SetEvent(ctxRC->hEventWakeup);
+    for(i = 0; i < cWorker; i++) {
+        SetEvent(pPool->Worker[i].hEventWork);
     }
+    WaitForSingleObject(pPool->hEventDone, INFINITE);
+    return TRUE;
 }
 
 /*
-* Condense scattered MEMs into as large linear read-chunks as possible and
-* schedule these chunks for reading using either single-threaded read or
-* multi-threaded read - as configured and as optimal.
+* Condense scattered MEMs into linear read-chunks and read them either single-
+* threaded or multi-threaded - as configured and as optimal.
+* MEMs are sorted on address before the chunks are built - the result is
+* still read into the original MEMs. When multi-threaded the chunks are split
+* into sub-chunks sized after the total read size so that all threads are kept
+* busy also on smaller reads.
 * MEMs are assumed to have their memory map translation/validation completed.
 * NB! MUST BE CALLED SINGLE THREADED (per device instance).
 * -- ctxLC
@@ -640,47 +857,84 @@ VOID LcReadContigious_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPM
 */
 VOID LcReadContigious_ReadScatterGather(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
 {
+    PLC_RC_POOL pPool = ctxLC->RC.pPool;
     PMEM_SCATTER pMEM;
-    QWORD i, iBase = 0, paBase = 0;
-    DWORD cbChunkSizeLimit, c = 0, cbCurrent = 0;
-    BOOL fSingleThreaded, fFirst = TRUE;
-    fSingleThreaded = (ctxLC->ReadContigious.cThread == 1);
-    cbChunkSizeLimit = ctxLC->ReadContigious.cbChunkSize;
-    if((ctxLC->ReadContigious.cThread > 1) && ctxLC->ReadContigious.fLoadBalance) {
-        cbChunkSizeLimit = min(cbChunkSizeLimit, max(0x00010000, 0x1000 * (cMEMs / ctxLC->ReadContigious.cThread)));
-    }
+    PPMEM_SCATTER ppMEMsSort;
+    PMEM_SCATTER ppMEMsSortSmall[0x40];
+    PLC_RC_WORK pWork, pWorkAll;
+    LC_RC_WORK WorkSmall[0x40];
+    QWORD cbTotal = 0;
+    DWORD i, cThread, cbChunkSizeLimit, cWork = 0, cMEMsSort = 0;
+    BOOL fSorted;
+    if(!pPool) { return; }
+    // 1: collect MEMs to read and sort them on address:
+    if(!(ppMEMsSort = (cMEMs <= _countof(ppMEMsSortSmall)) ? ppMEMsSortSmall : LcArena_Alloc(cMEMs * sizeof(PMEM_SCATTER)))) { return; }
     for(i = 0; i < cMEMs; i++) {
         pMEM = ppMEMs[i];
-        if(!MEM_SCATTER_ADDR_ISVALID(pMEM)) { continue; }
-        if(c == 0) {
-            if(pMEM->cb && !pMEM->f) {
-                c = 1;
-                iBase = i;
-                paBase = pMEM->qwA;
-                cbCurrent = pMEM->cb;
-            }
-        } else if((paBase + cbCurrent == pMEM->qwA) && (cbCurrent < cbChunkSizeLimit)) {
-            c++;
-            cbCurrent += pMEM->cb;
+        if(pMEM->cb && !pMEM->f && MEM_SCATTER_ADDR_ISVALID(pMEM)) {
+            ppMEMsSort[cMEMsSort++] = pMEM;
+            cbTotal += pMEM->cb;
+        }
+    }
+    if(!cMEMsSort) { goto fail; }
+    fSorted = Util_SortMEMs(cMEMsSort, ppMEMsSort);
+    // 2: adapt the sub-chunk size to the read size and thread count:
+    cThread = min(pPool->cThreadMax, ctxLC->ReadContigious.cThread);
+    cbChunkSizeLimit = ctxLC->ReadContigious.cbChunkSize;
+    if(cThread > 1) {
+        cbChunkSizeLimit = (DWORD)min(cbChunkSizeLimit, max(LC_RC_SUBCHUNK_MIN, cbTotal / (cThread * LC_RC_SUBCHUNK_PER_THREAD)) & ~0xfffULL);
+    }
+    // 3: build work items of address-contiguous MEMs:
+    if(!(pWorkAll = (cMEMsSort <= _countof(WorkSmall)) ? WorkSmall : LcArena_Alloc(cMEMsSort * sizeof(LC_RC_WORK)))) { goto fail; }
+    for(i = 0; i < cMEMsSort; i++) {
+        pMEM = ppMEMsSort[i];
+        pWork = pWorkAll + cWork - 1;
+        if(fSorted && cWork && (pWork->paBase + pWork->cb == pMEM->qwA) && (pWork->cb + pMEM->cb <= cbChunkSizeLimit)) {
+            pWork->cMEMs++;
+            pWork->cb += pMEM->cb;
         } else {
-            fFirst = FALSE;
-            LcReadContigious_Read(ctxLC, c, ppMEMs + iBase, paBase, cbCurrent, fSingleThreaded);
-            c = 0;
-            if(pMEM->cb && !pMEM->f) {
-                c = 1;
-                iBase = i;
-                paBase = pMEM->qwA;
-                cbCurrent = pMEM->cb;
-            }
+            pWork = pWorkAll + cWork++;
+            pWork->paBase = pMEM->qwA;
+            pWork->cb = pMEM->cb;
+            pWork->cMEMs = 1;
+            pWork->ppMEMs = ppMEMsSort + i;
         }
     }
-    fSingleThreaded = fSingleThreaded || fFirst;
-    if(c) {
-        LcReadContigious_Read(ctxLC, c, ppMEMs + iBase, paBase, cbCurrent, fSingleThreaded);
+    // 4: read the work items:
+    if((cThread == 1) || (cWork == 1) || !LcReadContigious_ReadParallel(pPool, cWork, pWorkAll, min(cThread, cWork))) {
+        for(i = 0; i < cWork; i++) {
+            LcReadContigious_WorkerRead(pPool->Worker, pWorkAll + i);
+        }
     }
-    if(!fSingleThreaded && ctxLC->RC.fActive) {
-        WaitForMultipleObjects(ctxLC->ReadContigious.cThread, ctxLC->RC.hEventFinish, TRUE, INFINITE);
+    if(pWorkAll != WorkSmall) { LcArena_Free(pWorkAll); }
+fail:
+    if(ppMEMsSort != ppMEMsSortSmall) { LcArena_Free(ppMEMsSort); }
+}
+
+/*
+* Set the number of threads or the chunk size used by contigious reads.
+* NB! Must be called with the device lock held.
+* -- ctxLC
+* -- fOption = LC_OPT_CORE_RC_THREADS / LC_OPT_CORE_RC_CHUNKSIZE
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcReadContigious_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    PLC_RC_POOL pPool = ctxLC->RC.pPool;
+    if(!pPool) { return FALSE; }
+    switch(fOption) {
+        case LC_OPT_CORE_RC_THREADS:
+            if(!qwValue || (qwValue > pPool->cThreadMax)) { return FALSE; }
+            ctxLC->ReadContigious.cThread = (DWORD)qwValue;
+            return TRUE;
+        case LC_OPT_CORE_RC_CHUNKSIZE:
+            if(!qwValue || (qwValue > LC_RC_CHUNKSIZE_MAX)) { return FALSE; }
+            ctxLC->ReadContigious.cbChunkSize = (DWORD)((qwValue + 0xfff) & ~0xfff);
+            return TRUE;
     }
+    return FALSE;
 }
 
 /*
@@ -690,56 +944,69 @@ VOID LcReadContigious_ReadScatterGather(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs
 VOID LcReadContigious_Close(_In_ PLC_CONTEXT ctxLC)
 {
     DWORD i;
-    PLC_READ_CONTIGIOUS_CONTEXT ctxRC;
+    PLC_RC_WORKER pWorker;
+    PLC_RC_POOL pPool = ctxLC->RC.pPool;
     ctxLC->RC.fActive = FALSE;
-    for(i = 0; i < ctxLC->ReadContigious.cThread; i++) {
-        if(!ctxLC->RC.ctx[i] || !ctxLC->RC.ctx[i]->hEventWakeup) { break; }
-        SetEvent(ctxLC->RC.ctx[i]->hEventWakeup);
-    }
-    for(i = 0; i < ctxLC->ReadContigious.cThread; i++) {
-        if(!ctxLC->RC.ctx[i]) { break; }
-        ctxRC = ctxLC->RC.ctx[i];
-        ctxLC->RC.ctx[i] = NULL;
-        if(ctxRC->hEventWakeup) { SetEvent(ctxRC->hEventWakeup); }
-        if(ctxRC->hEventFinish) { WaitForSingleObject(ctxRC->hEventFinish, INFINITE); }
-        if(ctxRC->hEventFinish) { CloseHandle(ctxRC->hEventFinish); }
-        if(ctxRC->hEventWakeup) { CloseHandle(ctxRC->hEventWakeup); }
-        if(ctxRC->hThread) { CloseHandle(ctxRC->hThread); }
-        LocalFree(ctxRC);
+    if(!pPool) { return; }
+    pPool->fActive = FALSE;
+    if(pPool->hEventDone) { SetEvent(pPool->hEventDone); }
+    while(pPool->cThreadActive) {
+        for(i = 0; i < pPool->cThreadStarted; i++) {
+            SetEvent(pPool->Worker[i].hEventWork);
+        }
+        SwitchToThread();
     }
+    for(i = 0; i < pPool->cThreadMax; i++) {
+        pWorker = pPool->Worker + i;
+        if(pWorker->hEventWork) { CloseHandle(pWorker->hEventWork); }
+        if(pWorker->hThread) { CloseHandle(pWorker->hThread); }
+        DeleteCriticalSection(&pWorker->Lock);
+        LcAlloc_LargeFree(ctxLC, &pWorker->AllocRC);
+    }
+    if(pPool->hEventDone) { CloseHandle(pPool->hEventDone); }
+    ctxLC->RC.pPool = NULL;
+    LocalFree(pPool);
 }
 
 /*
 * Initialize the ReadContigious sub-system for a specific device instance.
+* Worker threads and read buffers are not allocated until first used.
+* ReadContigious.cThread is the default thread count - devices may declare
+* that they support more threads (up to LC_OPT_CORE_RC_THREADS) by setting
+* Caps.cThreadContigiousMax.
 * -- ctxLC
 * -- return
 */
 _Success_(return)
 BOOL LcReadContigious_Initialize(_In_ PLC_CONTEXT ctxLC)
 {
-    DWORD i;
-    PLC_READ_CONTIGIOUS_CONTEXT ctxRC;
+    DWORD i, cThreadMax;
+    PLC_RC_POOL pPool;
     if(!ctxLC->pfnReadContigious) { return TRUE; }
-    if(!ctxLC->ReadContigious.cThread) { ctxLC->ReadContigious.cThread = 1; }                   // default: single-threaded.
-    if(!ctxLC->ReadContigious.cbChunkSize) { ctxLC->ReadContigious.cbChunkSize = 0x01000000; }  // default: 16MB buffer / thread.
-    ctxLC->ReadContigious.cThread = min(8, ctxLC->ReadContigious.cThread);                      // max 8 threads in parallel.
-    ctxLC->ReadContigious.cbChunkSize = min(0x01000000, ctxLC->ReadContigious.cbChunkSize);     // max 16MB buffer / thread.
+    if(!ctxLC->ReadContigious.cThread) { ctxLC->ReadContigious.cThread = 1; }                                  // default: single-threaded.
+    if(!ctxLC->ReadContigious.cbChunkSize) { ctxLC->ReadContigious.cbChunkSize = LC_RC_CHUNKSIZE_DEFAULT; }   // default: 16MB max chunk.
+    ctxLC->ReadContigious.cThread = min(LC_RC_THREADS_MAX, ctxLC->ReadContigious.cThread);
+    ctxLC->ReadContigious.cbChunkSize = min(LC_RC_CHUNKSIZE_MAX, (ctxLC->ReadContigious.cbChunkSize + 0xfff) & ~0xfff);
+    cThreadMax = ctxLC->ReadContigious.cThread;
+    if(ctxLC->Caps.dwVersion == LC_DEVICE_CAPS_VERSION) {
+        cThreadMax = min(LC_RC_THREADS_MAX, max(cThreadMax, ctxLC->Caps.cThreadContigiousMax));
+    }
+    if(!(pPool = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_RC_POOL) + cThreadMax * sizeof(LC_RC_WORKER)))) { return FALSE; }
+    pPool->ctxLC = ctxLC;
+    pPool->fActive = TRUE;
+    pPool->cThreadMax = cThreadMax;
+    for(i = 0; i < pPool->cThreadMax; i++) {
+        pPool->Worker[i].pPool = pPool;
+        pPool->Worker[i].iWorker = i;
+        InitializeCriticalSection(&pPool->Worker[i].Lock);
+    }
+    ctxLC->RC.pPool = pPool;
     ctxLC->RC.fActive = TRUE;
-    for(i = 0; i < ctxLC->ReadContigious.cThread; i++) {
-        if(!(ctxRC = ctxLC->RC.ctx[i] = LocalAlloc(0, sizeof(LC_READ_CONTIGIOUS_CONTEXT) + ctxLC->ReadContigious.cbChunkSize + 0x1000))) { goto fail; }
-        ZeroMemory(ctxRC, sizeof(LC_READ_CONTIGIOUS_CONTEXT));
-        ctxRC->ctxLC = ctxLC;
-        if(ctxLC->ReadContigious.cThread > 1) {
-            ctxRC->iRL = i;
-            if(!(ctxRC->hEventWakeup = CreateEvent(NULL, FALSE, FALSE, FALSE))) { goto fail; }
-            if(!(ctxRC->hEventFinish = ctxLC->RC.hEventFinish[i] = CreateEvent(NULL, TRUE, TRUE, FALSE))) { goto fail; }
-            if(!(ctxRC->hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)LcReadContigious_ThreadProc, ctxRC, 0, NULL))) { goto fail; }
-        }
+    if(!(pPool->hEventDone = CreateEvent(NULL, FALSE, FALSE, NULL))) {
+        LcReadContigious_Close(ctxLC);
+        return FALSE;
     }
     return TRUE;
-fail:
-    LcReadContigious_Close(ctxLC);
-    return FALSE;
 }
 
 
@@ -748,6 +1015,297 @@ fail:
 // READ / WRITE FUNCTIONALITY BELOW:
 // ----------------------------------------------------------------------------
 
+typedef struct tdLC_READ_SUBMIT {
+    struct tdLC_READ_SUBMIT *FLink;
+    PPMEM_SCATTER ppMEMs;
+    DWORD cMEMs;
+    BOOL volatile fComplete;
+    BOOL volatile fDispatch;        // dispatch of the submission queue handed over to the submitter.
+    HANDLE hEvent;                  // submitter completion event - signaled once (NULL = submitter polls).
+} LC_READ_SUBMIT, *PLC_READ_SUBMIT;
+
+/*
+* Dispatch MEMs to the underlying device.
+* NB! Must be called with the device lock held (unless multi-threaded device).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_DeviceDispatch(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    if(ctxLC->pfnReadScatter) {
+        LcDeviceCaps_SlotAcquire(ctxLC);
+        if(!LcDeviceCaps_ReadScatter(ctxLC, cMEMs, ppMEMs)) {
+            ctxLC->pfnReadScatter(ctxLC, cMEMs, ppMEMs);
+        }
+        LcDeviceCaps_SlotRelease(ctxLC);
+    } else if(ctxLC->RC.fActive) {
+        LcReadContigious_ReadScatterGather(ctxLC, cMEMs, ppMEMs);
+    }
+}
+
+/*
+* Drain the read submission queue and dispatch all queued reads to the device
+* as one single coalesced batch. Completed submissions are flagged and their
+* submitters are signaled.
+* NB! Must be called with the device lock held by the submission dispatcher.
+* -- ctxLC
+*/
+VOID LcReadScatter_DeviceCombine(_In_ PLC_CONTEXT ctxLC)
+{
+    DWORD c = 0, cMEMs = 0;
+    PPMEM_SCATTER ppMEMs;
+    PMEM_SCATTER ppMEMsSmall[0x40];
+    PLC_READ_SUBMIT pe, peNext, peFirst = NULL;
+    HANDLE hEvent;
+    // 1: take ownership of all queued submissions and restore fifo order:
+    pe = (PLC_READ_SUBMIT)InterlockedExchangePointer(&ctxLC->pReadSubmitHead, NULL);
+    while(pe) {
+        peNext = pe->FLink;
+        pe->FLink = peFirst;
+        peFirst = pe;
+        pe = peNext;
+        cMEMs += peFirst->cMEMs;
+        c++;
+    }
+    if(!peFirst) { return; }
+    // 2: dispatch as one batch (or one-by-one on single submission/alloc fail):
+    ppMEMs = (cMEMs <= _countof(ppMEMsSmall)) ? ppMEMsSmall : LcArena_Alloc(cMEMs * sizeof(PMEM_SCATTER));
+    if((c == 1) || !ppMEMs) {
+        for(pe = peFirst; pe; pe = pe->FLink) {
+            LcReadScatter_DeviceDispatch(ctxLC, pe->cMEMs, pe->ppMEMs);
+        }
+    } else {
+        for(cMEMs = 0, pe = peFirst; pe; pe = pe->FLink) {
+            memcpy(ppMEMs + cMEMs, pe->ppMEMs, pe->cMEMs * sizeof(PMEM_SCATTER));
+            cMEMs += pe->cMEMs;
+        }
+        LcReadScatter_DeviceDispatch(ctxLC, cMEMs, ppMEMs);
+        lcprintfvvv_fn(ctxLC, "coalesced %i submissions into %i MEMs.\n", c, cMEMs);
+    }
+    if(ppMEMs != ppMEMsSmall) { LcArena_Free(ppMEMs); }
+    // 3: complete (the submission may not be touched after fComplete is set):
+    for(pe = peFirst; pe; pe = peNext) {
+        peNext = pe->FLink;
+        hEvent = pe->hEvent;
+        pe->fComplete = TRUE;
+        if(hEvent) { SetEvent(hEvent); }
+    }
+}
+
+/*
+* Hand over dispatch of the read submission queue to the submitter of a queued
+* read - or give up dispatch if the queue is empty.
+* NB! Must be called by the submission dispatcher (without the device lock).
+* -- ctxLC
+* -- return = TRUE if dispatch was re-acquired (reads were queued after dispatch
+*             was given up) - the caller must then dispatch the queue again.
+*/
+BOOL LcReadScatter_DeviceHandover(_In_ PLC_CONTEXT ctxLC)
+{
+    HANDLE hEvent;
+    PLC_READ_SUBMIT pe;
+    if((pe = (PLC_READ_SUBMIT)ctxLC->pReadSubmitHead)) {
+        // queued submissions are only ever completed by the dispatcher - the
+        // submission is valid until its submitter is signaled:
+        hEvent = pe->hEvent;
+        pe->fDispatch = TRUE;
+        if(hEvent) { SetEvent(hEvent); }
+        return FALSE;
+    }
+    InterlockedExchange(&ctxLC->fReadSubmitDispatch, FALSE);
+    return ctxLC->pReadSubmitHead && !InterlockedCompareExchange(&ctxLC->fReadSubmitDispatch, TRUE, FALSE);
+}
+
+/*
+* Submit MEMs to the underlying device. Unless the device is remote the MEMs
+* are assumed to have their memory map translation completed.
+* Reads towards single-threaded devices are pushed onto a lock-free submission
+* queue. One thread at a time - the dispatcher - takes the device lock and
+* dispatches all queued reads in one batch; reads arriving while a batch is in
+* progress are coalesced into the next batch. Other submitters do not wait on
+* the device lock - they wait on their own completion event until their read
+* is completed or until dispatch of the next batch is handed over to them.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_DeviceSubmit(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    PVOID pvHead;
+    LC_READ_SUBMIT e;
+    if(ctxLC->Config.fRemote && ctxLC->pfnReadScatter) {
+        ctxLC->pfnReadScatter(ctxLC, cMEMs, ppMEMs);
+        return;
+    }
+    if(ctxLC->fMultiThread) {
+        if(!LcFanout_ReadScatter(ctxLC, cMEMs, ppMEMs)) {
+            LcReadScatter_DeviceDispatch(ctxLC, cMEMs, ppMEMs);
+        }
+        return;
+    }
+    e.ppMEMs = ppMEMs;
+    e.cMEMs = cMEMs;
+    e.fComplete = FALSE;
+    e.fDispatch = FALSE;
+    e.hEvent = LcArena_SubmitEvent();
+    do {
+        pvHead = ctxLC->pReadSubmitHead;
+        e.FLink = (PLC_READ_SUBMIT)pvHead;
+    } while(InterlockedCompareExchangePointer(&ctxLC->pReadSubmitHead, &e, pvHead) != pvHead);
+    if(InterlockedCompareExchange(&ctxLC->fReadSubmitDispatch, TRUE, FALSE)) {
+        // another thread dispatches - wait for completion or hand over:
+        if(e.hEvent) {
+            WaitForSingleObject(e.hEvent, INFINITE);
+        } else {
+            while(!e.fComplete && !e.fDispatch) { SwitchToThread(); }
+        }
+        if(e.fComplete) { return; }
+    } else if(e.fComplete) {
+        // completed by the previous dispatcher - consume its signal:
+        if(e.hEvent) { WaitForSingleObject(e.hEvent, INFINITE); }
+    }
+    // this thread is the dispatcher - its own submission is never signaled:
+    e.hEvent = NULL;
+    do {
+        EnterCriticalSection(&ctxLC->Lock);
+        LcReadScatter_DeviceCombine(ctxLC);
+        LeaveCriticalSection(&ctxLC->Lock);
+    } while(LcReadScatter_DeviceHandover(ctxLC));
+}
+
+/*
+* Fetch MEMs from the underlying device - scheduled according to the priority
+* of the calling thread and the read limits (if set).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_Device(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    if(!LcQos_ReadScatter(ctxLC, cMEMs, ppMEMs)) {
+        LcReadScatter_DeviceSubmit(ctxLC, cMEMs, ppMEMs);
+    }
+}
+
+/*
+* Fetch MEMs from the underlying device. Duplicate and sub-page MEMs are merged
+* into as few device reads as possible before the device read. Pages read from
+* the device are inserted into the page cache, compressed page cache and disk
+* cache (if enabled) and failed pages are inserted into the negative cache (if
+* enabled). Merged MEMs of failed merged reads are re-read on their own.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_DeviceMerge(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    DWORD cMEMsDevice, cMEMsRetry;
+    PPMEM_SCATTER ppMEMsDevice, ppMEMsRetry;
+    PLC_MERGE_CONTEXT ctxMerge;
+    QWORD qwWriteGeneration = ctxLC->qwWriteGeneration;
+    if(!(ctxMerge = LcMerge_Prepare(ctxLC, cMEMs, ppMEMs))) {
+        LcReadScatter_Device(ctxLC, cMEMs, ppMEMs);
+        LcCache_Insert(ctxLC, qwWriteGeneration, cMEMs, ppMEMs);
+        LcZCache_Insert(ctxLC, qwWriteGeneration, cMEMs, ppMEMs);
+        LcDiskCache_Insert(ctxLC, qwWriteGeneration, cMEMs, ppMEMs);
+        LcNegCache_Insert(ctxLC, qwWriteGeneration, cMEMs, ppMEMs);
+        return;
+    }
+    ppMEMsDevice = LcMerge_GetDeviceMEMs(ctxMerge, &cMEMsDevice);
+    LcReadScatter_Device(ctxLC, cMEMsDevice, ppMEMsDevice);
+    LcCache_Insert(ctxLC, qwWriteGeneration, cMEMsDevice, ppMEMsDevice);
+    LcZCache_Insert(ctxLC, qwWriteGeneration, cMEMsDevice, ppMEMsDevice);
+    LcDiskCache_Insert(ctxLC, qwWriteGeneration, cMEMsDevice, ppMEMsDevice);
+    LcNegCache_Insert(ctxLC, qwWriteGeneration, cMEMsDevice, ppMEMsDevice);
+    ppMEMsRetry = LcMerge_Complete(ctxMerge, &cMEMsRetry);
+    if(cMEMsRetry) {
+        LcReadScatter_Device(ctxLC, cMEMsRetry, ppMEMsRetry);
+    }
+    LcMerge_Finish(ctxMerge);
+}
+
+/*
+* Fetch MEMs from the readahead buffer, page cache, compressed page cache and
+* disk cache (if enabled) and fail MEMs known to be unreadable by the negative
+* cache (if enabled).
+* Remaining MEMs are fetched from the underlying device.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_FetchCache(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    DWORD cMEMsMiss = cMEMs;
+    PPMEM_SCATTER ppMEMsMiss;
+    PMEM_SCATTER ppMEMsMissSmall[0x20];
+    BOOL fReadAhead = LcReadAhead_IsEnabled(ctxLC);
+    BOOL fCache = LcCache_IsEnabled(ctxLC);
+    BOOL fNegCache = LcNegCache_IsEnabled(ctxLC);
+    BOOL fDiskCache = LcDiskCache_IsEnabled(ctxLC);
+    BOOL fZCache = LcZCache_IsEnabled(ctxLC);
+    if(!fReadAhead && !fCache && !fNegCache && !fDiskCache && !fZCache) {
+        LcReadScatter_DeviceMerge(ctxLC, cMEMs, ppMEMs);
+        return;
+    }
+    if(!(ppMEMsMiss = (cMEMs <= _countof(ppMEMsMissSmall)) ? ppMEMsMissSmall : LcArena_Alloc(cMEMs * sizeof(PMEM_SCATTER)))) {
+        LcReadScatter_DeviceMerge(ctxLC, cMEMs, ppMEMs);
+        return;
+    }
+    if(fReadAhead) {
+        cMEMsMiss = LcReadAhead_Read(ctxLC, cMEMs, ppMEMs, ppMEMsMiss);
+        ppMEMs = ppMEMsMiss;
+    }
+    if(fCache && cMEMsMiss) {
+        cMEMsMiss = LcCache_Read(ctxLC, cMEMsMiss, ppMEMs, ppMEMsMiss);
+        ppMEMs = ppMEMsMiss;
+    }
+    if(fZCache && cMEMsMiss) {
+        cMEMsMiss = LcZCache_Read(ctxLC, cMEMsMiss, ppMEMs, ppMEMsMiss);
+        ppMEMs = ppMEMsMiss;
+    }
+    if(fDiskCache && cMEMsMiss) {
+        cMEMsMiss = LcDiskCache_Read(ctxLC, cMEMsMiss, ppMEMs, ppMEMsMiss);
+        ppMEMs = ppMEMsMiss;
+    }
+    if(fNegCache && cMEMsMiss) {
+        cMEMsMiss = LcNegCache_Read(ctxLC, cMEMsMiss, ppMEMs, ppMEMsMiss);
+    }
+    if(cMEMsMiss) {
+        LcReadScatter_DeviceMerge(ctxLC, cMEMsMiss, ppMEMsMiss);
+    }
+    if(ppMEMsMiss != ppMEMsMissSmall) { LcArena_Free(ppMEMsMiss); }
+}
+
+/*
+* Fetch MEMs. If a snapshot epoch is active MEMs are served from the pages
+* retained in the epoch - and pages fetched for the first time in the epoch are
+* retained.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_Fetch(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    DWORD cMEMsMiss;
+    PPMEM_SCATTER ppMEMsMiss;
+    PMEM_SCATTER ppMEMsMissSmall[0x20];
+    QWORD qwWriteGeneration = ctxLC->qwWriteGeneration;
+    if(!LcSnapshot_IsActive(ctxLC)) {
+        LcReadScatter_FetchCache(ctxLC, cMEMs, ppMEMs);
+        return;
+    }
+    if(!(ppMEMsMiss = (cMEMs <= _countof(ppMEMsMissSmall)) ? ppMEMsMissSmall : LcArena_Alloc(cMEMs * sizeof(PMEM_SCATTER)))) {
+        LcReadScatter_FetchCache(ctxLC, cMEMs, ppMEMs);
+        return;
+    }
+    if((cMEMsMiss = LcSnapshot_Read(ctxLC, cMEMs, ppMEMs, ppMEMsMiss))) {
+        LcReadScatter_FetchCache(ctxLC, cMEMsMiss, ppMEMsMiss);
+        LcSnapshot_Insert(ctxLC, qwWriteGeneration, cMEMsMiss, ppMEMsMiss);
+    }
+    if(ppMEMsMiss != ppMEMsMissSmall) { LcArena_Free(ppMEMsMiss); }
+}
+
 /*
 * Read memory in a scattered non-contiguous way. This is recommended for reads.
 * -- hLC
@@ -757,11 +1315,16 @@ fail:
 EXPORTED_FUNCTION VOID LcReadScatter(_In_ HANDLE hLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
 {
     PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
-    QWORD i, tmStart = LcCallStart();
+    QWORD i, qwOffset, tmStart = LcCallStart();
     if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { return; }
     if(ctxLC->Config.fRemote && ctxLC->pfnReadScatter) {
         // REMOTE
-        ctxLC->pfnReadScatter(ctxLC, cMEMs, ppMEMs);
+        LcReadScatter_Fetch(ctxLC, cMEMs, ppMEMs);
+    } else if(LcMemMap_TranslateMEMsFast(ctxLC, cMEMs, ppMEMs, &qwOffset)) {
+        // LOCAL LEECHCORE - NO/SINGLE RANGE MEMORY MAP FAST PATH
+        LcReadScatter_Fetch(ctxLC, cMEMs, ppMEMs);
+        LcMemMap_TranslateMEMsFastRestore(cMEMs, ppMEMs, qwOffset);
+        LcReadAhead_Detect(ctxLC, cMEMs, ppMEMs);
     } else {
         // LOCAL LEECHCORE
         // 1: TRANSLATE
@@ -770,21 +1333,271 @@ EXPORTED_FUNCTION VOID LcReadScatter(_In_ HANDLE hLC, _In_ DWORD cMEMs, _Inout_
         }
         LcMemMap_TranslateMEMs(ctxLC, cMEMs, ppMEMs);
         // 2: FETCH
-        LcLockAcquire(ctxLC);
-        if(ctxLC->pfnReadScatter) {
-            ctxLC->pfnReadScatter(ctxLC, cMEMs, ppMEMs);
-        } else if(ctxLC->RC.fActive) {
-            LcReadContigious_ReadScatterGather(ctxLC, cMEMs, ppMEMs);
-        }
-        LcLockRelease(ctxLC);
+        LcReadScatter_Fetch(ctxLC, cMEMs, ppMEMs);
         // 3: RESTORE
         for(i = 0; i < cMEMs; i++) {
             ppMEMs[i]->qwA = MEM_SCATTER_STACK_POP(ppMEMs[i]);
         }
+        // 4: READAHEAD
+        LcReadAhead_Detect(ctxLC, cMEMs, ppMEMs);
     }
     LcCallEnd(ctxLC, LC_STATISTICS_ID_READSCATTER, tmStart);
 }
 
+#define LC_READSCATTEREX_BATCH          0x1000
+
+typedef struct tdLC_READSCATTEREX_SEGMENT {
+    MEM_SCATTER MEM;                // device MEM (translated address)
+    QWORD qwA;                      // untranslated address of the segment
+    DWORD cb;                       // requested segment size (MEM.cb may be lowered by partial reads)
+    DWORD iOwner;                   // index of owning extended MEM
+} LC_READSCATTEREX_SEGMENT, *PLC_READSCATTEREX_SEGMENT;
+
+/*
+* Read a batch of MEM segments and clear the success flag of the extended MEM
+* owning each failed segment.
+* -- hLC
+* -- cSeg
+* -- ppSeg
+* -- piOwner = index of owning extended MEM for each segment.
+* -- ppMEMsEx
+*/
+VOID LcReadScatterEx_ReadBatch(_In_ HANDLE hLC, _In_ DWORD cSeg, _Inout_ PPMEM_SCATTER ppSeg, _In_ PDWORD piOwner, _Inout_ PPMEM_SCATTER_EX ppMEMsEx)
+{
+    DWORD i;
+    LcReadScatter(hLC, cSeg, ppSeg);
+    for(i = 0; i < cSeg; i++) {
+        if(!ppSeg[i]->f) { ppMEMsEx[piOwner[i]]->f = FALSE; }
+    }
+}
+
+/*
+* Read extended MEMs split into page sized regular MEMs (which never cross page
+* boundaries) by LcReadScatter - so that the page based snapshot, readahead,
+* cache and negative cache stages apply.
+* -- hLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatterEx_ReadPages(_In_ HANDLE hLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER_EX ppMEMs)
+{
+    PBYTE pbBuffer;
+    PDWORD piOwner;
+    PMEM_SCATTER pMEM, pMEMs;
+    PPMEM_SCATTER ppSeg;
+    PMEM_SCATTER_EX pMEMEx;
+    QWORD o, cbSeg, paSeg;
+    DWORD iMEM, cSeg = 0;
+    if(!(pbBuffer = LcArena_Alloc(LC_READSCATTEREX_BATCH * (sizeof(MEM_SCATTER) + sizeof(PMEM_SCATTER) + sizeof(DWORD))))) { return; }
+    pMEMs = (PMEM_SCATTER)pbBuffer;
+    ppSeg = (PPMEM_SCATTER)(pMEMs + LC_READSCATTEREX_BATCH);
+    piOwner = (PDWORD)(ppSeg + LC_READSCATTEREX_BATCH);
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEMEx = ppMEMs[iMEM];
+        if(pMEMEx->f || !pMEMEx->cb || (pMEMEx->version != MEM_SCATTER_EX_VERSION)) { continue; }
+        if(pMEMEx->qwA + pMEMEx->cb < pMEMEx->qwA) { continue; }
+        pMEMEx->f = TRUE;
+        for(o = 0; o < pMEMEx->cb; o += cbSeg) {
+            // 1: split on page boundaries (memory map ranges are page aligned):
+            paSeg = pMEMEx->qwA + o;
+            cbSeg = min(0x1000 - (paSeg & 0xfff), pMEMEx->cb - o);
+            // 2: add segment to batch:
+            pMEM = pMEMs + cSeg;
+            ZeroMemory(pMEM, sizeof(MEM_SCATTER));
+            pMEM->version = MEM_SCATTER_VERSION;
+            pMEM->qwA = paSeg;
+            pMEM->cb = (DWORD)cbSeg;
+            pMEM->pb = pMEMEx->pb + o;
+            ppSeg[cSeg] = pMEM;
+            piOwner[cSeg] = iMEM;
+            cSeg++;
+            // 3: read batch when full:
+            if(cSeg == LC_READSCATTEREX_BATCH) {
+                LcReadScatterEx_ReadBatch(hLC, cSeg, ppSeg, piOwner, ppMEMs);
+                cSeg = 0;
+            }
+        }
+    }
+    if(cSeg) {
+        LcReadScatterEx_ReadBatch(hLC, cSeg, ppSeg, piOwner, ppMEMs);
+    }
+    LcArena_Free(pbBuffer);
+}
+
+/*
+* Read a batch of translated segments from the device. The unread remainder of
+* failed or partially read segments is re-read page by page - the readable
+* pages of a segment are thus kept - and the success flag of the extended MEM
+* owning a segment which still fails is cleared.
+* -- ctxLC
+* -- cSeg
+* -- pSegs
+* -- ppSeg
+* -- ppMEMsEx
+*/
+VOID LcReadScatterEx_ReadDeviceBatch(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cSeg, _Inout_ PLC_READSCATTEREX_SEGMENT pSegs, _Inout_ PPMEM_SCATTER ppSeg, _Inout_ PPMEM_SCATTER_EX ppMEMsEx)
+{
+    DWORD i, cbRead;
+    PLC_READSCATTEREX_SEGMENT pSeg;
+    MEM_SCATTER_EX MEMEx;
+    PMEM_SCATTER_EX pMEMEx = &MEMEx;
+    LcReadScatter_Device(ctxLC, cSeg, ppSeg);
+    for(i = 0; i < cSeg; i++) {
+        pSeg = pSegs + i;
+        cbRead = pSeg->MEM.f ? min(pSeg->MEM.cb, pSeg->cb) : 0;
+        if(cbRead == pSeg->cb) { continue; }
+        ZeroMemory(&MEMEx, sizeof(MEM_SCATTER_EX));
+        MEMEx.version = MEM_SCATTER_EX_VERSION;
+        MEMEx.qwA = pSeg->qwA + cbRead;
+        MEMEx.cb = pSeg->cb - cbRead;
+        MEMEx.pb = pSeg->MEM.pb + cbRead;
+        LcReadScatterEx_ReadPages((HANDLE)ctxLC, 1, &pMEMEx);
+        if(!MEMEx.f) { ppMEMsEx[pSeg->iOwner]->f = FALSE; }
+    }
+}
+
+/*
+* Read extended MEMs directly from the device. Each MEM is translated one
+* memory map range at a time and split only on memory map range boundaries and
+* on device max read size (cbReadScatterMax) boundaries - a 2MB large page is
+* thus typically read in one single device read.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatterEx_ReadDevice(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER_EX ppMEMs)
+{
+    PBYTE pbBuffer;
+    PPMEM_SCATTER ppSeg;
+    PMEM_SCATTER_EX pMEMEx;
+    PLC_READSCATTEREX_SEGMENT pSeg, pSegs;
+    QWORD o, cbSeg, paSeg, paDevice, cbReadMax;
+    DWORD iMEM, cSeg = 0;
+    cbReadMax = ctxLC->pfnReadScatter ? ctxLC->cbReadScatterMax : ctxLC->ReadContigious.cbChunkSize;
+    cbReadMax = max(0x1000, cbReadMax);
+    if(!(pbBuffer = LcArena_Alloc(LC_READSCATTEREX_BATCH * (sizeof(LC_READSCATTEREX_SEGMENT) + sizeof(PMEM_SCATTER))))) { return; }
+    pSegs = (PLC_READSCATTEREX_SEGMENT)pbBuffer;
+    ppSeg = (PPMEM_SCATTER)(pSegs + LC_READSCATTEREX_BATCH);
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEMEx = ppMEMs[iMEM];
+        if(pMEMEx->f || !pMEMEx->cb || (pMEMEx->version != MEM_SCATTER_EX_VERSION)) { continue; }
+        if(pMEMEx->qwA + pMEMEx->cb < pMEMEx->qwA) { continue; }
+        pMEMEx->f = TRUE;
+        for(o = 0; o < pMEMEx->cb; o += cbSeg) {
+            // 1: translate up until the end of the memory map range - and split
+            //    on device max read size boundaries:
+            paSeg = pMEMEx->qwA + o;
+            cbSeg = LcMemMap_TranslateRange(ctxLC, paSeg, pMEMEx->cb - o, &paDevice);
+            if(paDevice == (QWORD)-1) {
+                pMEMEx->f = FALSE;
+                continue;
+            }
+            cbSeg = min(cbSeg, cbReadMax - (paDevice % cbReadMax));
+            // 2: add segment to batch:
+            pSeg = pSegs + cSeg;
+            ZeroMemory(pSeg, sizeof(LC_READSCATTEREX_SEGMENT));
+            pSeg->MEM.version = MEM_SCATTER_VERSION;
+            pSeg->MEM.qwA = paDevice;
+            pSeg->MEM.cb = (DWORD)cbSeg;
+            pSeg->MEM.pb = pMEMEx->pb + o;
+            pSeg->qwA = paSeg;
+            pSeg->cb = (DWORD)cbSeg;
+            pSeg->iOwner = iMEM;
+            ppSeg[cSeg] = &pSeg->MEM;
+            cSeg++;
+            // 3: read batch when full:
+            if(cSeg == LC_READSCATTEREX_BATCH) {
+                LcReadScatterEx_ReadDeviceBatch(ctxLC, cSeg, pSegs, ppSeg, ppMEMs);
+                cSeg = 0;
+            }
+        }
+    }
+    if(cSeg) {
+        LcReadScatterEx_ReadDeviceBatch(ctxLC, cSeg, pSegs, ppSeg, ppMEMs);
+    }
+    LcArena_Free(pbBuffer);
+}
+
+/*
+* Read memory in a scattered way using extended MEMs of any size.
+* If page based stages (snapshot, readahead, caches or negative cache) are
+* active - or if the device is remote - each MEM is split into page sized MEMs
+* read by LcReadScatter so that the stages apply; the device read stage then
+* coalesces the pages into large contiguous device reads again where supported.
+* Otherwise each MEM is read directly from the device in as few segments as
+* the memory map and the device max read size allow.
+* -- hLC
+* -- cMEMs
+* -- ppMEMs
+*/
+EXPORTED_FUNCTION VOID LcReadScatterEx(_In_ HANDLE hLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER_EX ppMEMs)
+{
+    PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
+    QWORD tmStart = LcCallStart();
+    if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { return; }
+    if(ctxLC->Config.fRemote || LcSnapshot_IsActive(ctxLC) || LcReadAhead_IsEnabled(ctxLC) || LcCache_IsEnabled(ctxLC) || LcZCache_IsEnabled(ctxLC) || LcDiskCache_IsEnabled(ctxLC) || LcNegCache_IsEnabled(ctxLC)) {
+        LcReadScatterEx_ReadPages(hLC, cMEMs, ppMEMs);
+    } else {
+        LcReadScatterEx_ReadDevice(ctxLC, cMEMs, ppMEMs);
+    }
+    LcCallEnd(ctxLC, LC_STATISTICS_ID_READSCATTER, tmStart);
+}
+
+#define LC_READRANGES_BATCH             0x1000
+
+/*
+* Read multiple memory ranges given as flat address and size arrays into one
+* contiguous output buffer - range N is placed directly after range N-1.
+* The ranges are read in batches by LcReadScatterEx.
+* -- hLC
+* -- cRanges
+* -- pqwA = array of range addresses.
+* -- pcb = array of range sizes.
+* -- pbOut = output buffer - size is the sum of all range sizes.
+* -- pqwValidBitmap = optional bitmap, bit N is set if range N was read successfully.
+* -- return = TRUE if all ranges were read successfully.
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcReadRanges(_In_ HANDLE hLC, _In_ DWORD cRanges, _In_reads_(cRanges) const QWORD *pqwA, _In_reads_(cRanges) const DWORD *pcb, _Out_ PBYTE pbOut, _Out_writes_opt_((cRanges + 63) / 64) PQWORD pqwValidBitmap)
+{
+    PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
+    PBYTE pbBuffer;
+    PMEM_SCATTER_EX pMEMs;
+    PPMEM_SCATTER_EX ppMEMs;
+    DWORD i, iBase, cBatch;
+    QWORD o = 0;
+    BOOL fResult = TRUE;
+    if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { return FALSE; }
+    if(pqwValidBitmap) {
+        ZeroMemory(pqwValidBitmap, ((cRanges + 63) / 64) * sizeof(QWORD));
+    }
+    if(!(pbBuffer = LcArena_Alloc(LC_READRANGES_BATCH * (sizeof(MEM_SCATTER_EX) + sizeof(PMEM_SCATTER_EX))))) { return FALSE; }
+    pMEMs = (PMEM_SCATTER_EX)pbBuffer;
+    ppMEMs = (PPMEM_SCATTER_EX)(pMEMs + LC_READRANGES_BATCH);
+    for(iBase = 0; iBase < cRanges; iBase += cBatch) {
+        cBatch = min(LC_READRANGES_BATCH, cRanges - iBase);
+        for(i = 0; i < cBatch; i++) {
+            ppMEMs[i] = pMEMs + i;
+            pMEMs[i].version = MEM_SCATTER_EX_VERSION;
+            pMEMs[i].f = (pcb[iBase + i] == 0);
+            pMEMs[i].qwA = pqwA[iBase + i];
+            pMEMs[i].cb = pcb[iBase + i];
+            pMEMs[i].pb = pbOut + o;
+            o += pcb[iBase + i];
+        }
+        LcReadScatterEx(hLC, cBatch, ppMEMs);
+        for(i = 0; i < cBatch; i++) {
+            if(!pMEMs[i].f) {
+                fResult = FALSE;
+            } else if(pqwValidBitmap) {
+                pqwValidBitmap[(iBase + i) >> 6] |= 1ULL << ((iBase + i) & 63);
+            }
+        }
+    }
+    LcArena_Free(pbBuffer);
+    return fResult;
+}
+
 /*
 * Read memory in a contiguous way. Note that if multiple memory segments are
 * to be read LcReadScatter() may be more efficient.
@@ -800,7 +1613,7 @@ EXPORTED_FUNCTION BOOL LcRead(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cb, _Ou
     QWORD i, o, paBase, cMEMs;
     PPMEM_SCATTER ppMEMs = NULL;
     BOOL fFirst, fLast, f, fResult = FALSE;
-    BYTE pbFirst[0x1000] = { 0 }, pbLast[0x1000] = { 0 };
+    BYTE pbFirst[0x1000], pbLast[0x1000];
     PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
     QWORD tmStart = LcCallStart();
     if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { return FALSE; }
@@ -809,7 +1622,8 @@ EXPORTED_FUNCTION BOOL LcRead(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cb, _Ou
     if(cMEMs == 0) { return FALSE; }
     fFirst = (pa & 0xfff) || (cb < 0x1000);
     fLast = (cMEMs > 1) && ((pa + cb) & 0xfff);
-    f = LcAllocScatter3(
+    f = LcAllocScatter3_DoWork(
+        TRUE,
         fFirst ? pbFirst : NULL,
         fLast ? pbLast : NULL,
         cb - (fFirst ? 0x1000 - (pa & 0xfff) : 0) - (fLast ? (pa + cb) & 0xfff : 0),
@@ -836,7 +1650,7 @@ EXPORTED_FUNCTION BOOL LcRead(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cb, _Ou
     }
     fResult = TRUE;
 fail:
-    LocalFree(ppMEMs);
+    LcArena_Free(ppMEMs);
     LcCallEnd(ctxLC, LC_STATISTICS_ID_READ, tmStart);
     return fResult;
 }
@@ -859,29 +1673,40 @@ VOID LcWriteScatter_GatherContigious2(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs,
 }
 
 /*
-* Write scatter memory in a contigious way.
+* Write scatter memory in a contigious way. MEMs are sorted on address before
+* being gathered into writes of MEMs contiguous in both address and buffer.
 * -- ctxLC
 * -- cMEMs
 * -- ppMEMs
 */
 VOID LcWriteScatter_GatherContigious(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
 {
-    DWORD c = 0, cbCurrent;
+    DWORD c = 0, cbCurrent, cMEMsSort = 0;
     QWORD i, iBase = 0, paBase;
     PMEM_SCATTER pMEM;
+    PPMEM_SCATTER ppMEMsSort;
+    PMEM_SCATTER ppMEMsSortSmall[0x40];
+    BOOL fSorted;
+    if(!(ppMEMsSort = (cMEMs <= _countof(ppMEMsSortSmall)) ? ppMEMsSortSmall : LcArena_Alloc(cMEMs * sizeof(PMEM_SCATTER)))) { return; }
     for(i = 0; i < cMEMs; i++) {
         pMEM = ppMEMs[i];
-        if(pMEM->f || !MEM_SCATTER_ADDR_ISVALID(pMEM)) { continue; }
+        if(!pMEM->f && MEM_SCATTER_ADDR_ISVALID(pMEM)) {
+            ppMEMsSort[cMEMsSort++] = pMEM;
+        }
+    }
+    fSorted = Util_SortMEMs(cMEMsSort, ppMEMsSort);
+    for(i = 0; i < cMEMsSort; i++) {
+        pMEM = ppMEMsSort[i];
         if(c == 0) {
             c = 1;
             iBase = i;
             paBase = pMEM->qwA;
             cbCurrent = pMEM->cb;
-        } else if(paBase + cbCurrent == pMEM->qwA) {
+        } else if(fSorted && (paBase + cbCurrent == pMEM->qwA) && (ppMEMsSort[iBase]->pb + cbCurrent == pMEM->pb)) {
             c++;
             cbCurrent += pMEM->cb;
         } else {
-            LcWriteScatter_GatherContigious2(ctxLC, c, ppMEMs + iBase, cbCurrent);
+            LcWriteScatter_GatherContigious2(ctxLC, c, ppMEMsSort + iBase, cbCurrent);
             c = 1;
             iBase = i;
             paBase = pMEM->qwA;
@@ -889,8 +1714,9 @@ VOID LcWriteScatter_GatherContigious(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _
         }
     }
     if(c) {
-        LcWriteScatter_GatherContigious2(ctxLC, c, ppMEMs + iBase, cbCurrent);
+        LcWriteScatter_GatherContigious2(ctxLC, c, ppMEMsSort + iBase, cbCurrent);
     }
+    if(ppMEMsSort != ppMEMsSortSmall) { LcArena_Free(ppMEMsSort); }
 }
 
 /*
@@ -902,20 +1728,30 @@ VOID LcWriteScatter_GatherContigious(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _
 EXPORTED_FUNCTION VOID LcWriteScatter(_In_ HANDLE hLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
 {
     PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
-    QWORD i, tmStart = LcCallStart();
+    QWORD i, qwOffset, tmStart = LcCallStart();
+    BOOL fFast;
     if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { return; }
     if(!ctxLC->pfnWriteScatter && !ctxLC->pfnWriteContigious) { return; }
     if(!cMEMs) { return; }
     if(ctxLC->Config.fRemote && ctxLC->pfnWriteScatter) {
         // REMOTE
         ctxLC->pfnWriteScatter(ctxLC, cMEMs, ppMEMs);
+        InterlockedIncrement64(&ctxLC->qwWriteGeneration);
+        LcCache_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcNegCache_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcSnapshot_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcDiskCache_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcZCache_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcReadAhead_Invalidate(ctxLC, cMEMs, ppMEMs);
     } else {
         // LOCAL LEECHCORE
         // 1: TRANSLATE
-        for(i = 0; i < cMEMs; i++) {
-            MEM_SCATTER_STACK_PUSH(ppMEMs[i], ppMEMs[i]->qwA);
+        if(!(fFast = LcMemMap_TranslateMEMsFast(ctxLC, cMEMs, ppMEMs, &qwOffset))) {
+            for(i = 0; i < cMEMs; i++) {
+                MEM_SCATTER_STACK_PUSH(ppMEMs[i], ppMEMs[i]->qwA);
+            }
+            LcMemMap_TranslateMEMs(ctxLC, cMEMs, ppMEMs);
         }
-        LcMemMap_TranslateMEMs(ctxLC, cMEMs, ppMEMs);
         // 2: FETCH
         LcLockAcquire(ctxLC);
         if(ctxLC->pfnWriteScatter) {
@@ -924,9 +1760,20 @@ EXPORTED_FUNCTION VOID LcWriteScatter(_In_ HANDLE hLC, _In_ DWORD cMEMs, _Inout_
             LcWriteScatter_GatherContigious(ctxLC, cMEMs, ppMEMs);
         }
         LcLockRelease(ctxLC);
+        InterlockedIncrement64(&ctxLC->qwWriteGeneration);
+        LcCache_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcNegCache_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcSnapshot_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcDiskCache_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcZCache_Invalidate(ctxLC, cMEMs, ppMEMs);
+        LcReadAhead_Invalidate(ctxLC, cMEMs, ppMEMs);
         // 3: RESTORE
-        for(i = 0; i < cMEMs; i++) {
-            ppMEMs[i]->qwA = MEM_SCATTER_STACK_POP(ppMEMs[i]);
+        if(fFast) {
+            LcMemMap_TranslateMEMsFastRestore(cMEMs, ppMEMs, qwOffset);
+        } else {
+            for(i = 0; i < cMEMs; i++) {
+                ppMEMs[i]->qwA = MEM_SCATTER_STACK_POP(ppMEMs[i]);
+            }
         }
     }
     LcCallEnd(ctxLC, LC_STATISTICS_ID_WRITESCATTER, tmStart);
@@ -952,7 +1799,8 @@ EXPORTED_FUNCTION BOOL LcWrite(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cb, _I
     if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { goto fail; }
     // allocate
     cMEMs = (DWORD)(((pa & 0xfff) + cb + 0xfff) >> 12);
-    if(!(pbBuffer = (PBYTE)LocalAlloc(LMEM_ZEROINIT, cMEMs * (sizeof(MEM_SCATTER) + sizeof(PMEM_SCATTER))))) { goto fail; }
+    if(!(pbBuffer = (PBYTE)LcArena_Alloc(cMEMs * (sizeof(MEM_SCATTER) + sizeof(PMEM_SCATTER))))) { goto fail; }
+    ZeroMemory(pbBuffer, cMEMs * (sizeof(MEM_SCATTER) + sizeof(PMEM_SCATTER)));
     pMEMs = (PMEM_SCATTER)pbBuffer;
     ppMEMs = (PPMEM_SCATTER)(pbBuffer + cMEMs * sizeof(MEM_SCATTER));
     // prepare pages
@@ -976,7 +1824,7 @@ EXPORTED_FUNCTION BOOL LcWrite(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cb, _I
     }
     fResult = TRUE;
 fail:
-    LocalFree(pbBuffer);
+    LcArena_Free(pbBuffer);
     LcCallEnd(ctxLC, LC_STATISTICS_ID_WRITE, tmStart);
     return fResult;
 }
@@ -988,11 +1836,66 @@ fail:
 // ----------------------------------------------------------------------------
 
 /*
-* Helper function for LcGetOption.
+* Check whether an option is always handled by the local LeechCore instance -
+* also in the case of a remote connection (such as the core page cache).
+* -- fOption
+* -- return
+*/
+BOOL LcOption_IsLocal(_In_ QWORD fOption)
+{
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_CACHE_SIZE:
+        case LC_OPT_CORE_CACHE_POLICY:
+        case LC_OPT_CORE_CACHE_TTL:
+        case LC_OPT_CORE_CACHE_HIT:
+        case LC_OPT_CORE_CACHE_MISS:
+        case LC_OPT_CORE_READMERGE:
+        case LC_OPT_CORE_READMERGE_SAVED:
+        case LC_OPT_CORE_FANOUT_THREADS:
+        case LC_OPT_CORE_FANOUT_SLICE:
+        case LC_OPT_CORE_READAHEAD:
+        case LC_OPT_CORE_READAHEAD_HIT:
+        case LC_OPT_CORE_QOS_PRIORITY:
+        case LC_OPT_CORE_QOS_BYTES_PER_SEC:
+        case LC_OPT_CORE_QOS_PAGES_PER_SEC:
+        case LC_OPT_CORE_QOS_THROTTLE_MS:
+        case LC_OPT_CORE_NEGCACHE_TTL:
+        case LC_OPT_CORE_NEGCACHE_HIT:
+        case LC_OPT_CORE_NEGCACHE_FAIL:
+        case LC_OPT_CORE_SNAPSHOT_MEMMAX:
+        case LC_OPT_CORE_SNAPSHOT_PAGES:
+        case LC_OPT_CORE_SNAPSHOT_HIT:
+        case LC_OPT_CORE_DISKCACHE_PAGES:
+        case LC_OPT_CORE_DISKCACHE_HIT:
+        case LC_OPT_CORE_ZCACHE_BUDGET:
+        case LC_OPT_CORE_ZCACHE_TTL:
+        case LC_OPT_CORE_ZCACHE_HIT:
+        case LC_OPT_CORE_ZCACHE_PAGES:
+        case LC_OPT_CORE_ZCACHE_USED:
+        case LC_OPT_CORE_ALLOC_POLICY:
+        case LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES:
+        case LC_OPT_CORE_ALLOC_NUMA_BYTES:
+        case LC_OPT_CORE_ALLOC_NUMA_NODES:
+        case LC_OPT_CORE_ALLOC_PINNED:
+        case LC_OPT_CORE_DEVICE_CAPS_FLAGS:
+        case LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED:
+        case LC_OPT_CORE_DEVICE_CAPS_INFLIGHT_PEAK:
+        case LC_OPT_CORE_DEVICE_BATCH_SUBMIT:
+        case LC_OPT_CORE_DEVICE_BATCH_INFLIGHT_PEAK:
+        case LC_OPT_CORE_DEVICE_BATCH_REJECT:
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Helper function for LcGetOption. Core options are read without taking the
+* device lock - only options forwarded to the device serialize with device I/O.
 */
 _Success_(return)
 BOOL LcGetOption_DoWork(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
 {
+    BOOL fResult;
     *pqwValue = 0;
     switch(fOption & 0xffffffff00000000) {
         case LC_OPT_CORE_PRINTF_ENABLE:
@@ -1027,9 +1930,75 @@ BOOL LcGetOption_DoWork(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD
             if((DWORD)fOption > LC_STATISTICS_ID_MAX) { return FALSE; }
             *pqwValue = ctxLC->CallStat.Call[(DWORD)fOption].tm;
             return TRUE;
+        case LC_OPT_CORE_CACHE_SIZE:
+        case LC_OPT_CORE_CACHE_POLICY:
+        case LC_OPT_CORE_CACHE_TTL:
+        case LC_OPT_CORE_CACHE_HIT:
+        case LC_OPT_CORE_CACHE_MISS:
+            return LcCache_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_READMERGE:
+            *pqwValue = ctxLC->ReadMerge.fDisable ? 0 : 1;
+            return TRUE;
+        case LC_OPT_CORE_READMERGE_SAVED:
+            *pqwValue = ctxLC->ReadMerge.cSaved;
+            return TRUE;
+        case LC_OPT_CORE_RC_THREADS:
+            *pqwValue = ctxLC->ReadContigious.cThread;
+            return ctxLC->RC.fActive;
+        case LC_OPT_CORE_RC_CHUNKSIZE:
+            *pqwValue = ctxLC->ReadContigious.cbChunkSize;
+            return ctxLC->RC.fActive;
+        case LC_OPT_CORE_FANOUT_THREADS:
+        case LC_OPT_CORE_FANOUT_SLICE:
+            return LcFanout_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_READAHEAD:
+        case LC_OPT_CORE_READAHEAD_HIT:
+            return LcReadAhead_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_QOS_PRIORITY:
+        case LC_OPT_CORE_QOS_BYTES_PER_SEC:
+        case LC_OPT_CORE_QOS_PAGES_PER_SEC:
+        case LC_OPT_CORE_QOS_THROTTLE_MS:
+            return LcQos_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_NEGCACHE_TTL:
+        case LC_OPT_CORE_NEGCACHE_HIT:
+        case LC_OPT_CORE_NEGCACHE_FAIL:
+            return LcNegCache_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_SNAPSHOT_MEMMAX:
+        case LC_OPT_CORE_SNAPSHOT_PAGES:
+        case LC_OPT_CORE_SNAPSHOT_HIT:
+            return LcSnapshot_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_DISKCACHE_PAGES:
+        case LC_OPT_CORE_DISKCACHE_HIT:
+            return LcDiskCache_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_ZCACHE_BUDGET:
+        case LC_OPT_CORE_ZCACHE_TTL:
+        case LC_OPT_CORE_ZCACHE_HIT:
+        case LC_OPT_CORE_ZCACHE_PAGES:
+        case LC_OPT_CORE_ZCACHE_USED:
+            return LcZCache_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_ALLOC_POLICY:
+        case LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES:
+        case LC_OPT_CORE_ALLOC_NUMA_BYTES:
+        case LC_OPT_CORE_ALLOC_NUMA_NODES:
+        case LC_OPT_CORE_ALLOC_PINNED:
+            return LcAlloc_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_DEVICE_CAPS_FLAGS:
+        case LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED:
+        case LC_OPT_CORE_DEVICE_CAPS_INFLIGHT_PEAK:
+            return LcDeviceCaps_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_DEVICE_BATCH_SUBMIT:
+        case LC_OPT_CORE_DEVICE_BATCH_INFLIGHT_PEAK:
+        case LC_OPT_CORE_DEVICE_BATCH_REJECT:
+            return LcDeviceAsync_GetOption(ctxLC, fOption, pqwValue);
+        case LC_OPT_CORE_DEVICE_IDENTITY:
+            *pqwValue = ctxLC->qwDeviceIdentity;
+            return TRUE;
     }
     if(ctxLC->pfnGetOption) {
-        return ctxLC->pfnGetOption(ctxLC, fOption, pqwValue);
+        LcLockAcquire(ctxLC);
+        fResult = ctxLC->pfnGetOption(ctxLC, fOption, pqwValue);
+        LcLockRelease(ctxLC);
+        return fResult;
     }
     return FALSE;
 }
@@ -1049,11 +2018,13 @@ EXPORTED_FUNCTION BOOL LcGetOption(_In_ HANDLE hLC, _In_ QWORD fOption, _Out_ PQ
     QWORD tmStart = LcCallStart();
     BOOL fResult;
     if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { return FALSE; }
-    LcLockAcquire(ctxLC);
-    fResult = ctxLC->Config.fRemote ?
-        ctxLC->pfnGetOption(ctxLC, fOption, pqwValue) :
-        LcGetOption_DoWork(ctxLC, fOption, pqwValue);
-    LcLockRelease(ctxLC);
+    if(ctxLC->Config.fRemote && !LcOption_IsLocal(fOption)) {
+        LcLockAcquire(ctxLC);
+        fResult = ctxLC->pfnGetOption(ctxLC, fOption, pqwValue);
+        LcLockRelease(ctxLC);
+    } else {
+        fResult = LcGetOption_DoWork(ctxLC, fOption, pqwValue);
+    }
     LcCallEnd(ctxLC, LC_STATISTICS_ID_GETOPTION, tmStart);
     return fResult;
 }
@@ -1077,6 +2048,34 @@ BOOL LcSetOption_DoWork(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD q
         case LC_OPT_CORE_VERBOSE_EXTRA_TLP:
             ctxLC->fPrintf[LC_PRINTF_VVV] = qwValue ? TRUE : FALSE;
             return TRUE;
+        case LC_OPT_CORE_CACHE_SIZE:
+        case LC_OPT_CORE_CACHE_POLICY:
+        case LC_OPT_CORE_CACHE_TTL:
+            return LcCache_SetOption(ctxLC, fOption, qwValue);
+        case LC_OPT_CORE_READMERGE:
+            ctxLC->ReadMerge.fDisable = qwValue ? FALSE : TRUE;
+            return TRUE;
+        case LC_OPT_CORE_RC_THREADS:
+        case LC_OPT_CORE_RC_CHUNKSIZE:
+            return LcReadContigious_SetOption(ctxLC, fOption, qwValue);
+        case LC_OPT_CORE_FANOUT_THREADS:
+        case LC_OPT_CORE_FANOUT_SLICE:
+            return LcFanout_SetOption(ctxLC, fOption, qwValue);
+        case LC_OPT_CORE_READAHEAD:
+            return LcReadAhead_SetOption(ctxLC, fOption, qwValue);
+        case LC_OPT_CORE_QOS_PRIORITY:
+        case LC_OPT_CORE_QOS_BYTES_PER_SEC:
+        case LC_OPT_CORE_QOS_PAGES_PER_SEC:
+            return LcQos_SetOption(ctxLC, fOption, qwValue);
+        case LC_OPT_CORE_NEGCACHE_TTL:
+            return LcNegCache_SetOption(ctxLC, fOption, qwValue);
+        case LC_OPT_CORE_SNAPSHOT_MEMMAX:
+            return LcSnapshot_SetOption(ctxLC, fOption, qwValue);
+        case LC_OPT_CORE_ZCACHE_BUDGET:
+        case LC_OPT_CORE_ZCACHE_TTL:
+            return LcZCache_SetOption(ctxLC, fOption, qwValue);
+        case LC_OPT_CORE_ALLOC_POLICY:
+            return LcAlloc_SetOption(ctxLC, fOption, qwValue);
     }
     if(ctxLC->pfnSetOption) {
         return ctxLC->pfnSetOption(ctxLC, fOption, qwValue);
@@ -1099,7 +2098,7 @@ EXPORTED_FUNCTION BOOL LcSetOption(_In_ HANDLE hLC, _In_ QWORD fOption, _In_ QWO
     BOOL fResult;
     if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { return FALSE; }
     LcLockAcquire(ctxLC);
-    fResult = ctxLC->Config.fRemote ?
+    fResult = (ctxLC->Config.fRemote && !LcOption_IsLocal(fOption)) ?
         ctxLC->pfnSetOption(ctxLC, fOption, qwValue) :
         LcSetOption_DoWork(ctxLC, fOption, qwValue);
     LcLockRelease(ctxLC);
@@ -1108,11 +2107,32 @@ EXPORTED_FUNCTION BOOL LcSetOption(_In_ HANDLE hLC, _In_ QWORD fOption, _In_ QWO
 }
 
 /*
-* Helper function for LcCommand.
+* Check whether a command is always handled by the local LeechCore instance -
+* also in the case of a remote connection (such as the core negative cache).
+* -- fCommand
+* -- return
+*/
+BOOL LcCommand_IsLocal(_In_ QWORD fCommand)
+{
+    switch(fCommand) {
+        case LC_CMD_NEGCACHE_FLUSH:
+        case LC_CMD_SNAPSHOT_BEGIN:
+        case LC_CMD_SNAPSHOT_END:
+        case LC_CMD_DISKCACHE_OPEN:
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Helper function for LcCommand. Statistics and memory map commands are served
+* without taking the device lock (the memory map has its own writer lock) -
+* only commands forwarded to the device serialize with device I/O.
 */
 _Success_(return)
 BOOL LcCommand_DoWork(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ DWORD cbDataIn, _In_reads_opt_(cbDataIn) PBYTE pbDataIn, _Out_opt_ PBYTE *ppbDataOut, _Out_opt_ PDWORD pcbDataOut)
 {
+    BOOL fResult;
     if(ppbDataOut) { *ppbDataOut = NULL; }
     if(pcbDataOut) { *pcbDataOut = 0; }
     switch(fOption) {
@@ -1134,9 +2154,21 @@ BOOL LcCommand_DoWork(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ DWORD cbD
         case LC_CMD_MEMMAP_SET:
             if(!pbDataIn || !cbDataIn) { return FALSE; }
             return LcMemMap_SetRangesFromText(ctxLC, pbDataIn, cbDataIn);
+        case LC_CMD_NEGCACHE_FLUSH:
+            LcNegCache_Flush(ctxLC);
+            return TRUE;
+        case LC_CMD_SNAPSHOT_BEGIN:
+            return LcSnapshot_Begin(ctxLC, cbDataIn, (LPSTR)pbDataIn);
+        case LC_CMD_SNAPSHOT_END:
+            return LcSnapshot_End(ctxLC);
+        case LC_CMD_DISKCACHE_OPEN:
+            return LcDiskCache_Open(ctxLC, cbDataIn, (LPSTR)pbDataIn);
     }
     if(ctxLC->pfnCommand) {
-        return ctxLC->pfnCommand(ctxLC, fOption, cbDataIn, pbDataIn, ppbDataOut, pcbDataOut);
+        LcLockAcquire(ctxLC);
+        fResult = ctxLC->pfnCommand(ctxLC, fOption, cbDataIn, pbDataIn, ppbDataOut, pcbDataOut);
+        LcLockRelease(ctxLC);
+        return fResult;
     }
     return FALSE;
 }
@@ -1160,11 +2192,22 @@ EXPORTED_FUNCTION BOOL LcCommand(_In_ HANDLE hLC, _In_ QWORD fCommand, _In_ DWOR
     QWORD tmStart = LcCallStart();
     BOOL fResult;
     if(!ctxLC || ctxLC->version != LC_CONTEXT_VERSION) { return FALSE; }
-    LcLockAcquire(ctxLC);
-    fResult = ctxLC->Config.fRemote ?
-        ctxLC->pfnCommand(ctxLC, fCommand, cbDataIn, pbDataIn, ppbDataOut, pcbDataOut) :
-        LcCommand_DoWork(ctxLC, fCommand, cbDataIn, pbDataIn, ppbDataOut, pcbDataOut);
-    LcLockRelease(ctxLC);
+    if(ctxLC->Config.fRemote && !LcCommand_IsLocal(fCommand)) {
+        LcLockAcquire(ctxLC);
+        fResult = ctxLC->pfnCommand(ctxLC, fCommand, cbDataIn, pbDataIn, ppbDataOut, pcbDataOut);
+        LcLockRelease(ctxLC);
+    } else {
+        fResult = LcCommand_DoWork(ctxLC, fCommand, cbDataIn, pbDataIn, ppbDataOut, pcbDataOut);
+    }
+    if(fResult && ctxLC->Config.fRemote && ((fCommand == LC_CMD_MEMMAP_SET) || (fCommand == LC_CMD_MEMMAP_SET_STRUCT))) {
+        // remote cached and snapshot pages are keyed on untranslated addresses
+        // -> flush and end the snapshot epoch (if any).
+        LcCache_Flush(ctxLC);
+        LcZCache_Flush(ctxLC);
+        LcNegCache_Flush(ctxLC);
+        LcSnapshot_End(ctxLC);
+        LcDiskCache_SetMemMap(ctxLC, cbDataIn, pbDataIn);
+    }
     LcCallEnd(ctxLC, LC_STATISTICS_ID_COMMAND, tmStart);
     return fResult;
 }
@@ -188,6 +188,25 @@ extern "C" {
 #define MEM_SCATTER_STACK_ADD(pMEM, i, v)   (pMEM->vStack[pMEM->iStack - i] += (QWORD)v)
 #define MEM_SCATTER_STACK_POP(pMEM)         (pMEM->vStack[--pMEM->iStack])
 
+#define MEM_SCATTER_EX_VERSION              0xc0fe1001
+
+    /*
+    * Extended MEM with 64-bit size. Unlike MEM_SCATTER the extended MEM is not
+    * limited to 0x1000 bytes and may cross page boundaries - e.g. a 2MB large
+    * page may be read with one single MEM_SCATTER_EX. It is read by calling
+    * LcReadScatterEx.
+    */
+    typedef struct tdMEM_SCATTER_EX {
+        DWORD version;                          // MEM_SCATTER_EX_VERSION
+        BOOL f;                                 // TRUE = success all data in pb, FALSE = fail (partial) or not yet read.
+        QWORD qwA;                              // address of memory to read
+        union {
+            PBYTE pb;                           // buffer to hold memory contents
+            QWORD _Filler;
+        };
+        QWORD cb;                               // size of buffer to hold memory contents.
+    } MEM_SCATTER_EX, *PMEM_SCATTER_EX, **PPMEM_SCATTER_EX;
+
     /*
     * Free LeechCore allocated memory such as memory allocated by the
     * LcAllocScatter / LcCommand functions.
@@ -249,6 +268,32 @@ extern "C" {
             _Out_ PPMEM_SCATTER *pppMEMs
         );
 
+    /*
+    * Allocate and pre-initialize empty MEMs including a 0x1000 buffer for each
+    * pMEM - in the same way as LcAllocScatter1. The allocation is taken from a
+    * per-thread pool and is suitable for frequent allocation in hot loops.
+    * NB! The 0x1000 buffers are not zero initialized.
+    * CALLER LcFreeScatterPooled: *pppMEMs (NB! not LcMemFree).
+    * -- cMEMs
+    * -- pppMEMs = pointer to receive ppMEMs
+    * -- return
+    */
+    _Success_(return)
+        EXPORTED_FUNCTION BOOL LcAllocScatterPooled(
+            _In_ DWORD cMEMs,
+            _Out_ PPMEM_SCATTER *pppMEMs
+        );
+
+    /*
+    * Free MEMs allocated by LcAllocScatterPooled. The memory is returned to the
+    * pool of the calling thread for later re-use. Pointers not allocated by
+    * LcAllocScatterPooled (such as from LcAllocScatter1) are ignored.
+    * -- ppMEMs
+    */
+    EXPORTED_FUNCTION VOID LcFreeScatterPooled(
+        _Frees_ptr_opt_ PPMEM_SCATTER ppMEMs
+    );
+
     /*
     * Read memory in a scattered non-contiguous way. This is recommended for reads.
     * -- hLC
@@ -261,6 +306,47 @@ extern "C" {
         _Inout_ PPMEM_SCATTER ppMEMs
     );
 
+    /*
+    * Read memory in a scattered way using extended MEMs of any size. Each MEM is
+    * read in as few device reads as the memory map and the device allow (e.g. a
+    * large page in one single operation).
+    * Caches and snapshots (LC_OPT_CORE_SNAPSHOT_*) apply just as to LcReadScatter.
+    * -- hLC
+    * -- cMEMs
+    * -- ppMEMs
+    */
+    EXPORTED_FUNCTION VOID LcReadScatterEx(
+        _In_ HANDLE hLC,
+        _In_ DWORD cMEMs,
+        _Inout_ PPMEM_SCATTER_EX ppMEMs
+    );
+
+    /*
+    * Read multiple memory ranges given as flat address and size arrays into one
+    * contiguous output buffer. Range N is placed directly after range N-1 in
+    * pbOut. Ranges may be of any size and may cross page boundaries. This is
+    * recommended over LcReadScatter for very large batches since no per-page
+    * MEM_SCATTER has to be allocated by the caller.
+    * Contents of ranges which failed to read are undefined.
+    * -- hLC
+    * -- cRanges
+    * -- pqwA = array of range addresses.
+    * -- pcb = array of range sizes.
+    * -- pbOut = output buffer - size must be (at least) the sum of all range sizes.
+    * -- pqwValidBitmap = optional bitmap of (cRanges + 63) / 64 QWORDs, bit N is
+    *          set if range N was read successfully.
+    * -- return = TRUE if all ranges were read successfully.
+    */
+    _Success_(return)
+        EXPORTED_FUNCTION BOOL LcReadRanges(
+            _In_ HANDLE hLC,
+            _In_ DWORD cRanges,
+            _In_reads_(cRanges) const QWORD *pqwA,
+            _In_reads_(cRanges) const DWORD *pcb,
+            _Out_ PBYTE pbOut,
+            _Out_writes_opt_((cRanges + 63) / 64) PQWORD pqwValidBitmap
+        );
+
     /*
     * Read memory in a contiguous way. Note that if multiple memory segments are
     * to be read LcReadScatter() may be more efficient.
@@ -308,6 +394,227 @@ extern "C" {
 
 
 
+    //-----------------------------------------------------------------------------
+    // Asynchronous read functionality:
+    // Scatter reads may be submitted asynchronously. The read is performed by a
+    // LeechCore worker thread and the caller is notified by an optional callback
+    // and/or by waiting/polling the returned async read handle. Multiple reads
+    // may be in flight at the same time on the same LeechCore handle.
+    //-----------------------------------------------------------------------------
+
+#define LC_ASYNC_STATUS_PENDING                     0   // queued - not yet started.
+#define LC_ASYNC_STATUS_ACTIVE                      1   // read in progress.
+#define LC_ASYNC_STATUS_COMPLETE                    2   // read completed - check individual MEM.f for result.
+#define LC_ASYNC_STATUS_CANCELLED                   3   // read cancelled before it was started.
+#define LC_ASYNC_STATUS_INVALID                     0xffffffff
+
+    /*
+    * Callback function invoked when an asynchronous read is completed or
+    * cancelled. The callback is invoked on a LeechCore worker thread (or on
+    * the thread calling LcReadScatterAsyncCancel) and should return quickly.
+    * -- ctx = ctxCallback as supplied to LcReadScatterAsync.
+    * -- hLcAsync = the async read handle.
+    * -- cMEMs
+    * -- ppMEMs
+    */
+    typedef VOID(*PLC_READSCATTER_ASYNC_CALLBACK)(
+        _In_opt_ PVOID ctx,
+        _In_ HANDLE hLcAsync,
+        _In_ DWORD cMEMs,
+        _In_ PPMEM_SCATTER ppMEMs
+    );
+
+    /*
+    * Submit an asynchronous scatter read. The function returns immediately and
+    * the read is performed by a LeechCore worker thread.
+    * The ppMEMs array and its MEMs must remain valid until the read is completed.
+    * CALLER LcReadScatterAsyncClose: return
+    * -- hLC
+    * -- cMEMs
+    * -- ppMEMs
+    * -- pfnCallback = optional callback invoked on completion/cancellation.
+    * -- ctxCallback = optional context passed to pfnCallback.
+    * -- return = async read handle, NULL on fail.
+    */
+    _Success_(return != NULL)
+        EXPORTED_FUNCTION HANDLE LcReadScatterAsync(
+            _In_ HANDLE hLC,
+            _In_ DWORD cMEMs,
+            _Inout_ PPMEM_SCATTER ppMEMs,
+            _In_opt_ PLC_READSCATTER_ASYNC_CALLBACK pfnCallback,
+            _In_opt_ PVOID ctxCallback
+        );
+
+    /*
+    * Wait for an asynchronous scatter read to complete.
+    * -- hLcAsync
+    * -- dwMilliseconds = timeout in ms, INFINITE (0xffffffff) to wait forever.
+    * -- return = TRUE if the read is completed (or cancelled), FALSE on timeout.
+    */
+    _Success_(return)
+        EXPORTED_FUNCTION BOOL LcReadScatterAsyncWait(
+            _In_ HANDLE hLcAsync,
+            _In_ DWORD dwMilliseconds
+        );
+
+    /*
+    * Retrieve the status of an asynchronous scatter read without waiting.
+    * -- hLcAsync
+    * -- return = LC_ASYNC_STATUS_*
+    */
+    EXPORTED_FUNCTION DWORD LcReadScatterAsyncPoll(
+        _In_ HANDLE hLcAsync
+    );
+
+    /*
+    * Cancel an asynchronous scatter read which is not yet started. The callback
+    * (if any) is invoked on the calling thread before this function returns.
+    * -- hLcAsync
+    * -- return = TRUE if the read was cancelled.
+    */
+    _Success_(return)
+        EXPORTED_FUNCTION BOOL LcReadScatterAsyncCancel(
+            _In_ HANDLE hLcAsync
+        );
+
+    /*
+    * Close an asynchronous scatter read handle. A pending read is cancelled and
+    * an active read is waited upon. The handle may be closed from within its
+    * completion callback. All async read handles should be closed before the
+    * LeechCore handle is closed.
+    * -- hLcAsync
+    */
+    EXPORTED_FUNCTION VOID LcReadScatterAsyncClose(
+        _In_opt_ _Post_ptr_invalid_ HANDLE hLcAsync
+    );
+
+
+
+    //-----------------------------------------------------------------------------
+    // Streaming read functionality:
+    // Large memory ranges (larger than the DWORD size limit of LcRead) may be
+    // read in bounded-size chunks which are delivered to a caller callback. The
+    // next chunk is read in the background while the callback is running.
+    // Large scatter reads may be delivered to a caller callback chunk by chunk
+    // as they complete.
+    //-----------------------------------------------------------------------------
+
+    /*
+    * Callback function invoked once per chunk by LcReadStream - in address order
+    * and on the thread calling LcReadStream.
+    * Page validity: bit N in pqwValidBitmap is set if the page at address
+    * (pa & ~0xfff) + N * 0x1000 was read successfully. Pages which could not
+    * be read are zero-filled.
+    * -- ctx = ctxCallback as supplied to LcReadStream.
+    * -- pa = address of first byte in pb.
+    * -- cb = number of bytes in pb.
+    * -- pb = chunk data (only valid during the callback).
+    * -- cPages = number of pages in pqwValidBitmap.
+    * -- pqwValidBitmap = page validity bitmap.
+    * -- return = TRUE to continue, FALSE to abort the stream.
+    */
+    typedef BOOL(*PLC_READSTREAM_CALLBACK)(
+        _In_opt_ PVOID ctx,
+        _In_ QWORD pa,
+        _In_ DWORD cb,
+        _In_reads_(cb) PBYTE pb,
+        _In_ DWORD cPages,
+        _In_reads_((cPages + 63) / 64) PQWORD pqwValidBitmap
+    );
+
+    /*
+    * Read a large memory range in chunks. Each chunk is delivered to pfnCallback
+    * once read. At most two chunks are held in memory at any time.
+    * -- hLC
+    * -- pa = start address.
+    * -- cb = number of bytes to read.
+    * -- cbChunk = chunk size in bytes (rounded up to page size), 0 = default (4MB), max 64MB.
+    * -- pfnCallback
+    * -- ctxCallback = optional context passed to pfnCallback.
+    * -- return = TRUE if the whole range was delivered, FALSE on fail or abort.
+    */
+    _Success_(return)
+        EXPORTED_FUNCTION BOOL LcReadStream(
+            _In_ HANDLE hLC,
+            _In_ QWORD pa,
+            _In_ QWORD cb,
+            _In_ DWORD cbChunk,
+            _In_ PLC_READSTREAM_CALLBACK pfnCallback,
+            _In_opt_ PVOID ctxCallback
+        );
+
+    /*
+    * Callback function invoked by LcReadScatterStream once per completed chunk
+    * of MEMs - on the thread calling LcReadScatterStream. The chunk MEMs are
+    * sorted on address and check individual MEM.f for the read result.
+    * -- ctx = ctxCallback as supplied to LcReadScatterStream.
+    * -- cMEMs
+    * -- ppMEMs = completed MEMs (array only valid during the callback).
+    * -- return = TRUE to continue, FALSE to abort the read.
+    */
+    typedef BOOL(*PLC_READSCATTER_STREAM_CALLBACK)(
+        _In_opt_ PVOID ctx,
+        _In_ DWORD cMEMs,
+        _In_ PPMEM_SCATTER ppMEMs
+    );
+
+    /*
+    * Read memory in a scattered way and deliver the MEMs to pfnCallback as they
+    * complete instead of after the whole read. The MEMs are read in address
+    * sorted chunks with multiple chunks in flight - chunks are delivered in
+    * completion order. This allows the caller to start processing a large read
+    * before the slowest pages of it are read. MEMs of an aborted read which
+    * were not delivered are in an undefined state.
+    * -- hLC
+    * -- cMEMs
+    * -- ppMEMs
+    * -- cMEMsChunk = max MEMs per callback, 0 = default (256).
+    * -- pfnCallback
+    * -- ctxCallback = optional context passed to pfnCallback.
+    * -- return = TRUE if all MEMs were delivered, FALSE on fail or abort.
+    */
+    _Success_(return)
+        EXPORTED_FUNCTION BOOL LcReadScatterStream(
+            _In_ HANDLE hLC,
+            _In_ DWORD cMEMs,
+            _Inout_ PPMEM_SCATTER ppMEMs,
+            _In_ DWORD cMEMsChunk,
+            _In_ PLC_READSCATTER_STREAM_CALLBACK pfnCallback,
+            _In_opt_ PVOID ctxCallback
+        );
+
+
+
+    //-----------------------------------------------------------------------------
+    // Readahead / prefetch functionality:
+    // Ascending read streams are detected and the memory following them is read
+    // in the background if LC_OPT_CORE_READAHEAD is set. Memory about to be read
+    // may also be explicitly hinted by LcPrefetch. Prefetched pages are served
+    // until the page is read in full once. On volatile devices prefetched pages
+    // expire after the page cache time-to-live (LC_OPT_CORE_CACHE_TTL).
+    //-----------------------------------------------------------------------------
+
+    /*
+    * Hint that memory ranges will be read shortly. The ranges are read in the
+    * background into a bounded prefetch buffer - if more memory than fits in
+    * the buffer is prefetched pages prefetched earlier may be discarded.
+    * Prefetch is not supported on remote connections.
+    * -- hLC
+    * -- cRanges
+    * -- pqwA = range start addresses.
+    * -- pcb = range sizes in bytes.
+    * -- return = TRUE if all ranges were queued for prefetch.
+    */
+    _Success_(return)
+        EXPORTED_FUNCTION BOOL LcPrefetch(
+            _In_ HANDLE hLC,
+            _In_ DWORD cRanges,
+            _In_reads_(cRanges) const QWORD *pqwA,
+            _In_reads_(cRanges) const DWORD *pcb
+        );
+
+
+
     //-----------------------------------------------------------------------------
     // Get/Set/Command functionality may be used to query and/or update LeechCore
     // or its devices in various ways.
@@ -374,6 +681,48 @@ extern "C" {
 #define LC_OPT_CORE_ADDR_MAX                        0x1000000800000000  // R
 #define LC_OPT_CORE_STATISTICS_CALL_COUNT           0x4000000900000000  // R [lo-dword: LC_STATISTICS_ID_*]
 #define LC_OPT_CORE_STATISTICS_CALL_TIME            0x4000000a00000000  // R [lo-dword: LC_STATISTICS_ID_*]
+#define LC_OPT_CORE_CACHE_SIZE                      0x4000000b00000000  // RW - page cache size in 4kB pages (0 = disabled).
+#define LC_OPT_CORE_CACHE_POLICY                    0x4000000c00000000  // RW - page cache policy LC_CACHE_POLICY_*
+#define LC_OPT_CORE_CACHE_TTL                       0x4000000d00000000  // RW - page cache time-to-live in ms (TTL policy only).
+#define LC_OPT_CORE_CACHE_HIT                       0x4000000e00000000  // R  - page cache hit count.
+#define LC_OPT_CORE_CACHE_MISS                      0x4000000f00000000  // R  - page cache miss count.
+#define LC_OPT_CORE_READMERGE                       0x4000001000000000  // RW - merge duplicate/sub-page reads (default: 1 = enabled).
+#define LC_OPT_CORE_READMERGE_SAVED                 0x4000001100000000  // R  - number of device reads saved by read merging.
+#define LC_OPT_CORE_RC_THREADS                      0x4000001200000000  // RW - contigious read threads (1 .. max supported by device - may exceed the device default).
+#define LC_OPT_CORE_RC_CHUNKSIZE                    0x4000001300000000  // RW - contigious read max chunk size in bytes (max 64MB).
+#define LC_OPT_CORE_FANOUT_THREADS                  0x4000001400000000  // RW - parallel read threads for thread-safe devices (1 = disabled, max 32).
+#define LC_OPT_CORE_FANOUT_SLICE                    0x4000001500000000  // RW - MEMs per parallel read slice (default: 0x400).
+#define LC_OPT_CORE_READAHEAD                       0x4000001600000000  // RW - sequential readahead window in 4kB pages (0 = disabled, max 0x1000).
+#define LC_OPT_CORE_READAHEAD_HIT                   0x4000001700000000  // R  - reads served from the readahead / prefetch buffer.
+#define LC_OPT_CORE_QOS_PRIORITY                    0x4000001800000000  // RW - read priority of the calling thread LC_QOS_PRIORITY_*
+#define LC_OPT_CORE_QOS_BYTES_PER_SEC               0x4000001900000000  // RW - device read limit in bytes/s (0 = unlimited).
+#define LC_OPT_CORE_QOS_PAGES_PER_SEC               0x4000001a00000000  // RW - device read limit in pages/s (0 = unlimited).
+#define LC_OPT_CORE_QOS_THROTTLE_MS                 0x4000001b00000000  // R  - total ms background reads were delayed by the read limits.
+#define LC_OPT_CORE_NEGCACHE_TTL                    0x4000001c00000000  // RW - negative cache time-to-live of unreadable pages in ms (0 = disabled, max 3600000).
+#define LC_OPT_CORE_NEGCACHE_HIT                    0x4000001d00000000  // R  - page reads failed by the negative cache without a device read.
+#define LC_OPT_CORE_NEGCACHE_FAIL                   0x4000001e00000000  // R  - failed page reads recorded in the negative cache.
+#define LC_OPT_CORE_SNAPSHOT_MEMMAX                 0x4000001f00000000  // RW - snapshot in-memory page store size in bytes - applied at next LC_CMD_SNAPSHOT_BEGIN (default: 256MB).
+#define LC_OPT_CORE_SNAPSHOT_PAGES                  0x4000002000000000  // R  - pages retained in the current snapshot epoch.
+#define LC_OPT_CORE_SNAPSHOT_HIT                    0x4000002100000000  // R  - page reads served from the current snapshot epoch.
+#define LC_OPT_CORE_DISKCACHE_PAGES                 0x4000002200000000  // R  - pages stored in the persistent disk cache.
+#define LC_OPT_CORE_DISKCACHE_HIT                   0x4000002300000000  // R  - page reads served from the persistent disk cache.
+#define LC_OPT_CORE_ZCACHE_BUDGET                   0x4000002400000000  // RW - compressed page cache memory budget in bytes (0 = disabled, max 256GB).
+#define LC_OPT_CORE_ZCACHE_TTL                      0x4000002500000000  // RW - compressed page cache time-to-live in ms (0 = no expiry).
+#define LC_OPT_CORE_ZCACHE_HIT                      0x4000002600000000  // R  - page reads served from the compressed page cache.
+#define LC_OPT_CORE_ZCACHE_PAGES                    0x4000002700000000  // R  - pages stored in the compressed page cache.
+#define LC_OPT_CORE_ZCACHE_USED                     0x4000002800000000  // R  - bytes of memory used by the compressed page cache.
+#define LC_OPT_CORE_ALLOC_POLICY                    0x4000002900000000  // RW - read buffer allocation policy LC_ALLOC_POLICY_* flags - also by device parameter 'alloc=<policy>'.
+#define LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES            0x4000002a00000000  // R  - bytes of read buffers backed by (or advised as transparent) huge pages.
+#define LC_OPT_CORE_ALLOC_NUMA_BYTES                0x4000002b00000000  // R  - bytes of read buffers placed on the NUMA node of their read worker thread.
+#define LC_OPT_CORE_ALLOC_NUMA_NODES                0x4000002c00000000  // R  - number of NUMA nodes in the system.
+#define LC_OPT_CORE_ALLOC_PINNED                    0x4000002d00000000  // R  - read worker threads currently pinned to a NUMA node.
+#define LC_OPT_CORE_DEVICE_CAPS_FLAGS               0x4000002e00000000  // R  - device read capability flags LC_DEVICE_CAPS_FLAG_* (leechcore_device.h).
+#define LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED      0x4000002f00000000  // R  - device reads saved by coalescing contiguous pages.
+#define LC_OPT_CORE_DEVICE_BATCH_SUBMIT             0x4000003000000000  // R  - batches submitted to asynchronous (pfnSubmit) device.
+#define LC_OPT_CORE_DEVICE_BATCH_INFLIGHT_PEAK      0x4000003100000000  // R  - peak batches in flight at asynchronous (pfnSubmit) device.
+#define LC_OPT_CORE_DEVICE_CAPS_INFLIGHT_PEAK       0x4000003200000000  // R  - peak concurrent device reads (limited by device caps cInFlightMax).
+#define LC_OPT_CORE_DEVICE_BATCH_REJECT             0x4000003300000000  // R  - batches finally rejected by asynchronous (pfnSubmit) device (failed).
+#define LC_OPT_CORE_DEVICE_IDENTITY                 0x4000003400000000  // R  - content identity of the device (0 = not supplied - no disk cache).
 
 #define LC_OPT_MEMORYINFO_VALID                     0x0200000100000000  // R
 #define LC_OPT_MEMORYINFO_FLAG_32BIT                0x0200000300000000  // R
@@ -435,6 +784,10 @@ extern "C" {
 #define LC_CMD_MEMMAP_SET                           0x4000030000000000  // W  - MEMMAP as LPSTR
 #define LC_CMD_MEMMAP_GET_STRUCT                    0x4000040000000000  // R  - MEMMAP as LC_MEMMAP_ENTRY[]
 #define LC_CMD_MEMMAP_SET_STRUCT                    0x4000050000000000  // W  - MEMMAP as LC_MEMMAP_ENTRY[]
+#define LC_CMD_NEGCACHE_FLUSH                       0x4000060000000000  //    - remove all pages from the negative cache.
+#define LC_CMD_SNAPSHOT_BEGIN                       0x4000070000000000  // W  - begin snapshot epoch [pbDataIn: optional spill file path as LPSTR]
+#define LC_CMD_SNAPSHOT_END                         0x4000080000000000  //    - end snapshot epoch and free retained pages.
+#define LC_CMD_DISKCACHE_OPEN                       0x4000090000000000  // W  - open persistent disk cache (non-volatile devices only) [pbDataIn: directory as LPSTR] - also by device parameter 'diskcache=<directory>'.
 
 #define LC_CMD_AGENT_EXEC_PYTHON                    0x8000000100000000  // RW - [lo-dword: optional timeout in ms]
 #define LC_CMD_AGENT_EXIT_PROCESS                   0x8000000200000000  //    - [lo-dword: process exit code]
@@ -444,6 +797,17 @@ extern "C" {
 #define LC_CMD_AGENT_VFS_OPT_GET                    0x8000000600000000  // RW
 #define LC_CMD_AGENT_VFS_OPT_SET                    0x8000000700000000  // RW
 
+#define LC_CACHE_POLICY_AUTO                        0   // LRU on non-volatile devices, TTL on volatile devices.
+#define LC_CACHE_POLICY_LRU                         1   // least recently used eviction.
+#define LC_CACHE_POLICY_TTL                         2   // least recently used eviction and time-to-live expiry.
+
+#define LC_QOS_PRIORITY_INTERACTIVE                 0   // default - never delayed by background reads or read limits.
+#define LC_QOS_PRIORITY_BACKGROUND                  1   // yields to interactive reads and is throttled to the read limits.
+
+#define LC_ALLOC_POLICY_HUGEPAGE                    0x01    // back large read buffers with 2MB huge pages.
+#define LC_ALLOC_POLICY_NUMA                        0x02    // place read worker buffers on the NUMA node of the worker.
+#define LC_ALLOC_POLICY_PIN                         0x04    // pin read worker threads to the processors of their NUMA node.
+
 #define LC_CMD_AGENT_VFS_REQ_VERSION                0xfeed0001
 #define LC_CMD_AGENT_VFS_RSP_VERSION                0xfeee0001
 
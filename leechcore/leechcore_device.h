@@ -15,10 +15,19 @@
 // device may be created/opened - if only one instance may be open at the same
 // time this should be handled by the plugin module itself.
 //
+// Devices backed by an asynchronous transport may set pfnSubmit (and optionally
+// pfnPoll) instead of pfnReadScatter in LcPluginCreate(). Each submitted batch
+// must be completed exactly once by calling pBatch->pfnComplete - either from
+// the device's own completion thread or from within pfnPoll. The core bridges
+// the batches to both synchronous and asynchronous (LcReadScatterAsync) reads.
+// NB! the bridge is blocking: each batch in flight is waited upon by one core
+// thread (the reading thread or an async/fan-out worker thread) - completions
+// are not delivered to LcReadScatterAsync callers directly from the device.
+//
 // (c) Ulf Frisk, 2020-2022
 // Author: Ulf Frisk, pcileech@frizk.net
 //
-// Header Version: 2.5
+// Header Version: 2.6
 //
 
 #ifndef __LEECHCORE_DEVICE_H__
@@ -40,6 +49,8 @@ typedef struct tdCRITICAL_SECTION {
 
 #define LC_CONTEXT_VERSION                  0xc0e10004
 #define LC_DEVICE_PARAMETER_MAX_ENTRIES     0x10
+#define LC_DEVICE_PARAMETER_DISKCACHE       "diskcache"     // core parameter: persistent disk cache directory.
+#define LC_DEVICE_PARAMETER_ALLOC           "alloc"         // core parameter: read buffer allocation policy LC_ALLOC_POLICY_*
 
 typedef struct tdLC_DEVICE_PARAMETER_ENTRY {
     CHAR szName[MAX_PATH];
@@ -48,6 +59,21 @@ typedef struct tdLC_DEVICE_PARAMETER_ENTRY {
 } LC_DEVICE_PARAMETER_ENTRY, *PLC_DEVICE_PARAMETER_ENTRY;
 
 typedef struct tdLC_CONTEXT LC_CONTEXT, *PLC_CONTEXT;
+typedef struct tdLC_CACHE_CONTEXT *PLC_CACHE_CONTEXT;
+typedef struct tdLC_ASYNC_CONTEXT *PLC_ASYNC_CONTEXT;
+typedef struct tdLC_MERGE_CONTEXT *PLC_MERGE_CONTEXT;
+typedef struct tdLC_RC_POOL *PLC_RC_POOL;
+typedef struct tdLC_FANOUT_CONTEXT *PLC_FANOUT_CONTEXT;
+typedef struct tdLC_READAHEAD_CONTEXT *PLC_READAHEAD_CONTEXT;
+typedef struct tdLC_MEMMAP_CONTEXT *PLC_MEMMAP_CONTEXT;
+typedef struct tdLC_QOS_CONTEXT *PLC_QOS_CONTEXT;
+typedef struct tdLC_NEGCACHE_CONTEXT *PLC_NEGCACHE_CONTEXT;
+typedef struct tdLC_SNAPSHOT_CONTEXT *PLC_SNAPSHOT_CONTEXT;
+typedef struct tdLC_DISKCACHE_CONTEXT *PLC_DISKCACHE_CONTEXT;
+typedef struct tdLC_ZCACHE_CONTEXT *PLC_ZCACHE_CONTEXT;
+typedef struct tdLC_ALLOC_CONTEXT *PLC_ALLOC_CONTEXT;
+typedef struct tdLC_DEVASYNC_CONTEXT *PLC_DEVASYNC_CONTEXT;
+typedef struct tdLC_DEVCAPS_CONTEXT *PLC_DEVCAPS_CONTEXT;
 
 typedef struct tdLC_READ_CONTIGIOUS_CONTEXT {
     PLC_CONTEXT ctxLC;
@@ -63,6 +89,44 @@ typedef struct tdLC_READ_CONTIGIOUS_CONTEXT {
     BYTE pb[0];
 } LC_READ_CONTIGIOUS_CONTEXT, *PLC_READ_CONTIGIOUS_CONTEXT;
 
+#define LC_DEVICE_CAPS_VERSION              0xca910001
+#define LC_DEVICE_CAPS_FLAG_THREADSAFE      0x00000001      // pfnReadScatter may be called concurrently (as fMultiThread).
+#define LC_DEVICE_CAPS_FLAG_SORTED          0x00000002      // device reads are faster if MEMs are sorted on address.
+#define LC_DEVICE_CAPS_FLAG_CONTIGUOUS      0x00000004      // device reads contiguous runs cheaper than scattered pages.
+#define LC_DEVICE_CAPS_FLAG_PARTIAL         0x00000008      // MEMs larger than 0x1000 may be completed partially - f set and cb lowered to the whole pages read.
+
+/*
+* Device read capabilities - optionally filled in by the device in pfnCreate
+* (dwVersion must then be set to LC_DEVICE_CAPS_VERSION). The core uses the
+* caps to pick batch splitting, sorting, parallelism and contiguous coalescing
+* of scatter reads. Zero values are treated as 'no requirement'.
+*/
+typedef struct tdLC_DEVICE_CAPS {
+    DWORD dwVersion;                // LC_DEVICE_CAPS_VERSION
+    DWORD fFlags;                   // LC_DEVICE_CAPS_FLAG_*
+    DWORD cMEMsBatchMax;            // max MEMs per pfnReadScatter call.
+    DWORD cInFlightMax;             // max concurrent pfnReadScatter calls (THREADSAFE only) - enforced by the core.
+    DWORD cbAlign;                  // MEMs not on this address/size alignment are widened and bounced (power of two, max 0x1000, 0 = MEMs passed as-is).
+    DWORD cThreadContigiousMax;     // contigious devices: max concurrent pfnReadContigious threads (default ReadContigious.cThread).
+    DWORD _Reserved[10];
+} LC_DEVICE_CAPS, *PLC_DEVICE_CAPS;
+
+#define LC_DEVICE_BATCH_VERSION             0xba7c0001
+
+/*
+* Read batch submitted to asynchronous devices by pfnSubmit. The batch is owned
+* by the core and stays valid until the device calls pfnComplete. The device
+* sets MEM.f on successfully read MEMs before completing the batch and must not
+* access the batch once pfnComplete has been called.
+*/
+typedef struct tdLC_DEVICE_BATCH {
+    DWORD dwVersion;                // LC_DEVICE_BATCH_VERSION
+    DWORD cMEMs;
+    PPMEM_SCATTER ppMEMs;
+    PVOID pvDevice;                 // free for use by the device while in flight.
+    VOID(*pfnComplete)(_In_ struct tdLC_DEVICE_BATCH *pBatch);
+} LC_DEVICE_BATCH, *PLC_DEVICE_BATCH;
+
 #define LC_PRINTF_ENABLE            0
 #define LC_PRINTF_V                 1
 #define LC_PRINTF_VV                2
@@ -99,13 +163,13 @@ typedef struct tdLC_CONTEXT {
     struct {
         DWORD cThread;
         DWORD cbChunkSize;
-        BOOL fLoadBalance;
+        BOOL fLoadBalance;  // deprecated - reads are always split into load balanced sub-chunks.
     } ReadContigious;
     // Internal ReadContigious functionality:
     struct {
         BOOL fActive;
-        HANDLE hEventFinish[8];
-        PLC_READ_CONTIGIOUS_CONTEXT ctx[8];
+        PLC_RC_POOL pPool;
+        PVOID _Reserved[15];
     } RC;
     // MemMap functionality:
     DWORD cMemMap;
@@ -116,6 +180,69 @@ typedef struct tdLC_CONTEXT {
         BOOL fCompress;
         DWORD dwRpcClientId;
     } Rpc;
+    // Internal write generation - incremented after each write before caches
+    // are invalidated. Reads started before a write do not populate caches.
+    QWORD volatile qwWriteGeneration;
+    // Internal page cache functionality:
+    PLC_CACHE_CONTEXT pCache;
+    // Internal async read functionality:
+    PLC_ASYNC_CONTEXT pAsync;
+    // Internal lock-free read submission queue (coalesced device reads):
+    PVOID volatile pReadSubmitHead;
+    DWORD volatile fReadSubmitDispatch;
+    // Internal duplicate/sub-page read merge functionality:
+    struct {
+        BOOL fDisable;
+        QWORD cSaved;
+    } ReadMerge;
+    // Max MEM.cb supported by pfnReadScatter - MEMs may then cross page
+    // boundaries (optionally set by device at open, 0 = default 0x1000).
+    DWORD cbReadScatterMax;
+    // Internal parallel fan-out read functionality (fMultiThread devices):
+    PLC_FANOUT_CONTEXT pFanout;
+    // Internal sequential readahead / prefetch functionality:
+    PLC_READAHEAD_CONTEXT pReadAhead;
+    // Internal memory map lock and lock-free reader snapshots:
+    PLC_MEMMAP_CONTEXT pMemMapCtx;
+    // Internal read priority / bandwidth limit functionality:
+    PLC_QOS_CONTEXT pQos;
+    // Internal negative cache of unreadable pages:
+    PLC_NEGCACHE_CONTEXT pNegCache;
+    // Internal snapshot epoch functionality:
+    PLC_SNAPSHOT_CONTEXT pSnapshot;
+    // Internal persistent on-disk page cache functionality:
+    PLC_DISKCACHE_CONTEXT pDiskCache;
+    // Identity of the device memory contents (optional - set by devices in
+    // pfnCreate to key the persistent on-disk page cache, such as a file hash).
+    // Non-volatile devices leaving it at zero are not disk cached:
+    QWORD qwDeviceIdentity;
+    // Internal compressed in-memory page cache functionality:
+    PLC_ZCACHE_CONTEXT pZCache;
+    // Internal huge page / NUMA aware read buffer allocation functionality:
+    PLC_ALLOC_CONTEXT pAlloc;
+    // Device read capabilities (optionally filled in by devices in pfnCreate):
+    LC_DEVICE_CAPS Caps;
+    // Internal device reads saved by contiguous coalescing:
+    QWORD cCoalesceSaved;
+    // Asynchronous device interface (optionally set by devices in pfnCreate
+    // instead of pfnReadScatter). pfnSubmit returns FALSE if the batch is not
+    // accepted (it must then not be completed) - the batch is re-submitted once
+    // another batch completes, or failed if no other batch is in flight.
+    // pfnPoll (optional) completes finished batches - waiting max dwMilliseconds
+    // - and is never called concurrently. Max batches in flight is set by
+    // Caps.cInFlightMax.
+    BOOL(*pfnSubmit)(_In_ PLC_CONTEXT ctxLC, _In_ PLC_DEVICE_BATCH pBatch);
+    VOID(*pfnPoll)(_In_ PLC_CONTEXT ctxLC, _In_ DWORD dwMilliseconds);
+    // Internal asynchronous device interface bridge:
+    PLC_DEVASYNC_CONTEXT pDeviceAsync;
+    // Internal device in-flight read limit (Caps.cInFlightMax) functionality:
+    PLC_DEVCAPS_CONTEXT pDeviceCaps;
+    // Zero-copy contigious read (optionally set by devices in pfnCreate in
+    // addition to pfnReadContigious). Same as pfnReadContigious - except that
+    // the data is read into pb rather than into ctxRC->pb. pb may be the MEM
+    // buffers of the caller - in which case only the ctxRC->cbRead first bytes
+    // are used and the remainder of pb is cleared by the core.
+    VOID(*pfnReadContigiousZeroCopy)(_Inout_ PLC_READ_CONTIGIOUS_CONTEXT ctxReadContigious, _Out_writes_(ctxReadContigious->cb) PBYTE pb);
 } LC_CONTEXT, *PLC_CONTEXT;
 
 /*
@@ -10,6 +10,20 @@
 #include "leechcore.h"
 #include "leechcore_device.h"
 
+/*
+* Initialize the (initially empty) memory map of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcMemMap_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the memory map of a LeechCore context and free all its snapshots.
+* -- ctxLC
+*/
+VOID LcMemMap_Close(_In_ PLC_CONTEXT ctxLC);
+
 /*
 * Translate each individual MEM. The qwA field will be overwritten with the
 * translated value - or on error -1.
@@ -19,6 +33,38 @@
 */
 VOID LcMemMap_TranslateMEMs(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
 
+/*
+* Translate a range starting at pa. The range is translated up until the end of
+* the memory map range pa is located in.
+* -- ctxLC
+* -- pa
+* -- cb
+* -- ppaTranslated = translated address - or -1 if pa is not in the memory map.
+* -- return = number of bytes (max cb) the translation applies to.
+*/
+QWORD LcMemMap_TranslateRange(_In_ PLC_CONTEXT ctxLC, _In_ QWORD pa, _In_ QWORD cb, _Out_ PQWORD ppaTranslated);
+
+/*
+* Translate MEMs in place using the fast path selected for the current memory
+* map (no map or a single range). If the fast path does not apply the MEMs are
+* left unmodified and the general translation should be used.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- pqwOffset = offset added to each valid MEM address (to restore).
+* -- return
+*/
+_Success_(return)
+BOOL LcMemMap_TranslateMEMsFast(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_ PQWORD pqwOffset);
+
+/*
+* Restore MEMs translated by LcMemMap_TranslateMEMsFast.
+* -- cMEMs
+* -- ppMEMs
+* -- qwOffset
+*/
+VOID LcMemMap_TranslateMEMsFastRestore(_In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _In_ QWORD qwOffset);
+
 /*
 * Retrieve the memory ranges as an array of LC_MEMMAP_ENTRY.
 * -- ctxLC
@@ -62,4 +108,907 @@ BOOL LcMemMap_SetRangesFromStruct(_In_ PLC_CONTEXT ctxLC, _In_ PLC_MEMMAP_ENTRY
 _Success_(return)
 BOOL LcMemMap_SetRangesFromText(_In_ PLC_CONTEXT ctxLC, _In_ PBYTE pb, _In_ DWORD cb);
 
+/*
+* Initialize the (initially disabled) page cache of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcCache_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the page cache of a LeechCore context and free its resources.
+* -- ctxLC
+*/
+VOID LcCache_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Check whether the page cache is enabled.
+* -- ctxLC
+* -- return
+*/
+BOOL LcCache_IsEnabled(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Retrieve the time-to-live which applies to buffered pages of the device -
+* also when the page cache itself is disabled. A time-to-live applies to
+* volatile devices and if the TTL policy is explicitly selected.
+* -- ctxLC
+* -- pdwTTL = time-to-live in ms.
+* -- return = TRUE if buffered pages expire.
+*/
+_Success_(return)
+BOOL LcCache_GetTTL(_In_ PLC_CONTEXT ctxLC, _Out_ PDWORD pdwTTL);
+
+/*
+* Serve MEMs from the page cache. MEMs which are served from the cache are
+* marked as successfully read. MEMs which still require a device read are put
+* into the ppMEMsMiss array (which must have room for cMEMs entries, and which
+* may be the same array as ppMEMs).
+* MEMs are assumed to have their memory map translation completed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcCache_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss);
+
+/*
+* Insert successfully read full pages into the page cache.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcCache_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Invalidate any cached pages touched by the MEMs. This is called on writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcCache_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Remove all pages from the cache.
+* -- ctxLC
+*/
+VOID LcCache_Flush(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Retrieve a page cache option (LC_OPT_CORE_CACHE_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcCache_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Set a page cache option (LC_OPT_CORE_CACHE_*). Changing the cache size will
+* discard all currently cached pages.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcCache_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue);
+
+/*
+* Initialize the async read functionality of a LeechCore context. Worker
+* threads are not started until the first async read is submitted.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcAsync_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the async read functionality of a LeechCore context. Pending reads are
+* cancelled and active reads are waited upon.
+* NB! Must be called before the device is closed.
+* -- ctxLC
+*/
+VOID LcAsync_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Live async request table process attach and detach notifications.
+*/
+VOID LcAsync_ProcessAttach();
+VOID LcAsync_ProcessDetach();
+
+/*
+* Initialize the fan-out read functionality of a LeechCore context. Worker
+* threads are not started until the first fan-out read.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcFanout_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the fan-out read functionality of a LeechCore context.
+* NB! Must be called before the device is closed.
+* -- ctxLC
+*/
+VOID LcFanout_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Read MEMs from a thread-safe (fMultiThread) device in parallel if the read is
+* large enough to be split into multiple slices.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- return = TRUE if read, FALSE if not applicable - caller should read.
+*/
+_Success_(return)
+BOOL LcFanout_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Retrieve a fan-out option (LC_OPT_CORE_FANOUT_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcFanout_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Set a fan-out option (LC_OPT_CORE_FANOUT_*).
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcFanout_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue);
+
+/*
+* Initialize the (initially disabled) readahead functionality of a LeechCore
+* context. The page buffer and worker thread are allocated on first use.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the readahead functionality of a LeechCore context.
+* NB! Must be called before the device is closed.
+* -- ctxLC
+*/
+VOID LcReadAhead_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Check whether the readahead / prefetch page buffer is active.
+* -- ctxLC
+* -- return
+*/
+BOOL LcReadAhead_IsEnabled(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Serve MEMs from the readahead / prefetch page buffer. Served pages are
+* removed from the buffer. MEMs which still require a read are put into the
+* ppMEMsMiss array (which must have room for cMEMs entries, and which may be
+* the same array as ppMEMs).
+* MEMs are assumed to have their memory map translation completed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcReadAhead_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss);
+
+/*
+* Track ascending read streams and queue readahead of the pages following a
+* detected stream. MEMs are assumed to hold their untranslated addresses.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadAhead_Detect(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Remove any buffered pages touched by the MEMs. This is called on writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadAhead_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Retrieve a readahead option (LC_OPT_CORE_READAHEAD*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Set a readahead option (LC_OPT_CORE_READAHEAD).
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue);
+
+/*
+* Fetch MEMs from the underlying device with duplicate and sub-page MEMs
+* merged. MEMs are assumed to have their memory map translation completed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_DeviceMerge(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Initialize the (initially inactive) qos functionality of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcQos_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the qos functionality of a LeechCore context.
+* -- ctxLC
+*/
+VOID LcQos_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Schedule a device read according to the priority of the calling thread and
+* the bandwidth limits.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- return = TRUE if read, FALSE if qos is not active - caller should read.
+*/
+_Success_(return)
+BOOL LcQos_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Set the priority class of the calling thread.
+* -- ctxLC
+* -- dwPriority = LC_QOS_PRIORITY_*
+* -- return
+*/
+_Success_(return)
+BOOL LcQos_SetThreadPriority(_In_ PLC_CONTEXT ctxLC, _In_ DWORD dwPriority);
+
+/*
+* Retrieve the priority class of the calling thread.
+* -- ctxLC
+* -- return = LC_QOS_PRIORITY_*
+*/
+DWORD LcQos_GetThreadPriority(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Retrieve a qos option (LC_OPT_CORE_QOS_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcQos_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Set a qos option (LC_OPT_CORE_QOS_*).
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcQos_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue);
+
+/*
+* Per-thread qos priority process/thread attach and detach notifications.
+*/
+VOID LcQos_ProcessAttach();
+VOID LcQos_ProcessDetach();
+VOID LcQos_ThreadDetach();
+
+/*
+* Initialize the (initially disabled) negative cache of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcNegCache_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the negative cache of a LeechCore context.
+* -- ctxLC
+*/
+VOID LcNegCache_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Check whether the negative cache is enabled.
+* -- ctxLC
+* -- return
+*/
+BOOL LcNegCache_IsEnabled(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Fail MEMs of pages known to be unreadable. MEMs which still require a device
+* read are put into ppMEMsMiss (which may be the same array as ppMEMs).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcNegCache_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss);
+
+/*
+* Record pages which failed to read from the device.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcNegCache_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Remove pages touched by the MEMs from the negative cache (on write).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcNegCache_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Remove all pages from the negative cache.
+* -- ctxLC
+*/
+VOID LcNegCache_Flush(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Retrieve a negative cache option (LC_OPT_CORE_NEGCACHE_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcNegCache_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Set a negative cache option (LC_OPT_CORE_NEGCACHE_TTL).
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcNegCache_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue);
+
+/*
+* Initialize the (initially inactive) snapshot functionality of a LeechCore
+* context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the snapshot functionality of a LeechCore context.
+* -- ctxLC
+*/
+VOID LcSnapshot_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Check whether a snapshot epoch is active.
+* -- ctxLC
+* -- return
+*/
+BOOL LcSnapshot_IsActive(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Serve MEMs from pages retained in the current snapshot epoch. MEMs which are
+* not retained are put into ppMEMsMiss (which may be the same array as ppMEMs).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcSnapshot_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss);
+
+/*
+* Retain successfully read pages in the current snapshot epoch.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcSnapshot_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Mark retained pages touched by the MEMs as stale (on write).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcSnapshot_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Begin a new snapshot epoch (LC_CMD_SNAPSHOT_BEGIN).
+* -- ctxLC
+* -- cbSpillFile
+* -- szSpillFile = optional spill file.
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_Begin(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cbSpillFile, _In_reads_opt_(cbSpillFile) LPSTR szSpillFile);
+
+/*
+* End the current snapshot epoch (LC_CMD_SNAPSHOT_END).
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_End(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Retrieve a snapshot option (LC_OPT_CORE_SNAPSHOT_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Set a snapshot option (LC_OPT_CORE_SNAPSHOT_MEMMAX).
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue);
+
+/*
+* Initialize the (initially closed) disk cache of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcDiskCache_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the disk cache of a LeechCore context - persisting its index.
+* -- ctxLC
+*/
+VOID LcDiskCache_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Open the disk cache in a directory (LC_CMD_DISKCACHE_OPEN).
+* -- ctxLC
+* -- cbDirectory
+* -- szDirectory
+* -- return
+*/
+_Success_(return)
+BOOL LcDiskCache_Open(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cbDirectory, _In_reads_(cbDirectory) LPSTR szDirectory);
+
+/*
+* Check whether the disk cache is open.
+* -- ctxLC
+* -- return
+*/
+BOOL LcDiskCache_IsEnabled(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Read MEMs from the disk cache. MEMs which are not stored are put into
+* ppMEMsMiss (which may be the same array as ppMEMs).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcDiskCache_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss);
+
+/*
+* Store full pages successfully read from the device in the disk cache.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcDiskCache_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Remove pages touched by the MEMs from the disk cache (on write).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcDiskCache_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Re-key the disk cache on a remote memory map change.
+* -- ctxLC
+* -- cbMemMap
+* -- pbMemMap
+*/
+VOID LcDiskCache_SetMemMap(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cbMemMap, _In_reads_(cbMemMap) PBYTE pbMemMap);
+
+/*
+* Retrieve a disk cache option (LC_OPT_CORE_DISKCACHE_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcDiskCache_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Initialize the (initially disabled) compressed page cache of a LeechCore
+* context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the compressed page cache of a LeechCore context and free its
+* resources.
+* -- ctxLC
+*/
+VOID LcZCache_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Check whether the compressed page cache is enabled.
+* -- ctxLC
+* -- return
+*/
+BOOL LcZCache_IsEnabled(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Serve MEMs from the compressed page cache. MEMs which still require a device
+* read are put into the ppMEMsMiss array (which must have room for cMEMs
+* entries, and which may be the same array as ppMEMs).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcZCache_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss);
+
+/*
+* Insert successfully read full pages into the compressed page cache.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcZCache_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Invalidate any cached pages touched by the MEMs. This is called on writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcZCache_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Remove all pages from the compressed page cache.
+* -- ctxLC
+*/
+VOID LcZCache_Flush(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Retrieve a compressed page cache option (LC_OPT_CORE_ZCACHE_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Set a compressed page cache option (LC_OPT_CORE_ZCACHE_*).
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue);
+
+/*
+* Compress a page (LZ4 block format).
+* -- pbPage = 0x1000 bytes.
+* -- pbOut
+* -- cbOutMax
+* -- return = compressed size, 0 if the page does not compress below cbOutMax.
+*/
+DWORD LcZCache_Compress(_In_reads_(0x1000) PBYTE pbPage, _Out_writes_(cbOutMax) PBYTE pbOut, _In_ DWORD cbOutMax);
+
+/*
+* Decompress a page (LZ4 block format).
+* -- pbIn
+* -- cbIn
+* -- pbPage = 0x1000 bytes.
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_Decompress(_In_reads_(cbIn) PBYTE pbIn, _In_ DWORD cbIn, _Out_writes_(0x1000) PBYTE pbPage);
+
+#define LC_ALLOC_NODE_ANY               ((DWORD)-1)
+
+/*
+* Fail all huge page allocations when set - large read buffers then fall back
+* to normal pages as on systems without huge page support (used by tests).
+*/
+extern BOOL g_fLcAllocHugePageFail;
+
+typedef struct tdLC_ALLOC_LARGE {
+    PBYTE pb;
+    SIZE_T cb;
+    DWORD dwFlags;
+    DWORD dwPolicy;                 // allocation policy at time of allocation.
+} LC_ALLOC_LARGE, *PLC_ALLOC_LARGE;
+
+/*
+* Initialize the allocation policy of a LeechCore context - the initial policy
+* is taken from the device parameter 'alloc' (if any).
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcAlloc_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the allocation policy of a LeechCore context. All large read buffers
+* must have been free'd before this call.
+* -- ctxLC
+*/
+VOID LcAlloc_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Retrieve the NUMA node assigned to a contigious read worker.
+* -- ctxLC
+* -- iWorker
+* -- return = NUMA node, or LC_ALLOC_NODE_ANY if NUMA placement is disabled.
+*/
+DWORD LcAlloc_WorkerNode(_In_ PLC_CONTEXT ctxLC, _In_ DWORD iWorker);
+
+/*
+* Allocate a large read buffer according to the allocation policy. The buffer
+* contents are uninitialized.
+* -- ctxLC
+* -- cb
+* -- iNode = NUMA node (LC_ALLOC_POLICY_NUMA only), or LC_ALLOC_NODE_ANY.
+* -- pAlloc = receives the allocation - to be free'd by LcAlloc_LargeFree.
+* -- return = the buffer, NULL on fail.
+*/
+PBYTE LcAlloc_Large(_In_ PLC_CONTEXT ctxLC, _In_ SIZE_T cb, _In_ DWORD iNode, _Out_ PLC_ALLOC_LARGE pAlloc);
+
+/*
+* Free a large read buffer allocated by LcAlloc_Large.
+* -- ctxLC
+* -- pAlloc
+*/
+VOID LcAlloc_LargeFree(_In_ PLC_CONTEXT ctxLC, _Inout_ PLC_ALLOC_LARGE pAlloc);
+
+/*
+* Check whether a large read buffer was allocated under the current allocation
+* policy - if not it should be re-allocated when convenient.
+* -- ctxLC
+* -- pAlloc
+* -- return
+*/
+BOOL LcAlloc_LargeIsCurrent(_In_ PLC_CONTEXT ctxLC, _In_ PLC_ALLOC_LARGE pAlloc);
+
+/*
+* Pin (or unpin) the calling contigious read worker thread to the processors
+* of its NUMA node according to the current allocation policy.
+* -- ctxLC
+* -- iWorker
+* -- pfPinned = pinned state of the worker thread - updated on change.
+*/
+VOID LcAlloc_WorkerPin(_In_ PLC_CONTEXT ctxLC, _In_ DWORD iWorker, _Inout_ PBOOL pfPinned);
+
+/*
+* Advise that a large buffer allocated by LocalAlloc should be backed by
+* transparent huge pages (Linux only) - if an open context has the
+* LC_ALLOC_POLICY_HUGEPAGE policy set.
+* -- pb
+* -- cb
+*/
+VOID LcAlloc_HintHugePage(_In_ PBYTE pb, _In_ SIZE_T cb);
+
+/*
+* Retrieve an allocation option (LC_OPT_CORE_ALLOC_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcAlloc_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Set an allocation option (LC_OPT_CORE_ALLOC_*).
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcAlloc_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue);
+
+/*
+* Resolve the device capabilities after the device has been opened. Caps not
+* filled in by the device are derived from the legacy device fields and caps
+* filled in by the device are reflected in the legacy fields.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcDeviceCaps_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the device capability functionality.
+* -- ctxLC
+*/
+VOID LcDeviceCaps_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Acquire / release a device read slot - limits the number of concurrent reads
+* towards the device to Caps.cInFlightMax (if set).
+* -- ctxLC
+*/
+VOID LcDeviceCaps_SlotAcquire(_In_ PLC_CONTEXT ctxLC);
+VOID LcDeviceCaps_SlotRelease(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Read MEMs from a scatter device according to its capabilities.
+* MEMs are assumed to have their memory map translation completed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- return = TRUE if read, FALSE if no capability applies - caller should read.
+*/
+_Success_(return)
+BOOL LcDeviceCaps_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Retrieve a device capability option (LC_OPT_CORE_DEVICE_CAPS_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcDeviceCaps_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Bridge the asynchronous device interface (if set by the device in pfnCreate)
+* to the synchronous pfnReadScatter. Must be called after pfnCreate and before
+* the device capabilities are resolved.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcDeviceAsync_Initialize(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Close the asynchronous device interface bridge.
+* -- ctxLC
+*/
+VOID LcDeviceAsync_Close(_In_ PLC_CONTEXT ctxLC);
+
+/*
+* Retrieve an asynchronous device interface option (LC_OPT_CORE_DEVICE_BATCH_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcDeviceAsync_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue);
+
+/*
+* Submit MEMs to the underlying device - bypassing the qos scheduling.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_DeviceSubmit(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Dispatch MEMs to the underlying device read function.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadScatter_DeviceDispatch(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Merge duplicate and sub-page MEMs before a device read. If MEMs are merged
+* the MEMs to read from the device are returned in a merge context - which
+* must be completed by LcMerge_Complete and LcMerge_Finish after the device read.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- return = merge context, NULL if no MEMs were merged.
+*/
+PLC_MERGE_CONTEXT LcMerge_Prepare(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Retrieve the MEMs to read from the device from a merge context.
+* -- ctx
+* -- pcMEMs
+* -- return
+*/
+PPMEM_SCATTER LcMerge_GetDeviceMEMs(_In_ PLC_MERGE_CONTEXT ctx, _Out_ PDWORD pcMEMs);
+
+/*
+* Fan out the data read by the device to the merged MEMs. MEMs of failed group
+* reads which may still be readable on their own are returned to be re-read.
+* -- ctx
+* -- pcMEMs = number of MEMs to re-read.
+* -- return = MEMs to re-read (valid until LcMerge_Finish).
+*/
+PPMEM_SCATTER LcMerge_Complete(_In_ PLC_MERGE_CONTEXT ctx, _Out_ PDWORD pcMEMs);
+
+/*
+* Free a merge context.
+* -- ctx
+*/
+VOID LcMerge_Finish(_In_opt_ _Post_ptr_invalid_ PLC_MERGE_CONTEXT ctx);
+
+/*
+* Allocate a temporary buffer from the per-thread scratch arena. The buffer is
+* not zero initialized. The arena falls back to the heap when exhausted.
+* NB! Buffers must be freed by LcArena_Free in reverse order of allocation
+* and on the allocating thread.
+* -- cb
+* -- return
+*/
+PVOID LcArena_Alloc(_In_ SIZE_T cb);
+
+/*
+* Free a buffer allocated by LcArena_Alloc.
+* -- pv
+*/
+VOID LcArena_Free(_In_opt_ PVOID pv);
+
+/*
+* Retrieve the read submission completion event of the current thread. The
+* event is auto-reset and lives until the thread exits.
+* -- return = the event, or NULL on fail.
+*/
+HANDLE LcArena_SubmitEvent();
+
+/*
+* Per-thread arena process/thread attach and detach notifications.
+*/
+VOID LcArena_ProcessAttach();
+VOID LcArena_ProcessDetach();
+VOID LcArena_ThreadDetach();
+
 #endif /* __LEECHCORE_INTERNAL_H__ */
@@ -321,7 +321,8 @@ VOID LeechRPC_ReadScatter_Impl(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_
         }
     }
     // 1: prepare message to send
-    if(!(pMsgReq = LocalAlloc(LMEM_ZEROINIT, sizeof(LEECHRPC_MSG_BIN) + cValidMEMs * sizeof(MEM_SCATTER)))) { return; }
+    if(!(pMsgReq = LcArena_Alloc(sizeof(LEECHRPC_MSG_BIN) + cValidMEMs * sizeof(MEM_SCATTER)))) { return; }
+    ZeroMemory(pMsgReq, sizeof(LEECHRPC_MSG_BIN));
     pMsgReq->tpMsg = LEECHRPC_MSGTYPE_READSCATTER_REQ;
     pMsgReq->cb = cValidMEMs * sizeof(MEM_SCATTER);
     pMEM_Dst = (PMEM_SCATTER)pMsgReq->pb;
@@ -354,8 +355,8 @@ VOID LeechRPC_ReadScatter_Impl(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_
         pMEM_Src = pMEM_Src + 1;
     }
 fail:
-    LocalFree(pMsgReq);
     LocalFree(pMsgRsp);
+    LcArena_Free(pMsgReq);
 }
 
 VOID LeechRPC_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
@@ -379,7 +380,7 @@ VOID LeechRPC_WriteScatter_Impl(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout
     PBYTE pbReqWrData;
     // 1: prepare message to send
     cbReqData = cMEMs * (sizeof(MEM_SCATTER) + 0x1000);
-    if(!(pMsgReq = LocalAlloc(0, sizeof(LEECHRPC_MSG_BIN) + cbReqData))) { goto fail; }
+    if(!(pMsgReq = LcArena_Alloc(sizeof(LEECHRPC_MSG_BIN) + cbReqData))) { goto fail; }
     ZeroMemory(pMsgReq, sizeof(LEECHRPC_MSG_BIN));
     pMsgReq->tpMsg = LEECHRPC_MSGTYPE_WRITESCATTER_REQ;
     pMsgReq->qwData[0] = cMEMs;
@@ -402,8 +403,8 @@ VOID LeechRPC_WriteScatter_Impl(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout
         ppMEMs[i]->f = pfRsp[i] ? TRUE : FALSE;
     }
 fail:
-    LocalFree(pMsgReq);
     LocalFree(pMsgRsp);
+    LcArena_Free(pMsgReq);
 }
 
 VOID LeechRPC_WriteScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
@@ -691,6 +692,9 @@ BOOL LeechRpc_Open(_Inout_ PLC_CONTEXT ctxLC, _Out_opt_ PPLC_CONFIG_ERRORINFO pp
     ctxLC->pfnGetOption = LeechRPC_GetOption;
     ctxLC->pfnSetOption = LeechRPC_SetOption;
     ctxLC->pfnCommand = LeechRPC_Command;
+    // content identity of the remote device - keys the local disk cache (0 if
+    // not supplied by the remote - the remote device is then not disk cached):
+    LeechRPC_GetOption(ctxLC, LC_OPT_CORE_DEVICE_IDENTITY, &ctxLC->qwDeviceIdentity);
     lcprintfv(ctxLC, "RPC: Successfully opened remote device: %s\n", ctxLC->Config.szDeviceName);
     LocalFree(pMsgRsp);
     return TRUE;
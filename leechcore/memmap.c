@@ -1,13 +1,178 @@
 // memmap.c : implementation : memory map.
 //
+// The memory map is updated by writers (devices at open and memmap commands)
+// in a working array under the memory map lock. Readers (address translation
+// and memory map queries) never take a lock on the fast path - they use an
+// immutable snapshot of the working array which is re-published on the first
+// read after a change. Readers are counted while they hold a snapshot - the
+// replaced (retired) snapshots are freed once no readers remain. Since readers
+// always take the most recently published snapshot a retired snapshot is
+// never picked up again once the reader count has dropped to zero.
+// The translation fast path is selected when a snapshot is published: with no
+// memory map, or a single range, MEMs are translated in place by one offset
+// without the general range lookup and the MEM stack save/restore.
+// If a snapshot of a changed memory map can't be published (out of memory)
+// readers get a failure snapshot which fails all translations - the reads are
+// failed rather than served without (or with a stale) memory map.
+//
 // (c) Ulf Frisk, 2020-2022
 // Author: Ulf Frisk, pcileech@frizk.net
 //
 
 #include "leechcore.h"
 #include "leechcore_device.h"
+#include "leechcore_internal.h"
 #include "oscompatibility.h"
 
+#define LC_MEMMAP_FASTPATH_NONE         0       // general translation.
+#define LC_MEMMAP_FASTPATH_NOMAP        1       // no memory map - no translation.
+#define LC_MEMMAP_FASTPATH_SINGLE       2       // single range - offset translation.
+#define LC_MEMMAP_FASTPATH_FAIL         3       // snapshot publish failed - fail all translations.
+
+typedef struct tdLC_MEMMAP_SNAPSHOT {
+    struct tdLC_MEMMAP_SNAPSHOT *FLinkRetired;
+    DWORD dwVersion;
+    DWORD dwFastPath;                       // LC_MEMMAP_FASTPATH_*
+    QWORD qwFastPathOffset;                 // LC_MEMMAP_FASTPATH_SINGLE: paRemap - pa.
+    DWORD cMap;
+    LC_MEMMAP_ENTRY pMap[0];
+} LC_MEMMAP_SNAPSHOT, *PLC_MEMMAP_SNAPSHOT;
+
+typedef struct tdLC_MEMMAP_CONTEXT {
+    CRITICAL_SECTION Lock;                  // serializes writers and snapshot publish.
+    DWORD volatile dwVersion;               // incremented on each memory map change.
+    DWORD volatile cReaders;                // readers currently holding a snapshot.
+    PLC_MEMMAP_SNAPSHOT volatile pSnapshot; // most recently published snapshot.
+    PLC_MEMMAP_SNAPSHOT pRetired;           // replaced snapshots (protected by Lock).
+} LC_MEMMAP_CONTEXT;
+
+static LC_MEMMAP_SNAPSHOT g_LcMemMapSnapshotEmpty = { .dwFastPath = LC_MEMMAP_FASTPATH_NOMAP };
+static LC_MEMMAP_SNAPSHOT g_LcMemMapSnapshotFail = { .dwFastPath = LC_MEMMAP_FASTPATH_FAIL };
+
+/*
+* Free the retired snapshots - if no reader holds a snapshot.
+* -- ctx
+*/
+VOID LcMemMap_SnapshotReclaim(_In_ PLC_MEMMAP_CONTEXT ctx)
+{
+    PLC_MEMMAP_SNAPSHOT pSnapshot = NULL, pSnapshotNext;
+    EnterCriticalSection(&ctx->Lock);
+    if(!ctx->cReaders) {
+        pSnapshot = ctx->pRetired;
+        ctx->pRetired = NULL;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    while(pSnapshot) {
+        pSnapshotNext = pSnapshot->FLinkRetired;
+        LocalFree(pSnapshot);
+        pSnapshot = pSnapshotNext;
+    }
+}
+
+/*
+* Retrieve an immutable snapshot of the memory map. The snapshot is valid until
+* released by LcMemMap_SnapshotRelease. A new snapshot is published if the
+* memory map has changed since the last snapshot was published.
+* -- ctxLC
+* -- return = the snapshot, the failure snapshot if a changed memory map could
+*             not be published.
+*/
+PLC_MEMMAP_SNAPSHOT LcMemMap_Snapshot(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_MEMMAP_CONTEXT ctx = ctxLC->pMemMapCtx;
+    PLC_MEMMAP_SNAPSHOT pSnapshot, pSnapshotNew;
+    if(!ctx) { return &g_LcMemMapSnapshotEmpty; }
+    InterlockedIncrement(&ctx->cReaders);
+    pSnapshot = ctx->pSnapshot;
+    if(pSnapshot && (pSnapshot->dwVersion == ctx->dwVersion)) { return pSnapshot; }
+    EnterCriticalSection(&ctx->Lock);
+    pSnapshot = ctx->pSnapshot;
+    if(!pSnapshot || (pSnapshot->dwVersion != ctx->dwVersion)) {
+        if((pSnapshotNew = LocalAlloc(0, sizeof(LC_MEMMAP_SNAPSHOT) + ctxLC->cMemMap * sizeof(LC_MEMMAP_ENTRY)))) {
+            pSnapshotNew->FLinkRetired = NULL;
+            pSnapshotNew->dwVersion = ctx->dwVersion;
+            pSnapshotNew->cMap = ctxLC->cMemMap;
+            memcpy(pSnapshotNew->pMap, ctxLC->pMemMap, ctxLC->cMemMap * sizeof(LC_MEMMAP_ENTRY));
+            pSnapshotNew->dwFastPath = LC_MEMMAP_FASTPATH_NONE;
+            pSnapshotNew->qwFastPathOffset = 0;
+            if(pSnapshotNew->cMap == 0) {
+                pSnapshotNew->dwFastPath = LC_MEMMAP_FASTPATH_NOMAP;
+            } else if(pSnapshotNew->cMap == 1) {
+                pSnapshotNew->dwFastPath = LC_MEMMAP_FASTPATH_SINGLE;
+                pSnapshotNew->qwFastPathOffset = pSnapshotNew->pMap[0].paRemap - pSnapshotNew->pMap[0].pa;
+            }
+            InterlockedExchangePointer((PVOID volatile*)&ctx->pSnapshot, pSnapshotNew);
+            if(pSnapshot) {
+                pSnapshot->FLinkRetired = ctx->pRetired;
+                ctx->pRetired = pSnapshot;
+            }
+            pSnapshot = pSnapshotNew;
+        } else {
+            pSnapshot = (pSnapshot || ctxLC->cMemMap) ? &g_LcMemMapSnapshotFail : &g_LcMemMapSnapshotEmpty;
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return pSnapshot;
+}
+
+/*
+* Release a snapshot retrieved by LcMemMap_Snapshot. The last reader to leave
+* frees the retired snapshots.
+* -- ctxLC
+*/
+VOID LcMemMap_SnapshotRelease(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_MEMMAP_CONTEXT ctx = ctxLC->pMemMapCtx;
+    if(!ctx) { return; }
+    if((0 == InterlockedDecrement(&ctx->cReaders)) && ctx->pRetired) {
+        LcMemMap_SnapshotReclaim(ctx);
+    }
+}
+
+/*
+* Initialize the (initially empty) memory map of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcMemMap_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_MEMMAP_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_MEMMAP_CONTEXT)))) { return FALSE; }
+    ctxLC->cMemMapMax = 0x20;
+    if(!(ctxLC->pMemMap = LocalAlloc(LMEM_ZEROINIT, ctxLC->cMemMapMax * sizeof(LC_MEMMAP_ENTRY)))) {
+        LocalFree(ctx);
+        return FALSE;
+    }
+    InitializeCriticalSection(&ctx->Lock);
+    ctxLC->pMemMapCtx = ctx;
+    return TRUE;
+}
+
+/*
+* Close the memory map of a LeechCore context and free all its snapshots.
+* -- ctxLC
+*/
+VOID LcMemMap_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_MEMMAP_CONTEXT ctx = ctxLC->pMemMapCtx;
+    PLC_MEMMAP_SNAPSHOT pSnapshot, pSnapshotNext;
+    LocalFree(ctxLC->pMemMap);
+    ctxLC->pMemMap = NULL;
+    ctxLC->cMemMap = 0;
+    if(!ctx) { return; }
+    ctxLC->pMemMapCtx = NULL;
+    LocalFree(ctx->pSnapshot);
+    pSnapshot = ctx->pRetired;
+    while(pSnapshot) {
+        pSnapshotNext = pSnapshot->FLinkRetired;
+        LocalFree(pSnapshot);
+        pSnapshot = pSnapshotNext;
+    }
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx);
+}
+
 /*
 * Check whether the memory map is initialized or not.
 * -- ctxLC
@@ -15,11 +180,15 @@
 */
 EXPORTED_FUNCTION BOOL LcMemMap_IsInitialized(_In_ PLC_CONTEXT ctxLC)
 {
-    return ctxLC->cMemMap > 0;
+    PLC_MEMMAP_SNAPSHOT pSnapshot = LcMemMap_Snapshot(ctxLC);
+    BOOL fResult = (pSnapshot->cMap > 0) || (pSnapshot->dwFastPath == LC_MEMMAP_FASTPATH_FAIL);
+    LcMemMap_SnapshotRelease(ctxLC);
+    return fResult;
 }
 
 /*
 * Add a memory range to the memory map.
+* NB! Must be called with the memory map lock held.
 * -- ctxLC
 * -- pa
 * -- cb
@@ -27,8 +196,9 @@ EXPORTED_FUNCTION BOOL LcMemMap_IsInitialized(_In_ PLC_CONTEXT ctxLC)
 * -- return
 */
 _Success_(return)
-EXPORTED_FUNCTION BOOL LcMemMap_AddRange(_In_ PLC_CONTEXT ctxLC, _In_ QWORD pa, _In_ QWORD cb, _In_opt_ QWORD paRemap)
+BOOL LcMemMap_AddRange_DoWork(_In_ PLC_CONTEXT ctxLC, _In_ QWORD pa, _In_ QWORD cb, _In_opt_ QWORD paRemap)
 {
+    PLC_MEMMAP_CONTEXT ctx = ctxLC->pMemMapCtx;
     PVOID pvGrowMemMap;
     if((cb & 0xfff) == 1) { cb--; }
     if((pa & 0xfff) || (cb & 0xfff)) { return FALSE; }
@@ -47,10 +217,31 @@ EXPORTED_FUNCTION BOOL LcMemMap_AddRange(_In_ PLC_CONTEXT ctxLC, _In_ QWORD pa,
     ctxLC->pMemMap[ctxLC->cMemMap].cb = cb;
     ctxLC->pMemMap[ctxLC->cMemMap].paRemap = paRemap ? paRemap : pa;
     ctxLC->cMemMap++;
+    InterlockedIncrement(&ctx->dwVersion);
     lcprintfvv_fn(ctxLC, "%016llx-%016llx -> %016llx\n", pa, pa + cb - 1, paRemap);
     return TRUE;
 }
 
+/*
+* Add a memory range to the memory map.
+* -- ctxLC
+* -- pa
+* -- cb
+* -- paRemap = remap offset within file (if relevant).
+* -- return
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcMemMap_AddRange(_In_ PLC_CONTEXT ctxLC, _In_ QWORD pa, _In_ QWORD cb, _In_opt_ QWORD paRemap)
+{
+    BOOL fResult;
+    PLC_MEMMAP_CONTEXT ctx = ctxLC->pMemMapCtx;
+    if(!ctx) { return FALSE; }
+    EnterCriticalSection(&ctx->Lock);
+    fResult = LcMemMap_AddRange_DoWork(ctxLC, pa, cb, paRemap);
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
 /*
 * Get the max physical address from the memory map.
 * -- ctxLC
@@ -59,8 +250,13 @@ EXPORTED_FUNCTION BOOL LcMemMap_AddRange(_In_ PLC_CONTEXT ctxLC, _In_ QWORD pa,
 _Success_(return != 0)
 EXPORTED_FUNCTION QWORD LcMemMap_GetMaxAddress(_In_ PLC_CONTEXT ctxLC)
 {
-    if(ctxLC->cMemMap == 0) { return 0x0000ffffffffffff; }
-    return ctxLC->pMemMap[ctxLC->cMemMap - 1].pa + ctxLC->pMemMap[ctxLC->cMemMap - 1].cb;
+    QWORD paMax = 0x0000ffffffffffff;
+    PLC_MEMMAP_SNAPSHOT pSnapshot = LcMemMap_Snapshot(ctxLC);
+    if(pSnapshot->cMap) {
+        paMax = pSnapshot->pMap[pSnapshot->cMap - 1].pa + pSnapshot->pMap[pSnapshot->cMap - 1].cb;
+    }
+    LcMemMap_SnapshotRelease(ctxLC);
+    return paMax;
 }
 
 /*
@@ -75,8 +271,15 @@ VOID LcMemMap_TranslateMEMs(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PP
     DWORD iMEM, iMap, oMap;
     PMEM_SCATTER pMEM;
     PLC_MEMMAP_ENTRY peMap;
-    if(ctxLC->cMemMap == 0) { return; }
-    peMap = ctxLC->pMemMap + 0;
+    PLC_MEMMAP_SNAPSHOT pSnapshot = LcMemMap_Snapshot(ctxLC);
+    if(pSnapshot->dwFastPath == LC_MEMMAP_FASTPATH_FAIL) {
+        for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+            ppMEMs[iMEM]->qwA = (QWORD)-1;
+        }
+        goto finish;
+    }
+    if(pSnapshot->cMap == 0) { goto finish; }
+    peMap = pSnapshot->pMap + 0;
     for(iMEM = 0; iMEM < cMEMs; iMEM++) {
         pMEM = ppMEMs[iMEM];
         if(pMEM->qwA == (QWORD)-1) { continue; }
@@ -87,18 +290,18 @@ VOID LcMemMap_TranslateMEMs(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PP
         }
         // check all memmap ranges.
         iMap = 0;
-        if(ctxLC->cMemMap > 0x40) {             // fast find (large map optimization)
-            iMap = ctxLC->cMemMap >> 1;
+        if(pSnapshot->cMap > 0x40) {             // fast find (large map optimization)
+            iMap = pSnapshot->cMap >> 1;
             oMap = iMap;
             while((oMap = oMap >> 1)) {
-                iMap = (pMEM->qwA > ctxLC->pMemMap[iMap].pa) ? (iMap + oMap) : (iMap - oMap);
+                iMap = (pMEM->qwA > pSnapshot->pMap[iMap].pa) ? (iMap + oMap) : (iMap - oMap);
             }
-            while(iMap && (pMEM->qwA < ctxLC->pMemMap[iMap].pa)) {
+            while(iMap && (pMEM->qwA < pSnapshot->pMap[iMap].pa)) {
                 iMap--;
             }
         }
-        for(; iMap < ctxLC->cMemMap; iMap++) {  // find entry
-            peMap = ctxLC->pMemMap + iMap;
+        for(; iMap < pSnapshot->cMap; iMap++) {  // find entry
+            peMap = pSnapshot->pMap + iMap;
             if((pMEM->qwA >= peMap->pa) && (pMEM->qwA + pMEM->cb <= peMap->pa + peMap->cb)) {
                 break;
             }
@@ -112,6 +315,108 @@ VOID LcMemMap_TranslateMEMs(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PP
             pMEM->qwA = (QWORD)-1;
         }
     }
+finish:
+    LcMemMap_SnapshotRelease(ctxLC);
+}
+
+/*
+* Translate a range starting at pa. The range is translated up until the end of
+* the memory map range pa is located in - a range spanning multiple memory map
+* ranges is translated by calling this function once per memory map range.
+* -- ctxLC
+* -- pa
+* -- cb
+* -- ppaTranslated = translated address - or -1 if pa is not in the memory map.
+* -- return = number of bytes (max cb) the translation applies to.
+*/
+QWORD LcMemMap_TranslateRange(_In_ PLC_CONTEXT ctxLC, _In_ QWORD pa, _In_ QWORD cb, _Out_ PQWORD ppaTranslated)
+{
+    DWORD iMap, iMapLo = 0, iMapHi;
+    PLC_MEMMAP_ENTRY peMap;
+    PLC_MEMMAP_SNAPSHOT pSnapshot = LcMemMap_Snapshot(ctxLC);
+    *ppaTranslated = (pSnapshot->dwFastPath == LC_MEMMAP_FASTPATH_FAIL) ? (QWORD)-1 : pa;
+    if(pSnapshot->cMap == 0) { goto finish; }
+    // find the first memory map range starting above pa:
+    iMapHi = pSnapshot->cMap;
+    while(iMapLo < iMapHi) {
+        iMap = (iMapLo + iMapHi) >> 1;
+        if(pSnapshot->pMap[iMap].pa <= pa) {
+            iMapLo = iMap + 1;
+        } else {
+            iMapHi = iMap;
+        }
+    }
+    peMap = iMapLo ? (pSnapshot->pMap + iMapLo - 1) : NULL;
+    if(peMap && (pa < peMap->pa + peMap->cb)) {
+        cb = min(cb, peMap->pa + peMap->cb - pa);
+        *ppaTranslated = pa + peMap->paRemap - peMap->pa;
+    } else {
+        *ppaTranslated = (QWORD)-1;
+        if(iMapLo < pSnapshot->cMap) {
+            cb = min(cb, pSnapshot->pMap[iMapLo].pa - pa);
+        }
+    }
+finish:
+    LcMemMap_SnapshotRelease(ctxLC);
+    return cb;
+}
+
+/*
+* Translate MEMs in place using the fast path selected for the current memory
+* map (no map or a single range). The translation is undone by the caller with
+* LcMemMap_TranslateMEMsFastRestore. If the fast path does not apply - general
+* map or MEMs outside the single range - the MEMs are left unmodified and the
+* caller should use the general (stack saved) translation.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- pqwOffset = offset added to each valid MEM address (to restore).
+* -- return
+*/
+_Success_(return)
+BOOL LcMemMap_TranslateMEMsFast(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_ PQWORD pqwOffset)
+{
+    DWORD i, dwFastPath;
+    PMEM_SCATTER pMEM;
+    QWORD pa = 0, paEnd = 0, qwOffset = 0;
+    PLC_MEMMAP_SNAPSHOT pSnapshot = LcMemMap_Snapshot(ctxLC);
+    *pqwOffset = 0;
+    if((dwFastPath = pSnapshot->dwFastPath) == LC_MEMMAP_FASTPATH_SINGLE) {
+        pa = pSnapshot->pMap[0].pa;
+        paEnd = pa + pSnapshot->pMap[0].cb;
+        qwOffset = pSnapshot->qwFastPathOffset;
+    }
+    LcMemMap_SnapshotRelease(ctxLC);
+    if(dwFastPath == LC_MEMMAP_FASTPATH_NOMAP) { return TRUE; }
+    if(dwFastPath != LC_MEMMAP_FASTPATH_SINGLE) { return FALSE; }
+    for(i = 0; i < cMEMs; i++) {
+        pMEM = ppMEMs[i];
+        if(pMEM->qwA == (QWORD)-1) { continue; }
+        if((pMEM->qwA < pa) || (pMEM->qwA + pMEM->cb > paEnd)) {
+            LcMemMap_TranslateMEMsFastRestore(i, ppMEMs, qwOffset);
+            return FALSE;
+        }
+        pMEM->qwA += qwOffset;
+    }
+    *pqwOffset = qwOffset;
+    return TRUE;
+}
+
+/*
+* Restore MEMs translated by LcMemMap_TranslateMEMsFast.
+* -- cMEMs
+* -- ppMEMs
+* -- qwOffset
+*/
+VOID LcMemMap_TranslateMEMsFastRestore(_In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _In_ QWORD qwOffset)
+{
+    DWORD i;
+    if(!qwOffset) { return; }
+    for(i = 0; i < cMEMs; i++) {
+        if(ppMEMs[i]->qwA != (QWORD)-1) {
+            ppMEMs[i]->qwA -= qwOffset;
+        }
+    }
 }
 
 /*
@@ -125,13 +430,18 @@ BOOL LcMemMap_GetRangesAsStruct(_In_ PLC_CONTEXT ctxLC, _Out_ PBYTE *ppbDataOut,
 {
     PBYTE pb;
     DWORD cb;
-    if(ctxLC->cMemMap > 0x00100000) { return FALSE; }
-    cb = ctxLC->cMemMap * sizeof(LC_MEMMAP_ENTRY);
-    if(!(pb = LocalAlloc(LMEM_ZEROINIT, cb))) { return FALSE; }
-    memcpy(pb, ctxLC->pMemMap, cb);
+    BOOL fResult = FALSE;
+    PLC_MEMMAP_SNAPSHOT pSnapshot = LcMemMap_Snapshot(ctxLC);
+    if((pSnapshot->cMap > 0x00100000) || (pSnapshot->dwFastPath == LC_MEMMAP_FASTPATH_FAIL)) { goto fail; }
+    cb = pSnapshot->cMap * sizeof(LC_MEMMAP_ENTRY);
+    if(!(pb = LocalAlloc(LMEM_ZEROINIT, cb))) { goto fail; }
+    memcpy(pb, pSnapshot->pMap, cb);
     *ppbDataOut = pb;
     if(pcbDataOut) { *pcbDataOut = cb; }
-    return TRUE;
+    fResult = TRUE;
+fail:
+    LcMemMap_SnapshotRelease(ctxLC);
+    return fResult;
 }
 
 /*
@@ -146,24 +456,29 @@ BOOL LcMemMap_GetRangesAsText(_In_ PLC_CONTEXT ctxLC, _Out_ PBYTE *ppbDataOut, _
 {
     PBYTE pb;
     DWORD i, o, cb;
-    if(ctxLC->cMemMap > 0x00100000) { return FALSE; }
-    cb = ctxLC->cMemMap * (4 + 1 + 16 + 3 + 16 + 4 + 16 + 1);
-    if(!(pb = LocalAlloc(LMEM_ZEROINIT, cb))) { return FALSE; }
-    for(i = 0, o = 0; i < ctxLC->cMemMap; i++) {
+    BOOL fResult = FALSE;
+    PLC_MEMMAP_SNAPSHOT pSnapshot = LcMemMap_Snapshot(ctxLC);
+    if((pSnapshot->cMap > 0x00100000) || (pSnapshot->dwFastPath == LC_MEMMAP_FASTPATH_FAIL)) { goto fail; }
+    cb = pSnapshot->cMap * (4 + 1 + 16 + 3 + 16 + 4 + 16 + 1);
+    if(!(pb = LocalAlloc(LMEM_ZEROINIT, cb))) { goto fail; }
+    for(i = 0, o = 0; i < pSnapshot->cMap; i++) {
         o += snprintf(
             (LPSTR)pb + o,
             cb - o,
             "%04x %16llx - %16llx -> %16llx\n",
             i,
-            ctxLC->pMemMap[i].pa,
-            ctxLC->pMemMap[i].pa + ctxLC->pMemMap[i].cb - 1,
-            ctxLC->pMemMap[i].paRemap
+            pSnapshot->pMap[i].pa,
+            pSnapshot->pMap[i].pa + pSnapshot->pMap[i].cb - 1,
+            pSnapshot->pMap[i].paRemap
         );
     }
     pb[cb - 1] = '\n';
     *ppbDataOut = pb;
     if(pcbDataOut) { *pcbDataOut = cb; }
-    return TRUE;
+    fResult = TRUE;
+fail:
+    LcMemMap_SnapshotRelease(ctxLC);
+    return fResult;
 }
 
 /*
@@ -178,10 +493,15 @@ _Success_(return)
 BOOL LcMemMap_SetRangesFromStruct(_In_ PLC_CONTEXT ctxLC, _In_ PLC_MEMMAP_ENTRY pMemMap, _In_ DWORD cMemMap)
 {
     DWORD i;
+    PLC_MEMMAP_CONTEXT ctx = ctxLC->pMemMapCtx;
+    if(!ctx) { return FALSE; }
+    EnterCriticalSection(&ctx->Lock);
     ctxLC->cMemMap = 0;
+    InterlockedIncrement(&ctx->dwVersion);
     for(i = 0; i < cMemMap; i++) {
-        LcMemMap_AddRange(ctxLC, pMemMap[i].pa, pMemMap[i].cb, pMemMap[i].paRemap);
+        LcMemMap_AddRange_DoWork(ctxLC, pMemMap[i].pa, pMemMap[i].cb, pMemMap[i].paRemap);
     }
+    LeaveCriticalSection(&ctx->Lock);
     return TRUE;
 }
 
@@ -201,8 +521,12 @@ BOOL LcMemMap_SetRangesFromText(_In_ PLC_CONTEXT ctxLC, _In_ PBYTE pb, _In_ DWOR
     DWORD i, iMax;
     LPSTR sz, szLine, szLineContext = NULL, szToken, szTokenContext;
     QWORD v[3];
-    ctxLC->cMemMap = 0;
+    PLC_MEMMAP_CONTEXT ctx = ctxLC->pMemMapCtx;
+    if(!ctx) { return FALSE; }
     if(!(sz = LocalAlloc(0, cb + 1ULL))) { return FALSE; }
+    EnterCriticalSection(&ctx->Lock);
+    ctxLC->cMemMap = 0;
+    InterlockedIncrement(&ctx->dwVersion);
     memcpy(sz, pb, cb);
     sz[cb] = 0;
     // parse
@@ -229,10 +553,11 @@ BOOL LcMemMap_SetRangesFromText(_In_ PLC_CONTEXT ctxLC, _In_ PBYTE pb, _In_ DWOR
         }
         if(!(v[0] & 0xfff) && (v[0] < v[1])) {
             if(!v[2]) { v[2] = v[0]; }
-            LcMemMap_AddRange(ctxLC, v[0], v[1] + 1 - v[0], v[2]);
+            LcMemMap_AddRange_DoWork(ctxLC, v[0], v[1] + 1 - v[0], v[2]);
         }
         szLine = strtok_s(NULL, "\r\n", &szLineContext);
     }
+    LeaveCriticalSection(&ctx->Lock);
     LocalFree(sz);
     return TRUE;
 }
@@ -0,0 +1,226 @@
+// merge.c : implementation : duplicate and sub-page read merging.
+//
+// Scatter reads frequently contain the same page several times or many small
+// reads within the same page (e.g. when walking pointer tables). Before the
+// device read overlapping or adjacent MEMs within the same page are grouped
+// and only one device read - spanning exactly the bytes of the group - is
+// issued per group. The result is fanned out to each MEM in the group after
+// the device read completes. If a group read fails the MEMs of the group are
+// re-read on their own since parts of a page may still be readable (such as
+// at end-of-file).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_MERGE_MEMS_MIN               2
+
+typedef struct tdLC_MERGE_FOLLOWER {
+    PMEM_SCATTER pMEM;              // MEM to be fanned out
+    PMEM_SCATTER pMEMLeader;        // MEM performing the device read
+} LC_MERGE_FOLLOWER, *PLC_MERGE_FOLLOWER;
+
+typedef struct tdLC_MERGE_CONTEXT {
+    DWORD cFollower;
+    DWORD cMEMsDevice;
+    PPMEM_SCATTER ppMEMsDevice;     // MEMs to read from device
+    PLC_MERGE_FOLLOWER pFollower;
+    PPMEM_SCATTER ppMEMsRetry;      // MEMs to re-read after failed group reads
+    PBYTE pbTemp;                   // temporary group MEMs (if any)
+} LC_MERGE_CONTEXT;
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether a MEM is a candidate for merging. Candidates are MEMs which
+* are not yet read and which are located within a single page.
+*/
+BOOL LcMerge_IsCandidate(_In_ PMEM_SCATTER pMEM)
+{
+    return !pMEM->f && pMEM->cb && MEM_SCATTER_ADDR_ISVALID(pMEM) && ((pMEM->qwA & 0xfff) + pMEM->cb <= 0x1000);
+}
+
+/*
+* qsort compare function - sort MEM pointers on address.
+*/
+int LcMerge_CmpMEM(_In_ const void *pv1, _In_ const void *pv2)
+{
+    PMEM_SCATTER p1 = *(PPMEM_SCATTER)pv1;
+    PMEM_SCATTER p2 = *(PPMEM_SCATTER)pv2;
+    if(p1->qwA != p2->qwA) { return (p1->qwA < p2->qwA) ? -1 : 1; }
+    return (p1->cb > p2->cb) ? -1 : ((p1->cb < p2->cb) ? 1 : 0);
+}
+
+/*
+* Retrieve the number of MEMs in the group starting at ppMEMs[0]. A group is a
+* run of overlapping or adjacent MEMs within the same page.
+* -- cMEMs
+* -- ppMEMs
+* -- pqwTop = end address of the group.
+* -- return
+*/
+DWORD LcMerge_GroupSize(_In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs, _Out_ PQWORD pqwTop)
+{
+    DWORD i;
+    QWORD pa = ppMEMs[0]->qwA & ~0xfff;
+    *pqwTop = ppMEMs[0]->qwA + ppMEMs[0]->cb;
+    for(i = 1; (i < cMEMs) && ((ppMEMs[i]->qwA & ~0xfff) == pa) && (ppMEMs[i]->qwA <= *pqwTop); i++) {
+        *pqwTop = max(*pqwTop, ppMEMs[i]->qwA + ppMEMs[i]->cb);
+    }
+    return i;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// MERGE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Merge duplicate and sub-page MEMs before a device read. If MEMs are merged
+* the MEMs to read from the device are returned in a merge context - which
+* must be completed by LcMerge_Finish after the device read.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- return = merge context, NULL if no MEMs were merged.
+*/
+PLC_MERGE_CONTEXT LcMerge_Prepare(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_MERGE_CONTEXT ctx = NULL;
+    PPMEM_SCATTER ppSort;
+    PMEM_SCATTER pMEMTemp, pMEMLeader;
+    DWORD i, j, cGroup, cCandidate = 0, cTemp = 0, cFollower = 0, iTemp = 0;
+    QWORD qwTop;
+    if(ctxLC->ReadMerge.fDisable || (cMEMs < LC_MERGE_MEMS_MIN)) { return NULL; }
+    // 1: collect and sort candidates (the number of followers is bounded by
+    //    the number of candidates - allocate the merge context up front):
+    for(i = 0; i < cMEMs; i++) {
+        if(LcMerge_IsCandidate(ppMEMs[i])) { cCandidate++; }
+    }
+    if(cCandidate < LC_MERGE_MEMS_MIN) { return NULL; }
+    if(!(ctx = LcArena_Alloc(sizeof(LC_MERGE_CONTEXT) + (cMEMs + cCandidate) * sizeof(PMEM_SCATTER) + cCandidate * sizeof(LC_MERGE_FOLLOWER)))) { return NULL; }
+    ZeroMemory(ctx, sizeof(LC_MERGE_CONTEXT));
+    ctx->ppMEMsDevice = (PPMEM_SCATTER)(ctx + 1);
+    ctx->pFollower = (PLC_MERGE_FOLLOWER)(ctx->ppMEMsDevice + cMEMs);
+    ppSort = ctx->ppMEMsRetry = (PPMEM_SCATTER)(ctx->pFollower + cCandidate);
+    for(i = 0, j = 0; i < cMEMs; i++) {
+        if(LcMerge_IsCandidate(ppMEMs[i])) { ppSort[j++] = ppMEMs[i]; }
+    }
+    qsort(ppSort, cCandidate, sizeof(PMEM_SCATTER), LcMerge_CmpMEM);
+    // 2: count followers and temporary group MEMs required (since the group
+    //    is sorted on address and size descending only the first MEM may
+    //    cover the whole group):
+    for(i = 0; i < cCandidate; i += cGroup) {
+        cGroup = LcMerge_GroupSize(cCandidate - i, ppSort + i, &qwTop);
+        if(cGroup == 1) { continue; }
+        if(ppSort[i]->qwA + ppSort[i]->cb < qwTop) {
+            cTemp++;
+            cFollower++;
+        }
+        cFollower += cGroup - 1;
+    }
+    if(!cFollower) { goto fail; }
+    // 3: allocate temporary group MEMs (max one page each):
+    if(cTemp) {
+        if(!(ctx->pbTemp = LcArena_Alloc(cTemp * (sizeof(MEM_SCATTER) + 0x1000)))) { goto fail; }
+        ZeroMemory(ctx->pbTemp, cTemp * sizeof(MEM_SCATTER));
+    }
+    // 4: non-candidate MEMs are read as-is:
+    for(i = 0; i < cMEMs; i++) {
+        if(!LcMerge_IsCandidate(ppMEMs[i])) { ctx->ppMEMsDevice[ctx->cMEMsDevice++] = ppMEMs[i]; }
+    }
+    // 5: candidate MEMs are read once per page group:
+    for(i = 0; i < cCandidate; i += cGroup) {
+        cGroup = LcMerge_GroupSize(cCandidate - i, ppSort + i, &qwTop);
+        if(cGroup == 1) {
+            ctx->ppMEMsDevice[ctx->cMEMsDevice++] = ppSort[i];
+            continue;
+        }
+        if(ppSort[i]->qwA + ppSort[i]->cb >= qwTop) {
+            pMEMLeader = ppSort[i];
+            j = 1;
+        } else {
+            pMEMTemp = (PMEM_SCATTER)(ctx->pbTemp + iTemp * sizeof(MEM_SCATTER));
+            pMEMTemp->version = MEM_SCATTER_VERSION;
+            pMEMTemp->qwA = ppSort[i]->qwA;
+            pMEMTemp->cb = (DWORD)(qwTop - ppSort[i]->qwA);
+            pMEMTemp->pb = ctx->pbTemp + cTemp * sizeof(MEM_SCATTER) + iTemp * 0x1000;
+            iTemp++;
+            pMEMLeader = pMEMTemp;
+            j = 0;
+        }
+        ctx->ppMEMsDevice[ctx->cMEMsDevice++] = pMEMLeader;
+        for(; j < cGroup; j++) {
+            ctx->pFollower[ctx->cFollower].pMEM = ppSort[i + j];
+            ctx->pFollower[ctx->cFollower].pMEMLeader = pMEMLeader;
+            ctx->cFollower++;
+        }
+    }
+    InterlockedAdd64(&ctxLC->ReadMerge.cSaved, cMEMs - ctx->cMEMsDevice);
+    return ctx;
+fail:
+    LcArena_Free(ctx->pbTemp);
+    LcArena_Free(ctx);
+    return NULL;
+}
+
+/*
+* Retrieve the MEMs to read from the device from a merge context.
+* -- ctx
+* -- pcMEMs
+* -- return
+*/
+PPMEM_SCATTER LcMerge_GetDeviceMEMs(_In_ PLC_MERGE_CONTEXT ctx, _Out_ PDWORD pcMEMs)
+{
+    *pcMEMs = ctx->cMEMsDevice;
+    return ctx->ppMEMsDevice;
+}
+
+/*
+* Fan out the data read by the device to the merged MEMs. MEMs of failed group
+* reads which are smaller than the group read are returned to be re-read from
+* the device on their own - they may still be readable (such as a MEM located
+* before end-of-file in a group crossing end-of-file).
+* -- ctx
+* -- pcMEMs = number of MEMs to re-read.
+* -- return = MEMs to re-read (valid until LcMerge_Finish).
+*/
+PPMEM_SCATTER LcMerge_Complete(_In_ PLC_MERGE_CONTEXT ctx, _Out_ PDWORD pcMEMs)
+{
+    DWORD i, cRetry = 0;
+    PLC_MERGE_FOLLOWER pe;
+    for(i = 0; i < ctx->cFollower; i++) {
+        pe = ctx->pFollower + i;
+        if(pe->pMEMLeader->f) {
+            if(pe->pMEM != pe->pMEMLeader) {
+                memcpy(pe->pMEM->pb, pe->pMEMLeader->pb + (pe->pMEM->qwA - pe->pMEMLeader->qwA), pe->pMEM->cb);
+            }
+            pe->pMEM->f = TRUE;
+        } else if((pe->pMEM->qwA != pe->pMEMLeader->qwA) || (pe->pMEM->cb != pe->pMEMLeader->cb)) {
+            ctx->ppMEMsRetry[cRetry++] = pe->pMEM;
+        }
+    }
+    *pcMEMs = cRetry;
+    return ctx->ppMEMsRetry;
+}
+
+/*
+* Free a merge context.
+* -- ctx
+*/
+VOID LcMerge_Finish(_In_opt_ _Post_ptr_invalid_ PLC_MERGE_CONTEXT ctx)
+{
+    if(!ctx) { return; }
+    LcArena_Free(ctx->pbTemp);
+    LcArena_Free(ctx);
+}
@@ -0,0 +1,336 @@
+// negcache.c : implementation : negative cache of unreadable pages.
+//
+// Pages which fail to read from the device (such as pages in MMIO holes or in
+// unbacked ranges) are remembered for a configurable time-to-live. Reads of
+// such pages are failed directly without being sent to the device.
+// Failed pages are kept in a hash table of 64-page blocks - each block holds a
+// bitmap of its failed pages. A block expires as a whole once its time-to-live
+// (counted from the first failed page in the block) has passed.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_NEGCACHE_BLOCKS              0x4000          // hash table size in blocks (covers min 4GB).
+#define LC_NEGCACHE_BLOCKS_FILL         0x3000          // max used blocks before expired blocks are purged.
+#define LC_NEGCACHE_TTL_MAX             3600000         // max time-to-live in ms (1h).
+#define LC_NEGCACHE_KEY(pa)             (((pa) >> 18) + 1)
+#define LC_NEGCACHE_BIT(pa)             (1ULL << (((pa) >> 12) & 0x3f))
+#define LC_NEGCACHE_HASH(qwKey)         ((DWORD)((qwKey) * 0x9E3779B97F4A7C15 >> 40) & (LC_NEGCACHE_BLOCKS - 1))
+
+typedef struct tdLC_NEGCACHE_BLOCK {
+    QWORD qwKey;                    // LC_NEGCACHE_KEY (0 = unused)
+    QWORD qwBitmap;                 // failed pages in block
+    QWORD tcInsert;                 // tick count (ms) of first failed page in block
+} LC_NEGCACHE_BLOCK, *PLC_NEGCACHE_BLOCK;
+
+typedef struct tdLC_NEGCACHE_CONTEXT {
+    CRITICAL_SECTION Lock;
+    DWORD dwTTL;                    // LC_OPT_CORE_NEGCACHE_TTL (0 = disabled)
+    DWORD cBlocksUsed;
+    QWORD cHit;
+    QWORD cFail;
+    PLC_NEGCACHE_BLOCK pBlocks;     // LC_NEGCACHE_BLOCKS (allocated when enabled)
+} LC_NEGCACHE_CONTEXT;
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+// All functions assume the negative cache lock is held by the caller.
+//-----------------------------------------------------------------------------
+
+/*
+* Find the block of a page address.
+* -- ctx
+* -- pa
+* -- fCreate = create the block if it does not exist.
+* -- tcNow
+* -- return = the block, NULL if not found (or if not created).
+*/
+PLC_NEGCACHE_BLOCK LcNegCache_BlockFind(_In_ PLC_NEGCACHE_CONTEXT ctx, _In_ QWORD pa, _In_ BOOL fCreate, _In_ QWORD tcNow)
+{
+    QWORD qwKey = LC_NEGCACHE_KEY(pa);
+    DWORD i = LC_NEGCACHE_HASH(qwKey);
+    PLC_NEGCACHE_BLOCK pBlock;
+    while(TRUE) {
+        pBlock = ctx->pBlocks + i;
+        if(pBlock->qwKey == qwKey) {
+            if(pBlock->qwBitmap && (tcNow - pBlock->tcInsert > ctx->dwTTL)) {
+                pBlock->qwBitmap = 0;
+            }
+            if(!pBlock->qwBitmap && fCreate) {
+                pBlock->tcInsert = tcNow;
+            }
+            return pBlock;
+        }
+        if(!pBlock->qwKey) {
+            if(!fCreate) { return NULL; }
+            pBlock->qwKey = qwKey;
+            pBlock->qwBitmap = 0;
+            pBlock->tcInsert = tcNow;
+            ctx->cBlocksUsed++;
+            return pBlock;
+        }
+        i = (i + 1) & (LC_NEGCACHE_BLOCKS - 1);
+    }
+}
+
+/*
+* Remove expired and empty blocks by re-hashing the remaining blocks. If the
+* hash table is still too full all blocks are removed.
+* -- ctx
+* -- tcNow
+*/
+VOID LcNegCache_Purge(_In_ PLC_NEGCACHE_CONTEXT ctx, _In_ QWORD tcNow)
+{
+    DWORD i;
+    PLC_NEGCACHE_BLOCK pBlocksOld, pBlock, pBlockNew;
+    if(!(pBlocksOld = LocalAlloc(0, LC_NEGCACHE_BLOCKS * sizeof(LC_NEGCACHE_BLOCK)))) {
+        ZeroMemory(ctx->pBlocks, LC_NEGCACHE_BLOCKS * sizeof(LC_NEGCACHE_BLOCK));
+        ctx->cBlocksUsed = 0;
+        return;
+    }
+    memcpy(pBlocksOld, ctx->pBlocks, LC_NEGCACHE_BLOCKS * sizeof(LC_NEGCACHE_BLOCK));
+    ZeroMemory(ctx->pBlocks, LC_NEGCACHE_BLOCKS * sizeof(LC_NEGCACHE_BLOCK));
+    ctx->cBlocksUsed = 0;
+    for(i = 0; i < LC_NEGCACHE_BLOCKS; i++) {
+        pBlock = pBlocksOld + i;
+        if(!pBlock->qwKey || !pBlock->qwBitmap || (tcNow - pBlock->tcInsert > ctx->dwTTL)) { continue; }
+        pBlockNew = LcNegCache_BlockFind(ctx, (pBlock->qwKey - 1) << 18, TRUE, tcNow);
+        pBlockNew->qwBitmap = pBlock->qwBitmap;
+        pBlockNew->tcInsert = pBlock->tcInsert;
+    }
+    LocalFree(pBlocksOld);
+    if(ctx->cBlocksUsed >= LC_NEGCACHE_BLOCKS_FILL) {
+        ZeroMemory(ctx->pBlocks, LC_NEGCACHE_BLOCKS * sizeof(LC_NEGCACHE_BLOCK));
+        ctx->cBlocksUsed = 0;
+    }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// READ PATH FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether the negative cache is enabled.
+* -- ctxLC
+* -- return
+*/
+BOOL LcNegCache_IsEnabled(_In_ PLC_CONTEXT ctxLC)
+{
+    return ctxLC->pNegCache && ctxLC->pNegCache->dwTTL;
+}
+
+/*
+* Fail MEMs of pages known to be unreadable. MEMs which still require a device
+* read are put into the ppMEMsMiss array (which must have room for cMEMs
+* entries, and which may be the same array as ppMEMs).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcNegCache_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss)
+{
+    PLC_NEGCACHE_CONTEXT ctx = ctxLC->pNegCache;
+    PLC_NEGCACHE_BLOCK pBlock;
+    PMEM_SCATTER pMEM;
+    DWORD iMEM, cMiss = 0;
+    QWORD tcNow = GetTickCount64();
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        if(ctx->cBlocksUsed && ((pMEM->qwA & 0xfff) + pMEM->cb <= 0x1000) && (pBlock = LcNegCache_BlockFind(ctx, pMEM->qwA, FALSE, tcNow))) {
+            if(pBlock->qwBitmap & LC_NEGCACHE_BIT(pMEM->qwA)) {
+                ctx->cHit++;
+                continue;
+            }
+        }
+        ppMEMsMiss[cMiss++] = pMEM;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return cMiss;
+}
+
+/*
+* Record pages which failed to read from the device. Only MEMs within a single
+* page are recorded.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcNegCache_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_NEGCACHE_CONTEXT ctx = ctxLC->pNegCache;
+    PLC_NEGCACHE_BLOCK pBlock;
+    PMEM_SCATTER pMEM;
+    DWORD iMEM;
+    QWORD tcNow;
+    if(!LcNegCache_IsEnabled(ctxLC)) { return; }
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(!pMEM->f && MEM_SCATTER_ADDR_ISVALID(pMEM)) { break; }
+    }
+    if(iMEM == cMEMs) { return; }
+    tcNow = GetTickCount64();
+    EnterCriticalSection(&ctx->Lock);
+    if(qwWriteGeneration != ctxLC->qwWriteGeneration) { cMEMs = 0; }
+    for(; ctx->dwTTL && (iMEM < cMEMs); iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM) || ((pMEM->qwA & 0xfff) + pMEM->cb > 0x1000)) { continue; }
+        if(ctx->cBlocksUsed >= LC_NEGCACHE_BLOCKS_FILL) {
+            LcNegCache_Purge(ctx, tcNow);
+        }
+        pBlock = LcNegCache_BlockFind(ctx, pMEM->qwA, TRUE, tcNow);
+        pBlock->qwBitmap |= LC_NEGCACHE_BIT(pMEM->qwA);
+        ctx->cFail++;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Remove pages touched by the MEMs from the negative cache. This is called on
+* writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcNegCache_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_NEGCACHE_CONTEXT ctx = ctxLC->pNegCache;
+    PLC_NEGCACHE_BLOCK pBlock;
+    DWORD iMEM;
+    QWORD pa, tcNow;
+    if(!LcNegCache_IsEnabled(ctxLC) || !ctx->cBlocksUsed) { return; }
+    tcNow = GetTickCount64();
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; ctx->pBlocks && (iMEM < cMEMs); iMEM++) {
+        if(MEM_SCATTER_ADDR_ISINVALID(ppMEMs[iMEM])) { continue; }
+        for(pa = ppMEMs[iMEM]->qwA & ~0xfff; pa < ppMEMs[iMEM]->qwA + ppMEMs[iMEM]->cb; pa += 0x1000) {
+            if((pBlock = LcNegCache_BlockFind(ctx, pa, FALSE, tcNow))) {
+                pBlock->qwBitmap &= ~LC_NEGCACHE_BIT(pa);
+            }
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Remove all pages from the negative cache.
+* -- ctxLC
+*/
+VOID LcNegCache_Flush(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_NEGCACHE_CONTEXT ctx = ctxLC->pNegCache;
+    if(!ctx) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    if(ctx->pBlocks) {
+        ZeroMemory(ctx->pBlocks, LC_NEGCACHE_BLOCKS * sizeof(LC_NEGCACHE_BLOCK));
+    }
+    ctx->cBlocksUsed = 0;
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// GET / SET OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Retrieve a negative cache option (LC_OPT_CORE_NEGCACHE_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcNegCache_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_NEGCACHE_CONTEXT ctx = ctxLC->pNegCache;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_NEGCACHE_TTL:
+            *pqwValue = ctx->dwTTL;
+            return TRUE;
+        case LC_OPT_CORE_NEGCACHE_HIT:
+            *pqwValue = ctx->cHit;
+            return TRUE;
+        case LC_OPT_CORE_NEGCACHE_FAIL:
+            *pqwValue = ctx->cFail;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Set a negative cache option (LC_OPT_CORE_NEGCACHE_TTL). Disabling the
+* negative cache frees its memory.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcNegCache_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    PLC_NEGCACHE_CONTEXT ctx = ctxLC->pNegCache;
+    BOOL fResult = TRUE;
+    if((fOption != LC_OPT_CORE_NEGCACHE_TTL) || (qwValue > LC_NEGCACHE_TTL_MAX)) { return FALSE; }
+    EnterCriticalSection(&ctx->Lock);
+    if(!qwValue) {
+        LocalFree(ctx->pBlocks);
+        ctx->pBlocks = NULL;
+        ctx->cBlocksUsed = 0;
+    } else if(!ctx->pBlocks && !(ctx->pBlocks = LocalAlloc(LMEM_ZEROINIT, LC_NEGCACHE_BLOCKS * sizeof(LC_NEGCACHE_BLOCK)))) {
+        fResult = FALSE;
+    }
+    ctx->dwTTL = fResult ? (DWORD)qwValue : 0;
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the (initially disabled) negative cache of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcNegCache_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_NEGCACHE_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_NEGCACHE_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    ctxLC->pNegCache = ctx;
+    return TRUE;
+}
+
+/*
+* Close the negative cache of a LeechCore context and free its resources.
+* -- ctxLC
+*/
+VOID LcNegCache_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_NEGCACHE_CONTEXT ctx = ctxLC->pNegCache;
+    if(!ctx) { return; }
+    ctxLC->pNegCache = NULL;
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx->pBlocks);
+    LocalFree(ctx);
+}
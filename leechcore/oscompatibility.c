@@ -41,7 +41,6 @@ BOOL Util_GetPathExe(_Out_writes_(MAX_PATH) PCHAR szPath)
 #include "util.h"
 #include <dlfcn.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <sys/ioctl.h>
 
 #define INTERNAL_HANDLE_TYPE_THREAD        0xdeadbeeffedfed01
@@ -254,27 +253,83 @@ VOID LeaveCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
     pthread_mutex_unlock(&lpCriticalSection->mutex);
 }
 
+VOID InitializeConditionVariable(_Out_ PCONDITION_VARIABLE ConditionVariable)
+{
+    pthread_condattr_t CondAttr;
+    pthread_condattr_init(&CondAttr);
+    pthread_condattr_setclock(&CondAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ConditionVariable->cond, &CondAttr);
+    pthread_condattr_destroy(&CondAttr);
+}
+
+/*
+* Sleep on a condition variable. NB! the critical section must be entered
+* exactly once by the calling thread (it is recursive on Linux).
+*/
+BOOL SleepConditionVariableCS(_Inout_ PCONDITION_VARIABLE ConditionVariable, _Inout_ LPCRITICAL_SECTION CriticalSection, _In_ DWORD dwMilliseconds)
+{
+    struct timespec tsTimeout;
+    if(dwMilliseconds == INFINITE) {
+        return 0 == pthread_cond_wait(&ConditionVariable->cond, &CriticalSection->mutex);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tsTimeout);
+    tsTimeout.tv_sec += dwMilliseconds / 1000;
+    tsTimeout.tv_nsec += (dwMilliseconds % 1000) * 1000000;
+    if(tsTimeout.tv_nsec >= 1000000000) {
+        tsTimeout.tv_sec++;
+        tsTimeout.tv_nsec -= 1000000000;
+    }
+    return 0 == pthread_cond_timedwait(&ConditionVariable->cond, &CriticalSection->mutex, &tsTimeout);
+}
+
+VOID WakeConditionVariable(_Inout_ PCONDITION_VARIABLE ConditionVariable)
+{
+    pthread_cond_signal(&ConditionVariable->cond);
+}
+
+VOID WakeAllConditionVariable(_Inout_ PCONDITION_VARIABLE ConditionVariable)
+{
+    pthread_cond_broadcast(&ConditionVariable->cond);
+}
+
 // ----------------------------------------------------------------------------
 // EVENT AND CLOSE HANDLE functionality below:
+// Events are protected by one process-wide mutex. Waiters register a condition
+// variable on each event waited upon and are woken by SetEvent. The single
+// mutex makes the bWaitAll check and the auto-reset of signaled events atomic
+// across all events waited upon.
 // ----------------------------------------------------------------------------
 
 #define OSCOMPATIBILITY_HANDLE_INTERNAL         0x35d91cca
-#define OSCOMPATIBILITY_HANDLE_TYPE_EVENTFD     1
+#define OSCOMPATIBILITY_HANDLE_TYPE_EVENT       1
+
+typedef struct tdEVENT_WAITER {
+    struct tdEVENT_WAITER *FLink;
+    pthread_cond_t *pCond;
+} EVENT_WAITER, *PEVENT_WAITER;
 
 typedef struct tdHANDLE_INTERNAL {
     DWORD magic;
     DWORD type;
     BOOL fEventManualReset;
-    int handle;
+    BOOL fEventSignaled;
+    PEVENT_WAITER pEventWaiters;
 } HANDLE_INTERNAL, *PHANDLE_INTERNAL;
 
+pthread_mutex_t g_EventLock = PTHREAD_MUTEX_INITIALIZER;
+
 BOOL CloseHandle(_In_ HANDLE hObject)
 {
     PHANDLE_INTERNAL hi = (PHANDLE_INTERNAL)hObject;
-    if(hi->magic != OSCOMPATIBILITY_HANDLE_INTERNAL) { return FALSE; }
-    if(hi->type == OSCOMPATIBILITY_HANDLE_TYPE_EVENTFD) {
-        close(hi->handle);
+    PINTERNAL_HANDLE ph = (PINTERNAL_HANDLE)hObject;
+    if(!hObject) { return FALSE; }
+    if(ph->type == INTERNAL_HANDLE_TYPE_THREAD) {
+        pthread_detach((pthread_t)ph->handle);
+        LocalFree(ph);
+        return TRUE;
     }
+    if(hi->magic != OSCOMPATIBILITY_HANDLE_INTERNAL) { return FALSE; }
+    hi->magic = 0;
     LocalFree(hi);
     return TRUE;
 }
@@ -282,70 +337,132 @@ BOOL CloseHandle(_In_ HANDLE hObject)
 BOOL SetEvent(_In_ HANDLE hEvent)
 {
     PHANDLE_INTERNAL hi = (PHANDLE_INTERNAL)hEvent;
-    uint64_t v = 1;
-    return -1 != write(hi->handle, &v, sizeof(v));
+    PEVENT_WAITER pWaiter;
+    if(!hi || (hi->magic != OSCOMPATIBILITY_HANDLE_INTERNAL)) { return FALSE; }
+    pthread_mutex_lock(&g_EventLock);
+    hi->fEventSignaled = TRUE;
+    for(pWaiter = hi->pEventWaiters; pWaiter; pWaiter = pWaiter->FLink) {
+        pthread_cond_signal(pWaiter->pCond);
+    }
+    pthread_mutex_unlock(&g_EventLock);
+    return TRUE;
 }
 
-// function is not thread-safe, but use case in leechcore is single-threaded
 BOOL ResetEvent(_In_ HANDLE hEvent)
 {
     PHANDLE_INTERNAL hi = (PHANDLE_INTERNAL)hEvent;
-    uint64_t v;
-    struct pollfd fds[1];
-    fds[0].fd = hi->handle;
-    fds[0].events = POLLIN;
-    while((poll(fds, 1, 0) > 0) && (fds[0].revents & POLLIN)) {
-        read(fds[0].fd, &v, sizeof(v));
-    }
+    if(!hi || (hi->magic != OSCOMPATIBILITY_HANDLE_INTERNAL)) { return FALSE; }
+    pthread_mutex_lock(&g_EventLock);
+    hi->fEventSignaled = FALSE;
+    pthread_mutex_unlock(&g_EventLock);
     return TRUE;
 }
 
 HANDLE CreateEvent(_In_opt_ PVOID lpEventAttributes, _In_ BOOL bManualReset, _In_ BOOL bInitialState, _In_opt_ PVOID lpName)
 {
     PHANDLE_INTERNAL pi;
-    pi = malloc(sizeof(HANDLE_INTERNAL));
+    if(!(pi = LocalAlloc(LMEM_ZEROINIT, sizeof(HANDLE_INTERNAL)))) { return NULL; }
     pi->magic = OSCOMPATIBILITY_HANDLE_INTERNAL;
-    pi->type = OSCOMPATIBILITY_HANDLE_TYPE_EVENTFD;
+    pi->type = OSCOMPATIBILITY_HANDLE_TYPE_EVENT;
     pi->fEventManualReset = bManualReset;
-    pi->handle = eventfd(0, 0);
-    if(bInitialState) { SetEvent(pi); }
+    pi->fEventSignaled = bInitialState;
     return pi;
 }
 
-// function is limited and not thread-safe, but use case in leechcore is single-threaded
-DWORD WaitForSingleObject(_In_ HANDLE hHandle, _In_ DWORD dwMilliseconds)
+/*
+* Check whether the wait is satisfied and if so reset the auto-reset events
+* which satisfied it. NB! g_EventLock must be held.
+* -- nCount
+* -- phi
+* -- bWaitAll
+* -- return = WAIT_OBJECT_0 + index on success, WAIT_TIMEOUT if not satisfied.
+*/
+DWORD WaitForMultipleObjects_TryConsume(_In_ DWORD nCount, _In_ PHANDLE_INTERNAL *phi, _In_ BOOL bWaitAll)
 {
-    PHANDLE_INTERNAL hi = (PHANDLE_INTERNAL)hHandle;
-    uint64_t v;
-    read(hi->handle, &v, sizeof(v));
-    return 0;
-}
-
-// function is limited and not thread-safe, but use case in leechcore is single-threaded
-DWORD WaitForMultipleObjects(_In_ DWORD nCount, HANDLE *lpHandles, _In_ BOOL bWaitAll, _In_ DWORD dwMilliseconds)
-{
-    struct pollfd fds[MAXIMUM_WAIT_OBJECTS];
     DWORD i;
-    uint64_t v;
     if(bWaitAll) {
         for(i = 0; i < nCount; i++) {
-            WaitForSingleObject(lpHandles[i], dwMilliseconds);
+            if(!phi[i]->fEventSignaled) { return WAIT_TIMEOUT; }
+        }
+        for(i = 0; i < nCount; i++) {
+            if(!phi[i]->fEventManualReset) { phi[i]->fEventSignaled = FALSE; }
+        }
+        return WAIT_OBJECT_0;
+    }
+    for(i = 0; i < nCount; i++) {
+        if(phi[i]->fEventSignaled) {
+            if(!phi[i]->fEventManualReset) { phi[i]->fEventSignaled = FALSE; }
+            return WAIT_OBJECT_0 + i;
         }
-        return -1;
     }
+    return WAIT_TIMEOUT;
+}
+
+DWORD WaitForMultipleObjects(_In_ DWORD nCount, HANDLE *lpHandles, _In_ BOOL bWaitAll, _In_ DWORD dwMilliseconds)
+{
+    DWORD i, dwResult;
+    BOOL fWaiting = FALSE;
+    PEVENT_WAITER *ppWaiter;
+    PHANDLE_INTERNAL phi[MAXIMUM_WAIT_OBJECTS];
+    EVENT_WAITER Waiter[MAXIMUM_WAIT_OBJECTS];
+    pthread_condattr_t CondAttr;
+    pthread_cond_t Cond;
+    struct timespec tsTimeout;
+    if(!nCount || (nCount > MAXIMUM_WAIT_OBJECTS) || !lpHandles) { return WAIT_FAILED; }
     for(i = 0; i < nCount; i++) {
-        fds[i].fd = ((PHANDLE_INTERNAL)lpHandles[i])->handle;
-        fds[i].events = POLLIN;
+        phi[i] = (PHANDLE_INTERNAL)lpHandles[i];
+        if(!phi[i] || (phi[i]->magic != OSCOMPATIBILITY_HANDLE_INTERNAL) || (phi[i]->type != OSCOMPATIBILITY_HANDLE_TYPE_EVENT)) { return WAIT_FAILED; }
     }
-    if(poll(fds, 1, -1) > 0) {
+    if(dwMilliseconds != INFINITE) {
+        clock_gettime(CLOCK_MONOTONIC, &tsTimeout);
+        tsTimeout.tv_sec += dwMilliseconds / 1000;
+        tsTimeout.tv_nsec += (dwMilliseconds % 1000) * 1000000;
+        if(tsTimeout.tv_nsec >= 1000000000) {
+            tsTimeout.tv_sec++;
+            tsTimeout.tv_nsec -= 1000000000;
+        }
+    }
+    pthread_mutex_lock(&g_EventLock);
+    while((WAIT_TIMEOUT == (dwResult = WaitForMultipleObjects_TryConsume(nCount, phi, bWaitAll))) && dwMilliseconds) {
+        if(!fWaiting) {
+            // register as waiter on all events:
+            fWaiting = TRUE;
+            pthread_condattr_init(&CondAttr);
+            pthread_condattr_setclock(&CondAttr, CLOCK_MONOTONIC);
+            pthread_cond_init(&Cond, &CondAttr);
+            for(i = 0; i < nCount; i++) {
+                Waiter[i].pCond = &Cond;
+                Waiter[i].FLink = phi[i]->pEventWaiters;
+                phi[i]->pEventWaiters = &Waiter[i];
+            }
+        }
+        if(dwMilliseconds == INFINITE) {
+            pthread_cond_wait(&Cond, &g_EventLock);
+        } else if(ETIMEDOUT == pthread_cond_timedwait(&Cond, &g_EventLock, &tsTimeout)) {
+            dwResult = WaitForMultipleObjects_TryConsume(nCount, phi, bWaitAll);
+            break;
+        }
+    }
+    if(fWaiting) {
+        // unregister as waiter on all events:
         for(i = 0; i < nCount; i++) {
-            if((fds[0].revents & POLLIN)) {
-                read(fds[i].fd, &v, sizeof(v));
-                return i;
+            for(ppWaiter = &phi[i]->pEventWaiters; *ppWaiter; ppWaiter = &(*ppWaiter)->FLink) {
+                if(*ppWaiter == &Waiter[i]) {
+                    *ppWaiter = Waiter[i].FLink;
+                    break;
+                }
             }
         }
+        pthread_cond_destroy(&Cond);
+        pthread_condattr_destroy(&CondAttr);
     }
-    return -1;
+    pthread_mutex_unlock(&g_EventLock);
+    return dwResult;
+}
+
+DWORD WaitForSingleObject(_In_ HANDLE hHandle, _In_ DWORD dwMilliseconds)
+{
+    return WaitForMultipleObjects(1, &hHandle, FALSE, dwMilliseconds);
 }
 
 #endif /* LINUX */
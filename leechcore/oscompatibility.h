@@ -14,6 +14,8 @@
 #include <winusb.h>
 #include <setupapi.h>
 #include <conio.h>
+#include <io.h>
+#include <sys/stat.h>
 
 #define SOCK_NONBLOCK                       0
 
@@ -36,10 +38,13 @@ VOID usleep(_In_ DWORD us);
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
 #include <unistd.h>
-#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -56,6 +61,7 @@ typedef uint16_t                            WORD, *PWORD, USHORT, *PUSHORT;
 typedef uint16_t                            WCHAR, *PWCHAR, *LPWSTR, *LPCWSTR;
 typedef uint32_t                            DWORD, *PDWORD, ULONG, *PULONG;
 typedef long long unsigned int              QWORD, *PQWORD, ULONG64, *PULONG64;
+typedef long long int                       LONGLONG, *PLONGLONG;
 typedef uint64_t                            LARGE_INTEGER, *PLARGE_INTEGER, FILETIME;
 typedef size_t                              SIZE_T, *PSIZE_T;
 typedef void                                *OVERLAPPED, *LPOVERLAPPED;
@@ -89,6 +95,8 @@ typedef struct tdEXCEPTION_RECORD64         { CHAR sz[152]; } EXCEPTION_RECORD64
 #define SOCKET_ERROR	                    -1
 #define WSAEWOULDBLOCK                      10035L
 #define WAIT_OBJECT_0                       (0x00000000UL)
+#define WAIT_TIMEOUT                        (0x00000102UL)
+#define WAIT_FAILED                         (0xFFFFFFFFUL)
 #define INFINITE                            (0xFFFFFFFFUL)
 #define MAXIMUM_WAIT_OBJECTS                64
 
@@ -146,9 +154,16 @@ typedef struct tdEXCEPTION_RECORD64         { CHAR sz[152]; } EXCEPTION_RECORD64
 #define _fseeki64(f, o, w)                  (fseeko64(f, o, w))
 #define _chsize_s(fd, cb)                   (ftruncate64(fd, cb))
 #define _fileno(f)                          (fileno(f))
+#define _stat64                             stat64
 #define InterlockedAdd64(p, v)              (__sync_add_and_fetch(p, v))
 #define InterlockedIncrement64(p)           (__sync_add_and_fetch(p, 1))
 #define InterlockedIncrement(p)             (__sync_add_and_fetch_4(p, 1))
+#define InterlockedDecrement(p)             (__sync_sub_and_fetch_4(p, 1))
+#define InterlockedExchangePointer(p, v)    (__atomic_exchange_n(p, v, __ATOMIC_SEQ_CST))
+#define InterlockedCompareExchangePointer(p, v, c)  (__sync_val_compare_and_swap(p, c, v))
+#define InterlockedExchange(p, v)           (__atomic_exchange_n(p, v, __ATOMIC_SEQ_CST))
+#define InterlockedCompareExchange(p, v, c) (__sync_val_compare_and_swap(p, c, v))
+#define GetCurrentThreadId()                ((DWORD)syscall(SYS_gettid))
 #define GetCurrentProcess()					((HANDLE)-1)
 #define closesocket(s)                      close(s)
 
@@ -165,6 +180,15 @@ VOID DeleteCriticalSection(LPCRITICAL_SECTION lpCriticalSection);
 VOID EnterCriticalSection(LPCRITICAL_SECTION lpCriticalSection);
 VOID LeaveCriticalSection(LPCRITICAL_SECTION lpCriticalSection);
 
+typedef struct tdCONDITION_VARIABLE {
+    pthread_cond_t cond;
+} CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+
+VOID InitializeConditionVariable(_Out_ PCONDITION_VARIABLE ConditionVariable);
+BOOL SleepConditionVariableCS(_Inout_ PCONDITION_VARIABLE ConditionVariable, _Inout_ LPCRITICAL_SECTION CriticalSection, _In_ DWORD dwMilliseconds);
+VOID WakeConditionVariable(_Inout_ PCONDITION_VARIABLE ConditionVariable);
+VOID WakeAllConditionVariable(_Inout_ PCONDITION_VARIABLE ConditionVariable);
+
 typedef struct _SYSTEMTIME {
     WORD wYear;
     WORD wMonth;
@@ -0,0 +1,509 @@
+// qos.c : implementation : read scheduling priorities and bandwidth limits.
+//
+// All handles towards a device share one LeechCore context. Threads may mark
+// themselves as background readers (LC_OPT_CORE_QOS_PRIORITY). The priority is
+// kept in a per-thread table keyed by the unique id of the qos context - ids
+// are never re-used so a new context never inherits the priority set in a
+// closed context, and the priority is looked up without locking on each device
+// read. Each qos context counts its background threads - threads exiting while
+// marked background are subtracted through the process-wide table of live qos
+// contexts. Interactive reads are only tracked while background threads exist.
+// Device reads of background threads are dispatched in bounded slices and
+// yield to in-flight interactive reads between slices - interactive reads thus
+// never wait behind more than one background slice.
+// Device reads may also be limited in bytes/s and pages/s by token buckets.
+// Interactive reads are never delayed by the limits but consume tokens - the
+// background reads are throttled to the remaining bandwidth.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_QOS_SLICE                    0x200           // MEMs per background device read slice.
+#define LC_QOS_WAIT_MAX                 100             // max ms per wait for tokens.
+#define LC_QOS_THREAD_MAX               8               // max qos contexts per thread with a non-default priority.
+
+typedef struct tdLC_QOS_BUCKET {
+    QWORD qwRate;                   // tokens per second (0 = unlimited)
+    LONGLONG llTokens;              // available tokens (negative = debt)
+    QWORD tcLast;                   // tick count of last refill
+} LC_QOS_BUCKET, *PLC_QOS_BUCKET;
+
+typedef struct tdLC_QOS_CONTEXT {
+    CRITICAL_SECTION Lock;
+    BOOL fActive;
+    QWORD qwId;                     // unique qos context id (per-thread priority key)
+    struct tdLC_QOS_CONTEXT *FLink; // live qos context list (protected by g_QosLive.Lock)
+    DWORD volatile cThreadBackground;   // live threads marked background
+    DWORD cInteractive;             // in-flight interactive device reads (protected by Lock)
+    CONDITION_VARIABLE CondIdle;    // woken when no interactive reads are in flight (or on close)
+    LC_QOS_BUCKET Bytes;            // LC_OPT_CORE_QOS_BYTES_PER_SEC
+    LC_QOS_BUCKET Pages;            // LC_OPT_CORE_QOS_PAGES_PER_SEC
+    QWORD cmsThrottle;              // LC_OPT_CORE_QOS_THROTTLE_MS
+} LC_QOS_CONTEXT;
+
+typedef struct tdLC_QOS_THREAD_ENTRY {
+    QWORD qwQosId;                  // qos context id (0 = free entry).
+    DWORD dwPriority;               // LC_QOS_PRIORITY_* (never interactive in a used entry).
+} LC_QOS_THREAD_ENTRY;
+
+typedef struct tdLC_QOS_THREAD {
+    LC_QOS_THREAD_ENTRY e[LC_QOS_THREAD_MAX];
+} LC_QOS_THREAD, *PLC_QOS_THREAD;
+
+typedef struct tdLC_QOS_LIVE {
+    BOOL fValid;
+    CRITICAL_SECTION Lock;
+    PLC_QOS_CONTEXT pHead;
+} LC_QOS_LIVE;
+
+QWORD g_qwQosIdLast = 0;
+LC_QOS_LIVE g_QosLive = { 0 };
+
+#ifdef _WIN32
+DWORD g_dwQosTls = TLS_OUT_OF_INDEXES;
+#define LcQos_TlsGet()                  ((g_dwQosTls != TLS_OUT_OF_INDEXES) ? (PLC_QOS_THREAD)TlsGetValue(g_dwQosTls) : NULL)
+#define LcQos_TlsSet(p)                 ((g_dwQosTls != TLS_OUT_OF_INDEXES) && TlsSetValue(g_dwQosTls, p))
+#endif /* _WIN32 */
+#ifdef LINUX
+BOOL g_fQosTls = FALSE;
+pthread_key_t g_QosTls;
+#define LcQos_TlsGet()                  (g_fQosTls ? (PLC_QOS_THREAD)pthread_getspecific(g_QosTls) : NULL)
+#define LcQos_TlsSet(p)                 (g_fQosTls && !pthread_setspecific(g_QosTls, p))
+#endif /* LINUX */
+
+
+
+//-----------------------------------------------------------------------------
+// PER-THREAD PRIORITY FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Free the per-thread priority table of an exiting thread. The exiting thread
+* is subtracted from the background thread count of live qos contexts.
+* -- pv
+*/
+VOID LcQos_ThreadFree(_In_opt_ PVOID pv)
+{
+    DWORD i;
+    PLC_QOS_CONTEXT ctx;
+    PLC_QOS_THREAD pThread = (PLC_QOS_THREAD)pv;
+    if(!pThread) { return; }
+    if(g_QosLive.fValid) {
+        EnterCriticalSection(&g_QosLive.Lock);
+        for(i = 0; i < LC_QOS_THREAD_MAX; i++) {
+            if(pThread->e[i].qwQosId && (pThread->e[i].dwPriority == LC_QOS_PRIORITY_BACKGROUND)) {
+                for(ctx = g_QosLive.pHead; ctx && (ctx->qwId != pThread->e[i].qwQosId); ctx = ctx->FLink);
+                if(ctx) {
+                    InterlockedDecrement(&ctx->cThreadBackground);
+                }
+            }
+        }
+        LeaveCriticalSection(&g_QosLive.Lock);
+    }
+    LocalFree(pThread);
+}
+
+/*
+* Retrieve the priority of the calling thread in a qos context.
+* -- qwQosId
+* -- return = LC_QOS_PRIORITY_*
+*/
+DWORD LcQos_ThreadGet(_In_ QWORD qwQosId)
+{
+    DWORD i;
+    PLC_QOS_THREAD pThread = LcQos_TlsGet();
+    if(!pThread) { return LC_QOS_PRIORITY_INTERACTIVE; }
+    for(i = 0; i < LC_QOS_THREAD_MAX; i++) {
+        if(pThread->e[i].qwQosId == qwQosId) { return pThread->e[i].dwPriority; }
+    }
+    return LC_QOS_PRIORITY_INTERACTIVE;
+}
+
+/*
+* Set the priority of the calling thread in a qos context. Only threads with a
+* non-default priority take up an entry (and allocate the per-thread table).
+* -- qwQosId
+* -- dwPriority = LC_QOS_PRIORITY_*
+* -- pdwPriorityOld = the priority replaced.
+* -- return = FALSE if out of memory or if the thread already has a non-default
+*             priority in LC_QOS_THREAD_MAX other contexts.
+*/
+_Success_(return)
+BOOL LcQos_ThreadSet(_In_ QWORD qwQosId, _In_ DWORD dwPriority, _Out_ PDWORD pdwPriorityOld)
+{
+    DWORD i, iEntry = LC_QOS_THREAD_MAX;
+    PLC_QOS_THREAD pThread = LcQos_TlsGet();
+    *pdwPriorityOld = LC_QOS_PRIORITY_INTERACTIVE;
+    if(!pThread) {
+        if(dwPriority == LC_QOS_PRIORITY_INTERACTIVE) { return TRUE; }
+        if(!(pThread = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_QOS_THREAD)))) { return FALSE; }
+        if(!LcQos_TlsSet(pThread)) {
+            LocalFree(pThread);
+            return FALSE;
+        }
+    }
+    for(i = 0; i < LC_QOS_THREAD_MAX; i++) {
+        if(pThread->e[i].qwQosId == qwQosId) {
+            *pdwPriorityOld = pThread->e[i].dwPriority;
+            iEntry = i;
+            break;
+        }
+        if(!pThread->e[i].qwQosId && (iEntry == LC_QOS_THREAD_MAX)) {
+            iEntry = i;
+        }
+    }
+    if(dwPriority == LC_QOS_PRIORITY_INTERACTIVE) {
+        if(*pdwPriorityOld != LC_QOS_PRIORITY_INTERACTIVE) {
+            pThread->e[iEntry].qwQosId = 0;
+        }
+        return TRUE;
+    }
+    if(iEntry == LC_QOS_THREAD_MAX) { return FALSE; }
+    pThread->e[iEntry].qwQosId = qwQosId;
+    pThread->e[iEntry].dwPriority = dwPriority;
+    return TRUE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether the calling thread is a background thread.
+* -- ctx
+* -- return
+*/
+BOOL LcQos_IsThreadBackground(_In_ PLC_QOS_CONTEXT ctx)
+{
+    if(!ctx->cThreadBackground) { return FALSE; }
+    return LcQos_ThreadGet(ctx->qwId) == LC_QOS_PRIORITY_BACKGROUND;
+}
+
+/*
+* Refill a token bucket according to the time elapsed since the last refill.
+* The bucket holds at most one second worth of tokens.
+* -- pBucket
+* -- tcNow
+*/
+VOID LcQos_BucketRefill(_Inout_ PLC_QOS_BUCKET pBucket, _In_ QWORD tcNow)
+{
+    QWORD tcDelta;
+    LONGLONG llAdd;
+    if(!pBucket->qwRate) { return; }
+    tcDelta = min(1000, tcNow - pBucket->tcLast);
+    if(!(llAdd = (LONGLONG)(tcDelta * pBucket->qwRate / 1000))) { return; }
+    pBucket->llTokens = min((LONGLONG)pBucket->qwRate, pBucket->llTokens + llAdd);
+    pBucket->tcLast = tcNow;
+}
+
+/*
+* Retrieve the time in ms until a token bucket is no longer in debt.
+* -- pBucket
+* -- return
+*/
+DWORD LcQos_BucketWaitTime(_In_ PLC_QOS_BUCKET pBucket)
+{
+    if(!pBucket->qwRate || (pBucket->llTokens >= 0)) { return 0; }
+    return (DWORD)min(LC_QOS_WAIT_MAX, 1 + (QWORD)(-pBucket->llTokens) * 1000 / pBucket->qwRate);
+}
+
+/*
+* Consume tokens from a token bucket. The bucket may go into debt - at most one
+* second worth of tokens.
+* -- pBucket
+* -- qwCost
+*/
+VOID LcQos_BucketConsume(_Inout_ PLC_QOS_BUCKET pBucket, _In_ QWORD qwCost)
+{
+    if(!pBucket->qwRate) { return; }
+    pBucket->llTokens = max(-(LONGLONG)pBucket->qwRate, pBucket->llTokens - (LONGLONG)qwCost);
+}
+
+/*
+* Account a device read against the bandwidth limits. Background reads wait
+* until the token buckets are out of debt before consuming their tokens.
+* -- ctx
+* -- cMEMs
+* -- ppMEMs
+* -- fBackground
+*/
+VOID LcQos_Throttle(_In_ PLC_QOS_CONTEXT ctx, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs, _In_ BOOL fBackground)
+{
+    DWORD i, dwWait;
+    QWORD cb = 0, cPages = 0, tcStart = 0;
+    PMEM_SCATTER pMEM;
+    if(!ctx->Bytes.qwRate && !ctx->Pages.qwRate) { return; }
+    for(i = 0; i < cMEMs; i++) {
+        pMEM = ppMEMs[i];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        cb += pMEM->cb;
+        cPages += ((pMEM->qwA & 0xfff) + pMEM->cb + 0xfff) >> 12;
+    }
+    EnterCriticalSection(&ctx->Lock);
+    while(TRUE) {
+        LcQos_BucketRefill(&ctx->Bytes, GetTickCount64());
+        LcQos_BucketRefill(&ctx->Pages, GetTickCount64());
+        dwWait = max(LcQos_BucketWaitTime(&ctx->Bytes), LcQos_BucketWaitTime(&ctx->Pages));
+        if(!fBackground || !dwWait || !ctx->fActive) { break; }
+        if(!tcStart) { tcStart = GetTickCount64(); }
+        LeaveCriticalSection(&ctx->Lock);
+        Sleep(dwWait);
+        EnterCriticalSection(&ctx->Lock);
+    }
+    LcQos_BucketConsume(&ctx->Bytes, cb);
+    LcQos_BucketConsume(&ctx->Pages, cPages);
+    if(tcStart) { ctx->cmsThrottle += GetTickCount64() - tcStart; }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// READ SCHEDULING FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Schedule a device read according to the priority of the calling thread and
+* the bandwidth limits. Background reads are read in slices - before each slice
+* in-flight interactive reads are waited upon.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- return = TRUE if read, FALSE if qos is not active - caller should read.
+*/
+_Success_(return)
+BOOL LcQos_ReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_QOS_CONTEXT ctx = ctxLC->pQos;
+    DWORD i, c;
+    if(!ctx || (!ctx->cThreadBackground && !ctx->Bytes.qwRate && !ctx->Pages.qwRate)) { return FALSE; }
+    if(!LcQos_IsThreadBackground(ctx)) {
+        EnterCriticalSection(&ctx->Lock);
+        ctx->cInteractive++;
+        LeaveCriticalSection(&ctx->Lock);
+        LcQos_Throttle(ctx, cMEMs, ppMEMs, FALSE);
+        LcReadScatter_DeviceSubmit(ctxLC, cMEMs, ppMEMs);
+        EnterCriticalSection(&ctx->Lock);
+        if(0 == --ctx->cInteractive) {
+            WakeAllConditionVariable(&ctx->CondIdle);
+        }
+        LeaveCriticalSection(&ctx->Lock);
+        return TRUE;
+    }
+    for(i = 0; i < cMEMs; i += c) {
+        c = min(LC_QOS_SLICE, cMEMs - i);
+        EnterCriticalSection(&ctx->Lock);
+        while(ctx->cInteractive && ctx->fActive) {
+            SleepConditionVariableCS(&ctx->CondIdle, &ctx->Lock, INFINITE);
+        }
+        LeaveCriticalSection(&ctx->Lock);
+        LcQos_Throttle(ctx, c, ppMEMs + i, TRUE);
+        LcReadScatter_DeviceSubmit(ctxLC, c, ppMEMs + i);
+    }
+    return TRUE;
+}
+
+/*
+* Set the priority class of the calling thread.
+* -- ctxLC
+* -- dwPriority = LC_QOS_PRIORITY_*
+* -- return
+*/
+_Success_(return)
+BOOL LcQos_SetThreadPriority(_In_ PLC_CONTEXT ctxLC, _In_ DWORD dwPriority)
+{
+    PLC_QOS_CONTEXT ctx = ctxLC->pQos;
+    DWORD dwPriorityOld;
+    if(!ctx || (dwPriority > LC_QOS_PRIORITY_BACKGROUND)) { return FALSE; }
+    if(!LcQos_ThreadSet(ctx->qwId, dwPriority, &dwPriorityOld)) { return FALSE; }
+    if((dwPriority == LC_QOS_PRIORITY_BACKGROUND) && (dwPriorityOld != LC_QOS_PRIORITY_BACKGROUND)) {
+        InterlockedIncrement(&ctx->cThreadBackground);
+    }
+    if((dwPriority != LC_QOS_PRIORITY_BACKGROUND) && (dwPriorityOld == LC_QOS_PRIORITY_BACKGROUND)) {
+        InterlockedDecrement(&ctx->cThreadBackground);
+    }
+    return TRUE;
+}
+
+/*
+* Retrieve the priority class of the calling thread.
+* -- ctxLC
+* -- return = LC_QOS_PRIORITY_*
+*/
+DWORD LcQos_GetThreadPriority(_In_ PLC_CONTEXT ctxLC)
+{
+    return (ctxLC->pQos && LcQos_IsThreadBackground(ctxLC->pQos)) ? LC_QOS_PRIORITY_BACKGROUND : LC_QOS_PRIORITY_INTERACTIVE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// GET / SET OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Retrieve a qos option (LC_OPT_CORE_QOS_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcQos_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_QOS_CONTEXT ctx = ctxLC->pQos;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_QOS_PRIORITY:
+            *pqwValue = LcQos_GetThreadPriority(ctxLC);
+            return TRUE;
+        case LC_OPT_CORE_QOS_BYTES_PER_SEC:
+            *pqwValue = ctx->Bytes.qwRate;
+            return TRUE;
+        case LC_OPT_CORE_QOS_PAGES_PER_SEC:
+            *pqwValue = ctx->Pages.qwRate;
+            return TRUE;
+        case LC_OPT_CORE_QOS_THROTTLE_MS:
+            *pqwValue = ctx->cmsThrottle;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Set a qos option (LC_OPT_CORE_QOS_*). The priority is set for the calling
+* thread. Setting a bandwidth limit resets its token bucket to full.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcQos_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    PLC_QOS_CONTEXT ctx = ctxLC->pQos;
+    PLC_QOS_BUCKET pBucket;
+    switch(fOption) {
+        case LC_OPT_CORE_QOS_PRIORITY:
+            return LcQos_SetThreadPriority(ctxLC, (DWORD)qwValue);
+        case LC_OPT_CORE_QOS_BYTES_PER_SEC:
+        case LC_OPT_CORE_QOS_PAGES_PER_SEC:
+            if(qwValue > 0x7fffffffffff) { return FALSE; }
+            pBucket = (fOption == LC_OPT_CORE_QOS_BYTES_PER_SEC) ? &ctx->Bytes : &ctx->Pages;
+            EnterCriticalSection(&ctx->Lock);
+            pBucket->qwRate = qwValue;
+            pBucket->llTokens = (LONGLONG)qwValue;
+            pBucket->tcLast = GetTickCount64();
+            LeaveCriticalSection(&ctx->Lock);
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the (initially inactive) qos functionality of a LeechCore context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcQos_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_QOS_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_QOS_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    InitializeConditionVariable(&ctx->CondIdle);
+    ctx->fActive = TRUE;
+    ctx->qwId = InterlockedIncrement64(&g_qwQosIdLast);
+    if(g_QosLive.fValid) {
+        EnterCriticalSection(&g_QosLive.Lock);
+        ctx->FLink = g_QosLive.pHead;
+        g_QosLive.pHead = ctx;
+        LeaveCriticalSection(&g_QosLive.Lock);
+    }
+    ctxLC->pQos = ctx;
+    return TRUE;
+}
+
+/*
+* Close the qos functionality of a LeechCore context.
+* -- ctxLC
+*/
+VOID LcQos_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_QOS_CONTEXT ctx = ctxLC->pQos, *pp;
+    if(!ctx) { return; }
+    if(g_QosLive.fValid) {
+        EnterCriticalSection(&g_QosLive.Lock);
+        for(pp = &g_QosLive.pHead; *pp && (*pp != ctx); pp = &(*pp)->FLink);
+        if(*pp) { *pp = ctx->FLink; }
+        LeaveCriticalSection(&g_QosLive.Lock);
+    }
+    EnterCriticalSection(&ctx->Lock);
+    ctx->fActive = FALSE;
+    WakeAllConditionVariable(&ctx->CondIdle);
+    LeaveCriticalSection(&ctx->Lock);
+    ctxLC->pQos = NULL;
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx);
+}
+
+/*
+* Initialize the per-thread priority functionality. Called on process attach.
+*/
+VOID LcQos_ProcessAttach()
+{
+#ifdef _WIN32
+    g_dwQosTls = TlsAlloc();
+#endif /* _WIN32 */
+#ifdef LINUX
+    g_fQosTls = (0 == pthread_key_create(&g_QosTls, LcQos_ThreadFree));
+#endif /* LINUX */
+    InitializeCriticalSection(&g_QosLive.Lock);
+    g_QosLive.fValid = TRUE;
+}
+
+/*
+* Free the priority table of the current thread. Called on thread detach.
+*/
+VOID LcQos_ThreadDetach()
+{
+    LcQos_ThreadFree(LcQos_TlsGet());
+    LcQos_TlsSet(NULL);
+}
+
+/*
+* Close the per-thread priority functionality. Called on process detach.
+*/
+VOID LcQos_ProcessDetach()
+{
+    LcQos_ThreadDetach();
+#ifdef _WIN32
+    if(g_dwQosTls != TLS_OUT_OF_INDEXES) {
+        TlsFree(g_dwQosTls);
+        g_dwQosTls = TLS_OUT_OF_INDEXES;
+    }
+#endif /* _WIN32 */
+#ifdef LINUX
+    if(g_fQosTls) {
+        g_fQosTls = FALSE;
+        pthread_key_delete(g_QosTls);
+    }
+#endif /* LINUX */
+    if(g_QosLive.fValid) {
+        g_QosLive.fValid = FALSE;
+        DeleteCriticalSection(&g_QosLive.Lock);
+    }
+}
@@ -0,0 +1,566 @@
+// readahead.c : implementation : sequential readahead and explicit prefetch.
+//
+// Ascending read streams are detected per LeechCore handle on the untranslated
+// addresses of each LcReadScatter batch. Once a stream is detected the pages
+// following it are read by a background worker thread into a bounded page
+// buffer. Callers may also explicitly request pages to be prefetched by
+// LcPrefetch. Buffered pages are keyed on their translated (device) address
+// and are served by reads of the page - a full page read removes the page from
+// the buffer. Buffered pages expire after the page cache time-to-live on
+// volatile devices (and if the TTL cache policy is selected).
+// The buffer is LC_READAHEAD_WAYS-way set associative - a page colliding with
+// buffered pages in all ways of its set replaces the oldest page of the set.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_READAHEAD_WINDOW_MAX         0x1000          // max readahead window in pages (16MB).
+#define LC_READAHEAD_BUFFER_DEFAULT     0x400           // min buffer size in pages (4MB).
+#define LC_READAHEAD_CHUNK              0x100           // max pages per background device read.
+#define LC_READAHEAD_STREAMS            4               // concurrently tracked ascending streams.
+#define LC_READAHEAD_QUEUE              0x20            // max queued prefetch ranges.
+#define LC_READAHEAD_WAYS               2               // buffer slots per set.
+#define LC_READAHEAD_SLOT_EMPTY         ((QWORD)-1)
+
+typedef struct tdLC_READAHEAD_STREAM {
+    QWORD paNext;                   // expected address of next sequential read
+    QWORD paPrefetchEnd;            // end of range already queued for prefetch
+    DWORD cHit;                     // number of sequential reads in stream
+} LC_READAHEAD_STREAM, *PLC_READAHEAD_STREAM;
+
+typedef struct tdLC_READAHEAD_SLOT {
+    QWORD pa;                       // translated page address (or LC_READAHEAD_SLOT_EMPTY)
+    QWORD tcInsert;                 // tick count (ms) when buffered
+} LC_READAHEAD_SLOT, *PLC_READAHEAD_SLOT;
+
+typedef struct tdLC_READAHEAD_RANGE {
+    QWORD pa;
+    DWORD cPages;
+} LC_READAHEAD_RANGE, *PLC_READAHEAD_RANGE;
+
+typedef struct tdLC_READAHEAD_CONTEXT {
+    CRITICAL_SECTION Lock;
+    BOOL fActive;
+    DWORD cPagesWindow;             // LC_OPT_CORE_READAHEAD (0 = sequential readahead disabled)
+    DWORD cSlots;                   // buffer size in pages (0 = not allocated)
+    PLC_READAHEAD_SLOT pSlot;
+    PBYTE pbSlot;
+    QWORD cHit;
+    DWORD iStreamReplace;
+    LC_READAHEAD_STREAM Stream[LC_READAHEAD_STREAMS];
+    DWORD iQueueHead;
+    DWORD cQueue;
+    LC_READAHEAD_RANGE Queue[LC_READAHEAD_QUEUE];
+    DWORD cThreadActive;
+    HANDLE hThread;
+    HANDLE hEventWork;              // auto reset - set on queued prefetch
+    PPMEM_SCATTER ppMEMsWorker;     // LC_READAHEAD_CHUNK MEMs (worker thread only)
+} LC_READAHEAD_CONTEXT;
+
+#define LC_READAHEAD_SET(ctx, pa)       ((DWORD)(((pa) >> 12) % ((ctx)->cSlots / LC_READAHEAD_WAYS)) * LC_READAHEAD_WAYS)
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* (Re)allocate the page buffer. All buffered pages are discarded.
+* NB! Must be called with the readahead lock held.
+* -- ctx
+* -- cSlots
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_AllocBuffer(_In_ PLC_READAHEAD_CONTEXT ctx, _In_ DWORD cSlots)
+{
+    DWORD i;
+    if(cSlots == ctx->cSlots) { return TRUE; }
+    LocalFree(ctx->pSlot);
+    LocalFree(ctx->pbSlot);
+    ctx->pSlot = NULL;
+    ctx->pbSlot = NULL;
+    ctx->cSlots = 0;
+    if(!(ctx->pSlot = LocalAlloc(0, cSlots * sizeof(LC_READAHEAD_SLOT)))) { return FALSE; }
+    if(!(ctx->pbSlot = LocalAlloc(0, (SIZE_T)cSlots << 12))) {
+        LocalFree(ctx->pSlot);
+        ctx->pSlot = NULL;
+        return FALSE;
+    }
+    for(i = 0; i < cSlots; i++) {
+        ctx->pSlot[i].pa = LC_READAHEAD_SLOT_EMPTY;
+    }
+    ctx->cSlots = cSlots;
+    return TRUE;
+}
+
+/*
+* Find the buffer slot holding a page.
+* NB! Must be called with the readahead lock held.
+* -- ctx
+* -- pa = page aligned translated address.
+* -- piSlot
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_SlotFind(_In_ PLC_READAHEAD_CONTEXT ctx, _In_ QWORD pa, _Out_ PDWORD piSlot)
+{
+    DWORD i, iSet = LC_READAHEAD_SET(ctx, pa);
+    for(i = iSet; i < iSet + LC_READAHEAD_WAYS; i++) {
+        if(ctx->pSlot[i].pa == pa) {
+            *piSlot = i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+* Retrieve the buffer slot to buffer a page in: the slot already holding the
+* page, an empty slot or the oldest slot of the set (in that order).
+* NB! Must be called with the readahead lock held.
+* -- ctx
+* -- pa = page aligned translated address.
+* -- return
+*/
+DWORD LcReadAhead_SlotVictim(_In_ PLC_READAHEAD_CONTEXT ctx, _In_ QWORD pa)
+{
+    DWORD i, iSet = LC_READAHEAD_SET(ctx, pa), iVictim = iSet;
+    if(LcReadAhead_SlotFind(ctx, pa, &i)) { return i; }
+    for(i = iSet; i < iSet + LC_READAHEAD_WAYS; i++) {
+        if(ctx->pSlot[i].pa == LC_READAHEAD_SLOT_EMPTY) { return i; }
+        if(ctx->pSlot[i].tcInsert < ctx->pSlot[iVictim].tcInsert) { iVictim = i; }
+    }
+    return iVictim;
+}
+
+/*
+* Queue a range of pages for background prefetch.
+* NB! Must be called with the readahead lock held.
+* -- ctx
+* -- pa = page aligned address.
+* -- cPages
+* -- return = FALSE if the prefetch queue is full.
+*/
+_Success_(return)
+BOOL LcReadAhead_Enqueue(_In_ PLC_READAHEAD_CONTEXT ctx, _In_ QWORD pa, _In_ DWORD cPages)
+{
+    PLC_READAHEAD_RANGE pe;
+    if(!cPages) { return TRUE; }
+    if(ctx->cQueue == LC_READAHEAD_QUEUE) { return FALSE; }
+    pe = ctx->Queue + ((ctx->iQueueHead + ctx->cQueue) % LC_READAHEAD_QUEUE);
+    pe->pa = pa;
+    pe->cPages = cPages;
+    ctx->cQueue++;
+    return TRUE;
+}
+
+/*
+* Dequeue up to LC_READAHEAD_CHUNK pages to prefetch.
+* -- ctx
+* -- ppa
+* -- pcPages
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_Dequeue(_In_ PLC_READAHEAD_CONTEXT ctx, _Out_ PQWORD ppa, _Out_ PDWORD pcPages)
+{
+    PLC_READAHEAD_RANGE pe;
+    BOOL fResult = FALSE;
+    EnterCriticalSection(&ctx->Lock);
+    if(ctx->cQueue && ctx->cSlots) {
+        pe = ctx->Queue + ctx->iQueueHead;
+        *ppa = pe->pa;
+        *pcPages = min(LC_READAHEAD_CHUNK, pe->cPages);
+        pe->pa += (QWORD)*pcPages << 12;
+        pe->cPages -= *pcPages;
+        if(!pe->cPages) {
+            ctx->iQueueHead = (ctx->iQueueHead + 1) % LC_READAHEAD_QUEUE;
+            ctx->cQueue--;
+        }
+        fResult = TRUE;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+/*
+* Read pages from the device into the page buffer. Pages are translated by the
+* memory map - pages outside of the memory map are not read.
+* -- ctxLC
+* -- ctx
+* -- pa = page aligned untranslated address.
+* -- cPages
+*/
+VOID LcReadAhead_Fill(_In_ PLC_CONTEXT ctxLC, _In_ PLC_READAHEAD_CONTEXT ctx, _In_ QWORD pa, _In_ DWORD cPages)
+{
+    DWORD i, iSlot;
+    PMEM_SCATTER pMEM;
+    PPMEM_SCATTER ppMEMs = ctx->ppMEMsWorker;
+    QWORD tcNow, qwWriteGeneration = ctxLC->qwWriteGeneration;
+    for(i = 0; i < cPages; i++) {
+        pMEM = ppMEMs[i];
+        pMEM->qwA = pa + ((QWORD)i << 12);
+        pMEM->cb = 0x1000;
+        pMEM->f = FALSE;
+    }
+    LcMemMap_TranslateMEMs(ctxLC, cPages, ppMEMs);
+    LcReadScatter_DeviceMerge(ctxLC, cPages, ppMEMs);
+    tcNow = GetTickCount64();
+    EnterCriticalSection(&ctx->Lock);
+    if(ctx->cSlots && (qwWriteGeneration == ctxLC->qwWriteGeneration)) {
+        for(i = 0; i < cPages; i++) {
+            pMEM = ppMEMs[i];
+            if(!pMEM->f || (pMEM->qwA & 0xfff)) { continue; }
+            iSlot = LcReadAhead_SlotVictim(ctx, pMEM->qwA);
+            ctx->pSlot[iSlot].pa = pMEM->qwA;
+            ctx->pSlot[iSlot].tcInsert = tcNow;
+            memcpy(ctx->pbSlot + ((SIZE_T)iSlot << 12), pMEM->pb, 0x1000);
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Worker thread loop servicing the prefetch queue. Speculative reads are made
+* with background priority.
+* -- ctxLC
+* -- return
+*/
+DWORD LcReadAhead_ThreadProc(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_READAHEAD_CONTEXT ctx = ctxLC->pReadAhead;
+    QWORD pa;
+    DWORD cPages;
+    LcQos_SetThreadPriority(ctxLC, LC_QOS_PRIORITY_BACKGROUND);
+    while(ctx->fActive) {
+        while(ctx->fActive && LcReadAhead_Dequeue(ctx, &pa, &cPages)) {
+            LcReadAhead_Fill(ctxLC, ctx, pa, cPages);
+        }
+        if(!ctx->fActive) { break; }
+        WaitForSingleObject(ctx->hEventWork, INFINITE);
+    }
+    LcQos_SetThreadPriority(ctxLC, LC_QOS_PRIORITY_INTERACTIVE);
+    InterlockedDecrement(&ctx->cThreadActive);
+    return 0;
+}
+
+/*
+* Wake up the worker thread - start it if not already started.
+* NB! Must be called with the readahead lock held.
+* -- ctxLC
+* -- ctx
+*/
+VOID LcReadAhead_Wake(_In_ PLC_CONTEXT ctxLC, _In_ PLC_READAHEAD_CONTEXT ctx)
+{
+    if(!ctx->hThread && ctx->fActive) {
+        if(!ctx->ppMEMsWorker && !LcAllocScatter1(LC_READAHEAD_CHUNK, &ctx->ppMEMsWorker)) { return; }
+        if(!ctx->hEventWork && !(ctx->hEventWork = CreateEvent(NULL, FALSE, FALSE, NULL))) { return; }
+        InterlockedIncrement(&ctx->cThreadActive);
+        if(!(ctx->hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)LcReadAhead_ThreadProc, ctxLC, 0, NULL))) {
+            InterlockedDecrement(&ctx->cThreadActive);
+            return;
+        }
+    }
+    SetEvent(ctx->hEventWork);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// READ PATH FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether the readahead / prefetch page buffer is active.
+* -- ctxLC
+* -- return
+*/
+BOOL LcReadAhead_IsEnabled(_In_ PLC_CONTEXT ctxLC)
+{
+    return ctxLC->pReadAhead && ctxLC->pReadAhead->cSlots;
+}
+
+/*
+* Serve MEMs from the readahead / prefetch page buffer. Pages served to full
+* page MEMs are removed from the buffer - pages served to sub-page MEMs are
+* kept for reads of the remainder of the page. Expired pages are removed from
+* the buffer and are not served. MEMs which still require a read are put into the
+* ppMEMsMiss array (which must have room for cMEMs entries, and which may be
+* the same array as ppMEMs).
+* MEMs are assumed to have their memory map translation completed.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcReadAhead_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss)
+{
+    PLC_READAHEAD_CONTEXT ctx = ctxLC->pReadAhead;
+    DWORD iMEM, iSlot, dwTTL, cMiss = 0;
+    PMEM_SCATTER pMEM;
+    BOOL fTTL = LcCache_GetTTL(ctxLC, &dwTTL);
+    QWORD tcNow = fTTL ? GetTickCount64() : 0;
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        if(!ctx->cSlots || ((pMEM->qwA & 0xfff) + pMEM->cb > 0x1000)) {
+            ppMEMsMiss[cMiss++] = pMEM;
+            continue;
+        }
+        if(!LcReadAhead_SlotFind(ctx, pMEM->qwA & ~0xfff, &iSlot)) {
+            ppMEMsMiss[cMiss++] = pMEM;
+            continue;
+        }
+        if(fTTL && (tcNow - ctx->pSlot[iSlot].tcInsert > dwTTL)) {
+            ctx->pSlot[iSlot].pa = LC_READAHEAD_SLOT_EMPTY;
+            ppMEMsMiss[cMiss++] = pMEM;
+            continue;
+        }
+        memcpy(pMEM->pb, ctx->pbSlot + ((SIZE_T)iSlot << 12) + (pMEM->qwA & 0xfff), pMEM->cb);
+        pMEM->f = TRUE;
+        if(pMEM->cb == 0x1000) {
+            ctx->pSlot[iSlot].pa = LC_READAHEAD_SLOT_EMPTY;
+        }
+        ctx->cHit++;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return cMiss;
+}
+
+/*
+* Track ascending read streams and queue readahead of the pages following a
+* detected stream. Sparse batches are ignored. Called after each local
+* LcReadScatter with MEMs holding their untranslated addresses.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadAhead_Detect(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_READAHEAD_CONTEXT ctx = ctxLC->pReadAhead;
+    PLC_READAHEAD_STREAM pStream = NULL;
+    QWORD paMin = (QWORD)-1, paEnd = 0, cbTotal = 0, cbWindow, paStart, paStop;
+    DWORD i;
+    BOOL fQueued = FALSE;
+    PMEM_SCATTER pMEM;
+    if(!ctx || !ctx->cPagesWindow) { return; }
+    for(i = 0; i < cMEMs; i++) {
+        pMEM = ppMEMs[i];
+        if(MEM_SCATTER_ADDR_ISINVALID(pMEM) || !pMEM->cb) { continue; }
+        paMin = min(paMin, pMEM->qwA);
+        paEnd = max(paEnd, pMEM->qwA + pMEM->cb);
+        cbTotal += pMEM->cb;
+    }
+    if(!cbTotal || (paEnd - paMin > 2 * cbTotal + 0x1000)) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    cbWindow = (QWORD)ctx->cPagesWindow << 12;
+    for(i = 0; i < LC_READAHEAD_STREAMS; i++) {
+        if(ctx->Stream[i].paNext && (paMin + cbWindow >= ctx->Stream[i].paNext) && (paMin <= ctx->Stream[i].paNext + cbWindow)) {
+            pStream = ctx->Stream + i;
+            pStream->cHit++;
+            break;
+        }
+    }
+    if(!pStream) {
+        pStream = ctx->Stream + (ctx->iStreamReplace++ % LC_READAHEAD_STREAMS);
+        pStream->cHit = 0;
+        pStream->paPrefetchEnd = 0;
+    }
+    pStream->paNext = paEnd;
+    if(pStream->cHit && ctx->cSlots && (pStream->paPrefetchEnd < paEnd + cbWindow / 2)) {
+        paStart = max(pStream->paPrefetchEnd, (paEnd + 0xfff) & ~0xfff);
+        paStop = (paEnd + cbWindow) & ~0xfff;
+        if((paStop > paStart) && LcReadAhead_Enqueue(ctx, paStart, (DWORD)((paStop - paStart) >> 12))) {
+            pStream->paPrefetchEnd = paStop;
+            fQueued = TRUE;
+        }
+    }
+    if(fQueued) {
+        LcReadAhead_Wake(ctxLC, ctx);
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Remove any buffered pages touched by the MEMs. This is called on writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcReadAhead_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_READAHEAD_CONTEXT ctx = ctxLC->pReadAhead;
+    QWORD pa;
+    DWORD i, iSlot;
+    if(!LcReadAhead_IsEnabled(ctxLC)) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    for(i = 0; ctx->cSlots && (i < cMEMs); i++) {
+        if(MEM_SCATTER_ADDR_ISINVALID(ppMEMs[i])) { continue; }
+        for(pa = ppMEMs[i]->qwA & ~0xfff; pa < ppMEMs[i]->qwA + ppMEMs[i]->cb; pa += 0x1000) {
+            if(LcReadAhead_SlotFind(ctx, pa, &iSlot)) {
+                ctx->pSlot[iSlot].pa = LC_READAHEAD_SLOT_EMPTY;
+            }
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// EXPORTED PREFETCH FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Hint LeechCore that memory ranges will be read shortly. The ranges are read
+* into the prefetch page buffer in the background and served from the buffer
+* by reads of each page (until read in full). The buffer is bounded - if more
+* memory than fits in the buffer is prefetched the earliest prefetched pages
+* may be lost. On volatile devices prefetched pages expire after the page cache
+* time-to-live (LC_OPT_CORE_CACHE_TTL).
+* -- hLC
+* -- cRanges
+* -- pqwA = range start addresses.
+* -- pcb = range sizes in bytes.
+* -- return = TRUE if all ranges were queued for prefetch.
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcPrefetch(_In_ HANDLE hLC, _In_ DWORD cRanges, _In_reads_(cRanges) const QWORD *pqwA, _In_reads_(cRanges) const DWORD *pcb)
+{
+    PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
+    PLC_READAHEAD_CONTEXT ctx;
+    QWORD paStart, paStop;
+    DWORD i;
+    BOOL fResult = TRUE, fQueued = FALSE;
+    if(!ctxLC || (ctxLC->version != LC_CONTEXT_VERSION) || !(ctx = ctxLC->pReadAhead)) { return FALSE; }
+    if(ctxLC->Config.fRemote || !pqwA || !pcb) { return FALSE; }
+    EnterCriticalSection(&ctx->Lock);
+    if(!ctx->cSlots && !LcReadAhead_AllocBuffer(ctx, LC_READAHEAD_BUFFER_DEFAULT)) {
+        LeaveCriticalSection(&ctx->Lock);
+        return FALSE;
+    }
+    for(i = 0; i < cRanges; i++) {
+        if(!pcb[i]) { continue; }
+        paStart = pqwA[i] & ~0xfff;
+        paStop = (pqwA[i] + pcb[i] + 0xfff) & ~0xfff;
+        if(paStop <= paStart) { fResult = FALSE; continue; }
+        if(!LcReadAhead_Enqueue(ctx, paStart, (DWORD)((paStop - paStart) >> 12))) {
+            fResult = FALSE;
+            break;
+        }
+        fQueued = TRUE;
+    }
+    if(fQueued) {
+        LcReadAhead_Wake(ctxLC, ctx);
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// GET / SET OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Retrieve a readahead option (LC_OPT_CORE_READAHEAD*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_READAHEAD_CONTEXT ctx = ctxLC->pReadAhead;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_READAHEAD:
+            *pqwValue = ctx->cPagesWindow;
+            return TRUE;
+        case LC_OPT_CORE_READAHEAD_HIT:
+            *pqwValue = ctx->cHit;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Set a readahead option (LC_OPT_CORE_READAHEAD). Changing the readahead window
+* may re-allocate the page buffer - which discards all buffered pages.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    PLC_READAHEAD_CONTEXT ctx = ctxLC->pReadAhead;
+    BOOL fResult = FALSE;
+    if(ctxLC->Config.fRemote || (fOption != LC_OPT_CORE_READAHEAD) || (qwValue > LC_READAHEAD_WINDOW_MAX)) { return FALSE; }
+    EnterCriticalSection(&ctx->Lock);
+    ctx->cPagesWindow = (DWORD)qwValue;
+    ZeroMemory(ctx->Stream, sizeof(ctx->Stream));
+    fResult = !qwValue || LcReadAhead_AllocBuffer(ctx, max(LC_READAHEAD_BUFFER_DEFAULT, 2 * ctx->cPagesWindow));
+    if(!fResult) { ctx->cPagesWindow = 0; }
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the (initially disabled) readahead functionality of a LeechCore
+* context. The page buffer and worker thread are allocated on first use.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcReadAhead_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_READAHEAD_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_READAHEAD_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    ctx->fActive = TRUE;
+    ctxLC->pReadAhead = ctx;
+    return TRUE;
+}
+
+/*
+* Close the readahead functionality of a LeechCore context.
+* NB! Must be called before the device is closed.
+* -- ctxLC
+*/
+VOID LcReadAhead_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_READAHEAD_CONTEXT ctx = ctxLC->pReadAhead;
+    if(!ctx) { return; }
+    ctx->fActive = FALSE;
+    while(ctx->cThreadActive) {
+        SetEvent(ctx->hEventWork);
+        SwitchToThread();
+    }
+    ctxLC->pReadAhead = NULL;
+    if(ctx->hThread) { CloseHandle(ctx->hThread); }
+    if(ctx->hEventWork) { CloseHandle(ctx->hEventWork); }
+    LocalFree(ctx->ppMEMsWorker);
+    LocalFree(ctx->pSlot);
+    LocalFree(ctx->pbSlot);
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx);
+}
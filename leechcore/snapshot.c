@@ -0,0 +1,437 @@
+// snapshot.c : implementation : epoch-based consistent snapshot of volatile devices.
+//
+// Between LC_CMD_SNAPSHOT_BEGIN and LC_CMD_SNAPSHOT_END the first successful
+// read of each page is retained and all later reads of the page - on all
+// handles sharing the LeechCore context - are served from the retained copy.
+// This gives a stable view of memory which is not re-read from the device.
+// Retained pages are kept in memory up to LC_OPT_CORE_SNAPSHOT_MEMMAX bytes
+// and spilled to an optional file thereafter.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_SNAPSHOT_MEMMAX_DEFAULT      0x10000000      // default in-memory page store size (256MB).
+#define LC_SNAPSHOT_MEMMAX_MAX          0x1000000000    // max in-memory page store size (64GB).
+#define LC_SNAPSHOT_CHUNK_PAGES         0x200           // pages per in-memory page store chunk (2MB).
+#define LC_SNAPSHOT_ENTRIES_INITIAL     0x00010000
+#define LC_SNAPSHOT_LOC_SPILL           0x8000000000000000  // page is stored in the spill file.
+#define LC_SNAPSHOT_LOC_STALE           0x4000000000000000  // page was written to - location may be re-used.
+#define LC_SNAPSHOT_LOC_INDEX           0x0000ffffffffffff
+#define LC_SNAPSHOT_HASH(pa, cMask)     ((DWORD)(((pa) >> 12) * 0x9E3779B97F4A7C15 >> 32) & (cMask))
+
+typedef struct tdLC_SNAPSHOT_ENTRY {
+    QWORD qwKey;                    // page address | 1 (0 = unused)
+    QWORD qwLocation;               // page index in page store | LC_SNAPSHOT_LOC_*
+} LC_SNAPSHOT_ENTRY, *PLC_SNAPSHOT_ENTRY;
+
+typedef struct tdLC_SNAPSHOT_CONTEXT {
+    CRITICAL_SECTION Lock;
+    BOOL fActive;
+    QWORD cbMemMax;                 // LC_OPT_CORE_SNAPSHOT_MEMMAX (applied at epoch begin)
+    QWORD cHit;
+    QWORD cPages;                   // retained pages in current epoch
+    // page address -> location hash table (open addressing):
+    DWORD cEntriesMask;
+    DWORD cEntries;
+    PLC_SNAPSHOT_ENTRY pEntries;
+    // in-memory page store:
+    DWORD cChunksMax;
+    DWORD cPagesMem;
+    PBYTE *ppbChunks;
+    // spill file page store (optional):
+    FILE *pFile;
+    QWORD cPagesFile;
+    CHAR szFile[MAX_PATH];
+} LC_SNAPSHOT_CONTEXT;
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+// All functions assume the snapshot lock is held by the caller.
+//-----------------------------------------------------------------------------
+
+/*
+* Find the entry of a page address.
+* -- ctx
+* -- pa = page address.
+* -- fCreate = create the entry (without location) if it does not exist.
+* -- return = the entry, NULL if not found (or on fail).
+*/
+PLC_SNAPSHOT_ENTRY LcSnapshot_EntryFind(_In_ PLC_SNAPSHOT_CONTEXT ctx, _In_ QWORD pa, _In_ BOOL fCreate)
+{
+    DWORD i, cEntriesMaskNew;
+    QWORD qwKey = pa | 1;
+    PLC_SNAPSHOT_ENTRY pe, peNew, pEntriesNew;
+    if(fCreate && ((ctx->cEntries + 1) * 4ULL > (ctx->cEntriesMask + 1) * 3ULL)) {
+        // grow hash table:
+        cEntriesMaskNew = ctx->cEntriesMask * 2 + 1;
+        if(!(pEntriesNew = LocalAlloc(LMEM_ZEROINIT, (cEntriesMaskNew + 1ULL) * sizeof(LC_SNAPSHOT_ENTRY)))) { return NULL; }
+        for(i = 0; i <= ctx->cEntriesMask; i++) {
+            pe = ctx->pEntries + i;
+            if(!pe->qwKey) { continue; }
+            peNew = pEntriesNew + LC_SNAPSHOT_HASH(pe->qwKey, cEntriesMaskNew);
+            while(peNew->qwKey) {
+                peNew = pEntriesNew + ((peNew - pEntriesNew + 1) & cEntriesMaskNew);
+            }
+            *peNew = *pe;
+        }
+        LocalFree(ctx->pEntries);
+        ctx->pEntries = pEntriesNew;
+        ctx->cEntriesMask = cEntriesMaskNew;
+    }
+    i = LC_SNAPSHOT_HASH(qwKey, ctx->cEntriesMask);
+    while(TRUE) {
+        pe = ctx->pEntries + i;
+        if(pe->qwKey == qwKey) { return pe; }
+        if(!pe->qwKey) {
+            if(!fCreate) { return NULL; }
+            pe->qwKey = qwKey;
+            pe->qwLocation = LC_SNAPSHOT_LOC_STALE | LC_SNAPSHOT_LOC_INDEX;
+            ctx->cEntries++;
+            return pe;
+        }
+        i = (i + 1) & ctx->cEntriesMask;
+    }
+}
+
+/*
+* Copy data from a retained page.
+* -- ctx
+* -- qwLocation
+* -- o = offset in page.
+* -- cb
+* -- pb
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_PageGet(_In_ PLC_SNAPSHOT_CONTEXT ctx, _In_ QWORD qwLocation, _In_ DWORD o, _In_ DWORD cb, _Out_writes_(cb) PBYTE pb)
+{
+    QWORD iPage = qwLocation & LC_SNAPSHOT_LOC_INDEX;
+    if(qwLocation & LC_SNAPSHOT_LOC_SPILL) {
+        if(_fseeki64(ctx->pFile, iPage * 0x1000 + o, SEEK_SET)) { return FALSE; }
+        return cb == (DWORD)fread(pb, 1, cb, ctx->pFile);
+    }
+    memcpy(pb, ctx->ppbChunks[iPage / LC_SNAPSHOT_CHUNK_PAGES] + (iPage % LC_SNAPSHOT_CHUNK_PAGES) * 0x1000 + o, cb);
+    return TRUE;
+}
+
+/*
+* Retain a page. The location of stale pages is re-used - otherwise a new page
+* is allocated in memory or in the spill file.
+* -- ctx
+* -- pe
+* -- pb = page data (0x1000 bytes).
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_PagePut(_In_ PLC_SNAPSHOT_CONTEXT ctx, _In_ PLC_SNAPSHOT_ENTRY pe, _In_reads_(0x1000) PBYTE pb)
+{
+    QWORD iPage, qwLocation = pe->qwLocation & ~LC_SNAPSHOT_LOC_STALE;
+    if((qwLocation & LC_SNAPSHOT_LOC_INDEX) == LC_SNAPSHOT_LOC_INDEX) {
+        if((ctx->cPagesMem < ctx->cChunksMax * LC_SNAPSHOT_CHUNK_PAGES) && ((ctx->cPagesMem % LC_SNAPSHOT_CHUNK_PAGES) || (ctx->ppbChunks[ctx->cPagesMem / LC_SNAPSHOT_CHUNK_PAGES] = LocalAlloc(0, LC_SNAPSHOT_CHUNK_PAGES * 0x1000)))) {
+            qwLocation = ctx->cPagesMem++;
+        } else if(ctx->pFile) {
+            qwLocation = LC_SNAPSHOT_LOC_SPILL | ctx->cPagesFile++;
+        } else {
+            return FALSE;
+        }
+        ctx->cPages++;
+    }
+    iPage = qwLocation & LC_SNAPSHOT_LOC_INDEX;
+    if(qwLocation & LC_SNAPSHOT_LOC_SPILL) {
+        if(_fseeki64(ctx->pFile, iPage * 0x1000, SEEK_SET) || (0x1000 != fwrite(pb, 1, 0x1000, ctx->pFile))) {
+            pe->qwLocation = qwLocation | LC_SNAPSHOT_LOC_STALE;
+            return FALSE;
+        }
+    } else {
+        memcpy(ctx->ppbChunks[iPage / LC_SNAPSHOT_CHUNK_PAGES] + (iPage % LC_SNAPSHOT_CHUNK_PAGES) * 0x1000, pb, 0x1000);
+    }
+    pe->qwLocation = qwLocation;
+    return TRUE;
+}
+
+/*
+* Free all retained pages and end the current epoch (if any).
+* -- ctx
+*/
+VOID LcSnapshot_Reset(_In_ PLC_SNAPSHOT_CONTEXT ctx)
+{
+    DWORD i;
+    ctx->fActive = FALSE;
+    if(ctx->ppbChunks) {
+        for(i = 0; i < ctx->cChunksMax; i++) {
+            LocalFree(ctx->ppbChunks[i]);
+        }
+        LocalFree(ctx->ppbChunks);
+        ctx->ppbChunks = NULL;
+    }
+    LocalFree(ctx->pEntries);
+    ctx->pEntries = NULL;
+    if(ctx->pFile) {
+        fclose(ctx->pFile);
+        ctx->pFile = NULL;
+        remove(ctx->szFile);
+    }
+    ctx->szFile[0] = 0;
+    ctx->cChunksMax = 0;
+    ctx->cPagesMem = 0;
+    ctx->cPagesFile = 0;
+    ctx->cPages = 0;
+    ctx->cEntries = 0;
+    ctx->cEntriesMask = 0;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// READ / WRITE PATH FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether a snapshot epoch is active.
+* -- ctxLC
+* -- return
+*/
+BOOL LcSnapshot_IsActive(_In_ PLC_CONTEXT ctxLC)
+{
+    return ctxLC->pSnapshot && ctxLC->pSnapshot->fActive;
+}
+
+/*
+* Serve MEMs from retained pages. MEMs which are not retained are put into the
+* ppMEMsMiss array (which must have room for cMEMs entries, and which may be
+* the same array as ppMEMs).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcSnapshot_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss)
+{
+    PLC_SNAPSHOT_CONTEXT ctx = ctxLC->pSnapshot;
+    PLC_SNAPSHOT_ENTRY pe;
+    PMEM_SCATTER pMEM;
+    DWORD iMEM, cMiss = 0;
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        if(ctx->fActive && ((pMEM->qwA & 0xfff) + pMEM->cb <= 0x1000) && (pe = LcSnapshot_EntryFind(ctx, pMEM->qwA & ~0xfff, FALSE)) && !(pe->qwLocation & LC_SNAPSHOT_LOC_STALE)) {
+            if(LcSnapshot_PageGet(ctx, pe->qwLocation, pMEM->qwA & 0xfff, pMEM->cb, pMEM->pb)) {
+                pMEM->f = TRUE;
+                ctx->cHit++;
+                continue;
+            }
+        }
+        ppMEMsMiss[cMiss++] = pMEM;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return cMiss;
+}
+
+/*
+* Retain successfully read full pages in the current epoch. MEMs of pages which
+* were retained by a concurrent read in the meantime are overwritten with the
+* retained data to keep all readers consistent.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcSnapshot_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_SNAPSHOT_CONTEXT ctx = ctxLC->pSnapshot;
+    PLC_SNAPSHOT_ENTRY pe;
+    PMEM_SCATTER pMEM;
+    DWORD iMEM;
+    EnterCriticalSection(&ctx->Lock);
+    if(qwWriteGeneration != ctxLC->qwWriteGeneration) { cMEMs = 0; }
+    for(iMEM = 0; ctx->fActive && (iMEM < cMEMs); iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(!pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM) || ((pMEM->qwA & 0xfff) + pMEM->cb > 0x1000)) { continue; }
+        if((pMEM->cb == 0x1000) && !(pMEM->qwA & 0xfff)) {
+            if(!(pe = LcSnapshot_EntryFind(ctx, pMEM->qwA, TRUE))) { continue; }
+            if(pe->qwLocation & LC_SNAPSHOT_LOC_STALE) {
+                LcSnapshot_PagePut(ctx, pe, pMEM->pb);
+                continue;
+            }
+        } else if(!(pe = LcSnapshot_EntryFind(ctx, pMEM->qwA & ~0xfff, FALSE)) || (pe->qwLocation & LC_SNAPSHOT_LOC_STALE)) {
+            continue;
+        }
+        LcSnapshot_PageGet(ctx, pe->qwLocation, pMEM->qwA & 0xfff, pMEM->cb, pMEM->pb);
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Mark pages touched by the MEMs as stale - they are retained again on their
+* next read. This is called on writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcSnapshot_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_SNAPSHOT_CONTEXT ctx = ctxLC->pSnapshot;
+    PLC_SNAPSHOT_ENTRY pe;
+    DWORD iMEM;
+    QWORD pa;
+    if(!LcSnapshot_IsActive(ctxLC)) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; ctx->fActive && (iMEM < cMEMs); iMEM++) {
+        if(MEM_SCATTER_ADDR_ISINVALID(ppMEMs[iMEM])) { continue; }
+        for(pa = ppMEMs[iMEM]->qwA & ~0xfff; pa < ppMEMs[iMEM]->qwA + ppMEMs[iMEM]->cb; pa += 0x1000) {
+            if((pe = LcSnapshot_EntryFind(ctx, pa, FALSE))) {
+                pe->qwLocation |= LC_SNAPSHOT_LOC_STALE;
+            }
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// COMMAND / OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Begin a new snapshot epoch. Pages retained in an already active epoch are
+* discarded.
+* -- ctxLC
+* -- cbSpillFile
+* -- szSpillFile = optional file to spill retained pages to once the in-memory
+*                  page store is full. The file is deleted when the epoch ends.
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_Begin(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cbSpillFile, _In_reads_opt_(cbSpillFile) LPSTR szSpillFile)
+{
+    PLC_SNAPSHOT_CONTEXT ctx = ctxLC->pSnapshot;
+    BOOL fResult = FALSE;
+    EnterCriticalSection(&ctx->Lock);
+    LcSnapshot_Reset(ctx);
+    ctx->cChunksMax = (DWORD)((ctx->cbMemMax + LC_SNAPSHOT_CHUNK_PAGES * 0x1000 - 1) / (LC_SNAPSHOT_CHUNK_PAGES * 0x1000));
+    ctx->cEntriesMask = LC_SNAPSHOT_ENTRIES_INITIAL - 1;
+    if(!(ctx->pEntries = LocalAlloc(LMEM_ZEROINIT, LC_SNAPSHOT_ENTRIES_INITIAL * sizeof(LC_SNAPSHOT_ENTRY)))) { goto fail; }
+    if(ctx->cChunksMax && !(ctx->ppbChunks = LocalAlloc(LMEM_ZEROINIT, ctx->cChunksMax * sizeof(PBYTE)))) { goto fail; }
+    if(cbSpillFile && szSpillFile && szSpillFile[0]) {
+        strncpy_s(ctx->szFile, _countof(ctx->szFile), szSpillFile, cbSpillFile);
+        if(fopen_s(&ctx->pFile, ctx->szFile, "wb+") || !ctx->pFile) {
+            ctx->pFile = NULL;
+            ctx->szFile[0] = 0;
+            goto fail;
+        }
+    }
+    ctx->cHit = 0;
+    ctx->fActive = TRUE;
+    fResult = TRUE;
+fail:
+    if(!fResult) { LcSnapshot_Reset(ctx); }
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+/*
+* End the current snapshot epoch and free all retained pages.
+* -- ctxLC
+* -- return = FALSE if no epoch was active.
+*/
+_Success_(return)
+BOOL LcSnapshot_End(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_SNAPSHOT_CONTEXT ctx = ctxLC->pSnapshot;
+    BOOL fResult;
+    EnterCriticalSection(&ctx->Lock);
+    fResult = ctx->fActive;
+    LcSnapshot_Reset(ctx);
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+/*
+* Retrieve a snapshot option (LC_OPT_CORE_SNAPSHOT_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_SNAPSHOT_CONTEXT ctx = ctxLC->pSnapshot;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_SNAPSHOT_MEMMAX:
+            *pqwValue = ctx->cbMemMax;
+            return TRUE;
+        case LC_OPT_CORE_SNAPSHOT_PAGES:
+            *pqwValue = ctx->cPages;
+            return TRUE;
+        case LC_OPT_CORE_SNAPSHOT_HIT:
+            *pqwValue = ctx->cHit;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Set a snapshot option (LC_OPT_CORE_SNAPSHOT_MEMMAX). The in-memory page store
+* size is applied when the next epoch begins.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    if((fOption != LC_OPT_CORE_SNAPSHOT_MEMMAX) || (qwValue > LC_SNAPSHOT_MEMMAX_MAX)) { return FALSE; }
+    ctxLC->pSnapshot->cbMemMax = qwValue;
+    return TRUE;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the (initially inactive) snapshot functionality of a LeechCore
+* context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcSnapshot_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_SNAPSHOT_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_SNAPSHOT_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    ctx->cbMemMax = LC_SNAPSHOT_MEMMAX_DEFAULT;
+    ctxLC->pSnapshot = ctx;
+    return TRUE;
+}
+
+/*
+* Close the snapshot functionality of a LeechCore context - ending any active
+* epoch - and free its resources.
+* -- ctxLC
+*/
+VOID LcSnapshot_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_SNAPSHOT_CONTEXT ctx = ctxLC->pSnapshot;
+    if(!ctx) { return; }
+    ctxLC->pSnapshot = NULL;
+    LcSnapshot_Reset(ctx);
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx);
+}
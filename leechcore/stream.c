@@ -0,0 +1,258 @@
+// stream.c : implementation : streaming reads of large physical memory ranges.
+//
+// Large memory ranges are read in bounded-size chunks. Two chunk buffers are
+// used - the next chunk is read asynchronously while the caller callback is
+// consuming the current chunk. Memory use is bounded by two chunks regardless
+// of the total size of the range.
+// Large scatter reads may also be streamed - the MEMs are read in address
+// sorted chunks with several chunks in flight and each chunk is delivered to
+// the caller callback as soon as it completes.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+#include "util.h"
+
+#define LC_STREAM_CHUNK_DEFAULT         0x00400000      // 4MB
+#define LC_STREAM_CHUNK_MAX             0x04000000      // 64MB
+#define LC_STREAM_SCATTER_CHUNK_DEFAULT 0x100           // MEMs per scatter chunk.
+#define LC_STREAM_SCATTER_INFLIGHT      4               // scatter chunks in flight.
+
+typedef struct tdLC_STREAM_BUFFER {
+    HANDLE hLcAsync;                // in-flight async read (if any)
+    DWORD cPages;
+    PPMEM_SCATTER ppMEMs;           // cPagesMax MEMs with contiguous 0x1000 buffers
+    PQWORD pqwValid;                // page validity bitmap
+} LC_STREAM_BUFFER, *PLC_STREAM_BUFFER;
+
+typedef struct tdLC_STREAM_SCATTER_CHUNK {
+    HANDLE hLcAsync;                // in-flight async read (NULL = slot free)
+    HANDLE hEvent;                  // shared auto reset event - set on complete
+    volatile BOOL fComplete;
+    DWORD cMEMs;
+    PPMEM_SCATTER ppMEMs;           // slice of the address sorted MEMs
+} LC_STREAM_SCATTER_CHUNK, *PLC_STREAM_SCATTER_CHUNK;
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Start the read of a chunk into a stream buffer. The read is performed
+* asynchronously if possible - otherwise synchronously.
+* -- hLC
+* -- pBuffer
+* -- paBase = page aligned chunk base address.
+* -- cPages
+*/
+VOID LcStream_ChunkSubmit(_In_ HANDLE hLC, _Inout_ PLC_STREAM_BUFFER pBuffer, _In_ QWORD paBase, _In_ DWORD cPages)
+{
+    DWORD i;
+    PMEM_SCATTER pMEM;
+    pBuffer->cPages = cPages;
+    for(i = 0; i < cPages; i++) {
+        pMEM = pBuffer->ppMEMs[i];
+        pMEM->qwA = paBase + ((QWORD)i << 12);
+        pMEM->cb = 0x1000;
+        pMEM->f = FALSE;
+    }
+    if(!(pBuffer->hLcAsync = LcReadScatterAsync(hLC, cPages, pBuffer->ppMEMs, NULL, NULL))) {
+        LcReadScatter(hLC, cPages, pBuffer->ppMEMs);
+    }
+}
+
+/*
+* Wait for the read of a chunk to complete and build its page validity bitmap.
+* Pages which could not be read are zero-filled.
+* -- pBuffer
+*/
+VOID LcStream_ChunkComplete(_Inout_ PLC_STREAM_BUFFER pBuffer)
+{
+    DWORD i;
+    PMEM_SCATTER pMEM;
+    if(pBuffer->hLcAsync) {
+        LcReadScatterAsyncWait(pBuffer->hLcAsync, INFINITE);
+        LcReadScatterAsyncClose(pBuffer->hLcAsync);
+        pBuffer->hLcAsync = NULL;
+    }
+    ZeroMemory(pBuffer->pqwValid, ((pBuffer->cPages + 63) / 64) * sizeof(QWORD));
+    for(i = 0; i < pBuffer->cPages; i++) {
+        pMEM = pBuffer->ppMEMs[i];
+        if(pMEM->f) {
+            pBuffer->pqwValid[i >> 6] |= 1ULL << (i & 63);
+        } else {
+            ZeroMemory(pMEM->pb, 0x1000);
+        }
+    }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// STREAMING READ FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Read a large memory range in chunks. Each chunk is delivered to the callback
+* in address order once read. The next chunk is read while the callback is
+* processing the current chunk. Pages that could not be read are zero-filled
+* and their bit in the page validity bitmap is cleared.
+* -- hLC
+* -- pa = start address.
+* -- cb = number of bytes to read.
+* -- cbChunk = chunk size (rounded up to page size), 0 for default.
+* -- pfnCallback = callback receiving each chunk.
+* -- ctxCallback = optional context passed to pfnCallback.
+* -- return = TRUE if the whole range was delivered, FALSE on fail/abort.
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcReadStream(_In_ HANDLE hLC, _In_ QWORD pa, _In_ QWORD cb, _In_ DWORD cbChunk, _In_ PLC_READSTREAM_CALLBACK pfnCallback, _In_opt_ PVOID ctxCallback)
+{
+    PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
+    LC_STREAM_BUFFER Buffer[2] = { 0 };
+    PLC_STREAM_BUFFER pBuffer;
+    QWORD paChunk, paNext, paEnd, paStart, paStop;
+    DWORD i, cPagesMax, iBuffer = 0;
+    BOOL fResult = FALSE;
+    if(!ctxLC || (ctxLC->version != LC_CONTEXT_VERSION) || !pfnCallback) { return FALSE; }
+    if(!cb) { return TRUE; }
+    if(pa + cb < pa) { return FALSE; }
+    // 1: set up chunk buffers:
+    cbChunk = cbChunk ? ((min(LC_STREAM_CHUNK_MAX, cbChunk) + 0xfff) & ~0xfff) : LC_STREAM_CHUNK_DEFAULT;
+    cPagesMax = (DWORD)min(cbChunk >> 12, ((pa & 0xfff) + cb + 0xfff) >> 12);
+    for(i = 0; i < 2; i++) {
+        if(!LcAllocScatter1(cPagesMax, &Buffer[i].ppMEMs)) { goto fail; }
+        if(!(Buffer[i].pqwValid = LocalAlloc(0, ((cPagesMax + 63) / 64) * sizeof(QWORD)))) { goto fail; }
+    }
+    // 2: read chunks - keep one chunk read in flight while delivering the other:
+    paEnd = pa + cb;
+    paChunk = pa & ~0xfff;
+    LcStream_ChunkSubmit(hLC, &Buffer[0], paChunk, (DWORD)min(cPagesMax, ((paEnd - paChunk) + 0xfff) >> 12));
+    while(paChunk < paEnd) {
+        pBuffer = &Buffer[iBuffer];
+        paNext = paChunk + ((QWORD)pBuffer->cPages << 12);
+        if(paNext < paEnd) {
+            LcStream_ChunkSubmit(hLC, &Buffer[iBuffer ^ 1], paNext, (DWORD)min(cPagesMax, ((paEnd - paNext) + 0xfff) >> 12));
+        }
+        LcStream_ChunkComplete(pBuffer);
+        paStart = max(pa, paChunk);
+        paStop = min(paEnd, paNext);
+        if(!pfnCallback(ctxCallback, paStart, (DWORD)(paStop - paStart), pBuffer->ppMEMs[0]->pb + (paStart - paChunk), pBuffer->cPages, pBuffer->pqwValid)) {
+            goto fail;
+        }
+        paChunk = paNext;
+        iBuffer ^= 1;
+    }
+    fResult = TRUE;
+fail:
+    for(i = 0; i < 2; i++) {
+        LcReadScatterAsyncClose(Buffer[i].hLcAsync);
+        LocalFree(Buffer[i].pqwValid);
+        LocalFree(Buffer[i].ppMEMs);
+    }
+    return fResult;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// STREAMING SCATTER READ FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Async read completion callback - mark the chunk as completed and wake up the
+* streaming scatter read thread.
+*/
+VOID LcStream_ScatterNotify(_In_opt_ PVOID ctx, _In_ HANDLE hLcAsync, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_STREAM_SCATTER_CHUNK pChunk = (PLC_STREAM_SCATTER_CHUNK)ctx;
+    HANDLE hEvent = pChunk->hEvent;
+    pChunk->fComplete = TRUE;
+    SetEvent(hEvent);
+}
+
+/*
+* Read MEMs in a scattered way and deliver them to the callback as they are
+* read - in address sorted chunks and in completion order. Multiple chunks are
+* kept in flight so that the device read of the remaining MEMs overlaps the
+* callback processing of already completed MEMs.
+* -- hLC
+* -- cMEMs
+* -- ppMEMs
+* -- cMEMsChunk = max MEMs per callback, 0 for default.
+* -- pfnCallback = callback receiving each completed chunk.
+* -- ctxCallback = optional context passed to pfnCallback.
+* -- return = TRUE if all MEMs were delivered, FALSE on fail/abort.
+*/
+_Success_(return)
+EXPORTED_FUNCTION BOOL LcReadScatterStream(_In_ HANDLE hLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _In_ DWORD cMEMsChunk, _In_ PLC_READSCATTER_STREAM_CALLBACK pfnCallback, _In_opt_ PVOID ctxCallback)
+{
+    PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
+    LC_STREAM_SCATTER_CHUNK Chunk[LC_STREAM_SCATTER_INFLIGHT] = { 0 };
+    PLC_STREAM_SCATTER_CHUNK pChunk;
+    PPMEM_SCATTER ppSort = NULL;
+    HANDLE hEvent = NULL;
+    DWORD i, iMEM = 0, cInFlight = 0, cMEMsDone = 0;
+    BOOL fResult = FALSE;
+    if(!ctxLC || (ctxLC->version != LC_CONTEXT_VERSION) || !pfnCallback) { return FALSE; }
+    if(!cMEMs) { return TRUE; }
+    cMEMsChunk = cMEMsChunk ? cMEMsChunk : LC_STREAM_SCATTER_CHUNK_DEFAULT;
+    // 1: sort MEMs on address so that each chunk holds contiguous runs:
+    if(!(ppSort = LocalAlloc(0, cMEMs * sizeof(PMEM_SCATTER)))) { goto fail; }
+    memcpy(ppSort, ppMEMs, cMEMs * sizeof(PMEM_SCATTER));
+    if(!Util_SortMEMs(cMEMs, ppSort)) { goto fail; }
+    // 2: small read - read and deliver at once:
+    if(cMEMs <= cMEMsChunk) {
+        LcReadScatter(hLC, cMEMs, ppSort);
+        fResult = pfnCallback(ctxCallback, cMEMs, ppSort);
+        goto fail;
+    }
+    if(!(hEvent = CreateEvent(NULL, FALSE, FALSE, NULL))) { goto fail; }
+    // 3: keep chunks in flight - deliver each chunk as soon as it completes:
+    while(cMEMsDone < cMEMs) {
+        for(i = 0; (i < LC_STREAM_SCATTER_INFLIGHT) && (iMEM < cMEMs); i++) {
+            pChunk = &Chunk[i];
+            if(pChunk->hLcAsync) { continue; }
+            pChunk->cMEMs = min(cMEMsChunk, cMEMs - iMEM);
+            pChunk->ppMEMs = ppSort + iMEM;
+            pChunk->hEvent = hEvent;
+            pChunk->fComplete = FALSE;
+            iMEM += pChunk->cMEMs;
+            if((pChunk->hLcAsync = LcReadScatterAsync(hLC, pChunk->cMEMs, pChunk->ppMEMs, LcStream_ScatterNotify, pChunk))) {
+                cInFlight++;
+                continue;
+            }
+            LcReadScatter(hLC, pChunk->cMEMs, pChunk->ppMEMs);
+            cMEMsDone += pChunk->cMEMs;
+            if(!pfnCallback(ctxCallback, pChunk->cMEMs, pChunk->ppMEMs)) { goto fail; }
+        }
+        for(i = 0; i < LC_STREAM_SCATTER_INFLIGHT; i++) {
+            pChunk = &Chunk[i];
+            if(!pChunk->hLcAsync || !pChunk->fComplete) { continue; }
+            LcReadScatterAsyncClose(pChunk->hLcAsync);
+            pChunk->hLcAsync = NULL;
+            cInFlight--;
+            cMEMsDone += pChunk->cMEMs;
+            if(!pfnCallback(ctxCallback, pChunk->cMEMs, pChunk->ppMEMs)) { goto fail; }
+            break;
+        }
+        if((i == LC_STREAM_SCATTER_INFLIGHT) && cInFlight) {
+            WaitForSingleObject(hEvent, INFINITE);
+        }
+    }
+    fResult = TRUE;
+fail:
+    for(i = 0; i < LC_STREAM_SCATTER_INFLIGHT; i++) {
+        LcReadScatterAsyncClose(Chunk[i].hLcAsync);
+    }
+    if(hEvent) { CloseHandle(hEvent); }
+    LocalFree(ppSort);
+    return fResult;
+}
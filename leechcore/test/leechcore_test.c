@@ -0,0 +1,203 @@
+// leechcore_test.c : test runner and shared helpers of the core read pipeline
+//                    tests. The tests of each functionality are found in the
+//                    test_*.c files.
+//
+// Build and run (Linux): make test
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+FILE *g_pTestFileWrite = NULL;
+
+
+
+//-----------------------------------------------------------------------------
+// SCRATCH FILE AND HELPER FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+_Success_(return)
+BOOL Test_FileCreate()
+{
+    BOOL fResult = FALSE;
+    FILE *pFile = NULL;
+    QWORD o, i, qwBuffer[0x200];
+    if(fopen_s(&pFile, TEST_FILE_NAME, "wb") || !pFile) { return FALSE; }
+    for(o = 0; o < TEST_FILE_SIZE; o += sizeof(qwBuffer)) {
+        for(i = 0; i < _countof(qwBuffer); i++) {
+            qwBuffer[i] = o + i * sizeof(QWORD);
+        }
+        if(fwrite(qwBuffer, 1, (SIZE_T)min(sizeof(qwBuffer), TEST_FILE_SIZE - o), pFile) != min(sizeof(qwBuffer), TEST_FILE_SIZE - o)) { goto fail; }
+    }
+    fResult = TRUE;
+fail:
+    fclose(pFile);
+    return fResult;
+}
+
+_Success_(return)
+BOOL Test_FilePatch(_In_ QWORD pa, _In_ QWORD qwTag)
+{
+    BOOL fResult = FALSE;
+    FILE *pFile = NULL;
+    QWORD i, qwBuffer[0x200];
+    for(i = 0; i < _countof(qwBuffer); i++) {
+        qwBuffer[i] = (pa + i * sizeof(QWORD)) | qwTag;
+    }
+    if(fopen_s(&pFile, TEST_FILE_NAME, "r+b") || !pFile) { return FALSE; }
+    fResult = !_fseeki64(pFile, pa, SEEK_SET) && (fwrite(qwBuffer, 1, sizeof(qwBuffer), pFile) == sizeof(qwBuffer));
+    fclose(pFile);
+    return fResult;
+}
+
+BOOL Test_Verify(_In_ QWORD pa, _In_ DWORD cb, _In_reads_(cb) PBYTE pb, _In_ QWORD qwTag)
+{
+    DWORD o;
+    for(o = 0; o < cb; o += sizeof(QWORD)) {
+        if(*(PQWORD)(pb + o) != ((pa + o) | qwTag)) { return FALSE; }
+    }
+    return TRUE;
+}
+
+/*
+* Write function installed in the file device context - writes to the
+* scratch file through a separate file handle.
+*/
+VOID Test_WriteScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cpMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    DWORD i;
+    PMEM_SCATTER pMEM;
+    for(i = 0; i < cpMEMs; i++) {
+        pMEM = ppMEMs[i];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        if(_fseeki64(g_pTestFileWrite, pMEM->qwA, SEEK_SET)) { continue; }
+        pMEM->f = pMEM->cb == (DWORD)fwrite(pMEM->pb, 1, pMEM->cb, g_pTestFileWrite);
+    }
+    fflush(g_pTestFileWrite);
+}
+
+HANDLE Test_Open(_In_ BOOL fWrite)
+{
+    HANDLE hLC;
+    LC_CONFIG cfg = { 0 };
+    if(!Test_FileCreate()) { return NULL; }
+    cfg.dwVersion = LC_CONFIG_VERSION;
+    strcpy_s(cfg.szDevice, _countof(cfg.szDevice), "file://" TEST_FILE_NAME);
+    if(!(hLC = LcCreate(&cfg))) { return NULL; }
+    if(fWrite) {
+        if(fopen_s(&g_pTestFileWrite, TEST_FILE_NAME, "r+b") || !g_pTestFileWrite) {
+            LcClose(hLC);
+            return NULL;
+        }
+        ((PLC_CONTEXT)hLC)->pfnWriteScatter = Test_WriteScatter;
+    }
+    return hLC;
+}
+
+VOID Test_Close(_In_opt_ HANDLE hLC)
+{
+    LcClose(hLC);
+    if(g_pTestFileWrite) {
+        fclose(g_pTestFileWrite);
+        g_pTestFileWrite = NULL;
+    }
+}
+
+QWORD Test_GetOption(_In_ HANDLE hLC, _In_ QWORD fOption)
+{
+    QWORD qwValue = 0;
+    LcGetOption(hLC, fOption, &qwValue);
+    return qwValue;
+}
+
+BOOL Test_ReadPage(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cb, _In_ QWORD qwTag)
+{
+    BYTE pb[0x1000];
+    MEM_SCATTER MEM = { 0 };
+    PMEM_SCATTER pMEM = &MEM;
+    MEM.version = MEM_SCATTER_VERSION;
+    MEM.qwA = pa;
+    MEM.cb = cb;
+    MEM.pb = pb;
+    LcReadScatter(hLC, 1, &pMEM);
+    return MEM.f && Test_Verify(pa, cb, pb, qwTag);
+}
+
+_Success_(return)
+BOOL Test_WritePage(_In_ HANDLE hLC, _In_ QWORD pa, _In_ QWORD qwTag)
+{
+    QWORD i, qwBuffer[0x200];
+    for(i = 0; i < _countof(qwBuffer); i++) {
+        qwBuffer[i] = (pa + i * sizeof(QWORD)) | qwTag;
+    }
+    return LcWrite(hLC, pa, sizeof(qwBuffer), (PBYTE)qwBuffer);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// MAIN FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+typedef struct tdTEST_ENTRY {
+    LPSTR szName;
+    BOOL(*pfnTest)();
+} TEST_ENTRY;
+
+TEST_ENTRY g_Tests[] = {
+    { "cache invalidate on write",      Test_CacheInvalidateOnWrite },
+    { "async complete/close",           Test_AsyncCompleteClose },
+    { "async invalid handle",           Test_AsyncInvalidHandle },
+    { "stream complete/close",          Test_StreamCompleteClose },
+    { "stream scatter",                 Test_StreamScatter },
+    { "scatterex end-of-file",          Test_ScatterExEndOfFile },
+    { "scatterex memmap",               Test_ScatterExMemMap },
+    { "readcontigious threads",         Test_ReadContigiousThreads },
+    { "readcontigious zero-copy",       Test_ReadContigiousZeroCopy },
+    { "event wait-all",                 Test_EventWaitAll },
+    { "event timeout",                  Test_EventTimeout },
+    { "event concurrent waiters",       Test_EventConcurrentWaiters },
+    { "readahead prefetch sub-page",    Test_ReadAheadPrefetchSubPage },
+    { "readahead prefetch collide",     Test_ReadAheadPrefetchCollide },
+    { "readahead prefetch volatile",    Test_ReadAheadPrefetchVolatile },
+    { "readahead sequential",           Test_ReadAheadSequential },
+    { "negcache invalidate on write",   Test_NegCacheInvalidateOnWrite },
+    { "snapshot epoch",                 Test_SnapshotEpoch },
+    { "caps dispatch",                  Test_CapsDispatch },
+    { "caps bounce",                    Test_CapsBounce },
+    { "memmap fast/slow path",          Test_MemMapFastSlow },
+    { "submit concurrent readers",      Test_SubmitConcurrentReaders },
+    { "devasync submit reject",         Test_DevAsyncSubmitReject },
+    { "merge end-of-file",              Test_MergeEndOfFile },
+    { "merge overlap",                  Test_MergeOverlap },
+    { "diskcache persist",              Test_DiskCachePersist },
+    { "zcache codec",                   Test_ZCacheCodec },
+    { "zcache budget",                  Test_ZCacheBudget },
+    { "zcache invalidate on write",     Test_ZCacheInvalidateOnWrite },
+    { "qos rate limit",                 Test_QosRateLimit },
+    { "qos priority",                   Test_QosPriority },
+    { "fanout split",                   Test_FanoutSplit },
+    { "fanout device limits",           Test_FanoutDeviceLimits },
+    { "util sort mems",                 Test_UtilSortMEMs },
+    { "arena nesting",                  Test_ArenaNesting },
+    { "arena fallback",                 Test_ArenaFallback },
+    { "arena threads",                  Test_ArenaThreads },
+    { "alloc hugepage fallback",        Test_AllocHugePageFallback },
+};
+
+int main(_In_ int argc, _In_ char* argv[])
+{
+    DWORD i, cFail = 0;
+    for(i = 0; i < _countof(g_Tests); i++) {
+        if(g_Tests[i].pfnTest()) {
+            printf("[ OK ] %s\n", g_Tests[i].szName);
+        } else {
+            printf("[FAIL] %s\n", g_Tests[i].szName);
+            cFail++;
+        }
+    }
+    remove(TEST_FILE_NAME);
+    printf("%i/%i tests passed.\n", (DWORD)_countof(g_Tests) - cFail, (DWORD)_countof(g_Tests));
+    return cFail ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+// leechcore_test.h : definitions shared by the core read pipeline tests.
+//
+// The tests run against a scratch memory dump file created in the current
+// directory. Each QWORD of the file holds its own file offset - which makes
+// read results verifiable at any address. The file size is not page aligned
+// so that reads across end-of-file may be tested.
+// The file device is read-only - writes are tested by installing a write
+// function (writing to the scratch file) in the opened device context.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#ifndef __LEECHCORE_TEST_H__
+#define __LEECHCORE_TEST_H__
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define TEST_FILE_NAME                  "leechcore_test.raw"
+#define TEST_FILE_SIZE                  0x01000800      // min file device size (16MB) + half a page.
+#define TEST_WRITE_TAG                  0xcafe000000000000
+
+#define TEST_ASSERT(c)                  { if(!(c)) { printf("    ASSERT FAILED: %s (%s:%i)\n", #c, __FILE__, __LINE__); goto fail; } }
+
+//-----------------------------------------------------------------------------
+// SCRATCH FILE AND HELPER FUNCTIONALITY (leechcore_test.c):
+//-----------------------------------------------------------------------------
+
+/*
+* (Re)create the scratch memory dump file - each QWORD holds its own offset.
+* -- return
+*/
+_Success_(return)
+BOOL Test_FileCreate();
+
+/*
+* Overwrite a page of the scratch file behind the back of LeechCore.
+* -- pa
+* -- qwTag
+* -- return
+*/
+_Success_(return)
+BOOL Test_FilePatch(_In_ QWORD pa, _In_ QWORD qwTag);
+
+/*
+* Verify that a buffer holds the scratch file contents (optionally tagged).
+* -- pa = address of the first byte in pb (QWORD aligned).
+* -- cb
+* -- pb
+* -- qwTag
+* -- return
+*/
+BOOL Test_Verify(_In_ QWORD pa, _In_ DWORD cb, _In_reads_(cb) PBYTE pb, _In_ QWORD qwTag);
+
+/*
+* Open the file device on a freshly created scratch file.
+* -- fWrite = install the scratch file write function.
+* -- return
+*/
+HANDLE Test_Open(_In_ BOOL fWrite);
+
+/*
+* Close the file device opened by Test_Open.
+* -- hLC
+*/
+VOID Test_Close(_In_opt_ HANDLE hLC);
+
+/*
+* Retrieve a numeric option - 0 on fail.
+* -- hLC
+* -- fOption
+* -- return
+*/
+QWORD Test_GetOption(_In_ HANDLE hLC, _In_ QWORD fOption);
+
+/*
+* Read a single page (or a part of it) - return TRUE if read and tagged with qwTag.
+* -- hLC
+* -- pa
+* -- cb
+* -- qwTag
+* -- return
+*/
+BOOL Test_ReadPage(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cb, _In_ QWORD qwTag);
+
+/*
+* Write a page tagged with qwTag by LcWrite.
+* -- hLC
+* -- pa = page aligned address.
+* -- qwTag
+* -- return
+*/
+_Success_(return)
+BOOL Test_WritePage(_In_ HANDLE hLC, _In_ QWORD pa, _In_ QWORD qwTag);
+
+//-----------------------------------------------------------------------------
+// TESTS:
+//-----------------------------------------------------------------------------
+
+// test_cache.c:
+BOOL Test_CacheInvalidateOnWrite();
+
+// test_async.c:
+BOOL Test_AsyncCompleteClose();
+BOOL Test_AsyncInvalidHandle();
+
+// test_stream.c:
+BOOL Test_StreamCompleteClose();
+BOOL Test_StreamScatter();
+
+// test_scatterex.c:
+BOOL Test_ScatterExEndOfFile();
+BOOL Test_ScatterExMemMap();
+
+// test_readcontigious.c:
+BOOL Test_ReadContigiousThreads();
+BOOL Test_ReadContigiousZeroCopy();
+BOOL Test_EventWaitAll();
+BOOL Test_EventTimeout();
+BOOL Test_EventConcurrentWaiters();
+
+// test_readahead.c:
+BOOL Test_ReadAheadPrefetchSubPage();
+BOOL Test_ReadAheadPrefetchCollide();
+BOOL Test_ReadAheadPrefetchVolatile();
+BOOL Test_ReadAheadSequential();
+
+// test_negcache.c:
+BOOL Test_NegCacheInvalidateOnWrite();
+
+// test_snapshot.c:
+BOOL Test_SnapshotEpoch();
+
+// test_devcaps.c:
+BOOL Test_CapsDispatch();
+BOOL Test_CapsBounce();
+
+// test_memmap.c:
+BOOL Test_MemMapFastSlow();
+
+// test_devasync.c:
+BOOL Test_DevAsyncSubmitReject();
+
+// test_merge.c:
+BOOL Test_MergeEndOfFile();
+BOOL Test_MergeOverlap();
+
+// test_diskcache.c:
+BOOL Test_DiskCachePersist();
+
+// test_zcache.c:
+BOOL Test_ZCacheCodec();
+BOOL Test_ZCacheBudget();
+BOOL Test_ZCacheInvalidateOnWrite();
+
+// test_qos.c:
+BOOL Test_QosRateLimit();
+BOOL Test_QosPriority();
+
+// test_fanout.c:
+BOOL Test_FanoutSplit();
+BOOL Test_FanoutDeviceLimits();
+
+// test_util.c:
+BOOL Test_UtilSortMEMs();
+
+// test_arena.c:
+BOOL Test_ArenaNesting();
+BOOL Test_ArenaFallback();
+BOOL Test_ArenaThreads();
+
+// test_alloc.c:
+BOOL Test_AllocHugePageFallback();
+
+// test_submit.c:
+BOOL Test_SubmitConcurrentReaders();
+
+#endif /* __LEECHCORE_TEST_H__ */
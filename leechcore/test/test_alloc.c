@@ -0,0 +1,72 @@
+// test_alloc.c : tests of huge page read buffer allocation (alloc.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+#define TEST_ALLOC_CB                   0x00300000      // rounded up to 2MB huge pages.
+
+/*
+* Allocate a large read buffer, verify that it is usable and that the huge
+* page byte count follows the allocation - then free it.
+* -- hLC
+* -- pfHugePage = receives whether the buffer was huge page backed.
+* -- return
+*/
+BOOL Test_AllocLarge(_In_ HANDLE hLC, _Out_ PBOOL pfHugePage)
+{
+    BOOL fResult = FALSE;
+    PLC_CONTEXT ctxLC = (PLC_CONTEXT)hLC;
+    LC_ALLOC_LARGE Alloc = { 0 };
+    QWORD cbHugePage = Test_GetOption(hLC, LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES);
+    *pfHugePage = FALSE;
+    TEST_ASSERT(LcAlloc_Large(ctxLC, TEST_ALLOC_CB, LC_ALLOC_NODE_ANY, &Alloc));
+    TEST_ASSERT(Alloc.cb == 0x00400000);
+    memset(Alloc.pb, 0xcc, Alloc.cb);
+    *pfHugePage = Test_GetOption(hLC, LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES) != cbHugePage;
+    TEST_ASSERT(!*pfHugePage || (Test_GetOption(hLC, LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES) == cbHugePage + Alloc.cb));
+    LcAlloc_LargeFree(ctxLC, &Alloc);
+    TEST_ASSERT(!Alloc.pb && !Alloc.cb);
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES) == cbHugePage);
+    fResult = TRUE;
+fail:
+    LcAlloc_LargeFree(ctxLC, &Alloc);
+    return fResult;
+}
+
+/*
+* Huge page fallback: with huge page allocations failing, read buffers of the
+* LC_ALLOC_POLICY_HUGEPAGE policy fall back to normal pages - they are usable,
+* not accounted as huge pages and freed correctly. Contigious reads through
+* the fall back worker buffers return correct data.
+*/
+BOOL Test_AllocHugePageFallback()
+{
+    BOOL fResult = FALSE, fHugePage;
+    HANDLE hLC = NULL;
+    LC_CONFIG cfg = { 0 };
+    PBYTE pb = NULL;
+    DWORD cb = 0x00400000;
+    TEST_ASSERT(Test_FileCreate());
+    cfg.dwVersion = LC_CONFIG_VERSION;
+    sprintf_s(cfg.szDevice, _countof(cfg.szDevice), "file://file=%s,threads=2,alloc=%i", TEST_FILE_NAME, LC_ALLOC_POLICY_HUGEPAGE);
+    TEST_ASSERT(hLC = LcCreate(&cfg));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ALLOC_POLICY) == LC_ALLOC_POLICY_HUGEPAGE);
+    // huge pages - if available on this system:
+    TEST_ASSERT(Test_AllocLarge(hLC, &fHugePage));
+    // huge pages fail:
+    g_fLcAllocHugePageFail = TRUE;
+    TEST_ASSERT(Test_AllocLarge(hLC, &fHugePage) && !fHugePage);
+    TEST_ASSERT(pb = LocalAlloc(0, cb));
+    TEST_ASSERT(LcRead(hLC, 0x00200000, cb, pb) && Test_Verify(0x00200000, cb, pb, 0));
+    TEST_ASSERT(!Test_GetOption(hLC, LC_OPT_CORE_ALLOC_HUGEPAGE_BYTES));
+    LcClose(hLC);
+    hLC = NULL;
+    fResult = TRUE;
+fail:
+    g_fLcAllocHugePageFail = FALSE;
+    LocalFree(pb);
+    LcClose(hLC);
+    return fResult;
+}
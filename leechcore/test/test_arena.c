@@ -0,0 +1,179 @@
+// test_arena.c : tests of the per-thread scratch arena (arena.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+#define TEST_ARENA_SIZE                 0x00100000      // per-thread arena size (LC_ARENA_SIZE).
+
+typedef struct tdTEST_ARENA_CONTEXT {
+    PBYTE pbMain;
+    PBYTE pbThread;
+    BOOL volatile fStarted;
+    BOOL volatile fRelease;
+    BOOL volatile fDone;
+    BOOL volatile fFail;
+} TEST_ARENA_CONTEXT, *PTEST_ARENA_CONTEXT;
+
+/*
+* Fill a buffer with a pattern / verify that a buffer holds the pattern.
+*/
+VOID Test_ArenaFill(_Out_writes_(cb) PBYTE pb, _In_ SIZE_T cb, _In_ BYTE b)
+{
+    memset(pb, b, cb);
+}
+
+BOOL Test_ArenaVerify(_In_reads_(cb) PBYTE pb, _In_ SIZE_T cb, _In_ BYTE b)
+{
+    SIZE_T i;
+    for(i = 0; (i < cb) && (pb[i] == b); i++);
+    return i == cb;
+}
+
+/*
+* Return TRUE if the buffer is located within the arena starting at pbArena.
+*/
+BOOL Test_ArenaIsInArena(_In_ PBYTE pbArena, _In_ PBYTE pb)
+{
+    return (pb >= pbArena) && (pb < pbArena + TEST_ARENA_SIZE);
+}
+
+/*
+* Arena thread - allocates from its own arena while the main thread holds an
+* allocation of its arena.
+*/
+DWORD Test_ArenaThreadProc(_In_ PTEST_ARENA_CONTEXT ctx)
+{
+    PBYTE pb;
+    if(!(pb = LcArena_Alloc(0x100)) || Test_ArenaIsInArena(ctx->pbMain, pb)) {
+        ctx->fFail = TRUE;
+    }
+    if(pb) { Test_ArenaFill(pb, 0x100, 0x22); }
+    ctx->pbThread = pb;
+    ctx->fStarted = TRUE;
+    while(!ctx->fRelease) {
+        Sleep(1);
+    }
+    if(pb && !Test_ArenaVerify(pb, 0x100, 0x22)) {
+        ctx->fFail = TRUE;
+    }
+    LcArena_Free(pb);
+    ctx->fDone = TRUE;
+    return 0;
+}
+
+/*
+* LIFO nesting: nested allocations are carved consecutively (16-byte aligned)
+* from the arena - a free releases the freed allocation and all allocations
+* made after it.
+*/
+BOOL Test_ArenaNesting()
+{
+    BOOL fResult = FALSE;
+    PBYTE pbBase, pb1 = NULL, pb2, pb3, pb4;
+    TEST_ASSERT(pbBase = pb1 = LcArena_Alloc(0x101));
+    TEST_ASSERT((pb2 = LcArena_Alloc(0x1000)) == pb1 + 0x110);
+    TEST_ASSERT((pb3 = LcArena_Alloc(0x08)) == pb2 + 0x1000);
+    Test_ArenaFill(pb1, 0x101, 0x11);
+    Test_ArenaFill(pb2, 0x1000, 0x22);
+    Test_ArenaFill(pb3, 0x08, 0x33);
+    TEST_ASSERT(Test_ArenaVerify(pb1, 0x101, 0x11) && Test_ArenaVerify(pb2, 0x1000, 0x22));
+    // free innermost - the space is re-used by the next allocation:
+    LcArena_Free(pb3);
+    TEST_ASSERT((pb4 = LcArena_Alloc(0x20)) == pb3);
+    LcArena_Free(pb4);
+    // free middle - re-used while the outer allocation is intact:
+    LcArena_Free(pb2);
+    TEST_ASSERT((pb3 = LcArena_Alloc(0x10)) == pb2);
+    TEST_ASSERT(Test_ArenaVerify(pb1, 0x101, 0x11));
+    LcArena_Free(pb3);
+    // free outermost - the arena is empty:
+    LcArena_Free(pb1);
+    pb1 = NULL;
+    TEST_ASSERT((pb1 = LcArena_Alloc(0x10)) == pbBase);
+    LcArena_Free(NULL);
+    fResult = TRUE;
+fail:
+    LcArena_Free(pb1);
+    return fResult;
+}
+
+/*
+* Capacity: allocations which do not fit in the (remaining) arena fall back
+* to the heap and are freed to the heap - the arena is still used for later
+* allocations which do fit.
+*/
+BOOL Test_ArenaFallback()
+{
+    BOOL fResult = FALSE;
+    PBYTE pbArena, pbFull = NULL, pbHeap = NULL, pbLast = NULL;
+    TEST_ASSERT(pbArena = LcArena_Alloc(0x10));
+    LcArena_Free(pbArena);
+    // larger than the arena:
+    TEST_ASSERT(pbHeap = LcArena_Alloc(TEST_ARENA_SIZE + 1));
+    TEST_ASSERT(!Test_ArenaIsInArena(pbArena, pbHeap));
+    Test_ArenaFill(pbHeap, TEST_ARENA_SIZE + 1, 0x44);
+    LcArena_Free(pbHeap);
+    pbHeap = NULL;
+    // arena almost exhausted:
+    TEST_ASSERT((pbFull = LcArena_Alloc(TEST_ARENA_SIZE - 0x100)) == pbArena);
+    TEST_ASSERT(pbHeap = LcArena_Alloc(0x101));
+    TEST_ASSERT(!Test_ArenaIsInArena(pbArena, pbHeap));
+    TEST_ASSERT((pbLast = LcArena_Alloc(0x100)) == pbArena + TEST_ARENA_SIZE - 0x100);
+    Test_ArenaFill(pbHeap, 0x101, 0x55);
+    Test_ArenaFill(pbLast, 0x100, 0x66);
+    TEST_ASSERT(Test_ArenaVerify(pbHeap, 0x101, 0x55) && Test_ArenaVerify(pbLast, 0x100, 0x66));
+    LcArena_Free(pbLast);
+    pbLast = NULL;
+    LcArena_Free(pbHeap);
+    pbHeap = NULL;
+    LcArena_Free(pbFull);
+    // the whole arena:
+    TEST_ASSERT((pbFull = LcArena_Alloc(TEST_ARENA_SIZE)) == pbArena);
+    fResult = TRUE;
+fail:
+    LcArena_Free(pbLast);
+    LcArena_Free(pbHeap);
+    LcArena_Free(pbFull);
+    return fResult;
+}
+
+/*
+* Per-thread isolation: each thread allocates from its own arena - the
+* allocations of another thread are neither handed out nor released.
+*/
+BOOL Test_ArenaThreads()
+{
+    BOOL fResult = FALSE;
+    HANDLE hThread;
+    TEST_ARENA_CONTEXT ctx = { 0 };
+    PBYTE pb = NULL;
+    TEST_ASSERT(ctx.pbMain = LcArena_Alloc(0x100));
+    Test_ArenaFill(ctx.pbMain, 0x100, 0x11);
+    TEST_ASSERT(hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)Test_ArenaThreadProc, &ctx, 0, NULL));
+    CloseHandle(hThread);
+    while(!ctx.fStarted) {
+        Sleep(1);
+    }
+    TEST_ASSERT(!ctx.fFail);
+    TEST_ASSERT(!Test_ArenaIsInArena(ctx.pbMain, ctx.pbThread));
+    // this thread's nested allocation follows its own outer allocation:
+    TEST_ASSERT((pb = LcArena_Alloc(0x100)) == ctx.pbMain + 0x100);
+    Test_ArenaFill(pb, 0x100, 0x33);
+    ctx.fRelease = TRUE;
+    while(!ctx.fDone) {
+        Sleep(1);
+    }
+    TEST_ASSERT(!ctx.fFail);
+    TEST_ASSERT(Test_ArenaVerify(ctx.pbMain, 0x100, 0x11) && Test_ArenaVerify(pb, 0x100, 0x33));
+    fResult = TRUE;
+fail:
+    ctx.fRelease = TRUE;
+    while(ctx.fStarted && !ctx.fDone) {
+        Sleep(1);
+    }
+    LcArena_Free(pb);
+    LcArena_Free(ctx.pbMain);
+    return fResult;
+}
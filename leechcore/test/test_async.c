@@ -0,0 +1,109 @@
+// test_async.c : tests of asynchronous scatter reads (async.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+typedef struct tdTEST_ASYNC_CONTEXT {
+    DWORD volatile *pcCallback;
+    BOOL fSelfClose;                // close the async read handle from within its callback.
+} TEST_ASYNC_CONTEXT, *PTEST_ASYNC_CONTEXT;
+
+VOID Test_AsyncCallback(_In_opt_ PVOID ctx, _In_ HANDLE hLcAsync, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PTEST_ASYNC_CONTEXT ctxTest = (PTEST_ASYNC_CONTEXT)ctx;
+    if(ctxTest->fSelfClose) {
+        LcReadScatterAsyncClose(hLcAsync);
+    }
+    InterlockedIncrement(ctxTest->pcCallback);
+}
+
+/*
+* Async reads: every read completes (or is cancelled) with exactly one
+* callback - also reads closed while in flight and reads closed from within
+* their own callback - before the device is closed.
+*/
+BOOL Test_AsyncCompleteClose()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL, hLcAsync[8] = { 0 };
+    PPMEM_SCATTER ppMEMs[8] = { 0 };
+    TEST_ASYNC_CONTEXT ctx = { 0 }, ctxSelfClose = { 0 };
+    DWORD volatile cCallback = 0;
+    DWORD i, j, cMEMs = 0x40, dwStatus;
+    ctx.pcCallback = ctxSelfClose.pcCallback = &cCallback;
+    ctxSelfClose.fSelfClose = TRUE;
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    for(i = 0; i < _countof(ppMEMs); i++) {
+        TEST_ASSERT(LcAllocScatter1(cMEMs, &ppMEMs[i]));
+        for(j = 0; j < cMEMs; j++) {
+            ppMEMs[i][j]->qwA = (QWORD)(i * cMEMs + j) * 0x2000;
+        }
+    }
+    // self closing read (closed by its own callback):
+    TEST_ASSERT(LcReadScatterAsync(hLC, cMEMs, ppMEMs[0], Test_AsyncCallback, &ctxSelfClose));
+    for(i = 1; i < _countof(hLcAsync); i++) {
+        TEST_ASSERT(hLcAsync[i] = LcReadScatterAsync(hLC, cMEMs, ppMEMs[i], Test_AsyncCallback, &ctx));
+    }
+    // close half of the reads while in flight, wait on the other half:
+    for(i = 1; i < _countof(hLcAsync); i += 2) {
+        LcReadScatterAsyncClose(hLcAsync[i]);
+        hLcAsync[i] = NULL;
+    }
+    for(i = 2; i < _countof(hLcAsync); i += 2) {
+        TEST_ASSERT(LcReadScatterAsyncWait(hLcAsync[i], INFINITE));
+        dwStatus = LcReadScatterAsyncPoll(hLcAsync[i]);
+        TEST_ASSERT((dwStatus == LC_ASYNC_STATUS_COMPLETE) || (dwStatus == LC_ASYNC_STATUS_CANCELLED));
+        for(j = 0; (dwStatus == LC_ASYNC_STATUS_COMPLETE) && (j < cMEMs); j++) {
+            TEST_ASSERT(ppMEMs[i][j]->f && Test_Verify(ppMEMs[i][j]->qwA, 0x1000, ppMEMs[i][j]->pb, 0));
+        }
+        LcReadScatterAsyncClose(hLcAsync[i]);
+        hLcAsync[i] = NULL;
+    }
+    for(i = 0; (cCallback < _countof(hLcAsync)) && (i < 10000); i++) {
+        Sleep(1);
+    }
+    TEST_ASSERT(cCallback == _countof(hLcAsync));
+    fResult = TRUE;
+fail:
+    for(i = 0; i < _countof(hLcAsync); i++) {
+        LcReadScatterAsyncClose(hLcAsync[i]);
+    }
+    Test_Close(hLC);
+    for(i = 0; i < _countof(ppMEMs); i++) {
+        LcMemFree(ppMEMs[i]);
+    }
+    return fResult;
+}
+
+/*
+* Async read handles: handles not returned by LcReadScatterAsync - or already
+* closed - are rejected without being dereferenced.
+*/
+BOOL Test_AsyncInvalidHandle()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL, hLcAsync = NULL;
+    PPMEM_SCATTER ppMEMs = NULL;
+    QWORD qwNotHandle[0x10] = { 0 };
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(LcAllocScatter1(0x10, &ppMEMs));
+    TEST_ASSERT(LcReadScatterAsyncPoll((HANDLE)qwNotHandle) == LC_ASYNC_STATUS_INVALID);
+    TEST_ASSERT(!LcReadScatterAsyncWait((HANDLE)qwNotHandle, 0));
+    TEST_ASSERT(!LcReadScatterAsyncCancel((HANDLE)qwNotHandle));
+    LcReadScatterAsyncClose((HANDLE)qwNotHandle);
+    TEST_ASSERT(hLcAsync = LcReadScatterAsync(hLC, 0x10, ppMEMs, NULL, NULL));
+    TEST_ASSERT(LcReadScatterAsyncWait(hLcAsync, INFINITE));
+    TEST_ASSERT(LcReadScatterAsyncPoll(hLcAsync) == LC_ASYNC_STATUS_COMPLETE);
+    LcReadScatterAsyncClose(hLcAsync);
+    TEST_ASSERT(LcReadScatterAsyncPoll(hLcAsync) == LC_ASYNC_STATUS_INVALID);
+    LcReadScatterAsyncClose(hLcAsync);
+    hLcAsync = NULL;
+    fResult = TRUE;
+fail:
+    LcReadScatterAsyncClose(hLcAsync);
+    Test_Close(hLC);
+    LcMemFree(ppMEMs);
+    return fResult;
+}
@@ -0,0 +1,27 @@
+// test_cache.c : tests of the read-through page cache (cache.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+/*
+* Page cache: a cached page is invalidated by a write to it.
+*/
+BOOL Test_CacheInvalidateOnWrite()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD pa = 0x00200000;
+    TEST_ASSERT(hLC = Test_Open(TRUE));
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_CACHE_SIZE, 0x100));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_CACHE_HIT) >= 1);
+    TEST_ASSERT(Test_WritePage(hLC, pa, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, TEST_WRITE_TAG));
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
@@ -0,0 +1,54 @@
+// test_devasync.c : tests of the asynchronous (submit / complete) device
+//                   interface bridge (devasync.c).
+//
+// The file device is turned into an asynchronous device by replacing its read
+// function with a submit function completing each batch on submission.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+VOID(*g_pfnTestDevAsyncRead)(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cpMEMs, _Inout_ PPMEM_SCATTER ppMEMs) = NULL;
+DWORD volatile g_cTestDevAsyncReject = 0;
+
+BOOL Test_DevAsyncSubmit(_In_ PLC_CONTEXT ctxLC, _In_ PLC_DEVICE_BATCH pBatch)
+{
+    if(g_cTestDevAsyncReject) {
+        g_cTestDevAsyncReject--;
+        return FALSE;
+    }
+    g_pfnTestDevAsyncRead(ctxLC, pBatch->cMEMs, pBatch->ppMEMs);
+    pBatch->pfnComplete(pBatch);
+    return TRUE;
+}
+
+/*
+* Asynchronous devices: submitted batches are completed - a batch rejected by
+* the device while no other batch is in flight is failed (not waited upon).
+*/
+BOOL Test_DevAsyncSubmitReject()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PLC_CONTEXT ctxLC;
+    QWORD pa = 0x00200000;
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    ctxLC = (PLC_CONTEXT)hLC;
+    g_pfnTestDevAsyncRead = ctxLC->pfnReadScatter;
+    g_cTestDevAsyncReject = 0;
+    ctxLC->pfnReadScatter = NULL;
+    ctxLC->pfnSubmit = Test_DevAsyncSubmit;
+    TEST_ASSERT(LcDeviceAsync_Initialize(ctxLC));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_BATCH_SUBMIT) == 1);
+    g_cTestDevAsyncReject = 1;
+    TEST_ASSERT(!Test_ReadPage(hLC, pa + 0x1000, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_BATCH_REJECT) == 1);
+    TEST_ASSERT(Test_ReadPage(hLC, pa + 0x1000, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_BATCH_SUBMIT) == 3);
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
@@ -0,0 +1,80 @@
+// test_devcaps.c : tests of device capability driven read dispatch (devcaps.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+/*
+* Device capabilities: the file device advertises sorted contiguous partial
+* reads - unsorted page runs are read as one coalesced device read.
+*/
+BOOL Test_CapsDispatch()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PPMEM_SCATTER ppMEMs = NULL;
+    DWORD i, cMEMs = 0x40;
+    QWORD cSaved;
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_FLAGS) & LC_DEVICE_CAPS_FLAG_SORTED);
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_FLAGS) & LC_DEVICE_CAPS_FLAG_CONTIGUOUS);
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_FLAGS) & LC_DEVICE_CAPS_FLAG_PARTIAL);
+    TEST_ASSERT(LcAllocScatter1(cMEMs, &ppMEMs));
+    for(i = 0; i < cMEMs; i++) {
+        ppMEMs[i]->qwA = 0x00100000 + (QWORD)(cMEMs - 1 - i) * 0x1000;
+    }
+    cSaved = Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED);
+    LcReadScatter(hLC, cMEMs, ppMEMs);
+    for(i = 0; i < cMEMs; i++) {
+        TEST_ASSERT(ppMEMs[i]->f && Test_Verify(ppMEMs[i]->qwA, 0x1000, ppMEMs[i]->pb, 0));
+    }
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED) - cSaved == cMEMs - 1);
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMs);
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Device capabilities: page runs with non-contiguous buffers and MEMs not on
+* the device alignment share one bounce buffer (max 1MB) - bounce reads larger
+* than the buffer in total are read in several groups.
+*/
+BOOL Test_CapsBounce()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PPMEM_SCATTER ppMEMs = NULL;
+    DWORD i, cMEMs = 0x200, cMEMsUnaligned = 0x10;
+    QWORD cSaved, qwExpected[3];
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    ((PLC_CONTEXT)hLC)->Caps.cbAlign = 8;
+    ((PLC_CONTEXT)hLC)->cbReadScatterMax = 0x10000;
+    TEST_ASSERT(LcAllocScatter1(cMEMs + cMEMsUnaligned, &ppMEMs));
+    for(i = 0; i < cMEMs; i++) {
+        ppMEMs[i]->qwA = 0x00100000 + (QWORD)(cMEMs - 1 - i) * 0x1000;
+    }
+    for(i = cMEMs; i < cMEMs + cMEMsUnaligned; i++) {
+        ppMEMs[i]->qwA = 0x00300004 + (QWORD)i * 0x1000;
+        ppMEMs[i]->cb = 0x10;
+    }
+    cSaved = Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED);
+    LcReadScatter(hLC, cMEMs + cMEMsUnaligned, ppMEMs);
+    for(i = 0; i < cMEMs; i++) {
+        TEST_ASSERT(ppMEMs[i]->f && Test_Verify(ppMEMs[i]->qwA, 0x1000, ppMEMs[i]->pb, 0));
+    }
+    for(i = cMEMs; i < cMEMs + cMEMsUnaligned; i++) {
+        qwExpected[0] = ppMEMs[i]->qwA - 4;
+        qwExpected[1] = ppMEMs[i]->qwA + 4;
+        qwExpected[2] = ppMEMs[i]->qwA + 12;
+        TEST_ASSERT(ppMEMs[i]->f && !memcmp(ppMEMs[i]->pb, (PBYTE)qwExpected + 4, 0x10));
+    }
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED) - cSaved == cMEMs - cMEMs / 16);
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMs);
+    Test_Close(hLC);
+    return fResult;
+}
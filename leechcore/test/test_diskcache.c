@@ -0,0 +1,112 @@
+// test_diskcache.c : tests of the persistent on-disk page cache (diskcache.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+#define TEST_DISKCACHE_DIR              "leechcore_test_diskcache"
+
+/*
+* Open the file device on the current scratch file (without re-creating it)
+* and open the disk cache in the test disk cache directory.
+* -- return
+*/
+HANDLE Test_DiskCacheOpen()
+{
+    HANDLE hLC;
+    LC_CONFIG cfg = { 0 };
+    CHAR szDirectory[] = TEST_DISKCACHE_DIR;
+    cfg.dwVersion = LC_CONFIG_VERSION;
+    strcpy_s(cfg.szDevice, _countof(cfg.szDevice), "file://" TEST_FILE_NAME);
+    if(!(hLC = LcCreate(&cfg))) { return NULL; }
+    if(!LcCommand(hLC, LC_CMD_DISKCACHE_OPEN, sizeof(szDirectory), (PBYTE)szDirectory, NULL, NULL)) {
+        LcClose(hLC);
+        return NULL;
+    }
+    return hLC;
+}
+
+/*
+* Remove the cache files of the test disk cache directory.
+*/
+VOID Test_DiskCacheRemove()
+{
+    HANDLE hFind;
+    WIN32_FIND_DATAA FindData = { 0 };
+    CHAR szPath[MAX_PATH];
+    LPSTR szPattern[] = { TEST_DISKCACHE_DIR "/*.pages", TEST_DISKCACHE_DIR "/*.index" };
+    DWORD i;
+    for(i = 0; i < _countof(szPattern); i++) {
+        hFind = FindFirstFileA(szPattern[i], &FindData);
+        if(!hFind || (hFind == INVALID_HANDLE_VALUE)) { continue; }
+        do {
+            _snprintf_s(szPath, _countof(szPath), _TRUNCATE, "%s/%s", TEST_DISKCACHE_DIR, FindData.cFileName);
+            remove(szPath);
+        } while(FindNextFileA(hFind, &FindData));
+#ifdef _WIN32
+        FindClose(hFind);
+#endif /* _WIN32 */
+    }
+}
+
+/*
+* Disk cache: pages persist across LcClose / LcCreate of an unchanged device.
+* A device with a changed content identity (here: the file size) does not get
+* the pages of the previous device - and devices without a content identity
+* are not disk cached at all.
+*/
+BOOL Test_DiskCachePersist()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    FILE *pFile = NULL;
+    BYTE pbPage[0x1000] = { 0 };
+    CHAR szDirectory[] = TEST_DISKCACHE_DIR;
+    QWORD pa = 0x00400000;
+#ifdef _WIN32
+    CreateDirectoryA(TEST_DISKCACHE_DIR, NULL);
+#else /* _WIN32 */
+    mkdir(TEST_DISKCACHE_DIR, 0700);
+#endif /* _WIN32 */
+    Test_DiskCacheRemove();
+    // 1: populate the disk cache:
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    LcClose(hLC);
+    TEST_ASSERT(hLC = Test_DiskCacheOpen());
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DISKCACHE_PAGES) >= 1);
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_IDENTITY));
+    LcClose(hLC);
+    // 2: re-open the unchanged device - the page is served from the disk cache:
+    TEST_ASSERT(hLC = Test_DiskCacheOpen());
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DISKCACHE_PAGES) >= 1);
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DISKCACHE_HIT) >= 1);
+    LcClose(hLC);
+    // 3: change the device contents (and size) - cached pages are not served:
+    TEST_ASSERT(Test_FilePatch(pa, TEST_WRITE_TAG));
+    TEST_ASSERT(!fopen_s(&pFile, TEST_FILE_NAME, "ab") && pFile);
+    TEST_ASSERT(sizeof(pbPage) == fwrite(pbPage, 1, sizeof(pbPage), pFile));
+    fclose(pFile);
+    pFile = NULL;
+    TEST_ASSERT(hLC = Test_DiskCacheOpen());
+    TEST_ASSERT(!Test_GetOption(hLC, LC_OPT_CORE_DISKCACHE_PAGES));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, TEST_WRITE_TAG));
+    TEST_ASSERT(!Test_GetOption(hLC, LC_OPT_CORE_DISKCACHE_HIT));
+    // 4: a device without a content identity is not disk cached:
+    ((PLC_CONTEXT)hLC)->qwDeviceIdentity = 0;
+    TEST_ASSERT(!LcCommand(hLC, LC_CMD_DISKCACHE_OPEN, sizeof(szDirectory), (PBYTE)szDirectory, NULL, NULL));
+    TEST_ASSERT(!Test_GetOption(hLC, LC_OPT_CORE_DISKCACHE_PAGES));
+    fResult = TRUE;
+fail:
+    if(pFile) { fclose(pFile); }
+    LcClose(hLC);
+    Test_DiskCacheRemove();
+#ifdef _WIN32
+    RemoveDirectoryA(TEST_DISKCACHE_DIR);
+#else /* _WIN32 */
+    rmdir(TEST_DISKCACHE_DIR);
+#endif /* _WIN32 */
+    return fResult;
+}
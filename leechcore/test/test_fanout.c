@@ -0,0 +1,165 @@
+// test_fanout.c : tests of parallel fan-out of large scatter reads (fanout.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+#define TEST_FANOUT_MEMS                0x400
+#define TEST_FANOUT_SLICE               0x10
+#define TEST_FANOUT_BATCH_MAX           0x0c
+#define TEST_FANOUT_INFLIGHT_MAX        2
+
+typedef struct tdTEST_FANOUT_DEVICE {
+    CRITICAL_SECTION Lock;
+    VOID(*pfnReadScatter)(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cpMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+    DWORD volatile cInFlight;
+    DWORD cInFlightPeak;
+    DWORD cMEMsPeak;
+    DWORD cCall;
+} TEST_FANOUT_DEVICE;
+
+TEST_FANOUT_DEVICE g_TestFanout;
+
+/*
+* Device read function wrapping the file device - records the number of calls,
+* the largest batch and the number of concurrent calls. The file device itself
+* is not thread-safe and is called with a lock held.
+*/
+VOID Test_FanoutReadScatter(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cpMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    DWORD cInFlight = InterlockedIncrement(&g_TestFanout.cInFlight);
+    EnterCriticalSection(&g_TestFanout.Lock);
+    g_TestFanout.cInFlightPeak = max(g_TestFanout.cInFlightPeak, cInFlight);
+    g_TestFanout.cMEMsPeak = max(g_TestFanout.cMEMsPeak, cpMEMs);
+    g_TestFanout.cCall++;
+    LeaveCriticalSection(&g_TestFanout.Lock);
+    Sleep(1);
+    EnterCriticalSection(&g_TestFanout.Lock);
+    g_TestFanout.pfnReadScatter(ctxLC, cpMEMs, ppMEMs);
+    LeaveCriticalSection(&g_TestFanout.Lock);
+    InterlockedDecrement(&g_TestFanout.cInFlight);
+}
+
+/*
+* Read MEMs in a scattered order spanning multiple slices: every other page
+* (so that the device cannot coalesce pages), duplicates, invalid addresses
+* and addresses beyond end-of-file. Every MEM must receive its own data - or
+* fail - and the MEM table must be left in the caller order.
+*/
+BOOL Test_FanoutRead(_In_ HANDLE hLC)
+{
+    BOOL fResult = FALSE;
+    DWORD i, iPage;
+    PMEM_SCATTER pMEMs[TEST_FANOUT_MEMS];
+    PPMEM_SCATTER ppMEMs = NULL;
+    TEST_ASSERT(LcAllocScatter1(TEST_FANOUT_MEMS, &ppMEMs));
+    for(i = 0; i < TEST_FANOUT_MEMS; i++) {
+        iPage = (i * 0x295) % TEST_FANOUT_MEMS;
+        ppMEMs[i]->qwA = 0x00200000 + ((QWORD)iPage << 13);
+        if((i % 0x41) == 0x20) { ppMEMs[i]->qwA = ppMEMs[i - 1]->qwA; }
+        if((i % 0x83) == 0x40) { ppMEMs[i]->qwA = (QWORD)-1; }
+        if((i % 0x61) == 0x30) { ppMEMs[i]->qwA = (TEST_FILE_SIZE + 0xfff + ((QWORD)i << 12)) & ~0xfff; }
+        pMEMs[i] = ppMEMs[i];
+    }
+    LcReadScatter(hLC, TEST_FANOUT_MEMS, ppMEMs);
+    for(i = 0; i < TEST_FANOUT_MEMS; i++) {
+        TEST_ASSERT(ppMEMs[i] == pMEMs[i]);
+        if((ppMEMs[i]->qwA == (QWORD)-1) || (ppMEMs[i]->qwA >= TEST_FILE_SIZE)) {
+            TEST_ASSERT(!ppMEMs[i]->f);
+        } else {
+            TEST_ASSERT(ppMEMs[i]->f && (ppMEMs[i]->cb == 0x1000) && Test_Verify(ppMEMs[i]->qwA, 0x1000, ppMEMs[i]->pb, 0));
+        }
+    }
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMs);
+    return fResult;
+}
+
+/*
+* Close the file device opened by Test_FanoutOpen.
+*/
+VOID Test_FanoutClose(_In_opt_ HANDLE hLC)
+{
+    Test_Close(hLC);
+    DeleteCriticalSection(&g_TestFanout.Lock);
+}
+
+/*
+* Open the file device as a thread-safe device with the given device limits.
+* Device reads are routed through Test_FanoutReadScatter.
+*/
+HANDLE Test_FanoutOpen(_In_ DWORD cInFlightMax, _In_ DWORD cMEMsBatchMax)
+{
+    HANDLE hLC;
+    PLC_CONTEXT ctxLC;
+    if(!(hLC = Test_Open(FALSE))) { return NULL; }
+    ctxLC = (PLC_CONTEXT)hLC;
+    ZeroMemory(&g_TestFanout, sizeof(g_TestFanout));
+    InitializeCriticalSection(&g_TestFanout.Lock);
+    g_TestFanout.pfnReadScatter = ctxLC->pfnReadScatter;
+    ctxLC->pfnReadScatter = Test_FanoutReadScatter;
+    ctxLC->Caps.fFlags |= LC_DEVICE_CAPS_FLAG_THREADSAFE;
+    ctxLC->Caps.cInFlightMax = cInFlightMax;
+    ctxLC->Caps.cMEMsBatchMax = cMEMsBatchMax;
+    if(!LcDeviceCaps_Initialize(ctxLC) || !LcSetOption(hLC, LC_OPT_CORE_FANOUT_SLICE, TEST_FANOUT_SLICE)) {
+        Test_FanoutClose(hLC);
+        return NULL;
+    }
+    return hLC;
+}
+
+/*
+* Fan-out ordering and completeness: a read split into many slices - and read
+* in parallel - completes every MEM. A disabled fan-out reads the same data on
+* the calling thread only.
+*/
+BOOL Test_FanoutSplit()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    TEST_ASSERT(hLC = Test_FanoutOpen(0, 0));
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_FANOUT_THREADS, 4));
+    TEST_ASSERT(Test_FanoutRead(hLC));
+    TEST_ASSERT(g_TestFanout.cCall > TEST_FANOUT_MEMS / TEST_FANOUT_SLICE / 2);
+    TEST_ASSERT(g_TestFanout.cMEMsPeak <= TEST_FANOUT_SLICE);
+    TEST_ASSERT((g_TestFanout.cInFlightPeak > 1) && (g_TestFanout.cInFlightPeak <= 4));
+    // fan-out disabled - one thread:
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_FANOUT_THREADS, 1));
+    g_TestFanout.cInFlightPeak = 0;
+    g_TestFanout.cCall = 0;
+    TEST_ASSERT(Test_FanoutRead(hLC));
+    TEST_ASSERT(g_TestFanout.cInFlightPeak == 1);
+    TEST_ASSERT(g_TestFanout.cCall == 1);
+    fResult = TRUE;
+fail:
+    Test_FanoutClose(hLC);
+    return fResult;
+}
+
+/*
+* Fan-out device limits: no more than cInFlightMax device reads are in flight
+* and no device read exceeds cMEMsBatchMax MEMs.
+*/
+BOOL Test_FanoutDeviceLimits()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    TEST_ASSERT(hLC = Test_FanoutOpen(TEST_FANOUT_INFLIGHT_MAX, TEST_FANOUT_BATCH_MAX));
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_FANOUT_THREADS, 8));
+    TEST_ASSERT(Test_FanoutRead(hLC));
+    TEST_ASSERT(g_TestFanout.cCall > TEST_FANOUT_MEMS / TEST_FANOUT_BATCH_MAX / 2);
+    TEST_ASSERT(g_TestFanout.cMEMsPeak <= TEST_FANOUT_BATCH_MAX);
+    TEST_ASSERT(g_TestFanout.cInFlightPeak <= TEST_FANOUT_INFLIGHT_MAX);
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_INFLIGHT_PEAK) <= TEST_FANOUT_INFLIGHT_MAX);
+    // cInFlightMax == 1 - fan-out is not used:
+    ((PLC_CONTEXT)hLC)->Caps.cInFlightMax = 1;
+    g_TestFanout.cInFlightPeak = 0;
+    TEST_ASSERT(Test_FanoutRead(hLC));
+    TEST_ASSERT(g_TestFanout.cInFlightPeak == 1);
+    fResult = TRUE;
+fail:
+    Test_FanoutClose(hLC);
+    return fResult;
+}
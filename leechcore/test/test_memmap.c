@@ -0,0 +1,55 @@
+// test_memmap.c : tests of memory map translation (memmap.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+/*
+* Memory map: the single range fast path and the generic translation give
+* identical results - also for MEMs outside of the memory map.
+*/
+BOOL Test_MemMapFastSlow()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PPMEM_SCATTER ppMEMs = NULL;
+    PBYTE pbFast = NULL;
+    DWORD i, cMEMs = 0x100;
+    CHAR szMemMapFast[] = "0x0 0x7fffff 0x800000\n";
+    CHAR szMemMapSlow[] = "0x0 0x3fffff 0x800000\n0x400000 0x7fffff 0xc00000\n";
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(pbFast = LocalAlloc(LMEM_ZEROINIT, cMEMs * 0x1001));
+    TEST_ASSERT(LcAllocScatter1(cMEMs, &ppMEMs));
+    // fast path (single memory map range):
+    TEST_ASSERT(LcCommand(hLC, LC_CMD_MEMMAP_SET, sizeof(szMemMapFast), (PBYTE)szMemMapFast, NULL, NULL));
+    for(i = 0; i < cMEMs; i++) {
+        ppMEMs[i]->qwA = (QWORD)i * 0x9000;
+    }
+    LcReadScatter(hLC, cMEMs, ppMEMs);
+    for(i = 0; i < cMEMs; i++) {
+        TEST_ASSERT(ppMEMs[i]->qwA == (QWORD)i * 0x9000);
+        TEST_ASSERT(ppMEMs[i]->f == (ppMEMs[i]->qwA < 0x800000));
+        TEST_ASSERT(!ppMEMs[i]->f || Test_Verify(ppMEMs[i]->qwA + 0x800000, 0x1000, ppMEMs[i]->pb, 0));
+        pbFast[cMEMs * 0x1000 + i] = (BYTE)ppMEMs[i]->f;
+        memcpy(pbFast + i * 0x1000, ppMEMs[i]->pb, 0x1000);
+    }
+    // generic translation (multiple memory map ranges, identical translation):
+    TEST_ASSERT(LcCommand(hLC, LC_CMD_MEMMAP_SET, sizeof(szMemMapSlow), (PBYTE)szMemMapSlow, NULL, NULL));
+    for(i = 0; i < cMEMs; i++) {
+        ppMEMs[i]->f = FALSE;
+        ZeroMemory(ppMEMs[i]->pb, 0x1000);
+    }
+    LcReadScatter(hLC, cMEMs, ppMEMs);
+    for(i = 0; i < cMEMs; i++) {
+        TEST_ASSERT(ppMEMs[i]->qwA == (QWORD)i * 0x9000);
+        TEST_ASSERT(ppMEMs[i]->f == pbFast[cMEMs * 0x1000 + i]);
+        TEST_ASSERT(!ppMEMs[i]->f || !memcmp(pbFast + i * 0x1000, ppMEMs[i]->pb, 0x1000));
+    }
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMs);
+    LocalFree(pbFast);
+    Test_Close(hLC);
+    return fResult;
+}
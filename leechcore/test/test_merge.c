@@ -0,0 +1,101 @@
+// test_merge.c : tests of duplicate and sub-page read merging (merge.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+typedef struct tdTEST_MERGE_MEM {
+    DWORD o;                        // offset from page base.
+    DWORD cb;
+    BOOL fResult;                   // expected result.
+} TEST_MERGE_MEM, *PTEST_MERGE_MEM;
+
+/*
+* Read sub-page MEMs in one scatter read and verify the expected results.
+* -- hLC
+* -- pa = page base address.
+* -- cMEMs
+* -- pe
+* -- return
+*/
+BOOL Test_MergeRead(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cMEMs, _In_reads_(cMEMs) PTEST_MERGE_MEM pe)
+{
+    BOOL fResult = FALSE;
+    DWORD i;
+    PPMEM_SCATTER ppMEMs = NULL;
+    TEST_ASSERT(LcAllocScatter1(cMEMs, &ppMEMs));
+    for(i = 0; i < cMEMs; i++) {
+        ppMEMs[i]->qwA = pa + pe[i].o;
+        ppMEMs[i]->cb = pe[i].cb;
+    }
+    LcReadScatter(hLC, cMEMs, ppMEMs);
+    for(i = 0; i < cMEMs; i++) {
+        TEST_ASSERT(ppMEMs[i]->f == pe[i].fResult);
+        TEST_ASSERT(!ppMEMs[i]->f || Test_Verify(ppMEMs[i]->qwA, ppMEMs[i]->cb, ppMEMs[i]->pb, 0));
+    }
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMs);
+    return fResult;
+}
+
+/*
+* Read merging at end-of-file: merged reads crossing end-of-file fail - the
+* merged MEMs located before end-of-file are still read successfully.
+*/
+BOOL Test_MergeEndOfFile()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD pa = TEST_FILE_SIZE & ~0xfff, cSaved;
+    // group without a covering MEM (read as the union of the MEMs):
+    TEST_MERGE_MEM eUnion[] = {
+        { 0x100, 0x100, TRUE }, { 0x100, 0x100, TRUE }, { 0x180, 0x100, TRUE }, { 0x280, 0x600, FALSE },
+    };
+    // group covered by a MEM crossing end-of-file:
+    TEST_MERGE_MEM eCover[] = {
+        { 0x400, 0x600, FALSE }, { 0x500, 0x100, TRUE }, { 0x400, 0x600, FALSE }, { 0x7f8, 0x008, TRUE },
+    };
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    cSaved = Test_GetOption(hLC, LC_OPT_CORE_READMERGE_SAVED);
+    TEST_ASSERT(Test_MergeRead(hLC, pa, _countof(eUnion), eUnion));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_READMERGE_SAVED) > cSaved);
+    TEST_ASSERT(Test_MergeRead(hLC, pa, _countof(eCover), eCover));
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Read merging of duplicate, overlapping, adjacent and disjoint MEMs within a
+* page - every MEM receives its own data.
+*/
+BOOL Test_MergeOverlap()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD pa = 0x00300000, cSaved;
+    TEST_MERGE_MEM eOverlap[] = {
+        { 0x000, 0x040, TRUE }, { 0x020, 0x040, TRUE }, { 0x060, 0x020, TRUE }, { 0x000, 0x040, TRUE },
+        { 0x800, 0x008, TRUE }, { 0x800, 0x008, TRUE }, { 0xf00, 0x100, TRUE }, { 0xf80, 0x080, TRUE },
+        { 0x400, 0x010, TRUE },
+    };
+    TEST_MERGE_MEM eFullPage[] = {
+        { 0x123 & ~7, 0x100, TRUE }, { 0x000, 0x1000, TRUE }, { 0xff8, 0x008, TRUE }, { 0x000, 0x1000, TRUE },
+    };
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    cSaved = Test_GetOption(hLC, LC_OPT_CORE_READMERGE_SAVED);
+    TEST_ASSERT(Test_MergeRead(hLC, pa, _countof(eOverlap), eOverlap));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_READMERGE_SAVED) == cSaved + 5);
+    TEST_ASSERT(Test_MergeRead(hLC, pa + 0x1000, _countof(eFullPage), eFullPage));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_READMERGE_SAVED) == cSaved + 8);
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_READMERGE, 0));
+    TEST_ASSERT(Test_MergeRead(hLC, pa, _countof(eOverlap), eOverlap));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_READMERGE_SAVED) == cSaved + 8);
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
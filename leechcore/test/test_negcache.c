@@ -0,0 +1,30 @@
+// test_negcache.c : tests of the negative cache of unreadable pages (negcache.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+/*
+* Negative cache: an unreadable page (beyond end-of-file) is remembered as
+* unreadable until it is written to.
+*/
+BOOL Test_NegCacheInvalidateOnWrite()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD pa = 0x01800000;
+    CHAR szMemMap[] = "0x0 0x1ffffff\n";
+    TEST_ASSERT(hLC = Test_Open(TRUE));
+    TEST_ASSERT(LcCommand(hLC, LC_CMD_MEMMAP_SET, sizeof(szMemMap), (PBYTE)szMemMap, NULL, NULL));
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_NEGCACHE_TTL, 60000));
+    TEST_ASSERT(!Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(!Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_NEGCACHE_HIT) >= 1);
+    TEST_ASSERT(Test_WritePage(hLC, pa, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, TEST_WRITE_TAG));
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
@@ -0,0 +1,125 @@
+// test_qos.c : tests of read priorities and bandwidth limits (qos.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+#define TEST_QOS_PAGES_PER_SEC          0x400
+
+typedef struct tdTEST_QOS_CONTEXT {
+    HANDLE hLC;
+    BOOL volatile fStarted;
+    BOOL volatile fDone;
+    BOOL volatile fFail;
+} TEST_QOS_CONTEXT, *PTEST_QOS_CONTEXT;
+
+/*
+* Read and verify consecutive pages in one scatter read.
+*/
+BOOL Test_QosRead(_In_ HANDLE hLC, _In_ QWORD pa, _In_ DWORD cPages)
+{
+    BOOL fResult = FALSE;
+    DWORD i;
+    PPMEM_SCATTER ppMEMs = NULL;
+    TEST_ASSERT(LcAllocScatter1(cPages, &ppMEMs));
+    for(i = 0; i < cPages; i++) {
+        ppMEMs[i]->qwA = pa + ((QWORD)i << 12);
+    }
+    LcReadScatter(hLC, cPages, ppMEMs);
+    for(i = 0; i < cPages; i++) {
+        TEST_ASSERT(ppMEMs[i]->f && Test_Verify(ppMEMs[i]->qwA, 0x1000, ppMEMs[i]->pb, 0));
+    }
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMs);
+    return fResult;
+}
+
+/*
+* Background reader - exits without resetting its priority.
+*/
+DWORD Test_QosBackgroundThreadProc(_In_ PTEST_QOS_CONTEXT ctx)
+{
+    if(!LcSetOption(ctx->hLC, LC_OPT_CORE_QOS_PRIORITY, LC_QOS_PRIORITY_BACKGROUND)) {
+        ctx->fFail = TRUE;
+    }
+    ctx->fStarted = TRUE;
+    if(!Test_QosRead(ctx->hLC, 0, 3 * TEST_QOS_PAGES_PER_SEC / 2)) {
+        ctx->fFail = TRUE;
+    }
+    ctx->fDone = TRUE;
+    return 0;
+}
+
+/*
+* Rate limiting: background reads are throttled to the page limit - while
+* interactive reads consume tokens but are never delayed.
+*/
+BOOL Test_QosRateLimit()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD tcStart, cmsThrottle;
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_QOS_PAGES_PER_SEC, TEST_QOS_PAGES_PER_SEC));
+    // interactive (default) - never throttled:
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_QOS_PRIORITY) == LC_QOS_PRIORITY_INTERACTIVE);
+    TEST_ASSERT(Test_QosRead(hLC, 0, 2 * TEST_QOS_PAGES_PER_SEC));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_QOS_THROTTLE_MS) == 0);
+    // background - the read beyond the one second burst and debt is delayed:
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_QOS_PAGES_PER_SEC, TEST_QOS_PAGES_PER_SEC));
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_QOS_PRIORITY, LC_QOS_PRIORITY_BACKGROUND));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_QOS_PRIORITY) == LC_QOS_PRIORITY_BACKGROUND);
+    tcStart = GetTickCount64();
+    TEST_ASSERT(Test_QosRead(hLC, 0, 2 * TEST_QOS_PAGES_PER_SEC));
+    TEST_ASSERT(GetTickCount64() - tcStart >= 400);
+    TEST_ASSERT((cmsThrottle = Test_GetOption(hLC, LC_OPT_CORE_QOS_THROTTLE_MS)) >= 400);
+    // no limit - background reads are no longer throttled:
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_QOS_PAGES_PER_SEC, 0));
+    TEST_ASSERT(Test_QosRead(hLC, 0, 2 * TEST_QOS_PAGES_PER_SEC));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_QOS_THROTTLE_MS) == cmsThrottle);
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_QOS_PRIORITY, LC_QOS_PRIORITY_INTERACTIVE));
+    fResult = TRUE;
+fail:
+    if(hLC) { LcSetOption(hLC, LC_OPT_CORE_QOS_PRIORITY, LC_QOS_PRIORITY_INTERACTIVE); }
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Priority ordering: an interactive read issued while a throttled background
+* read is in progress completes first - the priority is per thread.
+*/
+BOOL Test_QosPriority()
+{
+    BOOL fResult = FALSE;
+    HANDLE hThread;
+    QWORD tcStart;
+    TEST_QOS_CONTEXT ctx = { 0 };
+    TEST_ASSERT(ctx.hLC = Test_Open(FALSE));
+    TEST_ASSERT(LcSetOption(ctx.hLC, LC_OPT_CORE_QOS_PAGES_PER_SEC, TEST_QOS_PAGES_PER_SEC / 2));
+    TEST_ASSERT(hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)Test_QosBackgroundThreadProc, &ctx, 0, NULL));
+    CloseHandle(hThread);
+    while(!ctx.fStarted) {
+        Sleep(1);
+    }
+    Sleep(50);
+    TEST_ASSERT(Test_GetOption(ctx.hLC, LC_OPT_CORE_QOS_PRIORITY) == LC_QOS_PRIORITY_INTERACTIVE);
+    tcStart = GetTickCount64();
+    TEST_ASSERT(Test_QosRead(ctx.hLC, 0x00800000, 0x40));
+    TEST_ASSERT(GetTickCount64() - tcStart < 250);
+    TEST_ASSERT(!ctx.fDone);
+    while(!ctx.fDone) {
+        Sleep(10);
+    }
+    TEST_ASSERT(!ctx.fFail);
+    TEST_ASSERT(Test_GetOption(ctx.hLC, LC_OPT_CORE_QOS_THROTTLE_MS) > 0);
+    fResult = TRUE;
+fail:
+    while(ctx.fStarted && !ctx.fDone) {
+        Sleep(10);
+    }
+    Test_Close(ctx.hLC);
+    return fResult;
+}
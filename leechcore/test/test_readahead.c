@@ -0,0 +1,127 @@
+// test_readahead.c : tests of sequential readahead and prefetch (readahead.c).
+//
+// Buffered pages are detected by modifying the scratch file after the pages
+// have been prefetched - reads served from the buffer return the old contents.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore_test.h"
+
+#define TEST_READAHEAD_FILL_MS          200
+
+/*
+* Prefetch pages and wait for the background prefetch to complete.
+*/
+_Success_(return)
+BOOL Test_ReadAheadPrefetch(_In_ HANDLE hLC, _In_ DWORD cRanges, _In_reads_(cRanges) const QWORD *pqwA)
+{
+    DWORD i, pcb[4];
+    for(i = 0; i < cRanges; i++) {
+        pcb[i] = 0x1000;
+    }
+    if(!LcPrefetch(hLC, cRanges, pqwA, pcb)) { return FALSE; }
+    Sleep(TEST_READAHEAD_FILL_MS);
+    return TRUE;
+}
+
+/*
+* Prefetch: a prefetched page is served from the buffer until it is read in
+* full - sub-page reads of the page keep it buffered.
+*/
+BOOL Test_ReadAheadPrefetchSubPage()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD pa = 0x00300000;
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(Test_ReadAheadPrefetch(hLC, 1, &pa));
+    TEST_ASSERT(Test_FilePatch(pa, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x800, 0));
+    TEST_ASSERT(Test_ReadPage(hLC, pa + 0x800, 0x800, 0));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_READAHEAD_HIT) == 3);
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, TEST_WRITE_TAG));
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Prefetch: pages colliding in the buffer are all kept (up to the number of
+* ways of the set associative buffer).
+*/
+BOOL Test_ReadAheadPrefetchCollide()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD pa[2] = { 0x00300000, 0x00700000 };      // 4MB apart - same buffer set in the default (4MB) buffer.
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(Test_ReadAheadPrefetch(hLC, 2, pa));
+    TEST_ASSERT(Test_FilePatch(pa[0], TEST_WRITE_TAG));
+    TEST_ASSERT(Test_FilePatch(pa[1], TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ReadPage(hLC, pa[0], 0x1000, 0));
+    TEST_ASSERT(Test_ReadPage(hLC, pa[1], 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_READAHEAD_HIT) == 2);
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Prefetch: on volatile devices prefetched pages expire after the cache
+* time-to-live.
+*/
+BOOL Test_ReadAheadPrefetchVolatile()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD pa = 0x00300000;
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    ((PLC_CONTEXT)hLC)->Config.fVolatile = TRUE;
+    // within time-to-live:
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_CACHE_TTL, 10000));
+    TEST_ASSERT(Test_ReadAheadPrefetch(hLC, 1, &pa));
+    TEST_ASSERT(Test_FilePatch(pa, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    // expired:
+    pa += 0x1000;
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_CACHE_TTL, TEST_READAHEAD_FILL_MS / 4));
+    TEST_ASSERT(Test_ReadAheadPrefetch(hLC, 1, &pa));
+    TEST_ASSERT(Test_FilePatch(pa, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_READAHEAD_HIT) == 1);
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Readahead: the pages following a sequential read stream are read ahead.
+*/
+BOOL Test_ReadAheadSequential()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PBYTE pb = NULL;
+    QWORD pa = 0x00600000;
+    DWORD i, cb = 0x10000;
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(pb = LocalAlloc(0, cb));
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_READAHEAD, 0x40));
+    for(i = 0; i < 4; i++, pa += cb) {
+        TEST_ASSERT(LcRead(hLC, pa, cb, pb) && Test_Verify(pa, cb, pb, 0));
+    }
+    Sleep(TEST_READAHEAD_FILL_MS);
+    TEST_ASSERT(LcRead(hLC, pa, cb, pb) && Test_Verify(pa, cb, pb, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_READAHEAD_HIT) >= cb >> 12);
+    fResult = TRUE;
+fail:
+    LocalFree(pb);
+    Test_Close(hLC);
+    return fResult;
+}
@@ -0,0 +1,254 @@
+// test_readcontigious.c : tests of multi-threaded contigious reads and of the
+//                         events they are synchronized with.
+//
+// The file device reads contigiously (with positional reads) if opened with
+// the 'threads' device parameter.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+#define TEST_RC_THREADS                 4
+#define TEST_RC_WAITERS                 4
+#define TEST_RC_WAKE_MS                 100
+
+#define TEST_RC_ZEROCOPY_MEMS          0x48            // 0x40 pages before end-of-file, the last partial page and pages beyond.
+
+typedef struct tdTEST_EVENT_CONTEXT {
+    HANDLE hEvent;
+    DWORD volatile cWoken;
+} TEST_EVENT_CONTEXT, *PTEST_EVENT_CONTEXT;
+
+VOID(*g_pfnTestRcZeroCopy)(_Inout_ PLC_READ_CONTIGIOUS_CONTEXT ctxRC, _Out_writes_(ctxRC->cb) PBYTE pb) = NULL;
+DWORD g_cTestRcZeroCopy = 0;
+
+/*
+* Zero-copy read function wrapping the file device - counts zero-copy reads.
+*/
+VOID Test_ReadContigiousZeroCopyCount(_Inout_ PLC_READ_CONTIGIOUS_CONTEXT ctxRC, _Out_writes_(ctxRC->cb) PBYTE pb)
+{
+    InterlockedIncrement(&g_cTestRcZeroCopy);
+    g_pfnTestRcZeroCopy(ctxRC, pb);
+}
+
+/*
+* Open the file device on a freshly created scratch file with contigious reads.
+* -- cThread
+* -- return
+*/
+HANDLE Test_ReadContigiousOpen(_In_ DWORD cThread)
+{
+    LC_CONFIG cfg = { 0 };
+    if(!Test_FileCreate()) { return NULL; }
+    cfg.dwVersion = LC_CONFIG_VERSION;
+    sprintf_s(cfg.szDevice, _countof(cfg.szDevice), "file://file=%s,threads=%i", TEST_FILE_NAME, cThread);
+    return LcCreate(&cfg);
+}
+
+/*
+* Contigious reads: reads split over several threads - with work stolen
+* between the threads - complete every MEM. MEMs beyond end-of-file fail.
+*/
+BOOL Test_ReadContigiousThreads()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PPMEM_SCATTER ppMEMs = NULL;
+    PBYTE pb = NULL;
+    DWORD i, iRound, cMEMs = 0x800, cb = 0x00800000;
+    TEST_ASSERT(hLC = Test_ReadContigiousOpen(TEST_RC_THREADS));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_RC_THREADS) == TEST_RC_THREADS);
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_RC_THREADS, 8));
+    TEST_ASSERT(!LcSetOption(hLC, LC_OPT_CORE_RC_THREADS, 9));
+    TEST_ASSERT(pb = LocalAlloc(0, cb));
+    TEST_ASSERT(LcAllocScatter1(cMEMs, &ppMEMs));
+    for(iRound = 0; iRound < 0x10; iRound++) {
+        // large contiguous read (sub-chunked over all threads):
+        ZeroMemory(pb, cb);
+        TEST_ASSERT(LcRead(hLC, 0x00400000, cb, pb) && Test_Verify(0x00400000, cb, pb, 0));
+        // unsorted scattered read - the last MEM crosses end-of-file:
+        for(i = 0; i < cMEMs; i++) {
+            ppMEMs[i]->f = FALSE;
+            ppMEMs[i]->qwA = 0x01000000 - (QWORD)i * 0x2000;
+            ZeroMemory(ppMEMs[i]->pb, 0x1000);
+        }
+        LcReadScatter(hLC, cMEMs, ppMEMs);
+        TEST_ASSERT(!ppMEMs[0]->f);
+        for(i = 1; i < cMEMs; i++) {
+            TEST_ASSERT(ppMEMs[i]->f && Test_Verify(ppMEMs[i]->qwA, 0x1000, ppMEMs[i]->pb, 0));
+        }
+    }
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMs);
+    LocalFree(pb);
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Zero-copy contigious reads: MEMs with back-to-back buffers are read directly
+* into the MEM buffers, other MEMs through the worker read buffer. Both paths
+* return identical data and identical results for a read across end-of-file.
+*/
+BOOL Test_ReadContigiousZeroCopy()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PLC_CONTEXT ctxLC;
+    PPMEM_SCATTER ppMEMsZero = NULL, ppMEMsCopy = NULL;
+    PBYTE pb = NULL, pbCopy = NULL;
+    QWORD pa = (TEST_FILE_SIZE & ~0xfff) - 0x40000;
+    DWORD i, cZeroCopy, cb = 0x10800;
+    TEST_ASSERT(hLC = Test_ReadContigiousOpen(2));
+    ctxLC = (PLC_CONTEXT)hLC;
+    TEST_ASSERT(g_pfnTestRcZeroCopy = ctxLC->pfnReadContigiousZeroCopy);
+    ctxLC->pfnReadContigiousZeroCopy = Test_ReadContigiousZeroCopyCount;
+    g_cTestRcZeroCopy = 0;
+    TEST_ASSERT(LcAllocScatter1(TEST_RC_ZEROCOPY_MEMS, &ppMEMsZero));
+    TEST_ASSERT(LcAllocScatter1(TEST_RC_ZEROCOPY_MEMS, &ppMEMsCopy));
+    TEST_ASSERT(pbCopy = LocalAlloc(0, TEST_RC_ZEROCOPY_MEMS * 0x2000));
+    for(i = 0; i < TEST_RC_ZEROCOPY_MEMS; i++) {
+        ppMEMsZero[i]->qwA = pa + ((QWORD)i << 12);
+        ppMEMsCopy[i]->qwA = pa + ((QWORD)i << 12);
+        ppMEMsCopy[i]->pb = pbCopy + (SIZE_T)i * 0x2000;
+        memset(ppMEMsCopy[i]->pb, 0xcc, 0x1000);
+    }
+    // zero-copy - back-to-back buffers:
+    LcReadScatter(hLC, TEST_RC_ZEROCOPY_MEMS, ppMEMsZero);
+    TEST_ASSERT((cZeroCopy = g_cTestRcZeroCopy));
+    // copy - buffers with gaps in-between:
+    LcReadScatter(hLC, TEST_RC_ZEROCOPY_MEMS, ppMEMsCopy);
+    TEST_ASSERT(g_cTestRcZeroCopy == cZeroCopy);
+    for(i = 0; i < TEST_RC_ZEROCOPY_MEMS; i++) {
+        TEST_ASSERT(ppMEMsZero[i]->f == (ppMEMsZero[i]->qwA + 0x1000 <= TEST_FILE_SIZE));
+        TEST_ASSERT(ppMEMsCopy[i]->f == ppMEMsZero[i]->f);
+        TEST_ASSERT(!ppMEMsZero[i]->f || (Test_Verify(ppMEMsZero[i]->qwA, 0x1000, ppMEMsZero[i]->pb, 0) && !memcmp(ppMEMsZero[i]->pb, ppMEMsCopy[i]->pb, 0x1000)));
+    }
+    // zero-copy LcRead - up to the last whole page - and across end-of-file:
+    TEST_ASSERT(pb = LocalAlloc(LMEM_ZEROINIT, cb));
+    TEST_ASSERT(LcRead(hLC, (TEST_FILE_SIZE & ~0xfff) - 0x10000, 0x10000, pb) && Test_Verify((TEST_FILE_SIZE & ~0xfff) - 0x10000, 0x10000, pb, 0));
+    TEST_ASSERT(g_cTestRcZeroCopy > cZeroCopy);
+    TEST_ASSERT(!LcRead(hLC, TEST_FILE_SIZE - cb, cb, pb));
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMsZero);
+    LcMemFree(ppMEMsCopy);
+    LocalFree(pbCopy);
+    LocalFree(pb);
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Events: a wait-all wait is satisfied only once all events are signaled and
+* then resets all of its auto-reset events - a wait-any wait returns the index
+* of the signaled event.
+*/
+BOOL Test_EventWaitAll()
+{
+    BOOL fResult = FALSE;
+    HANDLE hEvent[3] = { 0 };
+    TEST_ASSERT(hEvent[0] = CreateEvent(NULL, FALSE, FALSE, NULL));
+    TEST_ASSERT(hEvent[1] = CreateEvent(NULL, FALSE, FALSE, NULL));
+    TEST_ASSERT(hEvent[2] = CreateEvent(NULL, TRUE, TRUE, NULL));
+    SetEvent(hEvent[0]);
+    TEST_ASSERT(WaitForMultipleObjects(3, hEvent, TRUE, 10) == WAIT_TIMEOUT);
+    SetEvent(hEvent[1]);
+    TEST_ASSERT(WaitForMultipleObjects(3, hEvent, TRUE, 0) == WAIT_OBJECT_0);
+    TEST_ASSERT(WaitForSingleObject(hEvent[0], 0) == WAIT_TIMEOUT);
+    TEST_ASSERT(WaitForSingleObject(hEvent[1], 0) == WAIT_TIMEOUT);
+    TEST_ASSERT(WaitForSingleObject(hEvent[2], 0) == WAIT_OBJECT_0);
+    ResetEvent(hEvent[2]);
+    SetEvent(hEvent[1]);
+    TEST_ASSERT(WaitForMultipleObjects(3, hEvent, FALSE, 0) == WAIT_OBJECT_0 + 1);
+    TEST_ASSERT(WaitForMultipleObjects(3, hEvent, FALSE, 0) == WAIT_TIMEOUT);
+    fResult = TRUE;
+fail:
+    if(hEvent[0]) { CloseHandle(hEvent[0]); }
+    if(hEvent[1]) { CloseHandle(hEvent[1]); }
+    if(hEvent[2]) { CloseHandle(hEvent[2]); }
+    return fResult;
+}
+
+/*
+* Events: timed out waits return WAIT_TIMEOUT after the timeout and invalid
+* waits return WAIT_FAILED.
+*/
+BOOL Test_EventTimeout()
+{
+    BOOL fResult = FALSE;
+    HANDLE hEvent = NULL, hEventNull = NULL;
+    QWORD tcStart;
+    TEST_ASSERT(hEvent = CreateEvent(NULL, FALSE, FALSE, NULL));
+    tcStart = GetTickCount64();
+    TEST_ASSERT(WaitForSingleObject(hEvent, TEST_RC_WAKE_MS) == WAIT_TIMEOUT);
+    TEST_ASSERT(GetTickCount64() - tcStart >= TEST_RC_WAKE_MS - 10);
+    TEST_ASSERT(WaitForSingleObject(hEventNull, 0) == WAIT_FAILED);
+    TEST_ASSERT(WaitForMultipleObjects(0, &hEvent, FALSE, 0) == WAIT_FAILED);
+    fResult = TRUE;
+fail:
+    if(hEvent) { CloseHandle(hEvent); }
+    return fResult;
+}
+
+DWORD Test_EventWaiterThreadProc(_In_ PTEST_EVENT_CONTEXT ctx)
+{
+    if(WaitForSingleObject(ctx->hEvent, INFINITE) == WAIT_OBJECT_0) {
+        InterlockedIncrement(&ctx->cWoken);
+    }
+    return 0;
+}
+
+/*
+* Wait (max TEST_RC_WAKE_MS) until a number of waiters have been woken.
+*/
+DWORD Test_EventWaitWoken(_In_ PTEST_EVENT_CONTEXT ctx, _In_ DWORD cWoken)
+{
+    DWORD i;
+    for(i = 0; (ctx->cWoken < cWoken) && (i < TEST_RC_WAKE_MS); i++) {
+        Sleep(1);
+    }
+    Sleep(10);
+    return ctx->cWoken;
+}
+
+/*
+* Events: an auto-reset event wakes exactly one of several concurrent waiters
+* per SetEvent - a manual-reset event wakes all of them.
+*/
+BOOL Test_EventConcurrentWaiters()
+{
+    BOOL fResult = FALSE;
+    TEST_EVENT_CONTEXT ctxAuto = { 0 }, ctxManual = { 0 };
+    HANDLE hThread;
+    DWORD i;
+    TEST_ASSERT(ctxAuto.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL));
+    TEST_ASSERT(ctxManual.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL));
+    for(i = 0; i < TEST_RC_WAITERS; i++) {
+        TEST_ASSERT(hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)Test_EventWaiterThreadProc, &ctxAuto, 0, NULL));
+        CloseHandle(hThread);
+        TEST_ASSERT(hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)Test_EventWaiterThreadProc, &ctxManual, 0, NULL));
+        CloseHandle(hThread);
+    }
+    Sleep(TEST_RC_WAKE_MS);
+    for(i = 1; i <= TEST_RC_WAITERS; i++) {
+        SetEvent(ctxAuto.hEvent);
+        TEST_ASSERT(Test_EventWaitWoken(&ctxAuto, i) == i);
+    }
+    SetEvent(ctxManual.hEvent);
+    TEST_ASSERT(Test_EventWaitWoken(&ctxManual, TEST_RC_WAITERS) == TEST_RC_WAITERS);
+    fResult = TRUE;
+fail:
+    // release any remaining waiters before the contexts go out of scope:
+    for(i = 0; (ctxAuto.cWoken < TEST_RC_WAITERS) && (i < TEST_RC_WAITERS); i++) {
+        SetEvent(ctxAuto.hEvent);
+        Test_EventWaitWoken(&ctxAuto, ctxAuto.cWoken + 1);
+    }
+    SetEvent(ctxManual.hEvent);
+    Test_EventWaitWoken(&ctxManual, TEST_RC_WAITERS);
+    if(ctxAuto.hEvent) { CloseHandle(ctxAuto.hEvent); }
+    if(ctxManual.hEvent) { CloseHandle(ctxManual.hEvent); }
+    return fResult;
+}
@@ -0,0 +1,86 @@
+// test_scatterex.c : tests of extended (variable size) MEM reads (LcReadScatterEx).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+/*
+* Extended MEMs across end-of-file: the pages before end-of-file of a MEM
+* crossing it are kept - only MEMs touching the unreadable page fail. MEMs are
+* read as large device reads - not as page runs to coalesce.
+*/
+BOOL Test_ScatterExEndOfFile()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PBYTE pb = NULL;
+    QWORD cSaved;
+    MEM_SCATTER_EX MEMEx[3] = { 0 };
+    PMEM_SCATTER_EX ppMEMEx[3] = { &MEMEx[0], &MEMEx[1], &MEMEx[2] };
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(pb = LocalAlloc(LMEM_ZEROINIT, 0x9000));
+    MEMEx[0].qwA = 0x00ff8800;      // ends before end-of-file.
+    MEMEx[0].cb = 0x3800;
+    MEMEx[0].pb = pb;
+    MEMEx[1].qwA = 0x00ffc000;      // crosses end-of-file.
+    MEMEx[1].cb = 0x5000;
+    MEMEx[1].pb = pb + 0x3800;
+    MEMEx[2].qwA = 0x01000000;      // last (half) page up until end-of-file.
+    MEMEx[2].cb = 0x800;
+    MEMEx[2].pb = pb + 0x8800;
+    MEMEx[0].version = MEMEx[1].version = MEMEx[2].version = MEM_SCATTER_EX_VERSION;
+    cSaved = Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED);
+    LcReadScatterEx(hLC, 2, ppMEMEx);
+    LcReadScatterEx(hLC, 1, ppMEMEx + 2);     // separate read - not merged with the (unreadable) full page.
+    TEST_ASSERT(MEMEx[0].f && Test_Verify(MEMEx[0].qwA, MEMEx[0].cb, MEMEx[0].pb, 0));
+    TEST_ASSERT(!MEMEx[1].f && Test_Verify(MEMEx[1].qwA, 0x4000, MEMEx[1].pb, 0));
+    TEST_ASSERT(MEMEx[2].f && Test_Verify(MEMEx[2].qwA, MEMEx[2].cb, MEMEx[2].pb, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED) == cSaved);
+    fResult = TRUE;
+fail:
+    LocalFree(pb);
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Extended MEMs across memory map ranges: each MEM is translated one range at
+* a time and read as large device reads (no page runs to coalesce). The part
+* of a MEM beyond the memory map fails - the part before it is kept.
+*/
+BOOL Test_ScatterExMemMap()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PBYTE pb = NULL;
+    QWORD cSaved;
+    MEM_SCATTER_EX MEMEx[3] = { 0 };
+    PMEM_SCATTER_EX ppMEMEx[3] = { &MEMEx[0], &MEMEx[1], &MEMEx[2] };
+    CHAR szMemMap[] = "0x0 0x3fffff 0x800000\n0x400000 0x7fffff 0xc00000\n";
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(LcCommand(hLC, LC_CMD_MEMMAP_SET, sizeof(szMemMap), (PBYTE)szMemMap, NULL, NULL));
+    TEST_ASSERT(pb = LocalAlloc(LMEM_ZEROINIT, 0x00204000));
+    MEMEx[0].qwA = 0x00100800;      // large (2MB) unaligned MEM within one range.
+    MEMEx[0].cb = 0x00200000;
+    MEMEx[0].pb = pb;
+    MEMEx[1].qwA = 0x003ff800;      // crosses memory map ranges (remapped differently).
+    MEMEx[1].cb = 0x2000;
+    MEMEx[1].pb = pb + 0x00200000;
+    MEMEx[2].qwA = 0x007ff000;      // crosses the end of the memory map.
+    MEMEx[2].cb = 0x2000;
+    MEMEx[2].pb = pb + 0x00202000;
+    MEMEx[0].version = MEMEx[1].version = MEMEx[2].version = MEM_SCATTER_EX_VERSION;
+    cSaved = Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED);
+    LcReadScatterEx(hLC, 3, ppMEMEx);
+    TEST_ASSERT(MEMEx[0].f && Test_Verify(0x00900800, 0x00200000, MEMEx[0].pb, 0));
+    TEST_ASSERT(MEMEx[1].f && Test_Verify(0x00bff800, 0x800, MEMEx[1].pb, 0));
+    TEST_ASSERT(Test_Verify(0x00c00000, 0x1800, MEMEx[1].pb + 0x800, 0));
+    TEST_ASSERT(!MEMEx[2].f && Test_Verify(0x00fff000, 0x1000, MEMEx[2].pb, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_DEVICE_CAPS_COALESCE_SAVED) == cSaved);
+    fResult = TRUE;
+fail:
+    LocalFree(pb);
+    Test_Close(hLC);
+    return fResult;
+}
@@ -0,0 +1,46 @@
+// test_snapshot.c : tests of the epoch-based consistent snapshot (snapshot.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+/*
+* Snapshot: pages read in a snapshot epoch are retained - also for extended
+* MEM reads - until the epoch is ended.
+*/
+BOOL Test_SnapshotEpoch()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PBYTE pb = NULL;
+    QWORD pa = 0x00400000;
+    DWORD o, cb = 0x00010000;
+    MEM_SCATTER_EX MEMEx = { 0 };
+    PMEM_SCATTER_EX pMEMEx = &MEMEx;
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    TEST_ASSERT(pb = LocalAlloc(0, cb));
+    TEST_ASSERT(LcCommand(hLC, LC_CMD_SNAPSHOT_BEGIN, 0, NULL, NULL, NULL));
+    TEST_ASSERT(LcRead(hLC, pa, cb, pb) && Test_Verify(pa, cb, pb, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_SNAPSHOT_PAGES) == cb >> 12);
+    for(o = 0; o < cb; o += 0x1000) {
+        TEST_ASSERT(Test_FilePatch(pa + o, TEST_WRITE_TAG));
+    }
+    ZeroMemory(pb, cb);
+    TEST_ASSERT(LcRead(hLC, pa, cb, pb) && Test_Verify(pa, cb, pb, 0));
+    ZeroMemory(pb, cb);
+    MEMEx.version = MEM_SCATTER_EX_VERSION;
+    MEMEx.qwA = pa;
+    MEMEx.cb = cb;
+    MEMEx.pb = pb;
+    LcReadScatterEx(hLC, 1, &pMEMEx);
+    TEST_ASSERT(MEMEx.f && Test_Verify(pa, cb, pb, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_SNAPSHOT_HIT) >= 2 * (cb >> 12));
+    TEST_ASSERT(LcCommand(hLC, LC_CMD_SNAPSHOT_END, 0, NULL, NULL, NULL));
+    TEST_ASSERT(LcRead(hLC, pa, cb, pb) && Test_Verify(pa, cb, pb, TEST_WRITE_TAG));
+    fResult = TRUE;
+fail:
+    LocalFree(pb);
+    Test_Close(hLC);
+    return fResult;
+}
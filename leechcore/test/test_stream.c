@@ -0,0 +1,103 @@
+// test_stream.c : tests of streaming range and scatter reads (stream.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+typedef struct tdTEST_STREAM_CONTEXT {
+    QWORD paNext;
+    DWORD cChunk;
+    DWORD cChunkAbort;
+    DWORD cPagesInvalid;
+    BOOL fError;
+    PBYTE pbDelivered;
+} TEST_STREAM_CONTEXT, *PTEST_STREAM_CONTEXT;
+
+BOOL Test_StreamCallback(_In_opt_ PVOID ctx, _In_ QWORD pa, _In_ DWORD cb, _In_reads_(cb) PBYTE pb, _In_ DWORD cPages, _In_reads_((cPages + 63) / 64) PQWORD pqwValidBitmap)
+{
+    PTEST_STREAM_CONTEXT ctxTest = (PTEST_STREAM_CONTEXT)ctx;
+    DWORD iPage;
+    if(pa != ctxTest->paNext) { ctxTest->fError = TRUE; }
+    for(iPage = 0; iPage < cPages; iPage++) {
+        if((pqwValidBitmap[iPage >> 6] >> (iPage & 63)) & 1) {
+            if(!Test_Verify(pa + iPage * 0x1000, 0x1000, pb + iPage * 0x1000, 0)) { ctxTest->fError = TRUE; }
+        } else {
+            ctxTest->cPagesInvalid++;
+        }
+    }
+    ctxTest->paNext = pa + cb;
+    return ++ctxTest->cChunk != ctxTest->cChunkAbort;
+}
+
+BOOL Test_StreamScatterCallback(_In_opt_ PVOID ctx, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PTEST_STREAM_CONTEXT ctxTest = (PTEST_STREAM_CONTEXT)ctx;
+    DWORD i;
+    for(i = 0; i < cMEMs; i++) {
+        if(!ppMEMs[i]->f || !Test_Verify(ppMEMs[i]->qwA, 0x1000, ppMEMs[i]->pb, 0)) { ctxTest->fError = TRUE; }
+        ctxTest->pbDelivered[ppMEMs[i]->qwA >> 16]++;
+    }
+    return TRUE;
+}
+
+/*
+* Range streams: chunks are delivered in address order - with unreadable
+* pages beyond end-of-file flagged - and aborted streams stop delivering.
+*/
+BOOL Test_StreamCompleteClose()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    TEST_STREAM_CONTEXT ctx = { 0 };
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    // stream across end-of-file:
+    ctx.paNext = 0x00c00000;
+    TEST_ASSERT(LcReadStream(hLC, 0x00c00000, 0x00800000, 0x00100000, Test_StreamCallback, &ctx));
+    TEST_ASSERT(!ctx.fError && (ctx.cChunk == 8) && (ctx.paNext == 0x01400000));
+    TEST_ASSERT(ctx.cPagesInvalid == 0x400);
+    // chunk size near the DWORD limit is clamped (not wrapped) - one chunk:
+    ZeroMemory(&ctx, sizeof(TEST_STREAM_CONTEXT));
+    ctx.paNext = 0x00100000;
+    TEST_ASSERT(LcReadStream(hLC, 0x00100000, 0x00100000, 0xfffff001, Test_StreamCallback, &ctx));
+    TEST_ASSERT(!ctx.fError && (ctx.cChunk == 1) && (ctx.paNext == 0x00200000));
+    // aborted stream:
+    ZeroMemory(&ctx, sizeof(TEST_STREAM_CONTEXT));
+    ctx.paNext = 0;
+    ctx.cChunkAbort = 2;
+    TEST_ASSERT(!LcReadStream(hLC, 0, 0x00800000, 0x00100000, Test_StreamCallback, &ctx));
+    TEST_ASSERT(!ctx.fError && (ctx.cChunk == 2));
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Scatter streams: each MEM is delivered exactly once.
+*/
+BOOL Test_StreamScatter()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    PPMEM_SCATTER ppMEMs = NULL;
+    BYTE pbDelivered[0x100] = { 0 };
+    TEST_STREAM_CONTEXT ctx = { 0 };
+    DWORD i, cMEMs = _countof(pbDelivered);
+    TEST_ASSERT(hLC = Test_Open(FALSE));
+    ctx.pbDelivered = pbDelivered;
+    TEST_ASSERT(LcAllocScatter1(cMEMs, &ppMEMs));
+    for(i = 0; i < cMEMs; i++) {
+        ppMEMs[i]->qwA = (QWORD)(cMEMs - 1 - i) << 16;
+    }
+    TEST_ASSERT(LcReadScatterStream(hLC, cMEMs, ppMEMs, 0x10, Test_StreamScatterCallback, &ctx));
+    TEST_ASSERT(!ctx.fError);
+    for(i = 0; i < cMEMs; i++) {
+        TEST_ASSERT(pbDelivered[i] == 1);
+    }
+    fResult = TRUE;
+fail:
+    LcMemFree(ppMEMs);
+    Test_Close(hLC);
+    return fResult;
+}
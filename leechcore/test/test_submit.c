@@ -0,0 +1,82 @@
+// test_submit.c : tests of the read submission queue of single-threaded devices.
+//
+// The file device (without the 'threads' device parameter) is single-threaded
+// - concurrent reads are queued and dispatched in coalesced batches by one
+// thread at a time.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+#define TEST_SUBMIT_THREADS             8
+#define TEST_SUBMIT_ROUNDS              0x200
+#define TEST_SUBMIT_MEMS                0x10
+
+typedef struct tdTEST_SUBMIT_CONTEXT {
+    HANDLE hLC;
+    DWORD volatile iThreadNext;
+    DWORD volatile cThreadActive;
+    DWORD volatile cFail;
+} TEST_SUBMIT_CONTEXT, *PTEST_SUBMIT_CONTEXT;
+
+DWORD Test_SubmitThreadProc(_In_ PTEST_SUBMIT_CONTEXT ctx)
+{
+    QWORD pa;
+    DWORD i, iRound, iThread = InterlockedIncrement(&ctx->iThreadNext);
+    PPMEM_SCATTER ppMEMs = NULL;
+    if(!LcAllocScatter1(TEST_SUBMIT_MEMS, &ppMEMs)) {
+        InterlockedIncrement(&ctx->cFail);
+        goto fail;
+    }
+    for(iRound = 0; iRound < TEST_SUBMIT_ROUNDS; iRound++) {
+        for(i = 0; i < TEST_SUBMIT_MEMS; i++) {
+            pa = ((QWORD)iThread << 20) + ((QWORD)((iRound * TEST_SUBMIT_MEMS + i) & 0xff) << 12);
+            ppMEMs[i]->f = FALSE;
+            ppMEMs[i]->qwA = pa;
+            ZeroMemory(ppMEMs[i]->pb, 0x1000);
+        }
+        LcReadScatter(ctx->hLC, TEST_SUBMIT_MEMS, ppMEMs);
+        for(i = 0; i < TEST_SUBMIT_MEMS; i++) {
+            if(!ppMEMs[i]->f || !Test_Verify(ppMEMs[i]->qwA, 0x1000, ppMEMs[i]->pb, 0)) {
+                InterlockedIncrement(&ctx->cFail);
+                goto fail;
+            }
+        }
+    }
+fail:
+    LcMemFree(ppMEMs);
+    InterlockedDecrement(&ctx->cThreadActive);
+    return 0;
+}
+
+/*
+* Submission queue: concurrent readers of a single-threaded device are all
+* completed with the data they requested - no read is lost or completed twice.
+*/
+BOOL Test_SubmitConcurrentReaders()
+{
+    BOOL fResult = FALSE;
+    HANDLE hThread;
+    DWORD i;
+    TEST_SUBMIT_CONTEXT ctx = { 0 };
+    TEST_ASSERT(ctx.hLC = Test_Open(FALSE));
+    for(i = 0; i < TEST_SUBMIT_THREADS; i++) {
+        InterlockedIncrement(&ctx.cThreadActive);
+        hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)Test_SubmitThreadProc, &ctx, 0, NULL);
+        if(!hThread) {
+            InterlockedDecrement(&ctx.cThreadActive);
+            InterlockedIncrement(&ctx.cFail);
+            break;
+        }
+        CloseHandle(hThread);
+    }
+    while(ctx.cThreadActive) {
+        Sleep(10);
+    }
+    TEST_ASSERT(!ctx.cFail);
+    fResult = TRUE;
+fail:
+    Test_Close(ctx.hLC);
+    return fResult;
+}
@@ -0,0 +1,95 @@
+// test_util.c : tests of utility functions (util.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+#include "util.h"
+
+#define TEST_UTIL_SORT_MEMS             0x1800
+
+/*
+* Reference ordering: address - then original position (the MEM pointers are
+* allocated in ascending order by LcAllocScatter1) since the sort is stable.
+*/
+int Test_UtilSortCmp(_In_ const void *pv1, _In_ const void *pv2)
+{
+    PMEM_SCATTER pMEM1 = *(PMEM_SCATTER *)pv1, pMEM2 = *(PMEM_SCATTER *)pv2;
+    if(pMEM1->qwA != pMEM2->qwA) { return (pMEM1->qwA < pMEM2->qwA) ? -1 : 1; }
+    if(pMEM1 != pMEM2) { return (pMEM1 < pMEM2) ? -1 : 1; }
+    return 0;
+}
+
+/*
+* Sort the MEMs with Util_SortMEMs and verify the result against qsort.
+* -- cMEMs
+* -- ppMEMs
+* -- ppRef = scratch buffer of cMEMs pointers.
+* -- return
+*/
+BOOL Test_UtilSortVerify(_In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppRef)
+{
+    memcpy(ppRef, ppMEMs, cMEMs * sizeof(PMEM_SCATTER));
+    qsort(ppRef, cMEMs, sizeof(PMEM_SCATTER), Test_UtilSortCmp);
+    return Util_SortMEMs(cMEMs, ppMEMs) && !memcmp(ppMEMs, ppRef, cMEMs * sizeof(PMEM_SCATTER));
+}
+
+/*
+* MEM sort: random, duplicate, already sorted, reverse sorted and invalid
+* addresses are sorted identically to a stable reference sort.
+*/
+BOOL Test_UtilSortMEMs()
+{
+    BOOL fResult = FALSE;
+    DWORD i, iSet, cMEMs;
+    QWORD qwRandom = 0x9e3779b97f4a7c15;
+    PPMEM_SCATTER ppMEMs = NULL, ppRef = NULL, ppOrig;
+    TEST_ASSERT(LcAllocScatter1(TEST_UTIL_SORT_MEMS, &ppMEMs));
+    TEST_ASSERT(ppRef = LocalAlloc(0, 2 * TEST_UTIL_SORT_MEMS * sizeof(PMEM_SCATTER)));
+    ppOrig = ppRef + TEST_UTIL_SORT_MEMS;
+    memcpy(ppOrig, ppMEMs, TEST_UTIL_SORT_MEMS * sizeof(PMEM_SCATTER));
+    for(iSet = 0; iSet < 7; iSet++) {
+        memcpy(ppMEMs, ppOrig, TEST_UTIL_SORT_MEMS * sizeof(PMEM_SCATTER));
+        for(i = 0; i < TEST_UTIL_SORT_MEMS; i++) {
+            qwRandom ^= qwRandom << 13;
+            qwRandom ^= qwRandom >> 7;
+            qwRandom ^= qwRandom << 17;
+            switch(iSet) {
+                case 0:     // random 64-bit addresses:
+                    ppMEMs[i]->qwA = qwRandom;
+                    break;
+                case 1:     // random page addresses below 4GB:
+                    ppMEMs[i]->qwA = qwRandom & 0xfffff000;
+                    break;
+                case 2:     // few distinct addresses - many duplicates:
+                    ppMEMs[i]->qwA = (qwRandom & 0x7) << 12;
+                    break;
+                case 3:     // already sorted (with duplicates):
+                    ppMEMs[i]->qwA = 0x00100000 + ((QWORD)(i >> 1) << 12);
+                    break;
+                case 4:     // reverse sorted:
+                    ppMEMs[i]->qwA = 0x100000000 - ((QWORD)i << 12);
+                    break;
+                case 5:     // sorted except for the last address:
+                    ppMEMs[i]->qwA = (i == TEST_UTIL_SORT_MEMS - 1) ? 0 : 0x1000 + ((QWORD)i << 12);
+                    break;
+                case 6:     // random page addresses mixed with invalid addresses:
+                    ppMEMs[i]->qwA = (qwRandom & 1) ? MEM_SCATTER_ADDR_INVALID : (qwRandom & 0xfffffff000);
+                    break;
+            }
+        }
+        // full set and a subset:
+        TEST_ASSERT(Test_UtilSortVerify(TEST_UTIL_SORT_MEMS, ppMEMs, ppRef));
+        cMEMs = 0x101 + iSet;
+        memcpy(ppMEMs, ppOrig + iSet * 0x80, cMEMs * sizeof(PMEM_SCATTER));
+        TEST_ASSERT(Test_UtilSortVerify(cMEMs, ppMEMs, ppRef));
+    }
+    // trivial sets:
+    TEST_ASSERT(Util_SortMEMs(0, ppMEMs));
+    TEST_ASSERT(Test_UtilSortVerify(1, ppMEMs, ppRef));
+    fResult = TRUE;
+fail:
+    LocalFree(ppRef);
+    LcMemFree(ppMEMs);
+    return fResult;
+}
@@ -0,0 +1,180 @@
+// test_zcache.c : tests of the compressed in-memory page cache (zcache.c).
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+#include "leechcore_test.h"
+
+#define TEST_ZCACHE_BUDGET              0x80000
+#define TEST_ZCACHE_ZERO_PA             0x00800000
+#define TEST_ZCACHE_ZERO_PAGES          0x200
+
+/*
+* Compress and decompress a page and verify the round-trip - truncated
+* compressed data must be rejected by the decompressor.
+* -- pbPage
+* -- return = compressed size, 0 on fail.
+*/
+DWORD Test_ZCacheRoundTrip(_In_reads_(0x1000) PBYTE pbPage)
+{
+    BYTE pbCompressed[0x1100], pbResult[0x1000];
+    DWORD cb, cbTruncated;
+    if(!(cb = LcZCache_Compress(pbPage, pbCompressed, sizeof(pbCompressed)))) { return 0; }
+    memset(pbResult, 0xcc, sizeof(pbResult));
+    if(!LcZCache_Decompress(pbCompressed, cb, pbResult) || memcmp(pbPage, pbResult, 0x1000)) { return 0; }
+    for(cbTruncated = 0; cbTruncated < cb; cbTruncated += 1 + cbTruncated / 16) {
+        if(LcZCache_Decompress(pbCompressed, cbTruncated, pbResult)) { return 0; }
+    }
+    return cb;
+}
+
+/*
+* Read a page and verify that it is all zeros.
+*/
+BOOL Test_ZCacheReadZeroPage(_In_ HANDLE hLC, _In_ QWORD pa)
+{
+    BYTE pb[0x1000];
+    DWORD i;
+    MEM_SCATTER MEM = { 0 };
+    PMEM_SCATTER pMEM = &MEM;
+    MEM.version = MEM_SCATTER_VERSION;
+    MEM.qwA = pa;
+    MEM.cb = sizeof(pb);
+    MEM.pb = pb;
+    memset(pb, 0xcc, sizeof(pb));
+    LcReadScatter(hLC, 1, &pMEM);
+    for(i = 0; MEM.f && (i < sizeof(pb)) && !pb[i]; i++);
+    return MEM.f && (i == sizeof(pb));
+}
+
+/*
+* Open the file device with a zeroed range of TEST_ZCACHE_ZERO_PAGES pages at
+* TEST_ZCACHE_ZERO_PA and the compressed page cache enabled.
+*/
+HANDLE Test_ZCacheOpen()
+{
+    HANDLE hLC;
+    PBYTE pbZero;
+    if(!(hLC = Test_Open(TRUE))) { return NULL; }
+    if(!(pbZero = LocalAlloc(LMEM_ZEROINIT, TEST_ZCACHE_ZERO_PAGES * 0x1000))) {
+        Test_Close(hLC);
+        return NULL;
+    }
+    if(!LcWrite(hLC, TEST_ZCACHE_ZERO_PA, TEST_ZCACHE_ZERO_PAGES * 0x1000, pbZero) || !LcSetOption(hLC, LC_OPT_CORE_ZCACHE_BUDGET, TEST_ZCACHE_BUDGET)) {
+        LocalFree(pbZero);
+        Test_Close(hLC);
+        return NULL;
+    }
+    LocalFree(pbZero);
+    return hLC;
+}
+
+/*
+* Compression codec: random, zero, repetitive and scratch file pages survive
+* a compress / decompress round-trip.
+*/
+BOOL Test_ZCacheCodec()
+{
+    BOOL fResult = FALSE;
+    BYTE pbPage[0x1000], pbCompressed[0x1000];
+    QWORD i, qwRandom = 0x9e3779b97f4a7c15;
+    DWORD cb;
+    // random page - does not compress:
+    for(i = 0; i < sizeof(pbPage); i += sizeof(QWORD)) {
+        qwRandom ^= qwRandom << 13;
+        qwRandom ^= qwRandom >> 7;
+        qwRandom ^= qwRandom << 17;
+        *(PQWORD)(pbPage + i) = qwRandom;
+    }
+    TEST_ASSERT(Test_ZCacheRoundTrip(pbPage) > 0x1000);
+    TEST_ASSERT(!LcZCache_Compress(pbPage, pbCompressed, 0xe00));
+    // zero page:
+    ZeroMemory(pbPage, sizeof(pbPage));
+    TEST_ASSERT((cb = Test_ZCacheRoundTrip(pbPage)) && (cb < 0x40));
+    // repetitive page - short patterns, long runs and literals in-between:
+    for(i = 0; i < sizeof(pbPage); i++) {
+        pbPage[i] = (i < 0x400) ? (BYTE)(i % 7) : ((i < 0xc00) ? 0x41 : (BYTE)(i * i >> 3));
+    }
+    TEST_ASSERT((cb = Test_ZCacheRoundTrip(pbPage)) && (cb < 0x800));
+    // scratch file page:
+    for(i = 0; i < sizeof(pbPage); i += sizeof(QWORD)) {
+        *(PQWORD)(pbPage + i) = 0x00400000 + i;
+    }
+    TEST_ASSERT(Test_ZCacheRoundTrip(pbPage));
+    fResult = TRUE;
+fail:
+    return fResult;
+}
+
+/*
+* Budget: memory use stays within the budget and least recently used pages
+* are evicted first. Zero pages are kept as bits - they neither use page data
+* memory nor evict the data pages.
+*/
+BOOL Test_ZCacheBudget()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD i, cHit, cbUsed, pa = 0x00100000;
+    TEST_ASSERT(hLC = Test_ZCacheOpen());
+    for(i = 0; i < 0x100; i++) {
+        TEST_ASSERT(Test_ReadPage(hLC, pa + i * 0x1000, 0x1000, 0));
+        TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_USED) <= TEST_ZCACHE_BUDGET);
+    }
+    cHit = Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_HIT);
+    TEST_ASSERT(Test_ReadPage(hLC, pa + 0xff000, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_HIT) == cHit + 1);
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_HIT) == cHit + 1);
+    // zero pages:
+    cbUsed = Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_USED);
+    for(i = 0; i < TEST_ZCACHE_ZERO_PAGES; i++) {
+        TEST_ASSERT(Test_ZCacheReadZeroPage(hLC, TEST_ZCACHE_ZERO_PA + i * 0x1000));
+    }
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_USED) == cbUsed);
+    cHit = Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_HIT);
+    for(i = 0; i < TEST_ZCACHE_ZERO_PAGES; i++) {
+        TEST_ASSERT(Test_ZCacheReadZeroPage(hLC, TEST_ZCACHE_ZERO_PA + i * 0x1000));
+    }
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_HIT) == cHit + TEST_ZCACHE_ZERO_PAGES + 1);
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_PAGES) > TEST_ZCACHE_ZERO_PAGES);
+    // lowering the budget evicts - a zero budget frees everything:
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_ZCACHE_BUDGET, TEST_ZCACHE_BUDGET / 2));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_USED) <= TEST_ZCACHE_BUDGET / 2);
+    TEST_ASSERT(LcSetOption(hLC, LC_OPT_CORE_ZCACHE_BUDGET, 0));
+    TEST_ASSERT(!Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_USED));
+    TEST_ASSERT(!Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_PAGES));
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
+
+/*
+* Writes invalidate cached data pages and cached zero pages.
+*/
+BOOL Test_ZCacheInvalidateOnWrite()
+{
+    BOOL fResult = FALSE;
+    HANDLE hLC = NULL;
+    QWORD cPages, pa = 0x00100000, paZero = TEST_ZCACHE_ZERO_PA + 0x3000;
+    TEST_ASSERT(hLC = Test_ZCacheOpen());
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, 0));
+    TEST_ASSERT(Test_ZCacheReadZeroPage(hLC, paZero));
+    TEST_ASSERT(Test_ZCacheReadZeroPage(hLC, paZero + 0x1000));
+    TEST_ASSERT((cPages = Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_PAGES)) == 3);
+    TEST_ASSERT(Test_WritePage(hLC, pa, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_WritePage(hLC, paZero, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_PAGES) == 1);
+    TEST_ASSERT(Test_ReadPage(hLC, pa, 0x1000, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ReadPage(hLC, paZero, 0x1000, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ZCacheReadZeroPage(hLC, paZero + 0x1000));
+    TEST_ASSERT(Test_GetOption(hLC, LC_OPT_CORE_ZCACHE_PAGES) == 3);
+    TEST_ASSERT(Test_ReadPage(hLC, pa + 0x80, 0x100, TEST_WRITE_TAG));
+    TEST_ASSERT(Test_ReadPage(hLC, paZero + 0x80, 0x100, TEST_WRITE_TAG));
+    fResult = TRUE;
+fail:
+    Test_Close(hLC);
+    return fResult;
+}
@@ -4,6 +4,7 @@
 // Author: Ulf Frisk, pcileech@frizk.net
 //
 #include "util.h"
+#include "leechcore_internal.h"
 
 /*
 * Retrieve the operating system path of the directory which is containing this:
@@ -208,3 +209,53 @@ BOOL Util_IsProgramBitness64()
 #endif /* _WIN64 */
     return TRUE;
 }
+
+_Success_(return)
+BOOL Util_SortMEMs(_In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs)
+{
+    DWORD i, iShift, o, c, cBucket[0x100];
+    QWORD qwOr = 0, qwAnd = (QWORD)-1;
+    BOOL fSorted = TRUE;
+    PPMEM_SCATTER ppSrc = ppMEMs, ppDst, ppSwap, ppBuffer;
+    for(i = 0; i < cMEMs; i++) {
+        qwOr |= ppMEMs[i]->qwA;
+        qwAnd &= ppMEMs[i]->qwA;
+        if(i && (ppMEMs[i - 1]->qwA > ppMEMs[i]->qwA)) { fSorted = FALSE; }
+    }
+    if(fSorted) { return TRUE; }
+    if(!(ppBuffer = LcArena_Alloc(cMEMs * sizeof(PMEM_SCATTER)))) { return FALSE; }
+    ppDst = ppBuffer;
+    for(iShift = 0; iShift < 64; iShift += 8) {
+        if(!(((qwOr ^ qwAnd) >> iShift) & 0xff)) { continue; }  // byte identical in all MEMs
+        ZeroMemory(cBucket, sizeof(cBucket));
+        for(i = 0; i < cMEMs; i++) {
+            cBucket[(ppSrc[i]->qwA >> iShift) & 0xff]++;
+        }
+        for(i = 0, o = 0; i < 0x100; i++) {
+            c = cBucket[i];
+            cBucket[i] = o;
+            o += c;
+        }
+        for(i = 0; i < cMEMs; i++) {
+            ppDst[cBucket[(ppSrc[i]->qwA >> iShift) & 0xff]++] = ppSrc[i];
+        }
+        ppSwap = ppSrc;
+        ppSrc = ppDst;
+        ppDst = ppSwap;
+    }
+    if(ppSrc != ppMEMs) {
+        memcpy(ppMEMs, ppSrc, cMEMs * sizeof(PMEM_SCATTER));
+    }
+    LcArena_Free(ppBuffer);
+    return TRUE;
+}
+
+QWORD Util_HashFNV1a64(_In_ QWORD qwHash, _In_reads_(cb) PBYTE pb, _In_ DWORD cb)
+{
+    DWORD i;
+    if(!qwHash) { qwHash = 0xcbf29ce484222325; }
+    for(i = 0; i < cb; i++) {
+        qwHash = (qwHash ^ pb[i]) * 0x100000001b3;
+    }
+    return qwHash;
+}
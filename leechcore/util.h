@@ -78,6 +78,28 @@ BOOL Util_IsPlatformBitness64();
 */
 BOOL Util_IsProgramBitness64();
 
+/*
+* Sort an array of MEM pointers on address (qwA) in ascending order. The sort
+* is a stable LSD radix sort - bytes which are identical in all addresses are
+* skipped. The MEMs themselves are not modified. The temporary buffer is taken
+* from the per-thread arena - so the sort may fail (MEMs then left unsorted).
+* -- cMEMs
+* -- ppMEMs
+* -- return
+*/
+_Success_(return)
+BOOL Util_SortMEMs(_In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs);
+
+/*
+* Hash a buffer with the 64-bit FNV-1a hash. Multiple buffers may be hashed by
+* passing the hash of the previous buffer(s) as qwHash.
+* -- qwHash = previous hash, or 0 to start a new hash.
+* -- pb
+* -- cb
+* -- return
+*/
+QWORD Util_HashFNV1a64(_In_ QWORD qwHash, _In_reads_(cb) PBYTE pb, _In_ DWORD cb);
+
 #ifdef _WIN32
 
 /*
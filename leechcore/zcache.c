@@ -0,0 +1,688 @@
+// zcache.c : implementation : compressed in-memory page cache.
+//
+// The compressed page cache keeps pages read from the device compressed in a
+// configurable memory budget - zero pages are kept as bits in zero page block
+// entries (one entry per 64 pages) without any page data. Zero page block and
+// page entries share the budget, hash map and LRU list - a zero page block is
+// keyed on its 256kB aligned address with the LC_ZCACHE_ZERO_BLOCK bit set and
+// expires as a whole. Pages are compressed with a small LZ4 block format
+// compatible codec and evicted in least recently used order once the budget
+// is exceeded. The compressed page cache sits behind the (uncompressed) page
+// cache in LcReadScatter and is keyed on translated (device) addresses.
+//
+// (c) Ulf Frisk, 2020-2022
+// Author: Ulf Frisk, pcileech@frizk.net
+//
+
+#include "leechcore.h"
+#include "leechcore_device.h"
+#include "leechcore_internal.h"
+#include "oscompatibility.h"
+
+#define LC_ZCACHE_BUDGET_MAX            0x4000000000    // max 256GB memory budget.
+#define LC_ZCACHE_ENTRIES_INITIAL       0x1000
+#define LC_ZCACHE_CB_COMPRESSED_MAX     0xe00           // store pages uncompressed if not compressed below this size.
+#define LC_ZCACHE_HASH(pa, cMask)       ((DWORD)(((pa) >> 12) * 0x9E3779B97F4A7C15 >> 32) & (cMask))
+#define LC_ZCACHE_LZ_HASH(v)            (((v) * 2654435761U) >> 20)
+#define LC_ZCACHE_LZ_READ32(pb)         (*(PDWORD)(pb))
+#define LC_ZCACHE_ZERO_BLOCK            1               // address bit of zero page block entries.
+#define LC_ZCACHE_ZERO_KEY(pa)          (((pa) & ~0x3ffffULL) | LC_ZCACHE_ZERO_BLOCK)
+#define LC_ZCACHE_ZERO_BIT(pa)          (1ULL << (((pa) >> 12) & 0x3f))
+
+typedef struct tdLC_ZCACHE_ENTRY {
+    QWORD pa;                       // translated page address (or LC_ZCACHE_ZERO_KEY)
+    QWORD tcInsert;                 // tick count (ms) when inserted
+    QWORD qwZeroMap;                // zero page block: bitmap of its cached zero pages
+    PBYTE pb;                       // page data (NULL = zero page block)
+    WORD cb;                        // page data size (0x1000 = uncompressed)
+    WORD _Filler;
+    DWORD iHashNext;                // next entry in hash bucket chain (0 = none)
+    DWORD iLruPrev;                 // previous (more recently used) entry (0 = none)
+    DWORD iLruNext;                 // next (less recently used) entry (0 = none)
+} LC_ZCACHE_ENTRY, *PLC_ZCACHE_ENTRY;
+
+typedef struct tdLC_ZCACHE_CONTEXT {
+    CRITICAL_SECTION Lock;
+    QWORD cbBudget;                 // LC_OPT_CORE_ZCACHE_BUDGET (0 = disabled)
+    QWORD cbUsed;                   // entry, hash map and page data memory
+    DWORD dwTTL;                    // LC_OPT_CORE_ZCACHE_TTL (0 = no expiry)
+    DWORD cEntries;                 // allocated entries
+    DWORD cEntriesUsed;
+    DWORD iLruHead;                 // most recently used entry
+    DWORD iLruTail;                 // least recently used entry
+    DWORD iFree;                    // free list (chained by iHashNext)
+    DWORD cHashMask;
+    PDWORD piHashMap;
+    PLC_ZCACHE_ENTRY pe;            // entries [1..cEntries] - entry 0 is unused
+    QWORD cHit;
+    QWORD cZero;                    // zero pages currently cached
+    DWORD cZeroBlock;               // zero page block entries
+} LC_ZCACHE_CONTEXT;
+
+
+
+//-----------------------------------------------------------------------------
+// PAGE COMPRESSION FUNCTIONALITY BELOW:
+// Pages are compressed in the LZ4 block format (4-byte min match, 64kB window,
+// last 5 bytes as literals). Decompression is bounds checked.
+//-----------------------------------------------------------------------------
+
+/*
+* Compress a page.
+* -- pbPage = 0x1000 bytes.
+* -- pbOut
+* -- cbOutMax
+* -- return = compressed size, 0 if the page does not compress below cbOutMax.
+*/
+DWORD LcZCache_Compress(_In_reads_(0x1000) PBYTE pbPage, _Out_writes_(cbOutMax) PBYTE pbOut, _In_ DWORD cbOutMax)
+{
+    WORD wTable[0x1000];
+    DWORD i, iMatch, iAnchor = 0, o = 0, cbLiteral, cbMatch, h;
+    const DWORD iMatchLimit = 0x1000 - 12, iEnd = 0x1000 - 5;
+    memset(wTable, 0xff, sizeof(wTable));
+    for(i = 0; i < iMatchLimit; ) {
+        h = LC_ZCACHE_LZ_HASH(LC_ZCACHE_LZ_READ32(pbPage + i));
+        iMatch = wTable[h];
+        wTable[h] = (WORD)i;
+        if((iMatch == 0xffff) || (LC_ZCACHE_LZ_READ32(pbPage + iMatch) != LC_ZCACHE_LZ_READ32(pbPage + i))) {
+            i++;
+            continue;
+        }
+        cbMatch = 4;
+        while((i + cbMatch < iEnd) && (pbPage[iMatch + cbMatch] == pbPage[i + cbMatch])) {
+            cbMatch++;
+        }
+        // sequence: token, literal length, literals, offset, match length.
+        cbLiteral = i - iAnchor;
+        if(o + 1 + cbLiteral / 255 + 1 + cbLiteral + 2 + (cbMatch - 4) / 255 + 1 > cbOutMax) { return 0; }
+        pbOut[o++] = (BYTE)((min(cbLiteral, 15) << 4) | min(cbMatch - 4, 15));
+        if(cbLiteral >= 15) {
+            for(h = cbLiteral - 15; h >= 255; h -= 255) { pbOut[o++] = 255; }
+            pbOut[o++] = (BYTE)h;
+        }
+        memcpy(pbOut + o, pbPage + iAnchor, cbLiteral);
+        o += cbLiteral;
+        pbOut[o++] = (BYTE)(i - iMatch);
+        pbOut[o++] = (BYTE)((i - iMatch) >> 8);
+        if(cbMatch - 4 >= 15) {
+            for(h = cbMatch - 4 - 15; h >= 255; h -= 255) { pbOut[o++] = 255; }
+            pbOut[o++] = (BYTE)h;
+        }
+        i += cbMatch;
+        iAnchor = i;
+    }
+    // last literals:
+    cbLiteral = 0x1000 - iAnchor;
+    if(o + 1 + cbLiteral / 255 + 1 + cbLiteral > cbOutMax) { return 0; }
+    pbOut[o++] = (BYTE)(min(cbLiteral, 15) << 4);
+    if(cbLiteral >= 15) {
+        for(h = cbLiteral - 15; h >= 255; h -= 255) { pbOut[o++] = 255; }
+        pbOut[o++] = (BYTE)h;
+    }
+    memcpy(pbOut + o, pbPage + iAnchor, cbLiteral);
+    return o + cbLiteral;
+}
+
+/*
+* Decompress a page.
+* -- pbIn
+* -- cbIn
+* -- pbPage = 0x1000 bytes.
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_Decompress(_In_reads_(cbIn) PBYTE pbIn, _In_ DWORD cbIn, _Out_writes_(0x1000) PBYTE pbPage)
+{
+    DWORD i = 0, o = 0, cb, oMatch;
+    BYTE bToken, b;
+    while(i < cbIn) {
+        bToken = pbIn[i++];
+        // literals:
+        cb = bToken >> 4;
+        if(cb == 15) {
+            do {
+                if(i >= cbIn) { return FALSE; }
+                b = pbIn[i++];
+                cb += b;
+            } while(b == 255);
+        }
+        if((i + cb > cbIn) || (o + cb > 0x1000)) { return FALSE; }
+        memcpy(pbPage + o, pbIn + i, cb);
+        i += cb;
+        o += cb;
+        if(i == cbIn) { break; }
+        // match:
+        if(i + 2 > cbIn) { return FALSE; }
+        oMatch = pbIn[i] | (pbIn[i + 1] << 8);
+        i += 2;
+        cb = bToken & 15;
+        if(cb == 15) {
+            do {
+                if(i >= cbIn) { return FALSE; }
+                b = pbIn[i++];
+                cb += b;
+            } while(b == 255);
+        }
+        cb += 4;
+        if(!oMatch || (oMatch > o) || (o + cb > 0x1000)) { return FALSE; }
+        for(; cb; cb--, o++) {
+            pbPage[o] = pbPage[o - oMatch];
+        }
+    }
+    return o == 0x1000;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INTERNAL HELPER FUNCTIONS BELOW:
+// All functions assume the compressed page cache lock is held by the caller.
+//-----------------------------------------------------------------------------
+
+VOID LcZCache_LruUnlink(_In_ PLC_ZCACHE_CONTEXT ctx, _In_ DWORD i)
+{
+    PLC_ZCACHE_ENTRY pe = ctx->pe + i;
+    if(pe->iLruPrev) { ctx->pe[pe->iLruPrev].iLruNext = pe->iLruNext; } else { ctx->iLruHead = pe->iLruNext; }
+    if(pe->iLruNext) { ctx->pe[pe->iLruNext].iLruPrev = pe->iLruPrev; } else { ctx->iLruTail = pe->iLruPrev; }
+    pe->iLruPrev = 0;
+    pe->iLruNext = 0;
+}
+
+VOID LcZCache_LruPushHead(_In_ PLC_ZCACHE_CONTEXT ctx, _In_ DWORD i)
+{
+    PLC_ZCACHE_ENTRY pe = ctx->pe + i;
+    pe->iLruPrev = 0;
+    pe->iLruNext = ctx->iLruHead;
+    if(ctx->iLruHead) { ctx->pe[ctx->iLruHead].iLruPrev = i; }
+    ctx->iLruHead = i;
+    if(!ctx->iLruTail) { ctx->iLruTail = i; }
+}
+
+/*
+* Find the entry index of a page address.
+* -- return = entry index, 0 if not found.
+*/
+DWORD LcZCache_Find(_In_ PLC_ZCACHE_CONTEXT ctx, _In_ QWORD pa)
+{
+    DWORD i = ctx->piHashMap[LC_ZCACHE_HASH(pa, ctx->cHashMask)];
+    while(i && (ctx->pe[i].pa != pa)) {
+        i = ctx->pe[i].iHashNext;
+    }
+    return i;
+}
+
+/*
+* Free the page data of an entry.
+*/
+VOID LcZCache_EntryFreeData(_In_ PLC_ZCACHE_CONTEXT ctx, _In_ DWORD i)
+{
+    PLC_ZCACHE_ENTRY pe = ctx->pe + i;
+    if(pe->pb) {
+        LocalFree(pe->pb);
+        ctx->cbUsed -= pe->cb;
+    } else {
+        for(; pe->qwZeroMap; pe->qwZeroMap &= pe->qwZeroMap - 1) {
+            ctx->cZero--;
+        }
+        ctx->cZeroBlock--;
+    }
+    pe->pb = NULL;
+    pe->cb = 0;
+}
+
+/*
+* Remove an entry from the hash map and the LRU list, free its page data and
+* put it on the free list.
+*/
+VOID LcZCache_Remove(_In_ PLC_ZCACHE_CONTEXT ctx, _In_ DWORD i)
+{
+    PDWORD pi = ctx->piHashMap + LC_ZCACHE_HASH(ctx->pe[i].pa, ctx->cHashMask);
+    while(*pi && (*pi != i)) {
+        pi = &ctx->pe[*pi].iHashNext;
+    }
+    if(*pi) { *pi = ctx->pe[i].iHashNext; }
+    LcZCache_LruUnlink(ctx, i);
+    LcZCache_EntryFreeData(ctx, i);
+    ctx->pe[i].iHashNext = ctx->iFree;
+    ctx->iFree = i;
+    ctx->cEntriesUsed--;
+}
+
+/*
+* Free all entries and reset the compressed page cache to its empty state.
+*/
+VOID LcZCache_FreeBuffers(_In_ PLC_ZCACHE_CONTEXT ctx)
+{
+    DWORD i;
+    for(i = ctx->iLruHead; i; i = ctx->pe[i].iLruNext) {
+        LocalFree(ctx->pe[i].pb);
+    }
+    LocalFree(ctx->piHashMap);
+    LocalFree(ctx->pe);
+    ctx->piHashMap = NULL;
+    ctx->pe = NULL;
+    ctx->cbUsed = 0;
+    ctx->cEntries = 0;
+    ctx->cEntriesUsed = 0;
+    ctx->cHashMask = 0;
+    ctx->iLruHead = 0;
+    ctx->iLruTail = 0;
+    ctx->iFree = 0;
+    ctx->cZero = 0;
+    ctx->cZeroBlock = 0;
+}
+
+/*
+* Grow the entry array (and hash map) to the given number of entries. Entry
+* indexes remain stable - the hash map is rebuilt from the LRU list.
+* -- ctx
+* -- cEntries
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_Grow(_In_ PLC_ZCACHE_CONTEXT ctx, _In_ DWORD cEntries)
+{
+    DWORD i, iBucket, cHashMap = 1;
+    PDWORD piHashMap;
+    PLC_ZCACHE_ENTRY pe;
+    while(cHashMap < cEntries) { cHashMap <<= 1; }
+    piHashMap = LocalAlloc(LMEM_ZEROINIT, cHashMap * sizeof(DWORD));
+    pe = LocalAlloc(LMEM_ZEROINIT, (cEntries + 1ULL) * sizeof(LC_ZCACHE_ENTRY));
+    if(!piHashMap || !pe) {
+        LocalFree(piHashMap);
+        LocalFree(pe);
+        return FALSE;
+    }
+    if(ctx->pe) {
+        memcpy(pe, ctx->pe, (ctx->cEntries + 1ULL) * sizeof(LC_ZCACHE_ENTRY));
+    }
+    for(i = ctx->iLruHead; i; i = pe[i].iLruNext) {
+        iBucket = LC_ZCACHE_HASH(pe[i].pa, cHashMap - 1);
+        pe[i].iHashNext = piHashMap[iBucket];
+        piHashMap[iBucket] = i;
+    }
+    for(i = cEntries; i > ctx->cEntries; i--) {
+        pe[i].iHashNext = ctx->iFree;
+        ctx->iFree = i;
+    }
+    LocalFree(ctx->piHashMap);
+    LocalFree(ctx->pe);
+    ctx->cbUsed += (cEntries - ctx->cEntries) * (QWORD)sizeof(LC_ZCACHE_ENTRY) + (cHashMap - 1 - ctx->cHashMask) * (QWORD)sizeof(DWORD);
+    ctx->piHashMap = piHashMap;
+    ctx->pe = pe;
+    ctx->cEntries = cEntries;
+    ctx->cHashMask = cHashMap - 1;
+    return TRUE;
+}
+
+/*
+* Retrieve a free entry - growing the entry array if allowed by the budget or
+* evicting the least recently used entry otherwise.
+* -- ctx
+* -- return = entry index, 0 on fail.
+*/
+DWORD LcZCache_EntryAlloc(_In_ PLC_ZCACHE_CONTEXT ctx)
+{
+    DWORD i, cEntriesNew;
+    if(!ctx->iFree) {
+        cEntriesNew = ctx->cEntries ? ctx->cEntries * 2 : LC_ZCACHE_ENTRIES_INITIAL;
+        if((ctx->cEntries >= 0x40000000) || (ctx->cbUsed + cEntriesNew * 3ULL * sizeof(LC_ZCACHE_ENTRY) / 2 > ctx->cbBudget) || !LcZCache_Grow(ctx, cEntriesNew)) {
+            if(!ctx->iLruTail) { return 0; }
+            LcZCache_Remove(ctx, ctx->iLruTail);
+        }
+    }
+    i = ctx->iFree;
+    ctx->iFree = ctx->pe[i].iHashNext;
+    return i;
+}
+
+/*
+* Allocate an entry and insert it into the hash map under the given address.
+* -- ctx
+* -- pa = page address or zero page block key.
+* -- return = entry index, 0 on fail.
+*/
+DWORD LcZCache_EntryInsert(_In_ PLC_ZCACHE_CONTEXT ctx, _In_ QWORD pa)
+{
+    DWORD iEntry, iBucket;
+    if(!(iEntry = LcZCache_EntryAlloc(ctx))) { return 0; }
+    iBucket = LC_ZCACHE_HASH(pa, ctx->cHashMask);
+    ctx->pe[iEntry].pa = pa;
+    ctx->pe[iEntry].iHashNext = ctx->piHashMap[iBucket];
+    ctx->piHashMap[iBucket] = iEntry;
+    ctx->cEntriesUsed++;
+    return iEntry;
+}
+
+/*
+* Remove a zero page from its zero page block - the block entry is removed
+* once it has no zero pages left.
+* -- ctx
+* -- pa
+*/
+VOID LcZCache_ZeroClear(_In_ PLC_ZCACHE_CONTEXT ctx, _In_ QWORD pa)
+{
+    DWORD iEntry;
+    if(!ctx->cZero || !(iEntry = LcZCache_Find(ctx, LC_ZCACHE_ZERO_KEY(pa)))) { return; }
+    if(ctx->pe[iEntry].qwZeroMap & LC_ZCACHE_ZERO_BIT(pa)) {
+        ctx->pe[iEntry].qwZeroMap &= ~LC_ZCACHE_ZERO_BIT(pa);
+        ctx->cZero--;
+    }
+    if(!ctx->pe[iEntry].qwZeroMap) {
+        LcZCache_Remove(ctx, iEntry);
+    }
+}
+
+
+
+//-----------------------------------------------------------------------------
+// CACHE READ / WRITE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Check whether the compressed page cache is enabled.
+* -- ctxLC
+* -- return
+*/
+BOOL LcZCache_IsEnabled(_In_ PLC_CONTEXT ctxLC)
+{
+    return ctxLC->pZCache && ctxLC->pZCache->cbBudget;
+}
+
+/*
+* Serve MEMs from the compressed page cache. MEMs which still require a device
+* read are put into the ppMEMsMiss array (which must have room for cMEMs
+* entries, and which may be the same array as ppMEMs).
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+* -- ppMEMsMiss
+* -- return = the number of MEMs in ppMEMsMiss.
+*/
+DWORD LcZCache_Read(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _Inout_ PPMEM_SCATTER ppMEMs, _Out_writes_(cMEMs) PPMEM_SCATTER ppMEMsMiss)
+{
+    PLC_ZCACHE_CONTEXT ctx = ctxLC->pZCache;
+    PLC_ZCACHE_ENTRY pe;
+    PMEM_SCATTER pMEM;
+    DWORD iMEM, iEntry, cMiss = 0;
+    QWORD tcNow = 0, pa;
+    BYTE pbPage[0x1000];
+    PBYTE pbDst;
+    EnterCriticalSection(&ctx->Lock);
+    if(ctx->dwTTL) {
+        tcNow = GetTickCount64();
+    }
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(pMEM->f || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        pa = pMEM->qwA & ~0xfff;
+        iEntry = 0;
+        if(ctx->cEntriesUsed && ((pMEM->qwA & 0xfff) + pMEM->cb <= 0x1000)) {
+            iEntry = LcZCache_Find(ctx, pa);
+            if(!iEntry && ctx->cZero && (iEntry = LcZCache_Find(ctx, LC_ZCACHE_ZERO_KEY(pa))) && !(ctx->pe[iEntry].qwZeroMap & LC_ZCACHE_ZERO_BIT(pa))) {
+                iEntry = 0;
+            }
+        }
+        if(iEntry && ctx->dwTTL && (tcNow - ctx->pe[iEntry].tcInsert > ctx->dwTTL)) {
+            LcZCache_Remove(ctx, iEntry);
+            iEntry = 0;
+        }
+        if(!iEntry) {
+            ppMEMsMiss[cMiss++] = pMEM;
+            continue;
+        }
+        pe = ctx->pe + iEntry;
+        if(!pe->pb) {
+            ZeroMemory(pMEM->pb, pMEM->cb);
+        } else if(pe->cb == 0x1000) {
+            memcpy(pMEM->pb, pe->pb + (pMEM->qwA & 0xfff), pMEM->cb);
+        } else {
+            pbDst = (pMEM->cb == 0x1000) ? pMEM->pb : pbPage;
+            if(!LcZCache_Decompress(pe->pb, pe->cb, pbDst)) {
+                LcZCache_Remove(ctx, iEntry);
+                ppMEMsMiss[cMiss++] = pMEM;
+                continue;
+            }
+            if(pbDst == pbPage) {
+                memcpy(pMEM->pb, pbPage + (pMEM->qwA & 0xfff), pMEM->cb);
+            }
+        }
+        pMEM->f = TRUE;
+        LcZCache_LruUnlink(ctx, iEntry);
+        LcZCache_LruPushHead(ctx, iEntry);
+        ctx->cHit++;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return cMiss;
+}
+
+/*
+* Insert successfully read full pages into the compressed page cache. Pages
+* are compressed before the lock is taken.
+* -- ctxLC
+* -- qwWriteGeneration = write generation at read start - nothing is inserted if memory was written since.
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcZCache_Insert(_In_ PLC_CONTEXT ctxLC, _In_ QWORD qwWriteGeneration, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_ZCACHE_CONTEXT ctx = ctxLC->pZCache;
+    PMEM_SCATTER pMEM;
+    DWORD i, iMEM, iEntry, cb;
+    BYTE pbCompressed[LC_ZCACHE_CB_COMPRESSED_MAX];
+    PBYTE pbData;
+    QWORD tcNow;
+    if(!LcZCache_IsEnabled(ctxLC)) { return; }
+    tcNow = GetTickCount64();
+    for(iMEM = 0; iMEM < cMEMs; iMEM++) {
+        pMEM = ppMEMs[iMEM];
+        if(!pMEM->f || (pMEM->cb != 0x1000) || (pMEM->qwA & 0xfff) || MEM_SCATTER_ADDR_ISINVALID(pMEM)) { continue; }
+        // compress page (outside lock):
+        pbData = NULL;
+        for(i = 0; (i < 0x1000) && !*(PQWORD)(pMEM->pb + i); i += 8);
+        if(i == 0x1000) {
+            cb = 0;
+        } else {
+            if(!(cb = LcZCache_Compress(pMEM->pb, pbCompressed, sizeof(pbCompressed)))) {
+                cb = 0x1000;
+            }
+            if(!(pbData = LocalAlloc(0, cb))) { continue; }
+            memcpy(pbData, (cb == 0x1000) ? pMEM->pb : pbCompressed, cb);
+        }
+        // insert page:
+        EnterCriticalSection(&ctx->Lock);
+        if(!ctx->cbBudget || (qwWriteGeneration != ctxLC->qwWriteGeneration)) {
+            LeaveCriticalSection(&ctx->Lock);
+            LocalFree(pbData);
+            return;
+        }
+        if(!pbData) {
+            // zero page - set its bit in the zero page block entry:
+            if(ctx->cEntriesUsed && (iEntry = LcZCache_Find(ctx, pMEM->qwA))) {
+                LcZCache_Remove(ctx, iEntry);
+            }
+            if(ctx->cEntriesUsed && (iEntry = LcZCache_Find(ctx, LC_ZCACHE_ZERO_KEY(pMEM->qwA)))) {
+                LcZCache_LruUnlink(ctx, iEntry);
+            } else {
+                if(!(iEntry = LcZCache_EntryInsert(ctx, LC_ZCACHE_ZERO_KEY(pMEM->qwA)))) {
+                    LeaveCriticalSection(&ctx->Lock);
+                    continue;
+                }
+                ctx->pe[iEntry].tcInsert = tcNow;
+                ctx->pe[iEntry].qwZeroMap = 0;
+                ctx->cZeroBlock++;
+            }
+            if(!(ctx->pe[iEntry].qwZeroMap & LC_ZCACHE_ZERO_BIT(pMEM->qwA))) {
+                ctx->pe[iEntry].qwZeroMap |= LC_ZCACHE_ZERO_BIT(pMEM->qwA);
+                ctx->cZero++;
+            }
+        } else {
+            LcZCache_ZeroClear(ctx, pMEM->qwA);
+            if(ctx->cEntriesUsed && (iEntry = LcZCache_Find(ctx, pMEM->qwA))) {
+                LcZCache_LruUnlink(ctx, iEntry);
+                LcZCache_EntryFreeData(ctx, iEntry);
+            } else if(!(iEntry = LcZCache_EntryInsert(ctx, pMEM->qwA))) {
+                LeaveCriticalSection(&ctx->Lock);
+                LocalFree(pbData);
+                continue;
+            }
+            ctx->pe[iEntry].tcInsert = tcNow;
+            ctx->pe[iEntry].pb = pbData;
+            ctx->pe[iEntry].cb = (WORD)cb;
+            ctx->cbUsed += cb;
+        }
+        LcZCache_LruPushHead(ctx, iEntry);
+        while((ctx->cbUsed > ctx->cbBudget) && (ctx->iLruTail != iEntry)) {
+            LcZCache_Remove(ctx, ctx->iLruTail);
+        }
+        LeaveCriticalSection(&ctx->Lock);
+    }
+}
+
+/*
+* Invalidate any cached pages touched by the MEMs. This is called on writes.
+* -- ctxLC
+* -- cMEMs
+* -- ppMEMs
+*/
+VOID LcZCache_Invalidate(_In_ PLC_CONTEXT ctxLC, _In_ DWORD cMEMs, _In_ PPMEM_SCATTER ppMEMs)
+{
+    PLC_ZCACHE_CONTEXT ctx = ctxLC->pZCache;
+    DWORD iMEM, iEntry;
+    QWORD pa;
+    if(!LcZCache_IsEnabled(ctxLC)) { return; }
+    EnterCriticalSection(&ctx->Lock);
+    for(iMEM = 0; ctx->cEntriesUsed && (iMEM < cMEMs); iMEM++) {
+        if(MEM_SCATTER_ADDR_ISINVALID(ppMEMs[iMEM])) { continue; }
+        for(pa = ppMEMs[iMEM]->qwA & ~0xfff; pa < ppMEMs[iMEM]->qwA + ppMEMs[iMEM]->cb; pa += 0x1000) {
+            if((iEntry = LcZCache_Find(ctx, pa))) {
+                LcZCache_Remove(ctx, iEntry);
+            }
+            LcZCache_ZeroClear(ctx, pa);
+            if(!ctx->cEntriesUsed) { break; }
+        }
+    }
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+/*
+* Remove all pages from the compressed page cache.
+* -- ctxLC
+*/
+VOID LcZCache_Flush(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_ZCACHE_CONTEXT ctx = ctxLC->pZCache;
+    EnterCriticalSection(&ctx->Lock);
+    LcZCache_FreeBuffers(ctx);
+    LeaveCriticalSection(&ctx->Lock);
+}
+
+
+
+//-----------------------------------------------------------------------------
+// GET / SET OPTION FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Retrieve a compressed page cache option (LC_OPT_CORE_ZCACHE_*).
+* -- ctxLC
+* -- fOption
+* -- pqwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_GetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _Out_ PQWORD pqwValue)
+{
+    PLC_ZCACHE_CONTEXT ctx = ctxLC->pZCache;
+    switch(fOption & 0xffffffff00000000) {
+        case LC_OPT_CORE_ZCACHE_BUDGET:
+            *pqwValue = ctx->cbBudget;
+            return TRUE;
+        case LC_OPT_CORE_ZCACHE_TTL:
+            *pqwValue = ctx->dwTTL;
+            return TRUE;
+        case LC_OPT_CORE_ZCACHE_HIT:
+            *pqwValue = ctx->cHit;
+            return TRUE;
+        case LC_OPT_CORE_ZCACHE_PAGES:
+            *pqwValue = ctx->cEntriesUsed - ctx->cZeroBlock + ctx->cZero;
+            return TRUE;
+        case LC_OPT_CORE_ZCACHE_USED:
+            *pqwValue = ctx->cbUsed;
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+* Set a compressed page cache option (LC_OPT_CORE_ZCACHE_*). Lowering the
+* memory budget evicts pages until the new budget is met - a zero budget
+* disables the compressed page cache and frees all memory.
+* -- ctxLC
+* -- fOption
+* -- qwValue
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_SetOption(_In_ PLC_CONTEXT ctxLC, _In_ QWORD fOption, _In_ QWORD qwValue)
+{
+    PLC_ZCACHE_CONTEXT ctx = ctxLC->pZCache;
+    BOOL fResult = FALSE;
+    EnterCriticalSection(&ctx->Lock);
+    switch(fOption) {
+        case LC_OPT_CORE_ZCACHE_BUDGET:
+            if(qwValue > LC_ZCACHE_BUDGET_MAX) { break; }
+            ctx->cbBudget = qwValue;
+            while(ctx->iLruTail && (ctx->cbUsed > ctx->cbBudget)) {
+                LcZCache_Remove(ctx, ctx->iLruTail);
+            }
+            if(!ctx->cbBudget) {
+                LcZCache_FreeBuffers(ctx);
+            }
+            fResult = TRUE;
+            break;
+        case LC_OPT_CORE_ZCACHE_TTL:
+            ctx->dwTTL = (DWORD)min(qwValue, 0xffffffff);
+            fResult = TRUE;
+            break;
+    }
+    LeaveCriticalSection(&ctx->Lock);
+    return fResult;
+}
+
+
+
+//-----------------------------------------------------------------------------
+// INITIALIZE / CLOSE FUNCTIONALITY BELOW:
+//-----------------------------------------------------------------------------
+
+/*
+* Initialize the (initially disabled) compressed page cache of a LeechCore
+* context.
+* -- ctxLC
+* -- return
+*/
+_Success_(return)
+BOOL LcZCache_Initialize(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_ZCACHE_CONTEXT ctx;
+    if(!(ctx = LocalAlloc(LMEM_ZEROINIT, sizeof(LC_ZCACHE_CONTEXT)))) { return FALSE; }
+    InitializeCriticalSection(&ctx->Lock);
+    ctxLC->pZCache = ctx;
+    return TRUE;
+}
+
+/*
+* Close the compressed page cache of a LeechCore context and free its
+* resources.
+* -- ctxLC
+*/
+VOID LcZCache_Close(_In_ PLC_CONTEXT ctxLC)
+{
+    PLC_ZCACHE_CONTEXT ctx = ctxLC->pZCache;
+    if(!ctx) { return; }
+    ctxLC->pZCache = NULL;
+    LcZCache_FreeBuffers(ctx);
+    DeleteCriticalSection(&ctx->Lock);
+    LocalFree(ctx);
+}